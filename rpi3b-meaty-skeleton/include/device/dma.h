@@ -2,6 +2,8 @@
 #define DMA_H
 #include <kernel/rpi-base.h>
 #include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
 
 // Taken all of the following code is taken from linux source
 #define DMA_BASE PERIPHERAL_BASE + 0x7000
@@ -21,6 +23,10 @@
 // SPI with DMA, or GPIO with DMA can use this macro later.
 #define BUS_TO_PHYS(x) ((x) & ~0xC0000000)
 
+// Peripheral DREQ lines (TI.PERMAP)
+#define DMA_DREQ_UART_TX 12
+#define DMA_DREQ_UART_RX 14
+
 #define GPIO_REGISTER_BASE 0x200000
 #define GPIO_SET_OFFSET 0x1C
 #define GPIO_CLR_OFFSET 0x28
@@ -33,8 +39,105 @@ typedef enum
     MEM_TO_MEM = 2, /* memory to memory */
 } DMA_DIR;
 
+// Completion is IRQ driven, these only bound how long dma_wait spins / blocks
+#define DMA_WAIT_SPIN_US 20
+#define DMA_WAIT_TIMEOUT_US 1000000
+
+// Channels with their own IRQ line; 15 lives at a different base
+#define DMA_NUM_CHANNELS 13
+#define DMA_FIRST_LITE_CHANNEL 7
+#define DMA_LITE_MAX_LEN 0xffff
+// Used when the firmware does not answer TAG_GET_DMA_CHANNELS
+#define DMA_DEFAULT_CHANNEL_MASK 0x7f35
+
+// Capabilities for dma_request_channel, any of them needs a full channel
+#define DMA_CAP_2D BIT(0)   // TDMODE, lite channels have none
+#define DMA_CAP_LONG BIT(1) // segments over DMA_LITE_MAX_LEN bytes
+#define DMA_CAP_FAST BIT(2) // full bandwidth, lite channels are about half
+
+// Control blocks for all channels come from one pool, shared by every chain
+#define DMA_CB_POOL_SIZE 4096
+
+// 2D mode limits: XLENGTH is 16 bits, YLENGTH 14 bits
+#define DMA_2D_MAX_XLEN 0xffff
+#define DMA_2D_MAX_ROWS 0x4000
+#define DMA_MAX_LEN 0x3fffffff
+
+// dma_sg_t flags
+#define DMA_SG_SRC_FIXED BIT(0) // read the same source word(s) over and over, for fills
+
+/*
+ * One scatter-gather segment, becomes one control block. With rows > 1 the
+ * segment is a 2D transfer of `rows` rows of `len` bytes, src_stride and
+ * dst_stride bytes are skipped after every row.
+ */
+typedef struct
+{
+    void *src;
+    void *dst;
+    uint32_t len;
+    uint16_t rows;      // 0 or 1 for a linear transfer
+    int16_t src_stride; // 2D only
+    int16_t dst_stride; // 2D only
+    DMA_DIR dir;        // decides which side is paced by dreq
+    uint8_t dreq;       // peripheral DREQ (PERMAP), 0 for unpaced
+    uint8_t flags;      // DMA_SG_*
+} dma_sg_t;
+
+typedef void (*dma_callback_f)(int chan, int status, void *data);
+
+typedef struct
+{
+    uint32_t transfers;
+    uint32_t errors;
+    uint64_t bytes;
+    uint64_t busy_us; // submit to retire, summed over all transfers
+} dma_channel_stats_t;
+
+int dma_init(void);
 int dma_start(int chan, int dev, DMA_DIR dir, void *src, void *dst, int len);
+int dma_start_sg(int chan, const dma_sg_t *sg, uint32_t count);
+int dma_start_cyclic(int chan, const dma_sg_t *sg, uint32_t count);
+void dma_stop(int chan);
+void *dma_current_dst(int chan);
+void *dma_current_src(int chan);
+uint32_t dma_cb_free_count(void);
+
+int dma_request_channel(uint32_t caps);
+int dma_try_request_channel(uint32_t caps);
+void dma_release_channel(int chan);
+uint32_t dma_channel_mask(void);
+int dma_channel_is_lite(int chan);
+void dma_get_channel_stats(int chan, dma_channel_stats_t *stats);
+void dma_print_channel_stats(void);
+int dma_poll(int chan);
 int dma_wait(int chan);
+int dma_wait_timeout(int chan, uint32_t timeout_us);
+uint32_t dma_get_error(int chan);
+void dma_set_callback(int chan, dma_callback_f callback, void *data);
+
+/*
+ * Asynchronous copy / fill on the DMA engine (dma-mem.c). A token stays
+ * valid until polled or waited for; DMA_TOKEN_NONE means no channel was
+ * free or the arguments were not DMA-able, do the work on the CPU then.
+ * A destination that starts or ends mid cache line must not share that
+ * line with anything the CPU writes before the token completes.
+ */
+typedef uint32_t dma_token_t;
+#define DMA_TOKEN_NONE 0
+
+// memcpy / memset hand buffers at least this big to the DMA engine, see show_dma_benchmark
+#define DMA_OFFLOAD_MIN_BYTES (16 * 1024)
+
+dma_token_t dma_memcpy_async(void *dst, const void *src, size_t len);
+dma_token_t dma_memset_async(void *dst, uint8_t value, size_t len);
+int dma_token_poll(dma_token_t token);
+int dma_token_wait(dma_token_t token);
+
+void dma_offload_enable(bool enable);
+int memcpy_offload(void *dst, const void *src, size_t len);
+int memset_offload(void *dst, int value, size_t len);
 
 void show_dma_demo();
+void show_dma_benchmark(void);
 #endif
\ No newline at end of file
@@ -1,6 +1,20 @@
 #ifndef _UART0_H
 #define _UART0_H
 #include <stdint.h>
+#include <stdbool.h>
+
+// DMA rings hold one character per 32-bit word: the engine only does word
+// beats and the data register takes (and returns) one character per access
+#define UART_TX_RING_SIZE 4096
+#define UART_RX_RING_SIZE 4096
+
+// UART0_DMACR
+#define UART_DMACR_RXDMAE (1 << 0)
+#define UART_DMACR_TXDMAE (1 << 1)
+
+// Error bits returned with each received character in UART0_DR
+#define UART_DR_ERRORS 0xF00
+
 enum
 {
     // The GPIO registers base address.
@@ -44,4 +58,11 @@ unsigned char uart_getc();
 void uart_puts(const char *str);
 void hexstrings(uint32_t d);
 
+int uart_dma_init(void);
+bool uart_dma_enabled(void);
+uint32_t uart_dma_write(const char *buf, uint32_t len);
+void uart_dma_flush(void);
+uint32_t uart_dma_read(uint8_t *buf, uint32_t len);
+uint32_t uart_rx_errors(void);
+
 #endif
\ No newline at end of file
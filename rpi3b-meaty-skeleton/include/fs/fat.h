@@ -79,6 +79,7 @@ extern "C"
 	void print_root_directory_info();
 	uint32_t get_file_size(uint8_t *absolute_file_name);
 	void read_file(uint8_t *absolute_file_name);
+	uint32_t fat_read_file(uint8_t *absolute_file_name, uint8_t *dest, uint32_t max_size);
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,47 @@
+#ifndef _BLIT_H
+#define _BLIT_H
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <device/dma.h>
+
+/*
+ * Rectangle copy / fill / scroll on the DMA engine in 2D mode. One channel
+ * is owned by the blitter; every call waits for the previous operation,
+ * starts the new one and returns. Use blit_wait() before touching the
+ * pixels from the CPU, or blit_set_callback() to hear about completion.
+ *
+ * On a lite channel (no TDMODE) each row becomes its own control block.
+ */
+
+typedef struct
+{
+    uintptr_t base; // ARM address of pixel (0, 0)
+    uint32_t pitch; // bytes per row
+    uint32_t width;
+    uint32_t height;
+    uint32_t bpp; // bytes per pixel: 2, 3 or 4
+} blit_surface_t;
+
+int blit_init(void);
+bool blit_ready(void);
+
+int blit_copy(const blit_surface_t *dst, uint32_t dx, uint32_t dy,
+              const blit_surface_t *src, uint32_t sx, uint32_t sy, uint32_t w, uint32_t h);
+int blit_fill(const blit_surface_t *dst, uint32_t x, uint32_t y, uint32_t w, uint32_t h, uint32_t colour);
+int blit_scroll(const blit_surface_t *surface, int32_t lines, uint32_t colour);
+
+int blit_wait(void);
+bool blit_busy(void);
+void blit_set_callback(dma_callback_f callback, void *data);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,59 @@
+#ifndef _FRAMEBUFFER_H
+#define _FRAMEBUFFER_H
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <graphics/blit.h>
+
+/*
+ * Page flipped frame buffer. The firmware allocates a virtual frame buffer
+ * two or three screens tall; one page is on display, the others are drawn
+ * to off screen. fb_flip() shows the back buffer by moving the virtual
+ * offset, which the display latches at the next vsync, so nothing that is
+ * half drawn is ever scanned out.
+ *
+ * Vsync comes from the firmware: TAG_SET_VSYNC makes it raise the SMI
+ * interrupt once per frame. Firmware that never raises it is noticed on
+ * the first wait, after which vsync is paced off the system timer.
+ */
+
+#define FB_MAX_PAGES 3
+#define FB_FRAME_US 16667         // 60 Hz, used when no vsync interrupt arrives
+#define FB_VSYNC_TIMEOUT_US 50000 // three frames without one means there is none
+
+typedef struct
+{
+    uint32_t frames;
+    uint32_t missed;  // frames that took longer than one refresh
+    uint32_t vsyncs;  // vsync interrupts taken
+    uint32_t last_us; // flip to flip
+    uint32_t min_us;
+    uint32_t max_us;
+    uint64_t total_us;
+    uint64_t wait_us; // of which spent inside fb_flip (DMA and vsync waits)
+} fb_stats_t;
+
+int fb_init(uint32_t width, uint32_t height, uint32_t depth, uint32_t pages);
+const blit_surface_t *fb_back_buffer(void);
+uint32_t fb_back_address(void);
+uint32_t fb_pages(void);
+
+int fb_flip(void);
+void fb_wait_vsync(void);
+bool fb_vsync_irq_enabled(void);
+
+void fb_get_stats(fb_stats_t *stats);
+void fb_reset_stats(void);
+void fb_print_stats(void);
+void show_page_flip_demo(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
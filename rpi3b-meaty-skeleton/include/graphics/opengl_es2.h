@@ -8,10 +8,17 @@ extern "C"
 
 #include<stdint.h>
 #include<stdbool.h>
+#include<graphics/v3d_cl.h>
 
 typedef uint32_t GPU_HANDLE;
 typedef uint32_t VC4_ADDR;
 
+/* Who draws a scene: the V3D, or the ARM (graphics/soft_raster.h) where there is no V3D */
+typedef enum {
+	RENDERER_V3D = 0,
+	RENDERER_SOFT,
+} SCENE_RENDERER;
+
 
 /*--------------------------------------------------------------------------}
 ;{	    DEFINE A RENDER STRUCTURE ... WHICH JUST HOLD RENDER DETAILS	  	}
@@ -22,7 +29,7 @@ typedef struct render_t
 	VC4_ADDR loadpos;							// Physical load address as ARM address
 
 	/* These are all the same thing just handle and two different address GPU and ARM */
-	GPU_HANDLE rendererHandle;					// Renderer memory handle
+	GPU_HANDLE rendererHandle;					// Renderer memory, v3d_pool handle
 	VC4_ADDR rendererDataVC4;					// Renderer data VC4 locked address
 	
 	uint16_t renderWth;							// Render width
@@ -45,19 +52,30 @@ typedef struct render_t
 	uint32_t MaxIndexVertex;					// Maximum Index vertex referenced
 
 	/* TILE DATA MEMORY ... HAS TO BE 4K ALIGN */
-	GPU_HANDLE tileHandle;						// Tile memory handle
+	GPU_HANDLE tileHandle;						// Tile memory, v3d_pool handle
 	uint32_t  tileMemSize;						// Tiel memory size;
 	VC4_ADDR tileStateDataVC4;					// Tile data VC4 locked address
 	VC4_ADDR tileDataBufferVC4;					// Tile data buffer VC4 locked address
 
 	/* BINNING DATA MEMORY ... HAS TO BE 4K ALIGN */
-	GPU_HANDLE binningHandle;					// Binning memory handle
+	GPU_HANDLE binningHandle;					// Binning memory, v3d_pool handle
 	VC4_ADDR binningDataVC4;					// Binning data VC4 locked address
 	VC4_ADDR binningCfgEnd;						// VC4 binning config end address
 
+	SCENE_RENDERER renderer;					// What the scene memory was set up for
+	VC4_ADDR renderBufferAddr;					// Frame buffer being rendered to
+
+	/* Retained between frames, so a frame only rewrites what changed */
+	v3d_cl_t renderList;						// The resident render control list
+	uint32_t renderBufferField;					// Its offset of the render buffer address
+	uint32_t dirtyFirst;						// Vertices rewritten since the last render
+	uint32_t dirtyEnd;
+
 } RENDER_STRUCT;
 
 
+void v3d_SelectRenderer (SCENE_RENDERER renderer);
+SCENE_RENDERER v3d_SelectedRenderer (void);
 bool v3d_InitializeScene (RENDER_STRUCT* scene, uint32_t renderWth, uint32_t renderHt);
 bool v3d_AddVertexesToScene (RENDER_STRUCT* scene);
 bool v3d_AddShadderToScene (RENDER_STRUCT* scene, uint32_t* frag_shader, uint32_t frag_shader_emits);
@@ -65,6 +83,11 @@ bool v3d_SetupRenderControl(RENDER_STRUCT* scene, VC4_ADDR renderBufferAddr);
 bool v3d_SetupBinningConfig (RENDER_STRUCT* scene);
 void v3d_RenderScene (RENDER_STRUCT* scene);
 
+/* Between frames of a scene that is set up */
+bool v3d_SetVertexPosition (RENDER_STRUCT* scene, uint32_t index, uint16_t x, uint16_t y);
+bool v3d_SetVertexColour (RENDER_STRUCT* scene, uint32_t index, float r, float g, float b);
+bool v3d_SetRenderBuffer (RENDER_STRUCT* scene, VC4_ADDR renderBufferAddr);
+
 #ifdef __cplusplus
 }
 #endif
@@ -11,6 +11,11 @@ extern "C"
 void get_console_width_height_depth(uint32_t *width, uint32_t *height, uint32_t *depth, uint32_t *pitch);
 uint32_t get_console_frame_buffer(uint32_t width, uint32_t height, uint32_t depth);
 void console_puts(char *str);
+void console_putchar(char ch);
+uint32_t console_write(const char *buf, uint32_t len);
+int console_enable_shadow(uint32_t flush_us);
+void console_flush(void);
+void show_console_shadow_benchmark(void);
 #ifdef __cplusplus
 }
 #endif
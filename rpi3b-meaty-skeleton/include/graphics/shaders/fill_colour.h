@@ -0,0 +1,16 @@
+/* Generated from graphics/shaders/fill_colour.qasm by tools/qpuasm, do not edit */
+#ifndef _SHADER_FILL_COLOUR_H
+#define _SHADER_FILL_COLOUR_H
+
+#include <stdint.h>
+
+static uint32_t fill_colour_shader[12] = {
+	0x009e7000, 0x100009e7,	/* nop; nop */
+	0xffffffff, 0xe0020ba7,	/* ldi tlbc, 0xffffffff */
+	0x009e7000, 0x500009e7,	/* nop; nop; sbdone */
+	0x009e7000, 0x300009e7,	/* nop; nop; thrend */
+	0x009e7000, 0x100009e7,	/* nop; nop */
+	0x009e7000, 0x100009e7,	/* nop; nop */
+};
+
+#endif
@@ -0,0 +1,73 @@
+#ifndef _SHADOW_H
+#define _SHADOW_H
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <graphics/blit.h>
+#include <kernel/ktimer.h>
+
+/*
+ * Shadow frame buffer. Drawing goes to a cacheable copy of the frame
+ * buffer in the kernel heap and marks what it touched; shadow_flush()
+ * copies the merged dirty rectangles to the real, uncached frame buffer
+ * in whole rows, with the DMA blitter when there is one. Pixels that are
+ * drawn over several times before a flush cross the bus once.
+ *
+ * Dirty rectangles are merged when their bounding box wastes at most
+ * SHADOW_MERGE_SLACK pixels, and when the list is full the pair that
+ * wastes least is merged. With auto flush on, a ktimer flushes whatever
+ * is dirty one period after the first mark; those flushes run in timer
+ * softirq context and copy with the CPU, leaving the blitter to the
+ * foreground.
+ *
+ * Without the data cache the shadow is just a second uncached copy, so the
+ * console only takes one while shadow_cache_enabled().
+ */
+
+#define SHADOW_MAX_RECTS 16
+#define SHADOW_MERGE_SLACK 4096
+
+typedef struct
+{
+    uint32_t x1, y1; // inclusive
+    uint32_t x2, y2; // exclusive
+} shadow_rect_t;
+
+typedef struct
+{
+    blit_surface_t fb;  // the real frame buffer
+    blit_surface_t buf; // cacheable copy, same geometry
+    shadow_rect_t dirty[SHADOW_MAX_RECTS];
+    uint32_t count;
+    volatile bool flushing;
+
+    ktimer_t timer;
+    uint32_t period_us; // 0: flush only when asked
+
+    uint32_t flushes;
+    uint32_t rects;
+    uint64_t bytes;
+} shadow_t;
+
+bool shadow_cache_enabled(void);
+int shadow_init(shadow_t *s, const blit_surface_t *fb);
+void shadow_free(shadow_t *s);
+void shadow_auto_flush(shadow_t *s, uint32_t period_us);
+
+void shadow_mark(shadow_t *s, uint32_t x, uint32_t y, uint32_t w, uint32_t h);
+void shadow_fill(shadow_t *s, uint32_t x, uint32_t y, uint32_t w, uint32_t h, uint32_t colour);
+void shadow_copy(shadow_t *s, uint32_t dx, uint32_t dy, uint32_t sx, uint32_t sy, uint32_t w, uint32_t h);
+
+int shadow_flush(shadow_t *s);
+void shadow_print_stats(const shadow_t *s);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,58 @@
+#ifndef _SOFT_RASTER_H
+#define _SOFT_RASTER_H
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <graphics/blit.h>
+
+/*
+ * Software rasteriser for the same pre-transformed, vertex coloured
+ * triangles the V3D scene draws, for when there is no V3D to draw them
+ * (QEMU) or to compare against it.
+ *
+ * The screen is walked in SOFT_TILE_SIZE square tiles so a tile's rows
+ * stay in the data cache while every triangle touching it is drawn.
+ * Triangles are set up as three half-space edge functions on the 12.4
+ * fixed point vertex positions; per tile an edge is either known to pass
+ * the whole tile or crosses it, and for crossing edges each row's span is
+ * solved from the edge function instead of testing pixel by pixel. Spans
+ * are filled 8 pixels at a time with NEON, interpolating 16.16 fixed
+ * point colour.
+ *
+ * Pixel centres are sampled with the top-left fill rule, both windings
+ * are drawn, Z and 1/W are ignored (no depth test, like the V3D scene)
+ * and pixels are written as RGBA8888 with R in the low byte, which is
+ * what the V3D tile buffer stores.
+ */
+
+#define SOFT_TILE_SIZE 64
+#define SOFT_MAX_TRIANGLES 256 // set up per pass; longer lists take several passes
+
+/* The NV shader vertex the scene stores: stride 24, three colour varyings */
+typedef struct
+{
+    uint16_t x, y; // 12.4 fixed point pixels
+    float z;
+    float inv_w;
+    float r, g, b; // 0.0 to 1.0
+} soft_vertex_t;
+
+void soft_raster_set_neon(bool on);
+bool soft_raster_neon(void);
+
+void soft_raster_clear(const blit_surface_t *dst, uint32_t colour);
+int soft_raster_triangles(const blit_surface_t *dst, const soft_vertex_t *vertices,
+                          const uint8_t *indices, uint32_t index_count);
+
+void show_soft_raster_benchmark(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,108 @@
+#ifndef _V3D_CL_H
+#define _V3D_CL_H
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#include<stdint.h>
+#include<stdbool.h>
+#include<graphics/opengl_es.h>
+
+/*--------------------------------------------------------------------------}
+{			VC4 CONTROL LIST BUILDER										}
+{---------------------------------------------------------------------------}
+{	Packets are written into a fixed buffer of GPU memory. Every emit is	}
+{	checked against the capacity; once one does not fit the list is marked	}
+{	overflowed, nothing more is written and v3d_cl_ok() says false, so a	}
+{	builder can emit a whole list and check once at the end.				}
+{																			}
+{	Every bus address written with v3d_cl_addr (all the packet emitters		}
+{	that take one) is recorded if the list tracks relocations, so the list	}
+{	can be patched when a buffer it points into moves. v3d_cl_reset()		}
+{	rewinds the list for the next frame without touching its memory.		}
+{--------------------------------------------------------------------------*/
+
+/* GL_STORE_TILE_BUFFER flags (first 16 bits) */
+#define V3D_STORE_NONE			0x0000
+#define V3D_STORE_COLOUR		0x0001
+#define V3D_STORE_ZS			0x0002
+#define V3D_STORE_FORMAT_LINEAR	(0 << 4)
+
+/* GL_TILE_RENDER_CONFIG flags */
+#define V3D_RENDER_RGBA8888		0x0004		// Linear frame buffer, 32 bpp
+
+/* GL_TILE_BINNING_CONFIG flags */
+#define V3D_BIN_AUTO_INIT_STATE	0x04		// Binner initialises the tile state data
+
+/* GL_PRIMITIVE_LIST_FORMAT */
+#define V3D_PRIM_LIST_TRIANGLES_16	0x32	// Triangles, 16 bit indices
+
+/* GL_CONFIG_STATE */
+#define V3D_CONFIG_FRONT_AND_BACK	0x03
+#define V3D_CONFIG_EARLY_Z_UPDATE	0x02
+
+typedef struct v3d_cl {
+	uint8_t* base;							// ARM address of the first byte
+	uint32_t bus;							// VC4 bus address of the first byte
+	uint32_t size;							// Capacity in bytes
+	uint32_t used;							// Bytes emitted so far
+	bool overflow;							// An emit did not fit, the list is unusable
+
+	uint32_t* relocs;						// Offsets of bus address fields, NULL if not tracked
+	uint32_t max_relocs;
+	uint32_t reloc_count;
+} v3d_cl_t;
+
+void v3d_cl_init (v3d_cl_t* cl, void* arm, uint32_t bus, uint32_t size);
+void v3d_cl_track_relocs (v3d_cl_t* cl, uint32_t* offsets, uint32_t max_relocs);
+void v3d_cl_reset (v3d_cl_t* cl);
+bool v3d_cl_ok (const v3d_cl_t* cl);
+uint32_t v3d_cl_start (const v3d_cl_t* cl);
+uint32_t v3d_cl_end (const v3d_cl_t* cl);
+uint32_t v3d_cl_offset (const v3d_cl_t* cl);
+
+/* Raw fields, little endian, for shader records and vertex data */
+void v3d_cl_u8 (v3d_cl_t* cl, uint8_t d);
+void v3d_cl_u16 (v3d_cl_t* cl, uint16_t d);
+void v3d_cl_u32 (v3d_cl_t* cl, uint32_t d);
+void v3d_cl_f32 (v3d_cl_t* cl, float f);
+void v3d_cl_addr (v3d_cl_t* cl, uint32_t bus);
+void v3d_cl_align (v3d_cl_t* cl, uint32_t align);
+
+/* Rewrite a field emitted earlier, e.g. a per frame address */
+bool v3d_cl_patch_u32 (v3d_cl_t* cl, uint32_t offset, uint32_t d);
+uint32_t v3d_cl_relocate (v3d_cl_t* cl, uint32_t old_bus, uint32_t old_size, uint32_t new_bus);
+
+/* Control list packets */
+void v3d_cl_halt (v3d_cl_t* cl);
+void v3d_cl_nop (v3d_cl_t* cl);
+void v3d_cl_flush (v3d_cl_t* cl);
+void v3d_cl_flush_all_state (v3d_cl_t* cl);
+void v3d_cl_start_tile_binning (v3d_cl_t* cl);
+void v3d_cl_branch (v3d_cl_t* cl, uint32_t bus);
+void v3d_cl_branch_to_sublist (v3d_cl_t* cl, uint32_t bus);
+void v3d_cl_return_from_sublist (v3d_cl_t* cl);
+void v3d_cl_store_multisample (v3d_cl_t* cl, bool end_of_frame);
+void v3d_cl_store_tile_buffer (v3d_cl_t* cl, uint16_t flags, uint32_t bus);
+void v3d_cl_indexed_primitive_list (v3d_cl_t* cl, PRIMITIVE mode, uint32_t count, uint32_t indices, uint32_t max_index);
+void v3d_cl_vertex_array_primitives (v3d_cl_t* cl, PRIMITIVE mode, uint32_t count, uint32_t first);
+void v3d_cl_primitive_list_format (v3d_cl_t* cl, uint8_t format);
+void v3d_cl_nv_shader_state (v3d_cl_t* cl, uint32_t record);
+void v3d_cl_config_state (v3d_cl_t* cl, uint8_t flags0, uint8_t flags1, uint8_t flags2);
+void v3d_cl_clip_window (v3d_cl_t* cl, uint16_t left, uint16_t bottom, uint16_t wth, uint16_t ht);
+void v3d_cl_viewport_offset (v3d_cl_t* cl, int16_t x, int16_t y);
+void v3d_cl_tile_binning_config (v3d_cl_t* cl, uint32_t tile_alloc, uint32_t tile_alloc_size, uint32_t tile_state, uint8_t bin_wth, uint8_t bin_ht, uint8_t flags);
+void v3d_cl_tile_render_config (v3d_cl_t* cl, uint32_t render_buffer, uint16_t wth, uint16_t ht, uint16_t flags);
+void v3d_cl_clear_colors (v3d_cl_t* cl, uint32_t colour, uint32_t clear_zs, uint8_t stencil);
+void v3d_cl_tile_coordinates (v3d_cl_t* cl, uint8_t col, uint8_t row);
+
+/* NV shader state record: pre-transformed vertices and a fragment shader */
+void v3d_cl_nv_shader_record (v3d_cl_t* cl, uint8_t flags, uint8_t stride, uint8_t num_uniforms, uint8_t num_varyings, uint32_t code, uint32_t uniforms, uint32_t vertices);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,60 @@
+#ifndef _V3D_POOL_H
+#define _V3D_POOL_H
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#include<stdint.h>
+#include<stdbool.h>
+
+/*--------------------------------------------------------------------------}
+{			GPU MEMORY POOL OVER THE FIRMWARE ALLOCATOR						}
+{---------------------------------------------------------------------------}
+{	Every v3d_mem_alloc / v3d_mem_lock is a mailbox round trip, so GPU		}
+{	memory is taken from the firmware in V3D_POOL_CHUNK_SIZE chunks, locked	}
+{	once and handed out in aligned pieces. Each chunk keeps its blocks in	}
+{	address order; allocation is first fit, freeing merges a block with		}
+{	free neighbours. A request bigger than a chunk gets a chunk of its own.	}
+{																			}
+{	Chunks are MEM_FLAG_COHERENT and stay locked until v3d_pool_trim()		}
+{	gives back the ones with nothing allocated in them.						}
+{--------------------------------------------------------------------------*/
+
+#define V3D_POOL_CHUNK_SIZE		0x100000	// 1 MB from the firmware at a time
+#define V3D_POOL_MAX_CHUNKS		8
+#define V3D_POOL_MAX_BLOCKS		256			// Used and free blocks over all chunks
+#define V3D_POOL_MIN_ALIGN		16			// Also the size granule
+
+typedef struct v3d_pool_stats {
+	uint32_t chunks;
+	uint32_t reserved;						// Bytes taken from the firmware
+	uint32_t used;							// Bytes handed out
+	uint32_t peak;
+	uint32_t blocks;						// Live allocations
+	uint32_t largest_free;					// Biggest block one allocation could still get without a new chunk
+	uint32_t allocs;
+	uint32_t frees;
+	uint32_t failures;
+	uint32_t mailbox_calls;					// Firmware allocate, lock, unlock and release
+} v3d_pool_stats_t;
+
+/* flags: MEM_FLAG_ZERO or 0. Returns a handle, 0 when out of memory. A handle
+   carries a generation, so one kept after its block was freed is refused */
+uint32_t v3d_pool_alloc (uint32_t size, uint32_t align, uint32_t flags);
+bool v3d_pool_free (uint32_t handle);
+uint32_t v3d_pool_trim (void);
+
+uint32_t v3d_pool_bus (uint32_t handle);	// Bus address for the V3D, 0 for a bad handle
+void* v3d_pool_arm (uint32_t handle);		// The same memory for the ARM
+uint32_t v3d_pool_size (uint32_t handle);
+
+void v3d_pool_get_stats (v3d_pool_stats_t* stats);
+void v3d_pool_print_stats (void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
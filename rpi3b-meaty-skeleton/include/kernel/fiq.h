@@ -0,0 +1,57 @@
+#ifndef FIQ_H
+#define FIQ_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+ * One interrupt source can be promoted to FIQ. Its handler (fiq-entry.S) runs on
+ * the FIQ banked registers only, so entry costs nothing beyond the vector.
+ * Each FIQ samples one register into a ring, acknowledges the source and
+ * rings local mailbox 0 of the claiming core. Results come back either via
+ * the consumer callback (IRQ bottom half) or by polling fiq_read().
+ */
+
+#define FIQ_RING_SIZE 64
+#define FIQ_CONTROL_ENABLE (1 << 7)
+#define FIQ_MAILBOX 0
+
+/* Layout is shared with fiq-entry.S, keep the offsets there in sync */
+typedef struct
+{
+    volatile uint32_t head;
+    volatile uint32_t tail;
+    volatile uint32_t count;
+    volatile uint32_t overflows;
+    volatile uint32_t ack_addr;
+    volatile uint32_t ack_value;
+    volatile uint32_t sample_addr;
+    volatile uint32_t rearm_addr;
+    volatile uint32_t rearm_period;
+    volatile uint32_t doorbell_addr;
+    volatile uint32_t ring[FIQ_RING_SIZE];
+} fiq_shared_t;
+
+typedef struct
+{
+    uint32_t ack_addr;     // written with ack_value first thing
+    uint32_t ack_value;
+    uint32_t sample_addr;  // read once per FIQ and queued
+    uint32_t rearm_addr;   // optional: compare register set to sample + rearm_period
+    uint32_t rearm_period; // 0 for one-shot / self re-arming sources
+} fiq_source_t;
+
+typedef void (*fiq_consumer_f)(uint32_t sample);
+
+extern void fiq_asm_handler(void);
+extern void fiq_load_banked(volatile fiq_shared_t *shared);
+
+bool fiq_claim(uint32_t irq_num, const fiq_source_t *source, fiq_consumer_f consumer);
+void fiq_release(void);
+bool fiq_read(uint32_t *sample);
+uint32_t fiq_count(void);
+uint32_t fiq_overflows(void);
+
+void show_fiq_latency_demo(void);
+
+#endif
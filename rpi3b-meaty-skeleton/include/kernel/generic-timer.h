@@ -0,0 +1,41 @@
+#ifndef GENERIC_TIMER_H
+#define GENERIC_TIMER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+ * ARMv7/v8 generic timer, one instance per core, routed through the local
+ * interrupt controller so no core shares a timer interrupt with another.
+ *
+ *   CNTP (non-secure physical) - periodic scheduler tick
+ *   CNTV (virtual)             - high resolution one-shot deadline
+ *
+ * All functions act on the calling core. generic_timer_init() has to be called
+ * once on every core that wants to use its timers; it starts that core's tick
+ * at GENERIC_TIMER_TICK_HZ, so a core is never without a wakeup source.
+ */
+
+#define GENERIC_TIMER_TICK_HZ 100
+
+typedef void (*generic_timer_callback_f)(void);
+
+void generic_timer_init(void);
+
+uint32_t generic_timer_frequency(void);
+uint64_t generic_timer_count(void);
+uint64_t generic_timer_usecs_to_ticks(uint32_t usecs);
+
+void generic_timer_start_tick(uint32_t hz, generic_timer_callback_f callback);
+void generic_timer_stop_tick(void);
+void generic_timer_suspend_tick(void);
+void generic_timer_resume_tick(void);
+uint64_t generic_timer_tick_count(uint32_t core);
+
+void generic_timer_set_deadline(uint64_t count, generic_timer_callback_f callback);
+void generic_timer_set_oneshot(uint32_t usecs, generic_timer_callback_f callback);
+void generic_timer_cancel_deadline(void);
+bool generic_timer_deadline_pending(void);
+void generic_timer_wfi_timeout(uint32_t usecs);
+
+#endif
@@ -0,0 +1,22 @@
+#ifndef IDLE_H
+#define IDLE_H
+
+#include <stdint.h>
+
+/*
+ * Per-core idle loop. Softirq work left pending is run first; a core with
+ * nothing else to do stops its periodic tick, makes sure its next timer
+ * deadline is armed and sleeps in WFI until an interrupt arrives. Time
+ * spent in WFI is accounted per core.
+ */
+
+#define IDLE_UTILISATION_WINDOW_US 1000000
+
+void cpu_idle(void) __attribute__((noreturn));
+void cpu_idle_once(void);
+
+uint64_t cpu_idle_time_us(uint32_t core);
+uint64_t cpu_idle_wakeups(uint32_t core);
+uint32_t cpu_utilisation(uint32_t core);
+
+#endif
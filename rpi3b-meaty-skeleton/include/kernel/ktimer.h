@@ -0,0 +1,63 @@
+#ifndef KTIMER_H
+#define KTIMER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+ * Kernel timer events on top of the BCM system timer.
+ *
+ * Only compare channels C1 and C3 are usable from the ARM, so they are
+ * multiplexed:
+ *   C1 - min-heap of high resolution (sub-millisecond) deadlines, programmed
+ *        to the earliest one
+ *   C3 - hierarchical timing wheel with a 1 ms base tick for coarse
+ *        timeouts, programmed to the next occupied bucket
+ *
+ * Wheel timers never fire early but may fire late by up to the granularity
+ * of the level they landed in (1/8 of their timeout, roughly). Anything
+ * under KTIMER_HRES_THRESHOLD_US goes to the heap and fires on time.
+ *
+ * Times are system timer microseconds (timer_getTickCount64()). Timers
+ * are owned by core 0, where the system timer interrupts are routed, and
+ * callbacks run there in SOFTIRQ_TIMER context with interrupts enabled.
+ */
+
+#define KTIMER_HRES_THRESHOLD_US 1000
+#define KTIMER_HEAP_SIZE 64
+
+typedef void (*ktimer_callback_f)(void *data);
+
+typedef enum
+{
+    KTIMER_IDLE = 0,
+    KTIMER_WHEEL,
+    KTIMER_HEAP
+} ktimer_queue_t;
+
+typedef struct ktimer
+{
+    uint64_t expires;
+    ktimer_callback_f callback;
+    void *data;
+
+    // Queue bookkeeping, private to ktimer.c
+    ktimer_queue_t queue;
+    struct ktimer *next;
+    struct ktimer **pprev;
+    uint16_t index;
+} ktimer_t;
+
+void ktimer_init(void);
+void ktimer_setup(ktimer_t *timer, ktimer_callback_f callback, void *data);
+
+bool ktimer_add(ktimer_t *timer, uint64_t usecs);
+bool ktimer_add_at(ktimer_t *timer, uint64_t expires);
+bool ktimer_add_hres(ktimer_t *timer, uint64_t usecs);
+bool ktimer_cancel(ktimer_t *timer);
+bool ktimer_pending(const ktimer_t *timer);
+
+uint64_t ktimer_now(void);
+uint64_t ktimer_next_expiry(void);
+
+#endif
@@ -7,16 +7,29 @@
 
 #define RPI_INTERRUPT_CONTROLLER_BASE (PERIPHERAL_BASE + 0xB200)
 
+/* BCM2836/7 per-core local interrupt controller (QA7), outside the peripheral window */
+#define RPI_LOCAL_CONTROLLER_BASE 0x40000000UL
+
+/*
+ * The clearer is the top half: it runs in the IRQ with interrupts masked and must
+ * acknowledge the device. The handler (may be NULL) is the bottom half, deferred to
+ * the SOFTIRQ_IRQ softirq on the core that took the interrupt.
+ */
 typedef void (*interrupt_handler_f)(void);
 typedef void (*interrupt_clearer_f)(void);
 
 #define ARM_IRQ1_BASE 0
 #define ARM_IRQ0_BASE 64
 
+#define INTERRUPT_ARM_TIMER (ARM_IRQ0_BASE + 0)
+
+#define INTERRUPT_SYSTIMER1 (ARM_IRQ1_BASE + 1)
+#define INTERRUPT_SYSTIMER3 (ARM_IRQ1_BASE + 3)
+
 #define INTERRUPT_DMA0 (ARM_IRQ1_BASE + 16)
 #define INTERRUPT_DMA1 (ARM_IRQ1_BASE + 17)
-#define INTERRUPT_DMA2 (ARM_IRQ0_BASE + 13)
-#define INTERRUPT_DMA3 (ARM_IRQ0_BASE + 14)
+#define INTERRUPT_DMA2 (ARM_IRQ1_BASE + 18)
+#define INTERRUPT_DMA3 (ARM_IRQ1_BASE + 19)
 #define INTERRUPT_DMA4 (ARM_IRQ1_BASE + 20)
 #define INTERRUPT_DMA5 (ARM_IRQ1_BASE + 21)
 #define INTERRUPT_DMA6 (ARM_IRQ1_BASE + 22)
@@ -27,6 +40,8 @@ typedef void (*interrupt_clearer_f)(void);
 #define INTERRUPT_DMA11 (ARM_IRQ1_BASE + 27)
 #define INTERRUPT_DMA12 (ARM_IRQ1_BASE + 28)
 
+#define INTERRUPT_SMI (ARM_IRQ1_BASE + 48)
+
 #define IRQ_BASIC 0x3F00B200
 #define IRQ_PEND1 0x3F00B204
 #define IRQ_PEND2 0x3F00B208
@@ -60,7 +75,58 @@ typedef struct
     volatile uint32_t Disable_Basic_IRQs;
 } rpi_irq_controller_t;
 
+/* Bits of the per-core IRQ/FIQ source registers */
+typedef enum
+{
+    LOCAL_IRQ_CNTPS = 0,
+    LOCAL_IRQ_CNTPNS = 1,
+    LOCAL_IRQ_CNTHP = 2,
+    LOCAL_IRQ_CNTV = 3,
+    LOCAL_IRQ_MAILBOX0 = 4,
+    LOCAL_IRQ_MAILBOX1 = 5,
+    LOCAL_IRQ_MAILBOX2 = 6,
+    LOCAL_IRQ_MAILBOX3 = 7,
+    LOCAL_IRQ_GPU = 8,
+    LOCAL_IRQ_PMU = 9,
+    LOCAL_IRQ_AXI = 10,
+    LOCAL_IRQ_LOCAL_TIMER = 11,
+    NUM_LOCAL_IRQS = 12
+} local_irq_number_t;
+
+typedef struct
+{
+    volatile uint32_t Control;
+    volatile uint32_t reserved0;
+    volatile uint32_t CoreTimerPrescaler;
+    volatile uint32_t GPUInterruptRouting;
+    volatile uint32_t PMUInterruptRoutingSet;
+    volatile uint32_t PMUInterruptRoutingClear;
+    volatile uint32_t reserved1;
+    volatile uint32_t CoreTimerLow;
+    volatile uint32_t CoreTimerHigh;
+    volatile uint32_t LocalInterruptRouting;
+    volatile uint32_t reserved2;
+    volatile uint32_t AXIOutstandingCounters;
+    volatile uint32_t AXIOutstandingIRQ;
+    volatile uint32_t LocalTimerControl;
+    volatile uint32_t LocalTimerWriteFlags;
+    volatile uint32_t reserved3;
+    volatile uint32_t CoreTimerIRQControl[4];
+    volatile uint32_t CoreMailboxIRQControl[4];
+    volatile uint32_t CoreIRQSource[4];
+    volatile uint32_t CoreFIQSource[4];
+    volatile uint32_t MailboxWriteSet[4][4];   // [core][mailbox]
+    volatile uint32_t MailboxReadClear[4][4];  // write 1s to clear
+} rpi_local_controller_t;
+
+/* CoreTimerIRQControl bits: one IRQ enable per generic timer, FIQ enables are << 4 */
+#define LOCAL_TIMER_IRQ_CNTPS (1 << 0)
+#define LOCAL_TIMER_IRQ_CNTPNS (1 << 1)
+#define LOCAL_TIMER_IRQ_CNTHP (1 << 2)
+#define LOCAL_TIMER_IRQ_CNTV (1 << 3)
+
 extern rpi_irq_controller_t *RPI_GetIrqController(void);
+extern rpi_local_controller_t *RPI_GetLocalController(void);
 extern void _enable_interrupts();
 
 __inline__ int32_t INTERRUPTS_ENABLED(void)
@@ -89,8 +155,19 @@ __inline__ void DISABLE_INTERRUPTS(void)
     }
 }
 
+/* MPIDR affinity level 0, i.e. 0..3 on the BCM2837 */
+static inline uint32_t CORE_ID(void)
+{
+    uint32_t mpidr;
+    __asm__ __volatile__("mrc p15, 0, %0, c0, c0, 5"
+                         : "=r"(mpidr));
+    return mpidr & 3;
+}
+
 void interrupts_init(void);
 void register_irq_handler(irq_number_t irq_num, interrupt_handler_f handler, interrupt_clearer_f clearer);
 void unregister_irq_handler(irq_number_t irq_num);
+void register_local_irq_handler(local_irq_number_t irq_num, interrupt_handler_f handler, interrupt_clearer_f clearer);
+void unregister_local_irq_handler(local_irq_number_t irq_num);
 
 #endif
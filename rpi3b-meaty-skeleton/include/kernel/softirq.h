@@ -0,0 +1,69 @@
+#ifndef SOFTIRQ_H
+#define SOFTIRQ_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+ * Deferred interrupt work.
+ *
+ * The top half of an interrupt (the clearer passed to register_irq_handler)
+ * runs with IRQs masked and only acknowledges the device. Everything else is
+ * queued here and runs per core with IRQs enabled, either when the outermost
+ * IRQ returns or from the idle loop.
+ *
+ * Each softirq declares a budget in microseconds. Runs longer than that are
+ * counted as overruns, and the tasklet queue stops handing out work once its
+ * budget is spent and picks up again on the next pass. After
+ * SOFTIRQ_MAX_RESTART passes or SOFTIRQ_MAX_TIME_US the remaining work is
+ * left to the idle loop so a storm can not starve the foreground.
+ */
+
+#define SOFTIRQ_MAX_RESTART 10
+#define SOFTIRQ_MAX_TIME_US 2000
+
+/* Lower numbers run first */
+typedef enum
+{
+    SOFTIRQ_HI_TASKLET = 0,
+    SOFTIRQ_TIMER,
+    SOFTIRQ_IRQ,
+    SOFTIRQ_TASKLET,
+    NR_SOFTIRQS
+} softirq_number_t;
+
+typedef void (*softirq_action_f)(void);
+typedef void (*tasklet_func_f)(void *data);
+
+typedef struct tasklet
+{
+    struct tasklet *next;
+    tasklet_func_f func;
+    void *data;
+    volatile uint32_t scheduled;
+} tasklet_t;
+
+typedef struct
+{
+    uint32_t runs;
+    uint32_t overruns;
+    uint32_t max_us;
+    uint32_t budget_us;
+} softirq_stats_t;
+
+void softirq_init(void);
+void open_softirq(softirq_number_t nr, softirq_action_f action, uint32_t budget_us);
+void raise_softirq(softirq_number_t nr);
+bool softirq_pending(void);
+bool in_softirq(void);
+void do_softirq(void);
+void irq_exit(void);
+
+void tasklet_init(tasklet_t *tasklet, tasklet_func_f func, void *data);
+void tasklet_schedule(tasklet_t *tasklet);
+void tasklet_hi_schedule(tasklet_t *tasklet);
+
+void softirq_get_stats(uint32_t core, softirq_number_t nr, softirq_stats_t *stats);
+void softirq_print_stats(void);
+
+#endif
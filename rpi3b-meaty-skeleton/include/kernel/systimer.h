@@ -8,7 +8,8 @@
 
 void timer_init(void);
 
-void timer_set(uint32_t usecs);
+void timer_set_compare(uint8_t channel, uint32_t value);
+void timer_clear_match(uint8_t channel);
 void MicroDelay(uint64_t delayInUs);
 
 void udelay(uint32_t usecs);
@@ -0,0 +1,38 @@
+#ifndef _DMA_ALLOC_H_
+#define _DMA_ALLOC_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+/*
+ * DMA-coherent memory. A 1 MB section reserved in linker.ld
+ * (__dma_coherent_start) and always mapped uncached by
+ * initialize_virtual_memory, so devices and CPU see the same bytes without
+ * cache maintenance. Handed out in cache-line granules with any power of
+ * two alignment: DMA control blocks, USB packet buffers, SD bounce buffers.
+ *
+ * Buffers that do not come from here (stack, mem_allocate) need the
+ * dma_cache_* calls around a transfer once the data cache is on.
+ */
+
+#define DMA_COHERENT_SIZE 0x100000
+#define DMA_COHERENT_GRANULE 64 // Cortex-A53 cache line
+
+// VC bus alias for ARM RAM: direct, uncached. Peripherals use PIO_TO_DMA.
+#define DMA_BUS_ALIAS 0xC0000000
+
+void dma_alloc_init(void);
+void *dma_alloc_coherent(uint32_t size, uint32_t align);
+void dma_free_coherent(void *ptr);
+bool dma_is_coherent(const void *ptr);
+uint32_t dma_coherent_free(void);
+
+uint32_t dma_bus_address(const void *ptr);
+void *dma_bus_to_virt(uint32_t bus_addr);
+
+void dma_cache_clean(const void *ptr, uint32_t size);
+void dma_cache_invalidate(void *ptr, uint32_t size);
+void dma_cache_flush(void *ptr, uint32_t size);
+
+#endif
@@ -0,0 +1,238 @@
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <plibc/stdio.h>
+#include <kernel/fiq.h>
+#include <kernel/rpi-armtimer.h>
+#include <kernel/rpi-interrupts.h>
+#include <kernel/systimer.h>
+
+_Static_assert(offsetof(fiq_shared_t, ack_addr) == 16, "fiq-entry.S FIQ_ACK_ADDR");
+_Static_assert(offsetof(fiq_shared_t, doorbell_addr) == 36, "fiq-entry.S FIQ_DOORBELL_ADDR");
+_Static_assert(offsetof(fiq_shared_t, ring) == 40, "fiq-entry.S FIQ_RING");
+_Static_assert((FIQ_RING_SIZE & (FIQ_RING_SIZE - 1)) == 0, "fiq-entry.S FIQ_RING_MASK");
+
+#define NUM_IRQS 72
+
+static volatile fiq_shared_t fiq_shared __attribute__((aligned(64)));
+static int32_t fiq_irq = -1;
+static uint32_t fiq_core;
+static fiq_consumer_f fiq_consumer;
+
+/* Top half of the doorbell: the mailbox stays asserted until cleared */
+static void fiq_doorbell_clearer(void)
+{
+    RPI_GetLocalController()->MailboxReadClear[CORE_ID()][FIQ_MAILBOX] = 0xffffffff;
+}
+
+static void fiq_doorbell_handler(void)
+{
+    uint32_t sample;
+
+    while (fiq_consumer != NULL && fiq_read(&sample))
+    {
+        fiq_consumer(sample);
+    }
+}
+
+/**
+ * Route `irq_num` (same numbering as register_irq_handler, 64+ are the
+ * basic ARM sources) to FIQ on the calling core. The source is removed from
+ * the IRQ path. Only one source can be claimed at a time; claim from core 0,
+ * GPU FIQs are routed there.
+ */
+bool fiq_claim(uint32_t irq_num, const fiq_source_t *source, fiq_consumer_f consumer)
+{
+    rpi_local_controller_t *local = RPI_GetLocalController();
+
+    if (fiq_irq >= 0 || irq_num >= NUM_IRQS)
+    {
+        printf("ERROR: CANNOT CLAIM FIQ %d: already owned by %d\n", irq_num, fiq_irq);
+        return false;
+    }
+
+    fiq_core = CORE_ID();
+    fiq_consumer = consumer;
+    fiq_shared.head = 0;
+    fiq_shared.tail = 0;
+    fiq_shared.count = 0;
+    fiq_shared.overflows = 0;
+    fiq_shared.ack_addr = source->ack_addr;
+    fiq_shared.ack_value = source->ack_value;
+    fiq_shared.sample_addr = source->sample_addr;
+    fiq_shared.rearm_addr = source->rearm_addr;
+    fiq_shared.rearm_period = source->rearm_period;
+    fiq_shared.doorbell_addr = 0;
+
+    if (consumer != NULL)
+    {
+        register_local_irq_handler(LOCAL_IRQ_MAILBOX0 + FIQ_MAILBOX, fiq_doorbell_handler, fiq_doorbell_clearer);
+        local->CoreMailboxIRQControl[fiq_core] |= (1 << FIQ_MAILBOX);
+        fiq_shared.doorbell_addr = (uint32_t)&local->MailboxWriteSet[fiq_core][FIQ_MAILBOX];
+    }
+
+    fiq_load_banked(&fiq_shared);
+    unregister_irq_handler(irq_num);
+    fiq_irq = irq_num;
+    RPI_GetIrqController()->FIQ_control = FIQ_CONTROL_ENABLE | irq_num;
+    __asm__ __volatile__("cpsie f");
+    return true;
+}
+
+void fiq_release(void)
+{
+    rpi_local_controller_t *local = RPI_GetLocalController();
+
+    if (fiq_irq < 0)
+    {
+        return;
+    }
+    RPI_GetIrqController()->FIQ_control = 0;
+    __asm__ __volatile__("cpsid f");
+    if (fiq_consumer != NULL)
+    {
+        local->CoreMailboxIRQControl[fiq_core] &= ~(1 << FIQ_MAILBOX);
+        unregister_local_irq_handler(LOCAL_IRQ_MAILBOX0 + FIQ_MAILBOX);
+    }
+    fiq_consumer = NULL;
+    fiq_irq = -1;
+}
+
+/* Pop one sample queued by the FIQ, single consumer */
+bool fiq_read(uint32_t *sample)
+{
+    uint32_t tail = fiq_shared.tail;
+
+    if (tail == fiq_shared.head)
+    {
+        return false;
+    }
+    __asm__ __volatile__("dmb" ::
+                             : "memory");
+    *sample = fiq_shared.ring[tail];
+    fiq_shared.tail = (tail + 1) & (FIQ_RING_SIZE - 1);
+    return true;
+}
+
+uint32_t fiq_count(void)
+{
+    return fiq_shared.count;
+}
+
+uint32_t fiq_overflows(void)
+{
+    return fiq_shared.overflows;
+}
+
+/*----------------------------------------------------------------------
+ * Entry latency: FIQ vs IRQ
+ *
+ * The ARM timer runs periodically from LATENCY_TIMER_LOAD with no
+ * prescaler. It keeps counting down after it fires, so LOAD - Value read
+ * by the first instruction that touches it is the time from interrupt
+ * assertion to handler, in APB clock ticks.
+ *----------------------------------------------------------------------*/
+
+#define LATENCY_SAMPLES 32
+#define LATENCY_TIMER_LOAD 50000
+#define LATENCY_APB_CLOCK_MHZ 250
+#define LATENCY_TIMEOUT_US 1000000
+
+static volatile uint32_t irq_samples[LATENCY_SAMPLES];
+static volatile uint32_t irq_sample_count;
+
+static void latency_irq_clearer(void)
+{
+    uint32_t value = RPI_GetArmTimer()->Value;
+
+    RPI_GetArmTimer()->IRQClear = 1;
+    if (irq_sample_count < LATENCY_SAMPLES)
+    {
+        irq_samples[irq_sample_count++] = value;
+    }
+}
+
+static void latency_timer_start(void)
+{
+    rpi_arm_timer_t *timer = RPI_GetArmTimer();
+
+    timer->Control = 0;
+    timer->PreDivider = 0;
+    timer->Load = LATENCY_TIMER_LOAD;
+    timer->IRQClear = 1;
+    timer->Control = RPI_ARMTIMER_CTRL_23BIT |
+                     RPI_ARMTIMER_CTRL_ENABLE |
+                     RPI_ARMTIMER_CTRL_INT_ENABLE |
+                     RPI_ARMTIMER_CTRL_PRESCALE_1;
+}
+
+static void latency_timer_stop(void)
+{
+    RPI_GetArmTimer()->Control = 0;
+    RPI_GetArmTimer()->IRQClear = 1;
+}
+
+static void print_latency(const char *name, volatile uint32_t *samples, uint32_t count)
+{
+    uint32_t i, min = 0xffffffff, max = 0, sum = 0;
+
+    if (count == 0)
+    {
+        printf("\n %s: no samples", name);
+        return;
+    }
+    for (i = 0; i < count; i++)
+    {
+        uint32_t ticks = LATENCY_TIMER_LOAD - samples[i];
+        min = ticks < min ? ticks : min;
+        max = ticks > max ? ticks : max;
+        sum += ticks;
+    }
+    printf("\n %s entry latency over %d: min %d avg %d max %d ticks (%d/%d/%d ns at %d MHz)",
+           name, count, min, sum / count, max,
+           min * 1000 / LATENCY_APB_CLOCK_MHZ, (sum / count) * 1000 / LATENCY_APB_CLOCK_MHZ,
+           max * 1000 / LATENCY_APB_CLOCK_MHZ, LATENCY_APB_CLOCK_MHZ);
+}
+
+void show_fiq_latency_demo(void)
+{
+    static uint32_t fiq_samples[LATENCY_SAMPLES];
+    uint32_t fiq_sample_count = 0;
+    uint64_t start;
+    fiq_source_t source = {
+        .ack_addr = ARM_TIMER_CLI,
+        .ack_value = 1,
+        .sample_addr = ARM_TIMER_VAL,
+        .rearm_addr = 0,
+        .rearm_period = 0};
+
+    // IRQ path: vector, wrapper, irq_handler dispatch, then the clearer
+    irq_sample_count = 0;
+    register_irq_handler(INTERRUPT_ARM_TIMER, NULL, latency_irq_clearer);
+    latency_timer_start();
+    start = timer_getTickCount64();
+    while (irq_sample_count < LATENCY_SAMPLES && timer_getTickCount64() - start < LATENCY_TIMEOUT_US)
+        ;
+    latency_timer_stop();
+    unregister_irq_handler(INTERRUPT_ARM_TIMER);
+    print_latency("IRQ", irq_samples, irq_sample_count);
+
+    // FIQ path: vector straight into fiq_asm_handler
+    if (!fiq_claim(INTERRUPT_ARM_TIMER, &source, NULL))
+    {
+        return;
+    }
+    latency_timer_start();
+    start = timer_getTickCount64();
+    while (fiq_sample_count < LATENCY_SAMPLES && timer_getTickCount64() - start < LATENCY_TIMEOUT_US)
+    {
+        uint32_t sample;
+        if (fiq_read(&sample))
+        {
+            fiq_samples[fiq_sample_count++] = sample;
+        }
+    }
+    latency_timer_stop();
+    fiq_release();
+    print_latency("FIQ", fiq_samples, fiq_sample_count);
+}
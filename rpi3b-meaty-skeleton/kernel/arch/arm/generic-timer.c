@@ -0,0 +1,316 @@
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <plibc/stdio.h>
+#include <kernel/generic-timer.h>
+#include <kernel/rpi-interrupts.h>
+
+#define NUM_CORES 4
+
+#define CNT_CTL_ENABLE (1 << 0)
+#define CNT_CTL_IMASK (1 << 1)
+#define CNT_CTL_ISTATUS (1 << 2)
+
+// Crystal frequency the firmware programs into CNTFRQ on the Pi 3
+#define GENERIC_TIMER_DEFAULT_FREQ 19200000
+
+typedef struct
+{
+    uint64_t tick_period;
+    uint64_t tick_next;
+    volatile uint64_t ticks;
+    generic_timer_callback_f tick_callback;
+    generic_timer_callback_f deadline_callback;
+} generic_timer_core_t;
+
+static generic_timer_core_t cores[NUM_CORES];
+static uint32_t cntfrq = GENERIC_TIMER_DEFAULT_FREQ;
+
+static inline uint32_t read_cntfrq(void)
+{
+    uint32_t val;
+    __asm__ __volatile__("mrc p15, 0, %0, c14, c0, 0"
+                         : "=r"(val));
+    return val;
+}
+
+static inline uint64_t read_cntpct(void)
+{
+    uint64_t val;
+    __asm__ __volatile__("isb\n\tmrrc p15, 0, %Q0, %R0, c14"
+                         : "=r"(val));
+    return val;
+}
+
+static inline uint64_t read_cntvct(void)
+{
+    uint64_t val;
+    __asm__ __volatile__("isb\n\tmrrc p15, 1, %Q0, %R0, c14"
+                         : "=r"(val));
+    return val;
+}
+
+static inline void write_cntp_cval(uint64_t val)
+{
+    __asm__ __volatile__("mcrr p15, 2, %Q0, %R0, c14\n\tisb" ::"r"(val));
+}
+
+static inline void write_cntp_ctl(uint32_t val)
+{
+    __asm__ __volatile__("mcr p15, 0, %0, c14, c2, 1\n\tisb" ::"r"(val));
+}
+
+static inline void write_cntv_cval(uint64_t val)
+{
+    __asm__ __volatile__("mcrr p15, 3, %Q0, %R0, c14\n\tisb" ::"r"(val));
+}
+
+static inline void write_cntv_ctl(uint32_t val)
+{
+    __asm__ __volatile__("mcr p15, 0, %0, c14, c3, 1\n\tisb" ::"r"(val));
+}
+
+static inline uint64_t read_cntv_cval(void)
+{
+    uint64_t val;
+    __asm__ __volatile__("mrrc p15, 3, %Q0, %R0, c14"
+                         : "=r"(val));
+    return val;
+}
+
+static inline uint32_t read_cntv_ctl(void)
+{
+    uint32_t val;
+    __asm__ __volatile__("mrc p15, 0, %0, c14, c3, 1"
+                         : "=r"(val));
+    return val;
+}
+
+/*
+ * The tick runs off an absolute compare value so the period does not drift
+ * with interrupt latency. Writing CVAL is also what deasserts the interrupt.
+ */
+static void generic_tick_clearer(void)
+{
+    generic_timer_core_t *core = &cores[CORE_ID()];
+    uint64_t now = read_cntpct();
+
+    core->tick_next += core->tick_period;
+    if (core->tick_next <= now)
+    {
+        // Fell behind by more than a period, don't replay the backlog
+        core->tick_next = now + core->tick_period;
+    }
+    write_cntp_cval(core->tick_next);
+    core->ticks++;
+}
+
+static void generic_tick_handler(void)
+{
+    generic_timer_callback_f callback = cores[CORE_ID()].tick_callback;
+    if (callback != NULL)
+    {
+        callback();
+    }
+}
+
+static void generic_deadline_clearer(void)
+{
+    write_cntv_ctl(0);
+}
+
+static void generic_deadline_handler(void)
+{
+    generic_timer_core_t *core = &cores[CORE_ID()];
+    generic_timer_callback_f callback = core->deadline_callback;
+
+    // Cleared first so the callback may arm the next deadline
+    core->deadline_callback = NULL;
+    if (callback != NULL)
+    {
+        callback();
+    }
+}
+
+void generic_timer_init(void)
+{
+    uint32_t core_id = CORE_ID();
+    uint32_t freq = read_cntfrq();
+    rpi_local_controller_t *local = RPI_GetLocalController();
+
+    if (freq != 0)
+    {
+        cntfrq = freq;
+    }
+
+    write_cntp_ctl(0);
+    write_cntv_ctl(0);
+    cores[core_id].tick_period = 0;
+    cores[core_id].ticks = 0;
+    cores[core_id].tick_callback = NULL;
+    cores[core_id].deadline_callback = NULL;
+
+    register_local_irq_handler(LOCAL_IRQ_CNTPNS, generic_tick_handler, generic_tick_clearer);
+    register_local_irq_handler(LOCAL_IRQ_CNTV, generic_deadline_handler, generic_deadline_clearer);
+
+    // Route this core's timers to its own IRQ line
+    local->CoreTimerIRQControl[core_id] |= LOCAL_TIMER_IRQ_CNTPNS | LOCAL_TIMER_IRQ_CNTV;
+
+    printf("\n generic timer: core %d, %d Hz", core_id, cntfrq);
+
+    // Tickless idle silences it, anything else waiting in WFI is woken by it
+    generic_timer_start_tick(GENERIC_TIMER_TICK_HZ, NULL);
+}
+
+uint32_t generic_timer_frequency(void)
+{
+    return cntfrq;
+}
+
+/* Virtual count, the time base used by generic_timer_set_deadline() */
+uint64_t generic_timer_count(void)
+{
+    return read_cntvct();
+}
+
+uint64_t generic_timer_usecs_to_ticks(uint32_t usecs)
+{
+    return ((uint64_t)usecs * cntfrq) / 1000000;
+}
+
+void generic_timer_start_tick(uint32_t hz, generic_timer_callback_f callback)
+{
+    generic_timer_core_t *core = &cores[CORE_ID()];
+
+    if (hz == 0 || hz > cntfrq)
+    {
+        printf("ERROR: generic timer tick rate %d Hz not supported\n", hz);
+        return;
+    }
+
+    int32_t irqs_on = INTERRUPTS_ENABLED();
+    DISABLE_INTERRUPTS();
+    core->tick_callback = callback;
+    core->tick_period = cntfrq / hz;
+    core->tick_next = read_cntpct() + core->tick_period;
+    write_cntp_cval(core->tick_next);
+    write_cntp_ctl(CNT_CTL_ENABLE);
+    if (irqs_on)
+    {
+        ENABLE_INTERRUPTS();
+    }
+}
+
+void generic_timer_stop_tick(void)
+{
+    write_cntp_ctl(0);
+    cores[CORE_ID()].tick_period = 0;
+    cores[CORE_ID()].tick_callback = NULL;
+}
+
+/**
+ * Tickless idle: silence the periodic tick while the core sleeps. The tick
+ * keeps its phase and the ticks missed meanwhile are accounted on resume.
+ */
+void generic_timer_suspend_tick(void)
+{
+    if (cores[CORE_ID()].tick_period != 0)
+    {
+        write_cntp_ctl(CNT_CTL_ENABLE | CNT_CTL_IMASK);
+    }
+}
+
+void generic_timer_resume_tick(void)
+{
+    generic_timer_core_t *core = &cores[CORE_ID()];
+    uint64_t now;
+
+    if (core->tick_period == 0)
+    {
+        return;
+    }
+    now = read_cntpct();
+    if (core->tick_next <= now)
+    {
+        uint64_t missed = (now - core->tick_next) / core->tick_period + 1;
+        core->ticks += missed;
+        core->tick_next += missed * core->tick_period;
+        write_cntp_cval(core->tick_next);
+    }
+    write_cntp_ctl(CNT_CTL_ENABLE);
+}
+
+uint64_t generic_timer_tick_count(uint32_t core)
+{
+    return cores[core & (NUM_CORES - 1)].ticks;
+}
+
+/**
+ * Arms this core's one-shot deadline at an absolute generic_timer_count() value,
+ * replacing any deadline already pending. A count in the past fires immediately.
+ */
+void generic_timer_set_deadline(uint64_t count, generic_timer_callback_f callback)
+{
+    int32_t irqs_on = INTERRUPTS_ENABLED();
+    DISABLE_INTERRUPTS();
+    cores[CORE_ID()].deadline_callback = callback;
+    write_cntv_cval(count);
+    write_cntv_ctl(CNT_CTL_ENABLE);
+    if (irqs_on)
+    {
+        ENABLE_INTERRUPTS();
+    }
+}
+
+void generic_timer_set_oneshot(uint32_t usecs, generic_timer_callback_f callback)
+{
+    generic_timer_set_deadline(read_cntvct() + generic_timer_usecs_to_ticks(usecs), callback);
+}
+
+void generic_timer_cancel_deadline(void)
+{
+    write_cntv_ctl(0);
+    cores[CORE_ID()].deadline_callback = NULL;
+}
+
+bool generic_timer_deadline_pending(void)
+{
+    return (read_cntv_ctl() & CNT_CTL_ENABLE) != 0;
+}
+
+/**
+ * WFI for at most `usecs`, for waits that expect an interrupt but must not
+ * hang if it never comes. Call with interrupts masked: WFI still wakes on
+ * the pending IRQ. A deadline that was already armed is left alone when it
+ * is due first, otherwise it is put back after the wakeup.
+ */
+void generic_timer_wfi_timeout(uint32_t usecs)
+{
+    generic_timer_core_t *core = &cores[CORE_ID()];
+    uint64_t count = read_cntvct() + generic_timer_usecs_to_ticks(usecs);
+    bool armed = (read_cntv_ctl() & CNT_CTL_ENABLE) != 0;
+    uint64_t saved_cval = armed ? read_cntv_cval() : 0;
+    generic_timer_callback_f saved_callback = core->deadline_callback;
+
+    if (armed && saved_cval <= count)
+    {
+        __asm__ __volatile__("dsb\n\twfi" ::
+                                 : "memory");
+        return;
+    }
+
+    core->deadline_callback = NULL;
+    write_cntv_cval(count);
+    write_cntv_ctl(CNT_CTL_ENABLE);
+    __asm__ __volatile__("dsb\n\twfi" ::
+                             : "memory");
+    if (armed)
+    {
+        core->deadline_callback = saved_callback;
+        write_cntv_cval(saved_cval);
+    }
+    else
+    {
+        write_cntv_ctl(0);
+    }
+}
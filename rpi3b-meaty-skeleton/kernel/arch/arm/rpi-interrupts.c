@@ -4,6 +4,8 @@
 #include <kernel/rpi-base.h>
 #include <kernel/rpi-armtimer.h>
 #include <kernel/rpi-interrupts.h>
+#include <kernel/softirq.h>
+#include <device/dma.h>
 #include <device/uart0.h>
 
 #define INTERRUPTS_PENDING (RPI_INTERRUPT_CONTROLLER_BASE + 0x200)
@@ -20,12 +22,29 @@
 static rpi_irq_controller_t *rpiIRQController =
     (rpi_irq_controller_t *)RPI_INTERRUPT_CONTROLLER_BASE;
 
+/** @brief The per-core local interrupt controller */
+static rpi_local_controller_t *rpiLocalController =
+    (rpi_local_controller_t *)RPI_LOCAL_CONTROLLER_BASE;
+
 static interrupt_handler_f handlers[NUM_IRQS];
 static interrupt_clearer_f clearers[NUM_IRQS];
 
+/* Local sources are banked per core, the handler looks at CORE_ID() itself */
+static interrupt_handler_f local_handlers[NUM_LOCAL_IRQS];
+static interrupt_clearer_f local_clearers[NUM_LOCAL_IRQS];
+
+/* Handlers acknowledged by the top half and waiting for the softirq, per core */
+#define NUM_IRQ_WORDS ((NUM_IRQS + 31) / 32)
+static volatile uint32_t deferred_irqs[4][NUM_IRQ_WORDS];
+static volatile uint32_t deferred_local[4];
+
+// Worst case for all deferred device handlers of one pass
+#define DEFERRED_HANDLER_BUDGET_US 500
+
 volatile int32_t count_irqs = 0;
 
 void bzero(void *s, size_t n);
+static void run_deferred_handlers(void);
 
 /**
     @brief Return the IRQ Controller register set
@@ -35,6 +54,14 @@ rpi_irq_controller_t *RPI_GetIrqController(void)
     return rpiIRQController;
 }
 
+/**
+    @brief Return the local (per-core) interrupt controller register set
+*/
+rpi_local_controller_t *RPI_GetLocalController(void)
+{
+    return rpiLocalController;
+}
+
 /**
     @brief The Reset vector interrupt handler
 
@@ -87,44 +114,108 @@ void __attribute__((interrupt("ABORT"))) data_abort_vector(void)
         ;
 }
 
-void __attribute__((interrupt("FIQ"))) fast_interrupt_vector(void)
-{
-    uart_puts("fast_interrupt_vector Interrupt Occurred");
-}
-
 void interrupts_init(void)
 {
     _enable_interrupts();
     DISABLE_INTERRUPTS();
     bzero(handlers, sizeof(interrupt_handler_f) * NUM_IRQS);
     bzero(clearers, sizeof(interrupt_clearer_f) * NUM_IRQS);
+    bzero(local_handlers, sizeof(interrupt_handler_f) * NUM_LOCAL_IRQS);
+    bzero(local_clearers, sizeof(interrupt_clearer_f) * NUM_LOCAL_IRQS);
     rpiIRQController->Disable_Basic_IRQs = 0xffffffff; // disable all interrupts
     rpiIRQController->Disable_IRQs_1 = 0xffffffff;
     rpiIRQController->Disable_IRQs_2 = 0xffffffff;
+    softirq_init();
+    open_softirq(SOFTIRQ_IRQ, run_deferred_handlers, DEFERRED_HANDLER_BUDGET_US);
     ENABLE_INTERRUPTS();
 }
 
 /**
- * this function is going to be called by the processor.  Needs to check pending interrupts and execute handlers if one is registered
+ * Bottom halves: run the handlers whose top half fired on this core since
+ * the last pass. Runs from the softirq with interrupts enabled.
  */
-void irq_handler(void)
+static void run_deferred_handlers(void)
 {
-    printf("IRQ triggered");
+    uint32_t core = CORE_ID();
+    uint32_t local, gpu[NUM_IRQ_WORDS];
     int32_t j;
+
+    DISABLE_INTERRUPTS();
+    local = deferred_local[core];
+    deferred_local[core] = 0;
+    for (j = 0; j < NUM_IRQ_WORDS; j++)
+    {
+        gpu[j] = deferred_irqs[core][j];
+        deferred_irqs[core][j] = 0;
+    }
+    ENABLE_INTERRUPTS();
+
+    for (j = 0; j < NUM_LOCAL_IRQS; j++)
+    {
+        if ((local & (1 << j)) && (local_handlers[j] != 0))
+        {
+            local_handlers[j]();
+        }
+    }
     for (j = 0; j < NUM_IRQS; j++)
     {
-        // If the interrupt is pending and there is a handler, run the handler
-        if (IRQ_IS_PENDING(rpiIRQController, j) && (handlers[j] != 0))
+        if ((gpu[j / 32] & (1 << (j % 32))) && (handlers[j] != 0))
         {
-            clearers[j]();
-            ENABLE_INTERRUPTS();
             handlers[j]();
-            DISABLE_INTERRUPTS();
-            return;
         }
     }
 }
 
+/**
+ * this function is going to be called by the processor.  Needs to check pending interrupts and execute handlers if one is registered
+ *
+ * Per-core sources (generic timers, mailboxes) come from the local controller and are
+ * serviced on the core that took the exception; GPU sources are only scanned when the
+ * local controller says the GPU line is what fired on this core.
+ *
+ * This is the top half only: interrupts stay masked, the clearer acknowledges the
+ * device and the handler is queued as a bottom half that runs from the softirq on
+ * the way out.
+ */
+void irq_handler(void)
+{
+    int32_t j;
+    uint32_t core = CORE_ID();
+    uint32_t local_pending = rpiLocalController->CoreIRQSource[core];
+
+    for (j = 0; j < NUM_LOCAL_IRQS; j++)
+    {
+        if ((local_pending & (1 << j)) && (local_clearers[j] != 0))
+        {
+            local_clearers[j]();
+            if (local_handlers[j] != 0)
+            {
+                deferred_local[core] |= (1 << j);
+                raise_softirq(SOFTIRQ_IRQ);
+            }
+        }
+    }
+
+    if (local_pending & (1 << LOCAL_IRQ_GPU))
+    {
+        for (j = 0; j < NUM_IRQS; j++)
+        {
+            // If the interrupt is pending and there is a clearer, acknowledge it and defer the handler
+            if (IRQ_IS_PENDING(rpiIRQController, j) && (clearers[j] != 0))
+            {
+                clearers[j]();
+                if (handlers[j] != 0)
+                {
+                    deferred_irqs[core][j / 32] |= (1 << (j % 32));
+                    raise_softirq(SOFTIRQ_IRQ);
+                }
+            }
+        }
+    }
+
+    irq_exit();
+}
+
 void register_irq_handler(irq_number_t irq_num, interrupt_handler_f handler, interrupt_clearer_f clearer)
 {
     uint32_t irq_pos;
@@ -185,12 +276,44 @@ void unregister_irq_handler(irq_number_t irq_num)
     }
 }
 
+/**
+ * Local sources have no global enable, each core unmasks them itself
+ * (e.g. CoreTimerIRQControl[core] for the generic timers).
+ */
+void register_local_irq_handler(local_irq_number_t irq_num, interrupt_handler_f handler, interrupt_clearer_f clearer)
+{
+    if (irq_num >= NUM_LOCAL_IRQS || irq_num == LOCAL_IRQ_GPU)
+    {
+        printf("ERROR: CANNOT REGISTER LOCAL IRQ HANDLER: INVALID IRQ NUMBER: %d\n", irq_num);
+        return;
+    }
+    local_handlers[irq_num] = handler;
+    local_clearers[irq_num] = clearer;
+}
+
+void unregister_local_irq_handler(local_irq_number_t irq_num)
+{
+    if (irq_num >= NUM_LOCAL_IRQS || irq_num == LOCAL_IRQ_GPU)
+    {
+        printf("ERROR: CANNOT UNREGISTER LOCAL IRQ HANDLER: INVALID IRQ NUMBER: %d\n", irq_num);
+        return;
+    }
+    local_handlers[irq_num] = 0;
+    local_clearers[irq_num] = 0;
+}
+
 void *memset(void *s, int32_t c, size_t n)
 {
     uint8_t *p = s;
     uint8_t byte = c;
     size_t i;
 
+    // Large fills go to the DMA engine once dma_offload_enable() was called
+    if (n >= DMA_OFFLOAD_MIN_BYTES && memset_offload(s, c, n))
+    {
+        return s;
+    }
+
     for (i = 0; i < n; i++)
     {
         p[i] = byte;
@@ -164,10 +164,11 @@ void RPI_PropertyAddTag(rpi_mailbox_tag_t tag, ...)
         pt[pt_index++] = va_arg(vl, unsigned int); //state
         break;
 
+    case TAG_SET_VSYNC:
     case TAG_ENABLE_QPU:
         pt[pt_index++] = 4; //request length
         pt[pt_index++] = 0;
-        pt[pt_index++] = va_arg(vl, unsigned int); // 0 turn off qpu !0 enable qpu;
+        pt[pt_index++] = va_arg(vl, unsigned int); // 0 off, !0 on (QPUs or the vsync interrupt)
         break;
 
     case TAG_EXECUTE_QPU:
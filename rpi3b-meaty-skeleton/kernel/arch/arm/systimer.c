@@ -3,7 +3,7 @@
 #include <device/uart0.h>
 #include <plibc/stdio.h>
 
-static timer_registers_t *timer_regs; // = (timer_registers_t *)SYSTEM_TIMER_BASE;
+static volatile timer_registers_t *timer_regs; // = (timer_registers_t *)SYSTEM_TIMER_BASE;
 
 extern void dmb(void);
 // static void timer_irq_handler(void)
@@ -25,9 +25,30 @@ void timer_init(void)
     // register_irq_handler(RPI_BASIC_ARM_TIMER_IRQ, timer_irq_handler, timer_irq_clearer);
 }
 
-void timer_set(uint32_t usecs)
+/**
+ * Program compare register C<channel> to fire when the low counter reaches
+ * `value`. Only channels 1 and 3 are free for the ARM, the GPU owns 0 and 2.
+ */
+void timer_set_compare(uint8_t channel, uint32_t value)
 {
-    timer_regs->timer1 = timer_regs->counter_low + usecs;
+    switch (channel)
+    {
+    case 1:
+        timer_regs->timer1 = value;
+        break;
+    case 3:
+        timer_regs->timer3 = value;
+        break;
+    default:
+        printf("ERROR: system timer compare C%d belongs to the GPU\n", channel);
+        break;
+    }
+}
+
+/* CS match bits are write-one-to-clear, so never go through the bitfield */
+void timer_clear_match(uint8_t channel)
+{
+    *(volatile uint32_t *)SYSTEM_TIMER_BASE = (1 << channel);
 }
 
 __attribute__((optimize(0))) void udelay(uint32_t usecs)
@@ -0,0 +1,419 @@
+#include <device/dma.h>
+#include <plibc/stdio.h>
+#include <plibc/string.h>
+#include <kernel/rpi-base.h>
+#include <kernel/rpi-interrupts.h>
+#include <kernel/systimer.h>
+#include <kernel/softirq.h>
+#include <mem/kernel_alloc.h>
+#include <mem/dma_alloc.h>
+
+/*
+ * Tokens are (sequence << 4) | channel. A channel is held only while its
+ * transfer runs; the completion callback records the status and gives the
+ * channel back, so a token whose sequence no longer matches its channel
+ * finished long ago.
+ */
+#define TOKEN_CHAN(t) ((t)&0xf)
+#define TOKEN_SEQ(t) ((t) >> 4)
+#define TOKEN_SEQ_MASK 0x0fffffff
+
+typedef struct
+{
+    volatile uint32_t seq;
+    volatile uint32_t done;
+    volatile int32_t status;
+    void *dst; // invalidated again on completion
+    uint32_t len;
+} dma_async_t;
+
+static dma_async_t async_state[DMA_NUM_CHANNELS];
+static uint32_t async_seq;
+
+// Source words for fills, per channel since the engine re-reads them throughout.
+// Coherent memory, allocated on the first async call.
+static volatile uint32_t (*fill_word)[4];
+
+static bool offload_enabled;
+
+static void dma_async_done(int chan, int status, void *data)
+{
+    dma_async_t *state = &async_state[chan];
+
+    if (state->seq == (uint32_t)data)
+    {
+        // Lines the CPU speculatively pulled in while the engine was writing
+        dma_cache_invalidate(state->dst, state->len);
+        state->status = status;
+        state->done = 1;
+    }
+    dma_release_channel(chan);
+}
+
+/* Plain RAM only: peripherals sit at different bus addresses, see PIO_TO_DMA */
+static bool dma_addressable(const void *p, size_t len)
+{
+    uint32_t start = (uint32_t)p;
+
+    return len != 0 && len <= DMA_MAX_LEN && start < PERIPHERAL_BASE && len <= PERIPHERAL_BASE - start;
+}
+
+static dma_token_t dma_async_start(dma_sg_t *sg, uint32_t fill)
+{
+    dma_async_t *state;
+    uint32_t seq;
+    int32_t irqs_on;
+    int chan;
+
+    if (fill_word == 0)
+    {
+        fill_word = dma_alloc_coherent(DMA_NUM_CHANNELS * sizeof(fill_word[0]), DMA_COHERENT_GRANULE);
+        if (fill_word == 0)
+        {
+            return DMA_TOKEN_NONE;
+        }
+    }
+
+    // Prefer a full channel, a lite one will do for what fits its length field
+    chan = dma_try_request_channel(DMA_CAP_FAST);
+    if (chan < 0 && sg->len <= DMA_LITE_MAX_LEN)
+    {
+        chan = dma_try_request_channel(0);
+    }
+    if (chan < 0)
+    {
+        return DMA_TOKEN_NONE;
+    }
+
+    irqs_on = INTERRUPTS_ENABLED();
+    DISABLE_INTERRUPTS();
+    seq = ++async_seq & TOKEN_SEQ_MASK;
+    if (seq == 0)
+    {
+        seq = async_seq = 1;
+    }
+    if (irqs_on)
+    {
+        ENABLE_INTERRUPTS();
+    }
+
+    state = &async_state[chan];
+    state->seq = seq;
+    state->done = 0;
+    state->status = 0;
+    state->dst = sg->dst;
+    state->len = sg->len;
+
+    if (sg->flags & DMA_SG_SRC_FIXED)
+    {
+        for (uint32_t i = 0; i < 4; i++)
+        {
+            fill_word[chan][i] = fill;
+        }
+        sg->src = (void *)fill_word[chan];
+    }
+    else
+    {
+        dma_cache_clean(sg->src, sg->len);
+    }
+    // No dirty line may be evicted on top of what the engine writes
+    dma_cache_flush(sg->dst, sg->len);
+
+    dma_set_callback(chan, dma_async_done, (void *)seq);
+    if (dma_start_sg(chan, sg, 1) < 0)
+    {
+        dma_release_channel(chan);
+        return DMA_TOKEN_NONE;
+    }
+    return (seq << 4) | chan;
+}
+
+/**
+ * Start copying `len` bytes from `src` to `dst` on the DMA engine and return
+ * at once. Neither buffer may be touched until the token has completed.
+ */
+dma_token_t dma_memcpy_async(void *dst, const void *src, size_t len)
+{
+    dma_sg_t sg = {
+        .src = (void *)src,
+        .dst = dst,
+        .len = len,
+        .rows = 1,
+        .dir = MEM_TO_MEM};
+
+    if (!dma_addressable(src, len) || !dma_addressable(dst, len))
+    {
+        return DMA_TOKEN_NONE;
+    }
+    return dma_async_start(&sg, 0);
+}
+
+/* Fill `len` bytes at `dst` with `value`, the source address does not increment */
+dma_token_t dma_memset_async(void *dst, uint8_t value, size_t len)
+{
+    dma_sg_t sg = {
+        .dst = dst,
+        .len = len,
+        .rows = 1,
+        .dir = MEM_TO_MEM,
+        .flags = DMA_SG_SRC_FIXED};
+
+    if (!dma_addressable(dst, len))
+    {
+        return DMA_TOKEN_NONE;
+    }
+    return dma_async_start(&sg, (uint32_t)value * 0x01010101);
+}
+
+/**
+ * Returns 1 while the transfer behind `token` runs, 0 once it is done and
+ * -1 if it failed. A stale token (its channel has moved on) reads as done.
+ */
+int dma_token_poll(dma_token_t token)
+{
+    uint32_t chan = TOKEN_CHAN(token);
+    dma_async_t *state;
+
+    if (token == DMA_TOKEN_NONE || chan >= DMA_NUM_CHANNELS)
+    {
+        return -1;
+    }
+
+    state = &async_state[chan];
+    if (state->seq != TOKEN_SEQ(token))
+    {
+        return 0;
+    }
+    if (!state->done)
+    {
+        // Also runs dma_async_done when the top half retired the transfer first
+        int status = dma_poll(chan);
+
+        if (status == 1)
+        {
+            return 1;
+        }
+        if (state->seq != TOKEN_SEQ(token))
+        {
+            return 0;
+        }
+        if (!state->done)
+        {
+            // The callback is already running further up this core's stack
+            return status;
+        }
+    }
+    return state->status;
+}
+
+int dma_token_wait(dma_token_t token)
+{
+    uint32_t chan = TOKEN_CHAN(token);
+    int status;
+
+    if (token == DMA_TOKEN_NONE || chan >= DMA_NUM_CHANNELS)
+    {
+        return -1;
+    }
+    if ((status = dma_token_poll(token)) != 1)
+    {
+        return status;
+    }
+    if (dma_wait(chan) < 0)
+    {
+        return -1;
+    }
+    return dma_token_poll(token);
+}
+
+/*----------------------------------------------------------------------
+ * memcpy / memset offload
+ *
+ * libk's memcpy and the kernel memset ask here first. Buffers of at least
+ * DMA_OFFLOAD_MIN_BYTES go to the engine if a channel is free; the call
+ * still blocks, but the core sleeps in WFI instead of moving bytes.
+ * Only from thread context with interrupts on, never from a top half or
+ * a softirq: a bottom half waiting on the engine would sit on top of the
+ * DMA bottom half it needs, so those copy on the CPU.
+ *
+ * The engine only gets whole cache lines of the destination. A partial
+ * line at either end is shared with whatever lies next to the buffer; if
+ * the CPU dirtied it during the transfer (an IRQ frame on the stack, say)
+ * its write-back would land on top of the engine's bytes. Those edges are
+ * done on the CPU while the engine runs.
+ *----------------------------------------------------------------------*/
+
+void dma_offload_enable(bool enable)
+{
+    if (enable)
+    {
+        // Mailbox and control block pool are set up here, not from inside memcpy
+        if (dma_init() < 0)
+        {
+            return;
+        }
+    }
+    offload_enabled = enable;
+}
+
+static bool offload_allowed(size_t len)
+{
+    return offload_enabled && len >= DMA_OFFLOAD_MIN_BYTES && INTERRUPTS_ENABLED() && !in_softirq();
+}
+
+// Bytes before the first whole cache line of `dst`
+static size_t offload_head(const void *dst)
+{
+    return (0 - (uint32_t)dst) & (DMA_COHERENT_GRANULE - 1);
+}
+
+int memcpy_offload(void *dst, const void *src, size_t len)
+{
+    uint8_t *d = dst;
+    const uint8_t *s = src;
+    size_t head, body;
+    dma_token_t token;
+
+    if (!offload_allowed(len))
+    {
+        return 0;
+    }
+    head = offload_head(dst);
+    body = (len - head) & ~(DMA_COHERENT_GRANULE - 1);
+    token = dma_memcpy_async(d + head, s + head, body);
+    if (token == DMA_TOKEN_NONE)
+    {
+        return 0;
+    }
+    for (size_t i = 0; i < head; i++)
+    {
+        d[i] = s[i];
+    }
+    for (size_t i = head + body; i < len; i++)
+    {
+        d[i] = s[i];
+    }
+    return dma_token_wait(token) == 0;
+}
+
+int memset_offload(void *dst, int value, size_t len)
+{
+    uint8_t *d = dst;
+    size_t head, body;
+    dma_token_t token;
+
+    if (!offload_allowed(len))
+    {
+        return 0;
+    }
+    head = offload_head(dst);
+    body = (len - head) & ~(DMA_COHERENT_GRANULE - 1);
+    token = dma_memset_async(d + head, value, body);
+    if (token == DMA_TOKEN_NONE)
+    {
+        return 0;
+    }
+    for (size_t i = 0; i < head; i++)
+    {
+        d[i] = value;
+    }
+    for (size_t i = head + body; i < len; i++)
+    {
+        d[i] = value;
+    }
+    return dma_token_wait(token) == 0;
+}
+
+/*----------------------------------------------------------------------
+ * CPU vs DMA throughput
+ *
+ * Times memcpy and memset with the offload off against the async DMA
+ * versions (start + wait) for growing sizes, and reports the first size
+ * where the engine wins. That size is what DMA_OFFLOAD_MIN_BYTES should be.
+ *----------------------------------------------------------------------*/
+
+#define BENCH_MIN_BYTES 256
+#define BENCH_MAX_BYTES (1024 * 1024)
+#define BENCH_REPEAT 8
+
+static uint32_t bench_rate(uint32_t bytes, uint64_t usecs)
+{
+    // bytes per microsecond is MB/s
+    return usecs ? (uint32_t)(((uint64_t)bytes * BENCH_REPEAT) / usecs) : 0;
+}
+
+void show_dma_benchmark(void)
+{
+    uint8_t *src = mem_allocate(BENCH_MAX_BYTES);
+    uint8_t *dst = mem_allocate(BENCH_MAX_BYTES);
+    bool was_enabled = offload_enabled;
+    uint32_t copy_crossover = 0;
+    uint32_t fill_crossover = 0;
+
+    if (src == 0 || dst == 0)
+    {
+        printf("\n DMA benchmark: out of memory");
+        return;
+    }
+
+    offload_enabled = false;
+    memset(src, 0x5a, BENCH_MAX_BYTES);
+
+    printf("\n size      cpu copy  dma copy  cpu fill  dma fill  (MB/s)");
+    for (uint32_t size = BENCH_MIN_BYTES; size <= BENCH_MAX_BYTES; size <<= 1)
+    {
+        uint64_t start, cpu_copy, dma_copy, cpu_fill, dma_fill;
+
+        start = timer_getTickCount64();
+        for (uint32_t i = 0; i < BENCH_REPEAT; i++)
+        {
+            memcpy(dst, src, size);
+        }
+        cpu_copy = timer_getTickCount64() - start;
+
+        start = timer_getTickCount64();
+        for (uint32_t i = 0; i < BENCH_REPEAT; i++)
+        {
+            dma_token_wait(dma_memcpy_async(dst, src, size));
+        }
+        dma_copy = timer_getTickCount64() - start;
+
+        start = timer_getTickCount64();
+        for (uint32_t i = 0; i < BENCH_REPEAT; i++)
+        {
+            memset(dst, i, size);
+        }
+        cpu_fill = timer_getTickCount64() - start;
+
+        start = timer_getTickCount64();
+        for (uint32_t i = 0; i < BENCH_REPEAT; i++)
+        {
+            dma_token_wait(dma_memset_async(dst, i, size));
+        }
+        dma_fill = timer_getTickCount64() - start;
+
+        printf("\n %d  %d  %d  %d  %d", size,
+               bench_rate(size, cpu_copy), bench_rate(size, dma_copy),
+               bench_rate(size, cpu_fill), bench_rate(size, dma_fill));
+
+        if (copy_crossover == 0 && dma_copy < cpu_copy)
+        {
+            copy_crossover = size;
+        }
+        if (fill_crossover == 0 && dma_fill < cpu_fill)
+        {
+            fill_crossover = size;
+        }
+    }
+
+    if (dst[BENCH_MAX_BYTES - 1] != (uint8_t)(BENCH_REPEAT - 1))
+    {
+        printf("\n DMA benchmark: fill check failed, got %x", dst[BENCH_MAX_BYTES - 1]);
+    }
+    printf("\n crossover: copy %d bytes, fill %d bytes (offload threshold %d)",
+           copy_crossover, fill_crossover, DMA_OFFLOAD_MIN_BYTES);
+
+    offload_enabled = was_enabled;
+    mem_deallocate(dst);
+    mem_deallocate(src);
+}
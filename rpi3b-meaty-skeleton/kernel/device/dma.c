@@ -1,8 +1,10 @@
 #include <device/dma.h>
 #include <plibc/stdio.h>
 #include <kernel/rpi-interrupts.h>
-#include <mem/kernel_alloc.h>
+#include <mem/dma_alloc.h>
 #include <kernel/systimer.h>
+#include <kernel/generic-timer.h>
+#include <kernel/rpi-mailbox-interface.h>
 
 extern int dma_src_page_1;
 extern int dma_dest_page_1;
@@ -10,8 +12,6 @@ extern int dma_dest_page_2;
 extern int dma_cb_page;
 
 #define CB_ALIGN 32
-#define CB_ALIGN_MASK (CB_ALIGN - 1)
-#define PERMAP_SHIFT 16
 
 extern void PUT32(uint32_t addr, uint32_t value);
 
@@ -147,8 +147,8 @@ typedef struct
 // BCM2836_VCBUS_8_ALIAS = $80000000;	8 Alias - L2 cached (only)
 // BCM2836_VCBUS_C_ALIAS = $C0000000; {C Alias - Direct uncached}	Suitable for RPi 2 Model B
 // pass integer
-#define PMEM_TO_DMA(x) (x | 0XC0000000)
-#define DMA_TO_PMEM(x) (x & ~(0XC0000000))
+#define PMEM_TO_DMA(x) (x | DMA_BUS_ALIAS)
+#define DMA_TO_PMEM(x) (x & ~(DMA_BUS_ALIAS))
 
 // BCM2836 peripherals BCM2836_PERIPHERALS_*
 // See: BCM2835-ARM-Peripherals.pdf
@@ -166,7 +166,7 @@ typedef struct
 // 0x3F200000 - 0x3F000000 + 0X7E000000 = 0X7E200000
 
 // We will only use 13 dma channels
-static uint32_t dma_ints[13] = {
+static uint32_t dma_ints[DMA_NUM_CHANNELS] = {
     INTERRUPT_DMA0,
     INTERRUPT_DMA1,
     INTERRUPT_DMA2,
@@ -186,24 +186,179 @@ typedef enum
     DMA_NEED_INIT = 0,
     DMA_READY = 1,
     DMA_IN_PROGRESS = 2,
-    DMA_END = 3
+    DMA_END = 3,
+    DMA_ERROR = 4
 } dma_channel_status;
 
 typedef struct
 {
     dma_channel_header *channel_header;
-    bcm2835_dma_cb *cb;
-    uint8_t *cb_alloc_ptr; // This is used to point original allocated ptr
+    uint16_t chain_head; // control blocks owned by the running transfer
+    uint16_t chain_tail;
+    uint32_t chain_count;
     dma_channel_status channel_status;
+    uint32_t debug;           // DEBUG register latched when the channel failed
+    uint32_t callback_pending; // completion seen by the top half, callback not run yet
+    dma_callback_f callback;
+    void *callback_data;
+    uint32_t owned; // handed out by dma_request_channel
+    uint32_t lite;
+    uint64_t started; // system timer at submit, for busy_us
+    uint32_t pending_bytes;
+    dma_channel_stats_t stats;
 } dma_ctrl;
 
-static volatile dma_ctrl dma[13] = {0};
+static volatile dma_ctrl dma[DMA_NUM_CHANNELS] = {0};
+
+// Channels the VideoCore leaves to the ARM, read once from the firmware
+static uint32_t dma_usable_mask;
+
+#define CB_NONE 0xffff
+
+/*
+ * Control block pool. cb_link threads the free list and, once a run of
+ * blocks is handed out, keeps it threaded in the same order, so a chain is
+ * returned to the free list in O(1) from the completion top half.
+ */
+static bcm2835_dma_cb *cb_pool;
+static uint16_t cb_link[DMA_CB_POOL_SIZE];
+static uint16_t cb_free_head = CB_NONE;
+static uint32_t cb_free;
+
+static int cb_pool_init(void)
+{
+    // Uncached, so the engine fetches exactly what was written
+    cb_pool = dma_alloc_coherent(DMA_CB_POOL_SIZE * sizeof(bcm2835_dma_cb), CB_ALIGN);
+
+    if (cb_pool == 0)
+    {
+        printf("DMA ERROR: cannot allocate %d control blocks\n", DMA_CB_POOL_SIZE);
+        return -1;
+    }
+    for (uint32_t i = 0; i < DMA_CB_POOL_SIZE; i++)
+    {
+        cb_link[i] = (i + 1 < DMA_CB_POOL_SIZE) ? i + 1 : CB_NONE;
+    }
+    cb_free_head = 0;
+    cb_free = DMA_CB_POOL_SIZE;
+    return 0;
+}
+
+/* Take `count` blocks off the free list, returns the first index or CB_NONE */
+static uint16_t cb_chain_alloc(uint32_t count, uint16_t *tail)
+{
+    uint16_t head, last;
+    int32_t irqs_on;
+
+    if (count == 0)
+    {
+        return CB_NONE;
+    }
+
+    irqs_on = INTERRUPTS_ENABLED();
+    DISABLE_INTERRUPTS();
+    if (count > cb_free)
+    {
+        if (irqs_on)
+        {
+            ENABLE_INTERRUPTS();
+        }
+        return CB_NONE;
+    }
+    head = cb_free_head;
+    last = head;
+    for (uint32_t i = 1; i < count; i++)
+    {
+        last = cb_link[last];
+    }
+    cb_free_head = cb_link[last];
+    cb_free -= count;
+    if (irqs_on)
+    {
+        ENABLE_INTERRUPTS();
+    }
+
+    *tail = last;
+    return head;
+}
+
+/* Splice a whole chain back, callers hold interrupts masked */
+static void cb_chain_free(uint16_t head, uint16_t tail, uint32_t count)
+{
+    if (head == CB_NONE)
+    {
+        return;
+    }
+    cb_link[tail] = cb_free_head;
+    cb_free_head = head;
+    cb_free += count;
+}
+
+static void dma_release_chain(volatile dma_ctrl *ctrl)
+{
+    cb_chain_free(ctrl->chain_head, ctrl->chain_tail, ctrl->chain_count);
+    ctrl->chain_head = CB_NONE;
+    ctrl->chain_tail = CB_NONE;
+    ctrl->chain_count = 0;
+}
+
+uint32_t dma_cb_free_count(void)
+{
+    return cb_free;
+}
+
+static void dma_report_error(uint32_t chan, uint32_t cs, uint32_t debug)
+{
+    printf("DMA ERROR: channel %d CS: %x DEBUG: %x%s%s%s\n", chan, cs, debug,
+           (debug & BCM2835_DMA_DEBUG_READ_ERR) ? " read error" : "",
+           (debug & BCM2835_DMA_DEBUG_FIFO_ERR) ? " fifo error" : "",
+           (debug & BCM2835_DMA_DEBUG_LAST_NOT_SET_ERR) ? " AXI last not set" : "");
+}
+
+/*
+ * Common completion path for the IRQ top half and dma_poll. Must run with
+ * interrupts masked so only one of them retires the transfer.
+ */
+static void dma_complete(uint32_t chan, uint32_t cs)
+{
+    volatile dma_ctrl *ctrl = &dma[chan];
+
+    if (ctrl->channel_status != DMA_IN_PROGRESS)
+    {
+        return;
+    }
+
+    if (cs & BCM2835_DMA_ERR)
+    {
+        ctrl->debug = ctrl->channel_header->DEBUG;
+        ctrl->channel_header->DEBUG = BCM2835_DMA_DEBUG_CLR_ERRORS;
+        ctrl->channel_header->CS = BCM2835_DMA_RESET;
+        ctrl->channel_status = DMA_ERROR;
+        ctrl->stats.errors++;
+    }
+    else
+    {
+        ctrl->channel_header->CS = BCM2835_DMA_END | BCM2835_DMA_INT;
+        ctrl->channel_status = DMA_END;
+    }
+    dma_release_chain(ctrl);
+    ctrl->stats.transfers++;
+    ctrl->stats.bytes += ctrl->pending_bytes;
+    ctrl->stats.busy_us += timer_getTickCount64() - ctrl->started;
+    ctrl->callback_pending = 1;
+}
 
 static void dma_irq_clearer(uint32_t chan)
 {
     volatile dma_ctrl *ctrl = (void *)&dma[chan];
-    ctrl->channel_header->CS = BCM2835_DMA_INT;
-    ctrl->channel_status = DMA_END;
+    uint32_t cs = ctrl->channel_header->CS;
+
+    // Writing 0 to ACTIVE would pause a chain that raised a mid-chain INT
+    ctrl->channel_header->CS = BCM2835_DMA_INT | (cs & BCM2835_DMA_ACTIVE);
+    if ((cs & BCM2835_DMA_ACTIVE) == 0 || (cs & BCM2835_DMA_ERR))
+    {
+        dma_complete(chan, cs);
+    }
 }
 
 static void dma_0_irq_clearer(void) { dma_irq_clearer(0); }
@@ -222,7 +377,7 @@ static void dma_12_irq_clearer(void) { dma_irq_clearer(12); }
 
 typedef void (*clearer_callback_t)();
 
-static clearer_callback_t dma_clearer[13] = {
+static clearer_callback_t dma_clearer[DMA_NUM_CHANNELS] = {
     dma_0_irq_clearer,
     dma_1_irq_clearer,
     dma_2_irq_clearer,
@@ -237,9 +392,46 @@ static clearer_callback_t dma_clearer[13] = {
     dma_11_irq_clearer,
     dma_12_irq_clearer};
 
+/*
+ * Run the completion callback once. Whoever sees the transfer retired first
+ * gets here: the bottom half after the IRQ, or dma_poll when it retired the
+ * transfer itself or runs before the bottom half does.
+ */
+static void dma_run_callback(uint32_t chan)
+{
+    volatile dma_ctrl *ctrl = &dma[chan];
+    int32_t irqs_on = INTERRUPTS_ENABLED();
+    uint32_t pending;
+
+    DISABLE_INTERRUPTS();
+    pending = ctrl->callback_pending;
+    ctrl->callback_pending = 0;
+    if (irqs_on)
+    {
+        ENABLE_INTERRUPTS();
+    }
+
+    if (!pending)
+    {
+        return;
+    }
+    if (ctrl->channel_status == DMA_ERROR)
+    {
+        dma_report_error(chan, ctrl->channel_header->CS, ctrl->debug);
+    }
+    if (ctrl->callback != 0)
+    {
+        ctrl->callback(chan, ctrl->channel_status == DMA_ERROR ? -1 : 0, ctrl->callback_data);
+    }
+}
+
+/* Bottom half, shared by all channels: report errors and run completion callbacks */
 static void dma_irq_handler(void)
 {
-    // printf("\nDMA irq handler called. This should be called after clearer. \n");
+    for (uint32_t chan = 0; chan < DMA_NUM_CHANNELS; chan++)
+    {
+        dma_run_callback(chan);
+    }
 }
 
 void print_area(char *src_addr, int length)
@@ -293,7 +485,12 @@ void show_dma_demo()
     uart_puts("Before copying destination 2 lookslike \n");
     print_area((char *)&dma_dest_page_2, data_length);
 
-    uint32_t dma_chan_num = 4;
+    // 64 KiB copies do not fit a lite channel
+    int dma_chan_num = dma_request_channel(DMA_CAP_LONG);
+    if (dma_chan_num < 0)
+    {
+        return;
+    }
     dma_start(dma_chan_num, 0, MEM_TO_MEM, &dma_src_page_1, &dma_dest_page_1, 65536);
     dma_wait(dma_chan_num);
 
@@ -301,17 +498,201 @@ void show_dma_demo()
     uart_puts("After DMA destination 1 lookslike \n");
     print_area((char *)&dma_dest_page_1, data_length);
 
-    dma_chan_num = 5;
+    int first_chan = dma_chan_num;
+    dma_chan_num = dma_request_channel(DMA_CAP_LONG);
+    dma_release_channel(first_chan);
+    if (dma_chan_num < 0)
+    {
+        return;
+    }
     dma_start(dma_chan_num, 0, MEM_TO_MEM, &dma_dest_page_1, &dma_dest_page_2, 65536);
     dma_wait(dma_chan_num);
 
     uart_puts("After DMA ops \n");
     uart_puts("After DMA destination 2 lookslike \n");
     print_area((char *)&dma_dest_page_2, data_length);
+
+    // Gather the two halves back into destination 1 swapped, one chain
+    char *page_2 = (char *)&dma_dest_page_2;
+    char *page_1 = (char *)&dma_dest_page_1;
+    dma_sg_t sg[3] = {
+        {.src = page_2 + 6, .dst = page_1, .len = 5, .rows = 1, .dir = MEM_TO_MEM},
+        {.src = page_2, .dst = page_1 + 5, .len = 6, .rows = 1, .dir = MEM_TO_MEM},
+        {.src = page_2 + 11, .dst = page_1 + 11, .len = 1, .rows = 1, .dir = MEM_TO_MEM}};
+    dma_start_sg(dma_chan_num, sg, 3);
+    dma_wait(dma_chan_num);
+
+    uart_puts("After scatter-gather DMA destination 1 lookslike \n");
+    print_area((char *)&dma_dest_page_1, data_length);
+    dma_release_channel(dma_chan_num);
+    dma_print_channel_stats();
     // uart_puts("After DMA destination lookslike \n");
     // print_area((char *)&dma_dest_page_2, data_length);
 }
 
+/*
+ * Channel allocator. The usable mask comes from the firmware; everything
+ * outside it belongs to the VideoCore and is never touched.
+ */
+static void dma_channels_init(void)
+{
+    rpi_mailbox_property_t *mp;
+
+    if (dma_usable_mask != 0)
+    {
+        return;
+    }
+
+    RPI_PropertyInit();
+    RPI_PropertyAddTag(TAG_GET_DMA_CHANNELS);
+    RPI_PropertyProcess();
+
+    mp = RPI_PropertyGet(TAG_GET_DMA_CHANNELS);
+    if (mp)
+    {
+        dma_usable_mask = (uint32_t)mp->data.buffer_32[0];
+    }
+    else
+    {
+        printf("DMA: no channel mask from firmware, using %x\n", DMA_DEFAULT_CHANNEL_MASK);
+        dma_usable_mask = DMA_DEFAULT_CHANNEL_MASK;
+    }
+    dma_usable_mask &= (1 << DMA_NUM_CHANNELS) - 1;
+
+    for (uint32_t chan = 0; chan < DMA_NUM_CHANNELS; chan++)
+    {
+        volatile dma_channel_header *header = (dma_channel_header *)(DMA_BASE + DMACH(chan));
+        dma[chan].lite = chan >= DMA_FIRST_LITE_CHANNEL || (header->DEBUG & BCM2835_DMA_DEBUG_LITE);
+    }
+}
+
+uint32_t dma_channel_mask(void)
+{
+    dma_channels_init();
+    return dma_usable_mask;
+}
+
+int dma_channel_is_lite(int chan)
+{
+    dma_channels_init();
+    return chan >= 0 && chan < DMA_NUM_CHANNELS && dma[chan].lite;
+}
+
+/**
+ * Hand out a free channel able to do `caps` (DMA_CAP_*), -1 if none.
+ * Requests without capabilities go to lite channels first so the full
+ * ones stay free for transfers that need them.
+ */
+int dma_request_channel(uint32_t caps)
+{
+    int chan = dma_try_request_channel(caps);
+
+    if (chan < 0)
+    {
+        printf("DMA ERROR: no free channel for caps %x\n", caps);
+    }
+    return chan;
+}
+
+/* Same as dma_request_channel, without complaining when none is free */
+int dma_try_request_channel(uint32_t caps)
+{
+    int32_t irqs_on;
+    int found = -1;
+
+    dma_channels_init();
+
+    irqs_on = INTERRUPTS_ENABLED();
+    DISABLE_INTERRUPTS();
+    for (uint32_t pass = 0; pass < 2 && found < 0; pass++)
+    {
+        // pass 0: lite channels for undemanding requests, pass 1: full channels
+        for (uint32_t chan = 0; chan < DMA_NUM_CHANNELS; chan++)
+        {
+            volatile dma_ctrl *ctrl = &dma[chan];
+
+            if (!(dma_usable_mask & (1 << chan)) || ctrl->owned)
+            {
+                continue;
+            }
+            if (ctrl->lite ? (pass != 0 || caps != 0) : pass == 0)
+            {
+                continue;
+            }
+            ctrl->owned = 1;
+            found = chan;
+            break;
+        }
+    }
+    if (irqs_on)
+    {
+        ENABLE_INTERRUPTS();
+    }
+    return found;
+}
+
+void dma_release_channel(int chan)
+{
+    if (chan < 0 || chan >= DMA_NUM_CHANNELS)
+    {
+        return;
+    }
+    if (dma[chan].channel_status == DMA_IN_PROGRESS)
+    {
+        printf("DMA ERROR: releasing busy channel %d\n", chan);
+        return;
+    }
+    dma[chan].callback = 0;
+    dma[chan].callback_data = 0;
+    dma[chan].owned = 0;
+}
+
+void dma_get_channel_stats(int chan, dma_channel_stats_t *stats)
+{
+    volatile dma_ctrl *ctrl = &dma[chan];
+
+    stats->transfers = ctrl->stats.transfers;
+    stats->errors = ctrl->stats.errors;
+    stats->bytes = ctrl->stats.bytes;
+    stats->busy_us = ctrl->stats.busy_us;
+}
+
+void dma_print_channel_stats(void)
+{
+    uint64_t now = timer_getTickCount64();
+
+    dma_channels_init();
+    printf("\n chan  type  owner  transfers  errors  KiB  busy(us)  util");
+    for (uint32_t chan = 0; chan < DMA_NUM_CHANNELS; chan++)
+    {
+        volatile dma_ctrl *ctrl = &dma[chan];
+
+        if (!(dma_usable_mask & (1 << chan)))
+        {
+            printf("\n %d  videocore", chan);
+            continue;
+        }
+        printf("\n %d  %s  %s  %d  %d  %d  %d  %d%%", chan,
+               ctrl->lite ? "lite" : "full",
+               ctrl->owned ? "yes" : "no",
+               ctrl->stats.transfers, ctrl->stats.errors,
+               (uint32_t)(ctrl->stats.bytes >> 10),
+               (uint32_t)ctrl->stats.busy_us,
+               now ? (uint32_t)((ctrl->stats.busy_us * 100) / now) : 0);
+    }
+}
+
+/* Channel mask and control block pool, otherwise set up on first use */
+int dma_init(void)
+{
+    dma_channels_init();
+    if (cb_pool == 0)
+    {
+        return cb_pool_init();
+    }
+    return 0;
+}
+
 static void init_channel(volatile dma_ctrl *ctrl, uint32_t chan)
 {
     ctrl->channel_status = DMA_READY;
@@ -330,98 +711,346 @@ static void init_channel(volatile dma_ctrl *ctrl, uint32_t chan)
 
     register_irq_handler(dma_ints[chan], dma_irq_handler, dma_clearer[chan]);
 
-    // Control Block's needs 32 Byte alignment (256 Bits as mentioned in Manual)
-    // So we allocate 64 Bytes because even if I allocate memory at 32 Bytes alignment
-    // memory allocator header info like size, and magic comes first which will break the alignment.
-    void *p = mem_allocate(2 * CB_ALIGN);
-    ctrl->cb = (bcm2835_dma_cb *)(((uint32_t)p + CB_ALIGN) & ~CB_ALIGN_MASK);
-    ctrl->cb_alloc_ptr = (uint8_t *)p; // If we ever want to return memory, call mem_deallocate using this.
+    ctrl->chain_head = CB_NONE;
+    ctrl->chain_tail = CB_NONE;
+    ctrl->chain_count = 0;
     ctrl->channel_header = (void *)channel_header;
 }
 
-int dma_start(int chan, int dev, DMA_DIR dir, void *src, void *dst, int len)
+/* Fill one control block from a segment, `next` is linked by the caller */
+static int dma_fill_cb(volatile bcm2835_dma_cb *cb, const dma_sg_t *sg)
 {
-    volatile dma_ctrl *ctrl = &dma[chan];
-
-    if (ctrl->channel_status == DMA_READY || ctrl->channel_status == DMA_IN_PROGRESS)
-    {
-        printf("Channel is busy. %d \n", dev);
-        return -1;
-    }
-
-    if (ctrl->channel_status == DMA_NEED_INIT)
-    {
-        init_channel(ctrl, chan);
-    }
-
+    uint32_t transfer_info = 0;
     uint32_t src_addr = 0;
     uint32_t dest_addr = 0;
-    uint32_t transfer_info = 0;
-    switch (dir)
+
+    switch (sg->dir)
     {
     case DEV_TO_MEM:
         transfer_info = BCM2835_DMA_S_DREQ | BCM2835_DMA_D_INC;
-        src_addr = (uint32_t)PIO_TO_DMA((uint32_t)src);
-        dest_addr = (uint32_t)PMEM_TO_DMA((uint32_t)dst);
+        src_addr = (uint32_t)PIO_TO_DMA((uint32_t)sg->src);
+        dest_addr = (uint32_t)PMEM_TO_DMA((uint32_t)sg->dst);
         break;
     case MEM_TO_DEV:
         transfer_info = BCM2835_DMA_D_DREQ | BCM2835_DMA_S_INC;
-        src_addr = (uint32_t)PMEM_TO_DMA((uint32_t)src);
-        dest_addr = (uint32_t)PIO_TO_DMA((uint32_t)dst);
+        src_addr = (uint32_t)PMEM_TO_DMA((uint32_t)sg->src);
+        dest_addr = (uint32_t)PIO_TO_DMA((uint32_t)sg->dst);
         break;
     case MEM_TO_MEM:
         transfer_info = BCM2835_DMA_S_INC | BCM2835_DMA_D_INC;
-        src_addr = (uint32_t)PMEM_TO_DMA((uint32_t)src);
-        dest_addr = (uint32_t)PMEM_TO_DMA((uint32_t)dst);
+        src_addr = (uint32_t)PMEM_TO_DMA((uint32_t)sg->src);
+        dest_addr = (uint32_t)PMEM_TO_DMA((uint32_t)sg->dst);
         break;
     default:
-        break;
+        return -1;
+    }
+
+    if (sg->flags & DMA_SG_SRC_FIXED)
+    {
+        transfer_info &= ~BCM2835_DMA_S_INC;
     }
 
-    volatile bcm2835_dma_cb *cb = ctrl->cb;
-    cb->info = transfer_info | dev << PERMAP_SHIFT | BCM2835_DMA_INT_EN;
+    cb->info = transfer_info | BCM2835_DMA_PER_MAP(sg->dreq);
     cb->src = src_addr;
     cb->dst = dest_addr;
-    cb->length = len;
-    cb->stride = 0x0;
-    cb->next = 0x0; // last Control block
+    if (sg->rows > 1)
+    {
+        if (sg->len == 0 || sg->len > DMA_2D_MAX_XLEN || sg->rows > DMA_2D_MAX_ROWS)
+        {
+            return -1;
+        }
+        // YLENGTH + 1 rows of XLENGTH bytes, strides are signed 16 bit
+        cb->info |= BCM2835_DMA_TDMODE;
+        cb->length = ((uint32_t)(sg->rows - 1) << 16) | sg->len;
+        cb->stride = ((uint32_t)(uint16_t)sg->dst_stride << 16) | (uint16_t)sg->src_stride;
+    }
+    else
+    {
+        if (sg->len == 0 || sg->len > DMA_MAX_LEN)
+        {
+            return -1;
+        }
+        cb->length = sg->len;
+        cb->stride = 0x0;
+    }
+    cb->pad[0] = 0;
+    cb->pad[1] = 0;
+    return 0;
+}
 
-    ctrl->channel_header->CS = 0;
-    MicroDelay(1);
+static int dma_submit(int chan, const dma_sg_t *sg, uint32_t count, bool cyclic)
+{
+    volatile dma_ctrl *ctrl = &dma[chan];
+    uint16_t head, tail, index;
+    uint32_t bytes = 0;
 
-    // clear debug error flags
-    ctrl->channel_header->DEBUG = BCM2835_DMA_DEBUG_READ_ERR | BCM2835_DMA_DEBUG_FIFO_ERR | BCM2835_DMA_DEBUG_LAST_NOT_SET_ERR;
+    dma_channels_init();
+    if (chan < 0 || chan >= DMA_NUM_CHANNELS || !(dma_usable_mask & (1 << chan)))
+    {
+        printf("DMA ERROR: channel %d is not usable from the ARM (mask %x)\n", chan, dma_usable_mask);
+        return -1;
+    }
 
-    //we have to point it to the PHYSICAL address of the control block (cb)
-    ctrl->channel_header->CONBLK_AD = (uint32_t)PMEM_TO_DMA((uint32_t)cb);
+    if (ctrl->channel_status == DMA_IN_PROGRESS)
+    {
+        printf("Channel is busy. %d \n", chan);
+        return -1;
+    }
 
-    uint32_t *dmaBaseMem = (void *)DMA_BASE;
-    dmaBaseMem[0xfe0 >> 2] = 0; // Interrupt status
-    ctrl->channel_header->CS = BCM2835_DMA_INT;
-    MicroDelay(2);
-    ctrl->channel_header->CS = BCM2835_DMA_ACTIVE;
-    //set active bit, but everything else is 0.
+    if (ctrl->channel_status == DMA_NEED_INIT)
+    {
+        init_channel(ctrl, chan);
+    }
 
-    MicroDelay(2);
+    if (cb_pool == 0 && cb_pool_init() < 0)
+    {
+        return -1;
+    }
+
+    head = cb_chain_alloc(count, &tail);
+    if (head == CB_NONE)
+    {
+        printf("DMA ERROR: no room for %d control blocks (%d free)\n", count, cb_free);
+        return -1;
+    }
+
+    index = head;
+    for (uint32_t i = 0; i < count; i++)
+    {
+        volatile bcm2835_dma_cb *cb = &cb_pool[index];
+        int lite_overrun = ctrl->lite && (sg[i].rows > 1 || sg[i].len > DMA_LITE_MAX_LEN);
+
+        if (lite_overrun || dma_fill_cb(cb, &sg[i]) < 0)
+        {
+            int32_t irqs_on = INTERRUPTS_ENABLED();
+
+            printf("DMA ERROR: bad segment %d on %s channel %d\n", i, ctrl->lite ? "lite" : "full", chan);
+            DISABLE_INTERRUPTS();
+            cb_chain_free(head, tail, count);
+            if (irqs_on)
+            {
+                ENABLE_INTERRUPTS();
+            }
+            return -1;
+        }
+        bytes += sg[i].len * (sg[i].rows > 1 ? sg[i].rows : 1);
+        if (index == tail && cyclic)
+        {
+            cb->next = dma_bus_address(&cb_pool[head]); // back to the start, never ends
+        }
+        else if (index == tail)
+        {
+            cb->info |= BCM2835_DMA_INT_EN;
+            cb->next = 0x0; // last Control block
+        }
+        else
+        {
+            index = cb_link[index];
+            cb->next = dma_bus_address(&cb_pool[index]);
+        }
+    }
+
+    // clear debug error flags and stale END/INT from the previous transfer
+    ctrl->channel_header->DEBUG = BCM2835_DMA_DEBUG_CLR_ERRORS;
+    ctrl->channel_header->CS = BCM2835_DMA_END | BCM2835_DMA_INT;
+
+    //we have to point it to the PHYSICAL address of the control block (cb)
+    ctrl->channel_header->CONBLK_AD = dma_bus_address(&cb_pool[head]);
+
+    ctrl->chain_head = head;
+    ctrl->chain_tail = tail;
+    ctrl->chain_count = count;
+    ctrl->pending_bytes = bytes;
+    ctrl->started = timer_getTickCount64();
+    ctrl->debug = 0;
+    ctrl->callback_pending = 0;
+    ctrl->channel_status = DMA_IN_PROGRESS;
+    // The CB writes above must land before the engine fetches them
+    __asm__ __volatile__("dsb" ::
+                             : "memory");
+    ctrl->channel_header->CS = BCM2835_DMA_ACTIVE;
     return 0;
 }
 
-int dma_wait(int chan)
+/**
+ * Build a chain of `count` control blocks from `sg` and run it as one
+ * transfer: one CONBLK_AD write, one completion interrupt from the last
+ * block. Completion, polling and callbacks work as for dma_start.
+ */
+int dma_start_sg(int chan, const dma_sg_t *sg, uint32_t count)
+{
+    return dma_submit(chan, sg, count, false);
+}
+
+/**
+ * Like dma_start_sg, but the last block links back to the first, so the
+ * channel runs until dma_stop(). Meant for DREQ paced rings; no interrupts,
+ * follow progress with dma_current_dst / dma_current_src.
+ */
+int dma_start_cyclic(int chan, const dma_sg_t *sg, uint32_t count)
+{
+    return dma_submit(chan, sg, count, true);
+}
+
+/* Abort whatever runs on `chan` and give its control blocks back */
+void dma_stop(int chan)
 {
     volatile dma_ctrl *ctrl = &dma[chan];
-    MicroDelay(3000);
-    ctrl->channel_status = DMA_END;
-    volatile dma_channel_header *channel_header = ctrl->channel_header;
-    uint32_t status = channel_header->CS;
+    int32_t irqs_on;
 
-    if ((status & (BCM2835_DMA_ACTIVE | BCM2835_DMA_END | BCM2835_DMA_INT)) != BCM2835_DMA_END)
+    if (ctrl->channel_status != DMA_IN_PROGRESS)
     {
-        printf("DMA ERROR: Channel status: %x \n", channel_header->CS);
-        channel_header->CS = BCM2835_DMA_RESET;
-        ctrl->channel_header->DEBUG = BCM2835_DMA_DEBUG_CLR_ERRORS;
+        return;
+    }
+    irqs_on = INTERRUPTS_ENABLED();
+    DISABLE_INTERRUPTS();
+    ctrl->channel_header->CS = BCM2835_DMA_RESET;
+    while (ctrl->channel_header->CS & BCM2835_DMA_RESET)
+        ;
+    dma_release_chain(ctrl);
+    ctrl->channel_status = DMA_READY;
+    ctrl->callback_pending = 0;
+    if (irqs_on)
+    {
+        ENABLE_INTERRUPTS();
+    }
+}
 
-        return -1;
+/* ARM address the channel will write next, for memory destinations */
+void *dma_current_dst(int chan)
+{
+    return (void *)DMA_TO_PMEM(dma[chan].channel_header->DEST_AD);
+}
+
+/* ARM address the channel will read next, for memory sources */
+void *dma_current_src(int chan)
+{
+    return (void *)DMA_TO_PMEM(dma[chan].channel_header->SOURCE_AD);
+}
+
+int dma_start(int chan, int dev, DMA_DIR dir, void *src, void *dst, int len)
+{
+    dma_sg_t sg = {
+        .src = src,
+        .dst = dst,
+        .len = len,
+        .rows = 1,
+        .src_stride = 0,
+        .dst_stride = 0,
+        .dir = dir,
+        .dreq = dev};
+
+    return dma_start_sg(chan, &sg, 1);
+}
+
+/**
+ * Non-blocking completion check.
+ * Returns 1 while the transfer is running, 0 once it completed and -1 on error.
+ * A completion callback that is still pending runs here, whether this call
+ * retired the transfer or the IRQ top half did and its bottom half has not
+ * run yet, so callers spinning on state the callback updates always advance.
+ */
+int dma_poll(int chan)
+{
+    volatile dma_ctrl *ctrl = &dma[chan];
+    int32_t irqs_on;
+    int status;
+
+    if (ctrl->channel_status == DMA_IN_PROGRESS)
+    {
+        uint32_t cs = ctrl->channel_header->CS;
+        if ((cs & BCM2835_DMA_ACTIVE) && !(cs & BCM2835_DMA_ERR))
+        {
+            return 1;
+        }
+        irqs_on = INTERRUPTS_ENABLED();
+        DISABLE_INTERRUPTS();
+        dma_complete(chan, cs);
+        if (irqs_on)
+        {
+            ENABLE_INTERRUPTS();
+        }
     }
-    channel_header->CS = BCM2835_DMA_END | BCM2835_DMA_INT;
-    return 0;
+    // The callback may start the next transfer, report on this one
+    status = ctrl->channel_status == DMA_ERROR ? -1 : 0;
+    dma_run_callback(chan);
+    return status;
+}
+
+/* DEBUG register bits latched by the last failed transfer on the channel */
+uint32_t dma_get_error(int chan)
+{
+    return dma[chan].debug;
+}
+
+/**
+ * Completion callback, called from the DMA softirq with status 0 or -1,
+ * or from dma_poll / dma_wait when they get to it before the bottom half.
+ */
+void dma_set_callback(int chan, dma_callback_f callback, void *data)
+{
+    dma[chan].callback = callback;
+    dma[chan].callback_data = data;
+}
+
+/**
+ * Block until the transfer on `chan` ends. Short transfers are caught by
+ * spinning on CS; after DMA_WAIT_SPIN_US the core sleeps in WFI and is woken
+ * by the channel's completion IRQ, or by a one-shot at the timeout should
+ * that IRQ be lost. A transfer that times out is reset and its callback
+ * runs with status -1, like any other failed transfer.
+ */
+int dma_wait_timeout(int chan, uint32_t timeout_us)
+{
+    volatile dma_ctrl *ctrl = &dma[chan];
+    uint64_t start = timer_getTickCount64();
+    uint64_t elapsed = 0;
+    int32_t irqs_on;
+    int status;
+
+    while ((status = dma_poll(chan)) == 1)
+    {
+        elapsed = timer_getTickCount64() - start;
+        if (elapsed >= timeout_us)
+        {
+            printf("DMA ERROR: channel %d timed out after %d us, CS: %x\n", chan, timeout_us, ctrl->channel_header->CS);
+            irqs_on = INTERRUPTS_ENABLED();
+            DISABLE_INTERRUPTS();
+            if (ctrl->channel_status == DMA_IN_PROGRESS)
+            {
+                // Retired as failed, the owner's callback still gets to clean up
+                ctrl->debug = ctrl->channel_header->DEBUG;
+                ctrl->channel_header->CS = BCM2835_DMA_RESET;
+                ctrl->channel_status = DMA_ERROR;
+                ctrl->stats.errors++;
+                dma_release_chain(ctrl);
+                ctrl->callback_pending = 1;
+            }
+            // The IRQ may have retired it after all while the message went out
+            status = ctrl->channel_status == DMA_ERROR ? -1 : 0;
+            if (irqs_on)
+            {
+                ENABLE_INTERRUPTS();
+            }
+            dma_run_callback(chan);
+            return status;
+        }
+        if (elapsed >= DMA_WAIT_SPIN_US && INTERRUPTS_ENABLED())
+        {
+            // Masked across the check so the completion IRQ can not be missed
+            DISABLE_INTERRUPTS();
+            if (ctrl->channel_status == DMA_IN_PROGRESS && (ctrl->channel_header->CS & BCM2835_DMA_ACTIVE))
+            {
+                generic_timer_wfi_timeout(timeout_us - elapsed);
+            }
+            ENABLE_INTERRUPTS();
+        }
+    }
+    // Errors are decoded and printed by the bottom half
+    return status;
+}
+
+int dma_wait(int chan)
+{
+    return dma_wait_timeout(chan, DMA_WAIT_TIMEOUT_US);
 }
\ No newline at end of file
@@ -7,6 +7,7 @@
 #include <kernel/rpi-mailbox-interface.h>
 #include <kernel/systimer.h>
 #include <kernel/types.h>
+#include <mem/dma_alloc.h>
 
 bool PhyInitialised = false;
 volatile struct CoreGlobalRegs *CorePhysical, *Core = NULL;
@@ -92,7 +93,8 @@ int hcd_start()
         return ErrorDevice;
     }
 
-    if ((databuffer = MemoryAllocate(1024)) == NULL)
+    // The core DMAs to and from this, keep it out of the data cache
+    if ((databuffer = dma_alloc_coherent(1024, DMA_COHERENT_GRANULE)) == NULL)
         return ErrorMemory;
 
     ReadBackReg(&Core->Usb);
@@ -300,7 +302,7 @@ int hcd_start()
     return OK;
 
 deallocate:
-    MemoryDeallocate(databuffer);
+    dma_free_coherent(databuffer);
     return 0;
 }
 
@@ -1357,7 +1359,7 @@ void HcdTransmitChannel(uint8_t channel, void *buffer)
     if (((uint32_t)buffer & 3) != 0)
         printf("HCD: Transfer buffer %x is not DWORD aligned. Ignored, but dangerous.\n", buffer);
 
-    Host->Channel[channel].DmaAddress = (void *)((uint32_t)buffer | (uint32_t)0xC0000000);
+    Host->Channel[channel].DmaAddress = (void *)dma_bus_address(buffer);
     WriteThroughReg(&Host->Channel[channel].DmaAddress);
 
     ReadBackReg(&Host->Channel[channel].Characteristic);
@@ -1,4 +1,7 @@
 #include <device/uart0.h>
+#include <device/dma.h>
+#include <mem/dma_alloc.h>
+#include <kernel/rpi-interrupts.h>
 #include <stdint.h>
 #include <stddef.h>
 
@@ -28,6 +31,88 @@ static inline void delay(int32_t count)
 					 : "cc");
 }
 
+/*
+ * DMA state. TX drains a ring of queued characters, each completion starts
+ * the next contiguous run. RX is a cyclic transfer into a ring that never
+ * stops; the write position is read back from the channel.
+ */
+static int tx_chan = -1;
+static int rx_chan = -1;
+static volatile uint32_t *tx_ring;
+static volatile uint32_t *rx_ring;
+static volatile uint32_t tx_head;	  // free running, written by producers
+static volatile uint32_t tx_tail;	  // free running, advanced on completion
+static volatile uint32_t tx_inflight; // characters in the running transfer
+static uint32_t rx_read;
+static uint32_t rx_errors;
+static bool tx_draining; // uart_dma_flush running on the masked path
+
+static void uart_tx_done(int chan, int status, void *data);
+
+// Start the next run of queued characters, called with interrupts masked
+static void uart_tx_kick(void)
+{
+	uint32_t start, count;
+
+	if (tx_inflight != 0 || tx_head == tx_tail)
+	{
+		return;
+	}
+	start = tx_tail % UART_TX_RING_SIZE;
+	count = tx_head - tx_tail;
+	if (count > UART_TX_RING_SIZE - start)
+	{
+		count = UART_TX_RING_SIZE - start; // up to the end of the ring, the rest next time
+	}
+	tx_inflight = count;
+	dma_set_callback(tx_chan, uart_tx_done, 0);
+	if (dma_start(tx_chan, DMA_DREQ_UART_TX, MEM_TO_DEV, (void *)&tx_ring[start], (void *)UART0_DR, count * 4) < 0)
+	{
+		tx_inflight = 0;
+	}
+}
+
+static void uart_tx_done(int chan, int status, void *data)
+{
+	int32_t irqs_on = INTERRUPTS_ENABLED();
+
+	(void)chan;
+	(void)status;
+	(void)data;
+	DISABLE_INTERRUPTS();
+	tx_tail += tx_inflight;
+	tx_inflight = 0;
+	uart_tx_kick();
+	if (irqs_on)
+	{
+		ENABLE_INTERRUPTS();
+	}
+}
+
+/**
+ * Queue one character, retiring finished runs by polling while the ring is
+ * full. dma_poll runs uart_tx_done itself if the top half already retired
+ * the run, so this also makes progress from softirq context.
+ */
+static void uart_dma_putc(unsigned char c)
+{
+	int32_t irqs_on;
+
+	while (tx_head - tx_tail >= UART_TX_RING_SIZE)
+	{
+		dma_poll(tx_chan);
+	}
+	irqs_on = INTERRUPTS_ENABLED();
+	DISABLE_INTERRUPTS();
+	tx_ring[tx_head % UART_TX_RING_SIZE] = c;
+	tx_head++;
+	uart_tx_kick();
+	if (irqs_on)
+	{
+		ENABLE_INTERRUPTS();
+	}
+}
+
 /**
  * Public Methods
  */
@@ -73,8 +158,28 @@ void uart_init()
 	mmio_write(UART0_CR, (1 << 0) | (1 << 8) | (1 << 9));
 }
 
+/**
+ * With interrupts masked (exception handlers, critical sections) nothing
+ * would drain the ring behind us, so the queued characters are flushed by
+ * polling and this one goes out directly. A DMA error reported from inside
+ * that flush also comes through here and goes straight to the FIFO.
+ */
 void uart_putc(unsigned char c)
 {
+	if (tx_chan >= 0)
+	{
+		if (INTERRUPTS_ENABLED())
+		{
+			uart_dma_putc(c);
+			return;
+		}
+		if (!tx_draining)
+		{
+			tx_draining = true;
+			uart_dma_flush();
+			tx_draining = false;
+		}
+	}
 	// Wait for UART to become ready to transmit.
 	while (mmio_read(UART0_FR) & (1 << 5))
 	{
@@ -84,6 +189,14 @@ void uart_putc(unsigned char c)
 
 unsigned char uart_getc()
 {
+	if (rx_chan >= 0)
+	{
+		uint8_t c;
+		while (uart_dma_read(&c, 1) == 0)
+		{
+		}
+		return c;
+	}
 	// Wait for UART to have received something.
 	while (mmio_read(UART0_FR) & (1 << 4))
 	{
@@ -118,3 +231,129 @@ void hexstrings(uint32_t d)
 	}
 	uart_putc(0x20);
 }
+
+/**
+ * Switch UART0 to DMA: uart_putc / printf queue into the TX ring and
+ * uart_getc reads the RX ring. Falls back to programmed I/O (returns -1)
+ * if no channels or memory are left.
+ */
+int uart_dma_init(void)
+{
+	dma_sg_t rx_sg[2];
+
+	if (tx_chan >= 0)
+	{
+		return 0;
+	}
+
+	tx_ring = dma_alloc_coherent(UART_TX_RING_SIZE * 4, DMA_COHERENT_GRANULE);
+	rx_ring = dma_alloc_coherent(UART_RX_RING_SIZE * 4, DMA_COHERENT_GRANULE);
+	rx_chan = dma_request_channel(0);
+	if (tx_ring == 0 || rx_ring == 0 || rx_chan < 0)
+	{
+		goto fail;
+	}
+
+	// Two halves in a loop, paced by the RX DREQ
+	for (uint32_t i = 0; i < 2; i++)
+	{
+		rx_sg[i].src = (void *)UART0_DR;
+		rx_sg[i].dst = (void *)&rx_ring[i * UART_RX_RING_SIZE / 2];
+		rx_sg[i].len = UART_RX_RING_SIZE / 2 * 4;
+		rx_sg[i].rows = 1;
+		rx_sg[i].src_stride = 0;
+		rx_sg[i].dst_stride = 0;
+		rx_sg[i].dir = DEV_TO_MEM;
+		rx_sg[i].dreq = DMA_DREQ_UART_RX;
+		rx_sg[i].flags = 0;
+	}
+	rx_read = 0;
+	if (dma_start_cyclic(rx_chan, rx_sg, 2) < 0)
+	{
+		goto fail;
+	}
+
+	tx_head = 0;
+	tx_tail = 0;
+	tx_inflight = 0;
+	tx_chan = dma_request_channel(0);
+	if (tx_chan < 0)
+	{
+		dma_stop(rx_chan);
+		goto fail;
+	}
+
+	mmio_write(UART0_DMACR, UART_DMACR_RXDMAE | UART_DMACR_TXDMAE);
+	return 0;
+
+fail:
+	if (rx_chan >= 0)
+	{
+		dma_release_channel(rx_chan);
+	}
+	rx_chan = -1;
+	dma_free_coherent((void *)tx_ring);
+	dma_free_coherent((void *)rx_ring);
+	tx_ring = 0;
+	rx_ring = 0;
+	return -1;
+}
+
+bool uart_dma_enabled(void)
+{
+	return tx_chan >= 0;
+}
+
+/* Queue `len` bytes for transmission, returns once they are all in the ring */
+uint32_t uart_dma_write(const char *buf, uint32_t len)
+{
+	for (uint32_t i = 0; i < len; i++)
+	{
+		uart_putc(buf[i]);
+	}
+	return len;
+}
+
+/* Block until everything queued has left the FIFO-side of the DMA */
+void uart_dma_flush(void)
+{
+	if (tx_chan < 0)
+	{
+		return;
+	}
+	while (tx_head != tx_tail)
+	{
+		dma_poll(tx_chan);
+	}
+}
+
+/**
+ * Copy up to `len` received bytes out of the RX ring without blocking.
+ * The ring is overwritten if the reader falls UART_RX_RING_SIZE behind.
+ */
+uint32_t uart_dma_read(uint8_t *buf, uint32_t len)
+{
+	uint32_t write_pos, n = 0;
+
+	if (rx_chan < 0)
+	{
+		return 0;
+	}
+	write_pos = (((uint32_t)dma_current_dst(rx_chan) - (uint32_t)rx_ring) / 4) % UART_RX_RING_SIZE;
+	while (rx_read != write_pos && n < len)
+	{
+		uint32_t word = rx_ring[rx_read];
+		if (word & UART_DR_ERRORS)
+		{
+			rx_errors++;
+		}
+		buf[n++] = word;
+		rx_read = (rx_read + 1) % UART_RX_RING_SIZE;
+	}
+	return n;
+}
+
+uint32_t uart_rx_errors(void)
+{
+	return rx_errors;
+}
@@ -57,6 +57,7 @@ typedef enum
 
 static fat_type selected_fat_type = FAT_NULL;
 static struct sd_partition current_sd_partition = {0};
+static uint32_t found_file_size; // size field of the entry the last lookup matched
 
 struct __attribute__((packed, aligned(1))) dir_Structure
 {
@@ -198,9 +199,110 @@ uint32_t get_file_size(uint8_t *absolute_file_name)
         return 0;
     }
 
+    found_file_size = 0;
     return find_file_in_directory(current_sd_partition.rootCluster, absolute_file_name, 1);
 }
 
+// Next cluster in the chain, 0 at the end of the chain or on a read error
+static uint32_t next_cluster(uint32_t cluster_number, uint8_t *fat_sector_buffer, uint32_t *cached_sector)
+{
+    uint32_t fat_sector_num, fat_entry_offset, next;
+
+    getFatEntrySectorAndOffset(cluster_number, &fat_sector_num, &fat_entry_offset);
+    if (*cached_sector != fat_sector_num)
+    {
+        if (!sdcard_read(fat_sector_num, 1, fat_sector_buffer))
+        {
+            printf("FAT: Could not read FAT sector :%d. \n", fat_sector_num);
+            return 0;
+        }
+        *cached_sector = fat_sector_num;
+    }
+
+    if (selected_fat_type == FAT16)
+    {
+        next = *(uint16_t *)&fat_sector_buffer[fat_entry_offset];
+        return (next < 2 || next >= 0xFFF7) ? 0 : next;
+    }
+    next = (*(uint32_t *)&fat_sector_buffer[fat_entry_offset]) & 0x0fffffff;
+    return (next < 2 || next >= 0x0FFFFFF7) ? 0 : next;
+}
+
+/**
+ * Load a whole file into `dest`. Clusters that follow each other on the
+ * card are fetched with one multi-block read, so a defragmented file costs
+ * a handful of commands instead of one per sector. `dest` must be word
+ * aligned and have room for the size rounded up to a sector. Returns the
+ * file size, 0 if it is missing or does not fit in `max_size`.
+ */
+uint32_t fat_read_file(uint8_t *absolute_file_name, uint8_t *dest, uint32_t max_size)
+{
+    uint8_t fat_sector_buffer[512] __attribute__((aligned(4)));
+    uint32_t cached_sector = 0xffffffff;
+    uint32_t cluster_number = get_file_size(absolute_file_name);
+    uint32_t file_size = found_file_size;
+    uint32_t sector_size = current_sd_partition.bytesPerSector;
+    uint32_t sectors_left, run_start, run_length, next;
+
+    if (cluster_number == 0 || file_size == 0)
+    {
+        return 0;
+    }
+    sectors_left = (file_size + sector_size - 1) / sector_size;
+    if (sectors_left * sector_size > max_size)
+    {
+        printf("FAT: %s is %d bytes, only room for %d. \n", absolute_file_name, file_size, max_size);
+        return 0;
+    }
+
+    while (sectors_left > 0 && cluster_number != 0)
+    {
+        // Extend the run while the chain stays contiguous, BLKCNT is 16 bits
+        run_start = cluster_number;
+        run_length = 1;
+        next = cluster_number;
+        while (run_length * current_sd_partition.sectorPerCluster < sectors_left &&
+               (run_length + 1) * current_sd_partition.sectorPerCluster <= 0xffff)
+        {
+            next = next_cluster(next, fat_sector_buffer, &cached_sector);
+            if (next != run_start + run_length)
+            {
+                break;
+            }
+            run_length++;
+        }
+        if (run_length * current_sd_partition.sectorPerCluster >= sectors_left)
+        {
+            next = 0; // file ends in this run
+        }
+        else if (next == run_start + run_length - 1)
+        {
+            next = next_cluster(next, fat_sector_buffer, &cached_sector); // run cut at the BLKCNT limit
+        }
+
+        uint32_t count = run_length * current_sd_partition.sectorPerCluster;
+        if (count > sectors_left)
+        {
+            count = sectors_left;
+        }
+        if (!sdcard_read(getFirstSectorOfCluster(run_start), count, dest))
+        {
+            printf("FAT: Could not read %d sectors at cluster %d. \n", count, run_start);
+            return 0;
+        }
+        dest += count * sector_size;
+        sectors_left -= count;
+        cluster_number = next;
+    }
+
+    if (sectors_left != 0)
+    {
+        printf("FAT: cluster chain of %s ends early. \n", absolute_file_name);
+        return 0;
+    }
+    return file_size;
+}
+
 uint8_t get_next_dir_name(uint8_t *absolute_file_name, uint8_t *dest)
 {
     uint8_t count = 0;
@@ -360,6 +462,7 @@ uint32_t search_entries_in_sector(uint32_t sector_number, uint8_t *buffer, uint8
                         {
                             return search_directory_contents(first_cluster, &next_dir_name[0], next_index + next_length + 1);
                         }
+                        found_file_size = dir_entry->file_size_bytes;
                         return first_cluster;
                     }
                     index += sizeof(struct dir_sfn_entry);
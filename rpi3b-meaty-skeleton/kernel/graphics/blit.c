@@ -0,0 +1,268 @@
+#include <graphics/blit.h>
+#include <device/dma.h>
+#include <mem/dma_alloc.h>
+#include <plibc/stdio.h>
+
+// Per-row fallback for lite channels builds one control block per row
+#define BLIT_MAX_SEGMENTS 2048
+
+static int blit_chan = -1;
+static bool blit_lite;
+static volatile uint32_t *blit_fill_word; // coherent, the engine re-reads it per beat
+static dma_sg_t blit_sg[BLIT_MAX_SEGMENTS];
+static uint32_t blit_segments;
+
+/**
+ * Grab a channel for the blitter. A 2D capable one if there is any, else a
+ * lite channel and one control block per row.
+ */
+int blit_init(void)
+{
+    if (blit_chan >= 0)
+    {
+        return 0;
+    }
+
+    blit_fill_word = dma_alloc_coherent(4 * sizeof(uint32_t), DMA_COHERENT_GRANULE);
+    if (blit_fill_word == 0)
+    {
+        return -1;
+    }
+
+    blit_chan = dma_try_request_channel(DMA_CAP_2D);
+    if (blit_chan < 0)
+    {
+        blit_chan = dma_request_channel(0);
+    }
+    if (blit_chan < 0)
+    {
+        dma_free_coherent((void *)blit_fill_word);
+        blit_fill_word = 0;
+        return -1;
+    }
+    blit_lite = dma_channel_is_lite(blit_chan);
+    printf("\n blit: DMA channel %d (%s)", blit_chan, blit_lite ? "lite, row by row" : "2D");
+    return 0;
+}
+
+bool blit_ready(void)
+{
+    return blit_chan >= 0;
+}
+
+int blit_wait(void)
+{
+    return blit_chan >= 0 ? dma_wait(blit_chan) : 0;
+}
+
+bool blit_busy(void)
+{
+    return blit_chan >= 0 && dma_poll(blit_chan) == 1;
+}
+
+void blit_set_callback(dma_callback_f callback, void *data)
+{
+    if (blit_chan >= 0)
+    {
+        dma_set_callback(blit_chan, callback, data);
+    }
+}
+
+static bool fits_stride(int32_t stride)
+{
+    return stride >= -32768 && stride <= 32767;
+}
+
+/*
+ * Queue `rows` rows of `row_bytes`. Row starts advance by dst_step / src_step
+ * bytes (negative to walk bottom up). With a fixed source the same source
+ * bytes are re-read for every row.
+ */
+static int blit_add_rows(uintptr_t dst, int32_t dst_step, uintptr_t src, int32_t src_step,
+                         uint32_t row_bytes, uint32_t rows, uint8_t flags)
+{
+    bool src_fixed = flags & DMA_SG_SRC_FIXED;
+    int32_t dst_stride = dst_step - (int32_t)row_bytes;
+    int32_t src_stride = src_fixed ? 0 : src_step - (int32_t)row_bytes;
+    bool two_d = !blit_lite && row_bytes <= DMA_2D_MAX_XLEN && fits_stride(dst_stride) && fits_stride(src_stride);
+    uint32_t per_segment = two_d ? DMA_2D_MAX_ROWS : 1;
+
+    while (rows > 0)
+    {
+        uint32_t n = rows < per_segment ? rows : per_segment;
+        dma_sg_t *sg = &blit_sg[blit_segments];
+
+        if (blit_segments == BLIT_MAX_SEGMENTS || (blit_lite && row_bytes > DMA_LITE_MAX_LEN))
+        {
+            printf("BLIT ERROR: %d rows of %d bytes do not fit the DMA chain\n", rows, row_bytes);
+            blit_segments = 0;
+            return -1;
+        }
+        sg->src = (void *)src;
+        sg->dst = (void *)dst;
+        sg->len = row_bytes;
+        sg->rows = n;
+        sg->src_stride = src_stride;
+        sg->dst_stride = dst_stride;
+        sg->dir = MEM_TO_MEM;
+        sg->dreq = 0;
+        sg->flags = flags;
+        blit_segments++;
+
+        dst += dst_step * (int32_t)n;
+        src += src_fixed ? 0 : src_step * (int32_t)n;
+        rows -= n;
+    }
+    return 0;
+}
+
+static int blit_submit(void)
+{
+    uint32_t count = blit_segments;
+
+    blit_segments = 0;
+    if (count == 0)
+    {
+        return 0;
+    }
+    return dma_start_sg(blit_chan, blit_sg, count);
+}
+
+static bool rect_inside(const blit_surface_t *s, uint32_t x, uint32_t y, uint32_t w, uint32_t h)
+{
+    return x < s->width && y < s->height && w <= s->width - x && h <= s->height - y;
+}
+
+static inline uintptr_t pixel_address(const blit_surface_t *s, uint32_t x, uint32_t y)
+{
+    return s->base + y * s->pitch + x * s->bpp;
+}
+
+/**
+ * Copy a w x h rectangle. Source and destination may be the same surface;
+ * overlapping copies are walked bottom up when needed. Moving pixels right
+ * within the same rows is not supported by a forward-only engine.
+ */
+int blit_copy(const blit_surface_t *dst, uint32_t dx, uint32_t dy,
+              const blit_surface_t *src, uint32_t sx, uint32_t sy, uint32_t w, uint32_t h)
+{
+    uintptr_t to = pixel_address(dst, dx, dy);
+    uintptr_t from = pixel_address(src, sx, sy);
+    uint32_t row_bytes = w * dst->bpp;
+
+    if (blit_chan < 0 || dst->bpp != src->bpp || w == 0 || h == 0 ||
+        !rect_inside(dst, dx, dy, w, h) || !rect_inside(src, sx, sy, w, h))
+    {
+        return -1;
+    }
+    if (dst->base == src->base && dy == sy && dx > sx && dx < sx + w)
+    {
+        printf("BLIT ERROR: overlapping copy to the right\n");
+        return -1;
+    }
+
+    blit_wait();
+    if (dst->base == src->base && to > from)
+    {
+        // Destination below the source: last row first so nothing is read after it is overwritten
+        if (blit_add_rows(to + (h - 1) * dst->pitch, -(int32_t)dst->pitch,
+                          from + (h - 1) * src->pitch, -(int32_t)src->pitch, row_bytes, h, 0) < 0)
+        {
+            return -1;
+        }
+    }
+    else if (blit_add_rows(to, dst->pitch, from, src->pitch, row_bytes, h, 0) < 0)
+    {
+        return -1;
+    }
+    return blit_submit();
+}
+
+/**
+ * Fill a rectangle with `colour` in the surface's pixel format. 16 and 32
+ * bpp replay one fill word; 24 bpp pixels do not tile a word, so the CPU
+ * writes the first row and the engine replicates it downwards.
+ */
+int blit_fill(const blit_surface_t *dst, uint32_t x, uint32_t y, uint32_t w, uint32_t h, uint32_t colour)
+{
+    uintptr_t to = pixel_address(dst, x, y);
+    uint32_t row_bytes = w * dst->bpp;
+
+    if (blit_chan < 0 || w == 0 || h == 0 || !rect_inside(dst, x, y, w, h))
+    {
+        return -1;
+    }
+
+    blit_wait();
+    switch (dst->bpp)
+    {
+    case 2:
+        colour = (colour & 0xffff) | (colour << 16);
+        // fall through
+    case 4:
+        for (uint32_t i = 0; i < 4; i++)
+        {
+            blit_fill_word[i] = colour;
+        }
+        if (blit_add_rows(to, dst->pitch, (uintptr_t)blit_fill_word, 0, row_bytes, h, DMA_SG_SRC_FIXED) < 0)
+        {
+            return -1;
+        }
+        break;
+    case 3:
+    {
+        uint8_t *row = (uint8_t *)to;
+        for (uint32_t i = 0; i < w; i++)
+        {
+            row[i * 3 + 0] = colour;
+            row[i * 3 + 1] = colour >> 8;
+            row[i * 3 + 2] = colour >> 16;
+        }
+        if (h > 1)
+        {
+            // src_step 0: every destination row reads the first one again
+            if (blit_add_rows(to + dst->pitch, dst->pitch, to, 0, row_bytes, h - 1, 0) < 0)
+            {
+                return -1;
+            }
+        }
+        break;
+    }
+    default:
+        return -1;
+    }
+    return blit_submit();
+}
+
+/**
+ * Move the whole surface up by `lines` pixel rows (down if negative) and
+ * fill the rows that came into view with `colour`.
+ */
+int blit_scroll(const blit_surface_t *surface, int32_t lines, uint32_t colour)
+{
+    uint32_t shift = lines < 0 ? -lines : lines;
+
+    if (lines == 0)
+    {
+        return 0;
+    }
+    if (shift >= surface->height)
+    {
+        return blit_fill(surface, 0, 0, surface->width, surface->height, colour);
+    }
+
+    if (lines > 0)
+    {
+        if (blit_copy(surface, 0, 0, surface, 0, shift, surface->width, surface->height - shift) < 0)
+        {
+            return -1;
+        }
+        return blit_fill(surface, 0, surface->height - shift, surface->width, shift, colour);
+    }
+
+    if (blit_copy(surface, 0, shift, surface, 0, 0, surface->width, surface->height - shift) < 0)
+    {
+        return -1;
+    }
+    return blit_fill(surface, 0, 0, surface->width, shift, colour);
+}
@@ -0,0 +1,340 @@
+#include <graphics/framebuffer.h>
+#include <kernel/rpi-base.h>
+#include <kernel/rpi-interrupts.h>
+#include <kernel/rpi-mailbox-interface.h>
+#include <kernel/systimer.h>
+#include <kernel/generic-timer.h>
+#include <plibc/stdio.h>
+
+// The firmware signals vsync through the SMI block's interrupt flags
+#define SMI_CS (PERIPHERAL_BASE + 0x600000)
+#define SMI_CS_INTERRUPTS ((1 << 9) | (1 << 10) | (1 << 11))
+
+static blit_surface_t fb_page[FB_MAX_PAGES];
+static uint32_t fb_page_count;
+static uint32_t fb_height;
+static uint32_t back;  // page being drawn
+
+static volatile uint32_t vsync_count;
+static bool vsync_irq;
+static uint64_t vsync_epoch; // timer pacing: frame boundaries are counted from here
+static uint32_t flip_vsync;  // vsync number at the last flip
+
+static fb_stats_t stats;
+static uint64_t last_flip_us;
+
+static void fb_vsync_clearer(void)
+{
+    volatile uint32_t *cs = (volatile uint32_t *)SMI_CS;
+
+    *cs &= ~SMI_CS_INTERRUPTS;
+    vsync_count++;
+}
+
+static void fb_vsync_irq_off(void)
+{
+    unregister_irq_handler(INTERRUPT_SMI);
+    RPI_PropertyInit();
+    RPI_PropertyAddTag(TAG_SET_VSYNC, 0);
+    RPI_PropertyProcess();
+    vsync_irq = false;
+    vsync_epoch = timer_getTickCount64();
+}
+
+/* Frames since start up, from the interrupt or else the system timer */
+static uint32_t vsync_now(void)
+{
+    if (vsync_irq)
+    {
+        return vsync_count;
+    }
+    return (uint32_t)((timer_getTickCount64() - vsync_epoch) / FB_FRAME_US);
+}
+
+/* Sleep until the vsync after number `seen` */
+static void wait_vsync_after(uint32_t seen)
+{
+    if (vsync_irq && INTERRUPTS_ENABLED())
+    {
+        uint64_t start = timer_getTickCount64();
+
+        while (vsync_count == seen)
+        {
+            uint64_t waited = timer_getTickCount64() - start;
+
+            if (waited > FB_VSYNC_TIMEOUT_US)
+            {
+                printf("\n fb: no vsync interrupt, pacing at %d us per frame", FB_FRAME_US);
+                fb_vsync_irq_off();
+                return;
+            }
+            // Masked across the check so the vsync can not slip in before the
+            // WFI, and woken at the timeout should it never come
+            DISABLE_INTERRUPTS();
+            if (vsync_count == seen)
+            {
+                generic_timer_wfi_timeout((uint32_t)(FB_VSYNC_TIMEOUT_US - waited) + 1);
+            }
+            ENABLE_INTERRUPTS();
+        }
+        return;
+    }
+
+    if (vsync_irq)
+    {
+        // Interrupts masked, the count cannot move: pretend this is one
+        return;
+    }
+
+    uint64_t now = timer_getTickCount64();
+    uint64_t next = vsync_epoch + (uint64_t)(seen + 1) * FB_FRAME_US;
+    if (next > now)
+    {
+        udelay((uint32_t)(next - now));
+    }
+}
+
+static void set_view_page(uint32_t page)
+{
+    RPI_PropertyInit();
+    RPI_PropertyAddTag(TAG_SET_VIRTUAL_OFFSET, 0, page * fb_height);
+    RPI_PropertyProcess();
+}
+
+/**
+ * Allocate a frame buffer of `pages` (2 or 3) screens and show the first.
+ * Drawing goes to fb_back_buffer(), fb_flip() puts it on screen. Replaces
+ * whatever frame buffer the console set up.
+ */
+int fb_init(uint32_t width, uint32_t height, uint32_t depth, uint32_t pages)
+{
+    rpi_mailbox_property_t *mp;
+    uint32_t fb_addr, pitch, virt_height;
+
+    if (width == 0 || height == 0 || (depth != 16 && depth != 24 && depth != 32) ||
+        pages < 2 || pages > FB_MAX_PAGES)
+    {
+        printf("\n FB ERROR: bad mode %dx%d %d bpp, %d pages \n", width, height, depth, pages);
+        return -1;
+    }
+
+    RPI_PropertyInit();
+    RPI_PropertyAddTag(TAG_SET_VIRTUAL_OFFSET, 0, 0);
+    RPI_PropertyAddTag(TAG_SET_PHYSICAL_SIZE, width, height);
+    RPI_PropertyAddTag(TAG_SET_VIRTUAL_SIZE, width, height * pages);
+    RPI_PropertyAddTag(TAG_SET_DEPTH, depth);
+    RPI_PropertyAddTag(TAG_ALLOCATE_BUFFER, 16);
+    RPI_PropertyAddTag(TAG_GET_PITCH);
+    RPI_PropertyProcess();
+
+    mp = RPI_PropertyGet(TAG_ALLOCATE_BUFFER);
+    fb_addr = mp ? (uint32_t)(mp->data.buffer_32[0]) & 0x3FFFFFFF : 0;
+    mp = RPI_PropertyGet(TAG_GET_PITCH);
+    pitch = mp ? (uint32_t)mp->data.value_32 : 0;
+    mp = RPI_PropertyGet(TAG_SET_VIRTUAL_SIZE);
+    virt_height = mp ? (uint32_t)(mp->data.buffer_32[1]) : 0;
+
+    if (fb_addr == 0)
+    {
+        printf("\n FB ERROR: firmware did not allocate a frame buffer \n");
+        return -1;
+    }
+    if (virt_height / height < pages)
+    {
+        // Firmware may grant less, settle for what fits if that is still two
+        pages = virt_height / height;
+        if (pages < 2)
+        {
+            printf("\n FB ERROR: virtual height %d holds no second page \n", virt_height);
+            return -1;
+        }
+    }
+
+    for (uint32_t i = 0; i < pages; i++)
+    {
+        fb_page[i].base = fb_addr + i * height * pitch;
+        fb_page[i].pitch = pitch ? pitch : width * (depth / 8);
+        fb_page[i].width = width;
+        fb_page[i].height = height;
+        fb_page[i].bpp = depth / 8;
+    }
+    fb_page_count = pages;
+    fb_height = height;
+    back = 1;
+    blit_init();
+
+    if (!vsync_irq)
+    {
+        RPI_PropertyInit();
+        RPI_PropertyAddTag(TAG_SET_VSYNC, 1);
+        RPI_PropertyProcess();
+        register_irq_handler(INTERRUPT_SMI, NULL, fb_vsync_clearer);
+        vsync_irq = true;
+    }
+    vsync_epoch = timer_getTickCount64();
+    flip_vsync = vsync_now() - 1; // nothing to wait for on the first flip
+    fb_reset_stats();
+
+    printf("\n fb: %dx%d %d bpp, %d pages at %x pitch %d", width, height, depth, pages, fb_addr, pitch);
+    return 0;
+}
+
+/* Where to draw the next frame */
+const blit_surface_t *fb_back_buffer(void)
+{
+    return fb_page_count ? &fb_page[back] : 0;
+}
+
+/* ARM address of the back buffer, for renderers that take a plain address */
+uint32_t fb_back_address(void)
+{
+    return fb_page_count ? fb_page[back].base : 0;
+}
+
+uint32_t fb_pages(void)
+{
+    return fb_page_count;
+}
+
+bool fb_vsync_irq_enabled(void)
+{
+    return vsync_irq;
+}
+
+void fb_wait_vsync(void)
+{
+    wait_vsync_after(vsync_now());
+}
+
+/**
+ * Show the back buffer and hand out the next one. The page handed out is
+ * never one the display may still be scanning:
+ *   2 pages - the old front page, so wait for the vsync that latches the new one
+ *   3 pages - the page shown two flips ago, free once the previous flip has
+ *             been latched; usually that vsync has already gone by
+ */
+int fb_flip(void)
+{
+    uint64_t start;
+    uint64_t now;
+
+    if (fb_page_count == 0)
+    {
+        return -1;
+    }
+
+    start = timer_getTickCount64();
+    blit_wait(); // DMA still filling the back buffer
+
+    if (fb_page_count == 2)
+    {
+        uint32_t seen;
+
+        // Sampled once the firmware has the new offset, a vsync during the
+        // mailbox call may not have latched it yet
+        set_view_page(back);
+        seen = vsync_now();
+        wait_vsync_after(seen);
+    }
+    else
+    {
+        if (vsync_now() == flip_vsync)
+        {
+            wait_vsync_after(flip_vsync);
+        }
+        set_view_page(back);
+        flip_vsync = vsync_now();
+    }
+    back = (back + 1) % fb_page_count;
+
+    now = timer_getTickCount64();
+    stats.wait_us += now - start;
+    if (last_flip_us != 0)
+    {
+        uint32_t frame = (uint32_t)(now - last_flip_us);
+
+        stats.frames++;
+        stats.last_us = frame;
+        stats.total_us += frame;
+        if (frame < stats.min_us)
+        {
+            stats.min_us = frame;
+        }
+        if (frame > stats.max_us)
+        {
+            stats.max_us = frame;
+        }
+        if (frame > FB_FRAME_US + FB_FRAME_US / 2)
+        {
+            stats.missed++;
+        }
+    }
+    last_flip_us = now;
+    return 0;
+}
+
+void fb_get_stats(fb_stats_t *out)
+{
+    *out = stats;
+    out->vsyncs = vsync_count;
+}
+
+void fb_reset_stats(void)
+{
+    stats = (fb_stats_t){.min_us = 0xFFFFFFFF};
+    last_flip_us = 0;
+}
+
+void fb_print_stats(void)
+{
+    uint32_t avg = stats.frames ? (uint32_t)(stats.total_us / stats.frames) : 0;
+
+    printf("\n fb: %d frames, frame time min %d avg %d max %d us, %d missed",
+           stats.frames, stats.frames ? stats.min_us : 0, avg, stats.max_us, stats.missed);
+    printf("\n fb: %d us inside fb_flip, vsync from %s (%d interrupts)",
+           (uint32_t)stats.wait_us, vsync_irq ? "SMI interrupt" : "system timer", vsync_count);
+}
+
+/*----------------------------------------------------------------------
+ * Demo: a bar sweeping across a triple buffered 640x480 screen. Each
+ * frame clears the back buffer and draws the bar at its new position,
+ * so any tearing would show up as a broken bar.
+ *----------------------------------------------------------------------*/
+
+#define DEMO_FRAMES 300
+#define DEMO_BAR_WIDTH 32
+
+static void demo_fill(const blit_surface_t *s, uint32_t x, uint32_t w, uint32_t colour)
+{
+    if (blit_fill(s, x, 0, w, s->height, colour) == 0)
+    {
+        return;
+    }
+    for (uint32_t y = 0; y < s->height; y++)
+    {
+        uint8_t *p = (uint8_t *)(s->base + y * s->pitch + x * s->bpp);
+        for (uint32_t i = 0; i < w * s->bpp; i++)
+        {
+            p[i] = colour >> ((i % s->bpp) * 8);
+        }
+    }
+}
+
+void show_page_flip_demo(void)
+{
+    if (fb_init(640, 480, 32, 3) < 0)
+    {
+        return;
+    }
+
+    for (uint32_t frame = 0; frame < DEMO_FRAMES; frame++)
+    {
+        const blit_surface_t *s = fb_back_buffer();
+        uint32_t x = (frame * 4) % (s->width - DEMO_BAR_WIDTH);
+
+        demo_fill(s, 0, s->width, 0x00000000);
+        demo_fill(s, x, DEMO_BAR_WIDTH, 0x00FFFFFF);
+        fb_flip();
+    }
+    fb_print_stats();
+}
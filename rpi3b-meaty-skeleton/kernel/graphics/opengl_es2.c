@@ -1,20 +1,106 @@
 #include<graphics/opengl_es.h>
 #include<graphics/opengl_es2.h>
 #include<graphics/v3d.h>
-#include<graphics/gpu_mem_util.h>
+#include<graphics/v3d_cl.h>
+#include<graphics/v3d_pool.h>
+#include<graphics/soft_raster.h>
+#include<mem/kernel_alloc.h>
+#include<mem/dma_alloc.h>
 #include <plibc/stdio.h>
 
 #define v3d ((volatile __attribute__((aligned(4))) uint32_t*)(uintptr_t)(V3D_BASE))
 #define ALIGN_128BIT_MASK  0xFFFFFF80
+#define RENDERER_MEM_SIZE 0x10000
+#define BINNING_MEM_SIZE 0x10000
 extern uint32_t GPUaddrToARMaddr (uint32_t BUSaddress);
 
+_Static_assert(sizeof(soft_vertex_t) == 6 * 4, "soft_vertex_t must match the shader record stride");
 
+static SCENE_RENDERER selected_renderer = RENDERER_V3D;
+
+/**
+ * Draw with the V3D or on the ARM from now on. Scenes initialised for the
+ * V3D can be drawn either way; scenes initialised while the software
+ * renderer was selected have no tile or binning memory and are always
+ * drawn on the ARM.
+ */
+void v3d_SelectRenderer (SCENE_RENDERER renderer) {
+	selected_renderer = renderer;
+}
+
+SCENE_RENDERER v3d_SelectedRenderer (void) {
+	return selected_renderer;
+}
+
+/* Give back the memory of a scene set up for the other renderer */
+static void scene_release (RENDER_STRUCT* scene) {
+	if (scene->renderer == RENDERER_SOFT) {
+		mem_deallocate((void*)(uintptr_t)scene->rendererDataVC4);
+	} else {
+		GPU_HANDLE handles[3] = { scene->rendererHandle, scene->tileHandle, scene->binningHandle };
+		for (int i = 0; i < 3; i++)
+			if (handles[i]) v3d_pool_free(handles[i]);
+	}
+	scene->rendererHandle = scene->tileHandle = scene->binningHandle = 0;
+	scene->rendererDataVC4 = 0;
+}
+
+/* Builder over the renderer memory from the next 128 bit aligned load position to its end */
+static VC4_ADDR scene_region (RENDER_STRUCT* scene, v3d_cl_t* cl) {
+	VC4_ADDR start = (scene->loadpos + 127) & ALIGN_128BIT_MASK;
+	VC4_ADDR end = scene->rendererDataVC4 + RENDERER_MEM_SIZE;
+	v3d_cl_init(cl, (void*)(uintptr_t)GPUaddrToARMaddr(start), start, start < end ? end - start : 0);
+	return start;
+}
+
+
+/**
+ * The scene must start out zeroed. Initialising it again keeps the memory
+ * it already has, so building a scene over and over costs no allocations;
+ * better still, build it once and use v3d_SetVertexPosition and friends.
+ * V3D scene memory comes from the GPU pool, so scenes share locked chunks
+ * instead of each making mailbox calls of their own.
+ */
 bool v3d_InitializeScene (RENDER_STRUCT* scene, uint32_t renderWth, uint32_t renderHt) {
     if (scene) 
 	{
-		scene->rendererHandle = v3d_mem_alloc(0x10000, 0x1000, MEM_FLAG_COHERENT | MEM_FLAG_ZERO);
-		if (!scene->rendererHandle) return false;
-		scene->rendererDataVC4 = v3d_mem_lock(scene->rendererHandle);
+		scene->dirtyFirst = scene->dirtyEnd = 0;
+		if (scene->rendererDataVC4 && scene->renderer == selected_renderer) {
+			scene->loadpos = scene->rendererDataVC4;				// Same memory, start filling it again
+			scene->renderWth = renderWth;
+			scene->renderHt = renderHt;
+			scene->binWth = (renderWth + 63) / 64;
+			scene->binHt = (renderHt + 63) / 64;
+			return true;
+		}
+		if (scene->rendererDataVC4) scene_release(scene);
+
+		scene->renderer = selected_renderer;
+		if (scene->renderer == RENDERER_SOFT) {
+			// Plain kernel memory, the bus address is the ARM address
+			void* mem = mem_allocate(RENDERER_MEM_SIZE);
+			if (!mem) return false;
+			scene->rendererHandle = 0;
+			scene->rendererDataVC4 = (VC4_ADDR)(uintptr_t)mem;
+			scene->loadpos = scene->rendererDataVC4;
+			scene->renderWth = renderWth;
+			scene->renderHt = renderHt;
+			scene->binWth = (renderWth + 63) / 64;
+			scene->binHt = (renderHt + 63) / 64;
+			scene->tileHandle = 0;
+			scene->binningHandle = 0;
+			return true;
+		}
+
+		scene->rendererHandle = v3d_pool_alloc(RENDERER_MEM_SIZE, 0x1000, MEM_FLAG_ZERO);
+		scene->tileMemSize = 0x4000;
+		scene->tileHandle = v3d_pool_alloc(scene->tileMemSize + 0x4000, 0x1000, MEM_FLAG_ZERO);
+		scene->binningHandle = v3d_pool_alloc(BINNING_MEM_SIZE, 0x1000, MEM_FLAG_ZERO);
+		scene->rendererDataVC4 = v3d_pool_bus(scene->rendererHandle);
+		if (!scene->rendererHandle || !scene->tileHandle || !scene->binningHandle) {
+			scene_release(scene);
+			return false;
+		}
 		scene->loadpos = scene->rendererDataVC4;					// VC4 load from start of memory
 
 		scene->renderWth = renderWth;								// Render width
@@ -22,13 +108,9 @@ bool v3d_InitializeScene (RENDER_STRUCT* scene, uint32_t renderWth, uint32_t ren
 		scene->binWth = (renderWth + 63) / 64;						// Tiles across 
 		scene->binHt = (renderHt + 63) / 64;						// Tiles down 
 
-		scene->tileMemSize = 0x4000;
-		scene->tileHandle = v3d_mem_alloc(scene->tileMemSize + 0x4000, 0x1000, MEM_FLAG_COHERENT | MEM_FLAG_ZERO);
-		scene->tileStateDataVC4 = v3d_mem_lock(scene->tileHandle);
+		scene->tileStateDataVC4 = v3d_pool_bus(scene->tileHandle);
 		scene->tileDataBufferVC4 = scene->tileStateDataVC4 + 0x4000;
-
-		scene->binningHandle = v3d_mem_alloc(0x10000, 0x1000, MEM_FLAG_COHERENT | MEM_FLAG_ZERO);
-		scene->binningDataVC4 = v3d_mem_lock(scene->binningHandle);
+		scene->binningDataVC4 = v3d_pool_bus(scene->binningHandle);
 		return true;
 	}
 	return false;
@@ -37,9 +119,8 @@ bool v3d_InitializeScene (RENDER_STRUCT* scene, uint32_t renderWth, uint32_t ren
 bool v3d_AddVertexesToScene (RENDER_STRUCT* scene) {
 if (scene) 
 	{
-		scene->vertexVC4 = (scene->loadpos + 127) & ALIGN_128BIT_MASK;	// Hold vertex start adderss .. aligned to 128bits
-		uint8_t* p = (uint8_t*)(uintptr_t)GPUaddrToARMaddr(scene->vertexVC4);
-		uint8_t* q = p;
+		v3d_cl_t cl;
+		scene->vertexVC4 = scene_region(scene, &cl);					// Hold vertex start adderss .. aligned to 128bits
 
 		/* Setup triangle vertices from OpenGL tutorial which used this */
 		// fTriangle[0] = -0.4f; fTriangle[1] = 0.1f; fTriangle[2] = 0.0f;
@@ -53,31 +134,31 @@ if (scene)
 		// Vertex Data
 
 		// Vertex: Top, vary red
-		emit_uint16_t(&p, (centreX) << 4);								// X in 12.4 fixed point
-		emit_uint16_t(&p, (centreY - half_shape_ht) << 4);				// Y in 12.4 fixed point
-		emit_float(&p, 1.0f);											// Z
-		emit_float(&p, 1.0f);											// 1/W
-		emit_float(&p, 1.0f);											// Varying 0 (Red)
-		emit_float(&p, 0.0f);											// Varying 1 (Green)
-		emit_float(&p, 0.0f);											// Varying 2 (Blue)
+		v3d_cl_u16(&cl, (centreX) << 4);								// X in 12.4 fixed point
+		v3d_cl_u16(&cl, (centreY - half_shape_ht) << 4);				// Y in 12.4 fixed point
+		v3d_cl_f32(&cl, 1.0f);											// Z
+		v3d_cl_f32(&cl, 1.0f);											// 1/W
+		v3d_cl_f32(&cl, 1.0f);											// Varying 0 (Red)
+		v3d_cl_f32(&cl, 0.0f);											// Varying 1 (Green)
+		v3d_cl_f32(&cl, 0.0f);											// Varying 2 (Blue)
 
 		// Vertex: bottom left, vary blue
-		emit_uint16_t(&p, (centreX - half_shape_wth) << 4);				// X in 12.4 fixed point
-		emit_uint16_t(&p, (centreY + half_shape_ht) << 4);				// Y in 12.4 fixed point
-		emit_float(&p, 1.0f);											// Z
-		emit_float(&p, 1.0f);											// 1/W
-		emit_float(&p, 0.0f);											// Varying 0 (Red)
-		emit_float(&p, 0.0f);											// Varying 1 (Green)
-		emit_float(&p, 1.0f);											// Varying 2 (Blue)
+		v3d_cl_u16(&cl, (centreX - half_shape_wth) << 4);				// X in 12.4 fixed point
+		v3d_cl_u16(&cl, (centreY + half_shape_ht) << 4);				// Y in 12.4 fixed point
+		v3d_cl_f32(&cl, 1.0f);											// Z
+		v3d_cl_f32(&cl, 1.0f);											// 1/W
+		v3d_cl_f32(&cl, 0.0f);											// Varying 0 (Red)
+		v3d_cl_f32(&cl, 0.0f);											// Varying 1 (Green)
+		v3d_cl_f32(&cl, 1.0f);											// Varying 2 (Blue)
 
 		// Vertex: bottom right, vary green 
-		emit_uint16_t(&p, (centreX + half_shape_wth) << 4);				// X in 12.4 fixed point
-		emit_uint16_t(&p, (centreY + half_shape_ht) << 4);				// Y in 12.4 fixed point
-		emit_float(&p, 1.0f);											// Z
-		emit_float(&p, 1.0f);											// 1/W
-		emit_float(&p, 0.0f);											// Varying 0 (Red)
-		emit_float(&p, 1.0f);											// Varying 1 (Green)
-		emit_float(&p, 0.0f);											// Varying 2 (Blue)
+		v3d_cl_u16(&cl, (centreX + half_shape_wth) << 4);				// X in 12.4 fixed point
+		v3d_cl_u16(&cl, (centreY + half_shape_ht) << 4);				// Y in 12.4 fixed point
+		v3d_cl_f32(&cl, 1.0f);											// Z
+		v3d_cl_f32(&cl, 1.0f);											// 1/W
+		v3d_cl_f32(&cl, 0.0f);											// Varying 0 (Red)
+		v3d_cl_f32(&cl, 1.0f);											// Varying 1 (Green)
+		v3d_cl_f32(&cl, 0.0f);											// Varying 2 (Blue)
 
 
 		/* Setup triangle vertices from OpenGL tutorial which used this */
@@ -88,64 +169,63 @@ if (scene)
 		centreY = (uint_fast32_t)(1.35f * (scene->renderHt / 2));				// quad centre y
 
 		// Vertex: Top, left  vary blue
-		emit_uint16_t(&p, (centreX - half_shape_wth) << 4);				// X in 12.4 fixed point
-		emit_uint16_t(&p, (centreY - half_shape_ht) << 4);				// Y in 12.4 fixed point
-		emit_float(&p, 1.0f);											// Z
-		emit_float(&p, 1.0f);											// 1/W
-		emit_float(&p, 0.0f);											// Varying 0 (Red)
-		emit_float(&p, 0.0f);											// Varying 1 (Green)
-		emit_float(&p, 1.0f);											// Varying 2 (Blue)
+		v3d_cl_u16(&cl, (centreX - half_shape_wth) << 4);				// X in 12.4 fixed point
+		v3d_cl_u16(&cl, (centreY - half_shape_ht) << 4);				// Y in 12.4 fixed point
+		v3d_cl_f32(&cl, 1.0f);											// Z
+		v3d_cl_f32(&cl, 1.0f);											// 1/W
+		v3d_cl_f32(&cl, 0.0f);											// Varying 0 (Red)
+		v3d_cl_f32(&cl, 0.0f);											// Varying 1 (Green)
+		v3d_cl_f32(&cl, 1.0f);											// Varying 2 (Blue)
 
 		// Vertex: bottom left, vary Green
-		emit_uint16_t(&p, (centreX - half_shape_wth) << 4);				// X in 12.4 fixed point
-		emit_uint16_t(&p, (centreY + half_shape_ht) << 4);				// Y in 12.4 fixed point
-		emit_float(&p, 1.0f);											// Z
-		emit_float(&p, 1.0f);											// 1/W
-		emit_float(&p, 0.0f);											// Varying 0 (Red)
-		emit_float(&p, 1.0f);											// Varying 1 (Green)
-		emit_float(&p, 0.0f);											// Varying 2 (Blue)
+		v3d_cl_u16(&cl, (centreX - half_shape_wth) << 4);				// X in 12.4 fixed point
+		v3d_cl_u16(&cl, (centreY + half_shape_ht) << 4);				// Y in 12.4 fixed point
+		v3d_cl_f32(&cl, 1.0f);											// Z
+		v3d_cl_f32(&cl, 1.0f);											// 1/W
+		v3d_cl_f32(&cl, 0.0f);											// Varying 0 (Red)
+		v3d_cl_f32(&cl, 1.0f);											// Varying 1 (Green)
+		v3d_cl_f32(&cl, 0.0f);											// Varying 2 (Blue)
 
 		// Vertex: top right, vary red
-		emit_uint16_t(&p, (centreX + half_shape_wth) << 4);				// X in 12.4 fixed point
-		emit_uint16_t(&p, (centreY - half_shape_ht) << 4);				// Y in 12.4 fixed point
-		emit_float(&p, 1.0f);											// Z
-		emit_float(&p, 1.0f);											// 1/W
-		emit_float(&p, 1.0f);											// Varying 0 (Red)
-		emit_float(&p, 0.0f);											// Varying 1 (Green)
-		emit_float(&p, 0.0f);											// Varying 2 (Blue)
+		v3d_cl_u16(&cl, (centreX + half_shape_wth) << 4);				// X in 12.4 fixed point
+		v3d_cl_u16(&cl, (centreY - half_shape_ht) << 4);				// Y in 12.4 fixed point
+		v3d_cl_f32(&cl, 1.0f);											// Z
+		v3d_cl_f32(&cl, 1.0f);											// 1/W
+		v3d_cl_f32(&cl, 1.0f);											// Varying 0 (Red)
+		v3d_cl_f32(&cl, 0.0f);											// Varying 1 (Green)
+		v3d_cl_f32(&cl, 0.0f);											// Varying 2 (Blue)
 
 		// Vertex: bottom right, vary yellow
-		emit_uint16_t(&p, (centreX + half_shape_wth) << 4);				// X in 12.4 fixed point
-		emit_uint16_t(&p, (centreY + half_shape_ht) << 4);				// Y in 12.4 fixed point
-		emit_float(&p, 1.0f);											// Z
-		emit_float(&p, 1.0f);											// 1/W
-		emit_float(&p, 0.0f);											// Varying 0 (Red)
-		emit_float(&p, 1.0f);											// Varying 1 (Green)
-		emit_float(&p, 1.0f);											// Varying 2 (Blue)
+		v3d_cl_u16(&cl, (centreX + half_shape_wth) << 4);				// X in 12.4 fixed point
+		v3d_cl_u16(&cl, (centreY + half_shape_ht) << 4);				// Y in 12.4 fixed point
+		v3d_cl_f32(&cl, 1.0f);											// Z
+		v3d_cl_f32(&cl, 1.0f);											// 1/W
+		v3d_cl_f32(&cl, 0.0f);											// Varying 0 (Red)
+		v3d_cl_f32(&cl, 1.0f);											// Varying 1 (Green)
+		v3d_cl_f32(&cl, 1.0f);											// Varying 2 (Blue)
 
 		scene->num_verts = 7;
-		scene->loadpos = scene->vertexVC4 + (p - q);					// Update load position
+		scene->loadpos = v3d_cl_end(&cl);								// Update load position
+		if (!v3d_cl_ok(&cl)) return false;
 
-		scene->indexVertexVC4 = (scene->loadpos + 127) & ALIGN_128BIT_MASK;// Hold index vertex start adderss .. align it to 128 bits
-		p = (uint8_t*)(uintptr_t)GPUaddrToARMaddr(scene->indexVertexVC4);
-		q = p;
+		scene->indexVertexVC4 = scene_region(scene, &cl);				// Hold index vertex start adderss .. align it to 128 bits
 
-		emit_uint8_t(&p, 0);											// tri - top
-		emit_uint8_t(&p, 1);											// tri - bottom left
-		emit_uint8_t(&p, 2);											// tri - bottom right
+		v3d_cl_u8(&cl, 0);											// tri - top
+		v3d_cl_u8(&cl, 1);											// tri - bottom left
+		v3d_cl_u8(&cl, 2);											// tri - bottom right
 
-		emit_uint8_t(&p, 3);											// quad - top left
-		emit_uint8_t(&p, 4);											// quad - bottom left
-		emit_uint8_t(&p, 5);											// quad - top right
+		v3d_cl_u8(&cl, 3);											// quad - top left
+		v3d_cl_u8(&cl, 4);											// quad - bottom left
+		v3d_cl_u8(&cl, 5);											// quad - top right
 
-		emit_uint8_t(&p, 4);											// quad - bottom left
-		emit_uint8_t(&p, 6);											// quad - bottom right
-		emit_uint8_t(&p, 5);											// quad - top right
+		v3d_cl_u8(&cl, 4);											// quad - bottom left
+		v3d_cl_u8(&cl, 6);											// quad - bottom right
+		v3d_cl_u8(&cl, 5);											// quad - top right
 		scene->IndexVertexCt = 9;
 		scene->MaxIndexVertex = 6;
 
-		scene->loadpos = scene->indexVertexVC4 + (p - q);				// Move loaad pos to new position
-		return true;
+		scene->loadpos = v3d_cl_end(&cl);								// Move loaad pos to new position
+		return v3d_cl_ok(&cl);
 	}
 	return false;
 }
@@ -153,31 +233,30 @@ if (scene)
 bool v3d_AddShadderToScene (RENDER_STRUCT* scene, uint32_t* frag_shader, uint32_t frag_shader_emits) {
     if (scene)
 	{
-		scene->shaderStart = (scene->loadpos + 127) & ALIGN_128BIT_MASK;// Hold shader start adderss .. aligned to 127 bits
-		uint8_t *p = (uint8_t*)(uintptr_t)GPUaddrToARMaddr(scene->shaderStart);	// ARM address for load
-		uint8_t *q = p;												// Hold start address
+		v3d_cl_t cl;
+		scene->shaderStart = scene_region(scene, &cl);				// Hold shader start adderss .. aligned to 128 bits
 
 		for (int i = 0; i < frag_shader_emits; i++)					// For the number of fragment shader emits
-			emit_uint32_t(&p, frag_shader[i]);						// Emit fragment shader into our allocated memory
+			v3d_cl_u32(&cl, frag_shader[i]);						// Emit fragment shader into our allocated memory
 
-		scene->loadpos = scene->shaderStart + (p - q);				// Update load position
+		scene->loadpos = v3d_cl_end(&cl);							// Update load position
+		if (!v3d_cl_ok(&cl)) return false;
 
-		scene->fragShaderRecStart = (scene->loadpos + 127) & ALIGN_128BIT_MASK;// Hold frag shader start adderss .. .aligned to 128bits
-		p = (uint8_t*)(uintptr_t)GPUaddrToARMaddr(scene->fragShaderRecStart);
-		q = p;
+		scene->fragShaderRecStart = scene_region(scene, &cl);		// Hold frag shader start adderss .. .aligned to 128bits
 
 		// Okay now we need Shader Record to buffer
-		emit_uint8_t(&p, 0x01);										// flags
-		emit_uint8_t(&p, 6 * 4);									// stride
-		emit_uint8_t(&p, 0xcc);										// num uniforms (not used)
-		emit_uint8_t(&p, 3);										// num varyings
-		emit_uint32_t(&p, scene->shaderStart);						// Shader code address
-		emit_uint32_t(&p, 0);										// Fragment shader uniforms (not in use)
-		emit_uint32_t(&p, scene->vertexVC4);						// Vertex Data
-
-		scene->loadpos = scene->fragShaderRecStart + (p - q);		// Adjust VC4 load poistion
-
-		return true;
+		v3d_cl_nv_shader_record(&cl,
+			0x01,													// flags
+			6 * 4,													// stride
+			0xcc,													// num uniforms (not used)
+			3,														// num varyings
+			scene->shaderStart,										// Shader code address
+			0,														// Fragment shader uniforms (not in use)
+			scene->vertexVC4);										// Vertex Data
+
+		scene->loadpos = v3d_cl_end(&cl);							// Adjust VC4 load poistion
+
+		return v3d_cl_ok(&cl);
 	}
 	return false;
 }
@@ -185,67 +264,38 @@ bool v3d_AddShadderToScene (RENDER_STRUCT* scene, uint32_t* frag_shader, uint32_
 bool v3d_SetupRenderControl(RENDER_STRUCT* scene, VC4_ADDR renderBufferAddr) {
 	if (scene)
 	{
-		scene->renderControlVC4 = (scene->loadpos + 127) & ALIGN_128BIT_MASK;// Hold render control start adderss .. aligned to 128 bits
-		uint8_t *p = (uint8_t*)(uintptr_t)GPUaddrToARMaddr(scene->renderControlVC4); // ARM address for load
-		uint8_t *q = p;												// Hold start address
-
-		// Clear colors
-		emit_uint8_t(&p, GL_CLEAR_COLORS);
-		emit_uint32_t(&p, 0xff000000);								// Opaque Black
-		emit_uint32_t(&p, 0xff000000);								// 32 bit clear colours need to be repeated twice
-		emit_uint32_t(&p, 0);
-		emit_uint8_t(&p, 0);
+		v3d_cl_t cl;
+		scene->renderBufferAddr = renderBufferAddr;
+		if (scene->renderer == RENDERER_SOFT) return true;		// Nothing for a V3D to run
 
-		// Tile Rendering Mode Configuration
-		emit_uint8_t(&p, GL_TILE_RENDER_CONFIG);
+		scene->renderControlVC4 = scene_region(scene, &cl);			// Hold render control start adderss .. aligned to 128 bits
 
-		emit_uint32_t(&p, renderBufferAddr);						// render address (will be framebuffer)
+		v3d_cl_clear_colors(&cl, 0xff000000, 0, 0);					// Opaque Black
 
-		emit_uint16_t(&p, scene->renderWth);						// render width
-		emit_uint16_t(&p, scene->renderHt);							// render height
-		emit_uint8_t(&p, 0x04);										// framebuffer mode (linear rgba8888)
-		emit_uint8_t(&p, 0x00);
+		// Tile Rendering Mode Configuration, render address will be framebuffer
+		scene->renderBufferField = v3d_cl_offset(&cl) + 1;			// Address follows the opcode
+		v3d_cl_tile_render_config(&cl, renderBufferAddr, scene->renderWth, scene->renderHt, V3D_RENDER_RGBA8888);
 
 		// Do a store of the first tile to force the tile buffer to be cleared
-		// Tile Coordinates
-		emit_uint8_t(&p, GL_TILE_COORDINATES);
-		emit_uint8_t(&p, 0);
-		emit_uint8_t(&p, 0);
-
-		// Store Tile Buffer General
-		emit_uint8_t(&p, GL_STORE_TILE_BUFFER);
-		emit_uint16_t(&p, 0);										// Store nothing (just clear)
-		emit_uint32_t(&p, 0);										// no address is needed
+		v3d_cl_tile_coordinates(&cl, 0, 0);
+		v3d_cl_store_tile_buffer(&cl, V3D_STORE_NONE, 0);			// Store nothing (just clear)
 
 		// Link all binned lists together
 		for (int x = 0; x < scene->binWth; x++) {
 			for (int y = 0; y < scene->binHt; y++) {
+				v3d_cl_tile_coordinates(&cl, x, y);
+				v3d_cl_branch_to_sublist(&cl, scene->tileDataBufferVC4 + (y * scene->binWth + x) * 32);
 
-				// Tile Coordinates
-				emit_uint8_t(&p, GL_TILE_COORDINATES);
-				emit_uint8_t(&p, x);
-				emit_uint8_t(&p, y);
-
-				// Call Tile sublist
-				emit_uint8_t(&p, GL_BRANCH_TO_SUBLIST);
-				emit_uint32_t(&p, scene->tileDataBufferVC4 + (y * scene->binWth + x) * 32);
-
-				// Last tile needs a special store instruction
-				if (x == (scene->binWth - 1) && (y == scene->binHt - 1)) {
-					// Store resolved tile color buffer and signal end of frame
-					emit_uint8_t(&p, GL_STORE_MULTISAMPLE_END);
-				}
-				else {
-					// Store resolved tile color buffer
-					emit_uint8_t(&p, GL_STORE_MULTISAMPLE);
-				}
+				// Store resolved tile color buffer, the last tile also signals end of frame
+				v3d_cl_store_multisample(&cl, x == (scene->binWth - 1) && (y == scene->binHt - 1));
 			}
 		}
 
-		scene->loadpos = scene->renderControlVC4 + (p - q);			// Adjust VC4 load poistion
+		scene->loadpos = v3d_cl_end(&cl);							// Adjust VC4 load poistion
 		scene->renderControlEndVC4 = scene->loadpos;				// Hold end of render control data
+		scene->renderList = cl;										// Kept to patch between frames
 
-		return true;
+		return v3d_cl_ok(&cl);
 	}
 	return false;
 }
@@ -253,71 +303,106 @@ bool v3d_SetupRenderControl(RENDER_STRUCT* scene, VC4_ADDR renderBufferAddr) {
 bool v3d_SetupBinningConfig (RENDER_STRUCT* scene) {
 if (scene)
 	{
-		uint8_t *p = (uint8_t*)(uintptr_t)GPUaddrToARMaddr(scene->binningDataVC4); // ARM address for binning data load
-		uint8_t *list = p;												// Hold start address
-
-		emit_uint8_t(&p, GL_TILE_BINNING_CONFIG);						// tile binning config control 
-		emit_uint32_t(&p, scene->tileDataBufferVC4);					// tile allocation memory address
-		emit_uint32_t(&p, scene->tileMemSize);							// tile allocation memory size
-		emit_uint32_t(&p, scene->tileStateDataVC4);						// Tile state data address
-		emit_uint8_t(&p, scene->binWth);								// renderWidth/64
-		emit_uint8_t(&p, scene->binHt);									// renderHt/64
-		emit_uint8_t(&p, 0x04);											// config
-
-		// Start tile binning.
-		emit_uint8_t(&p, GL_START_TILE_BINNING);						// Start binning command
-
-		// Primitive type
-		emit_uint8_t(&p, GL_PRIMITIVE_LIST_FORMAT);
-		emit_uint8_t(&p, 0x32);											// 16 bit triangle
-
-		// Clip Window
-		emit_uint8_t(&p, GL_CLIP_WINDOW);								// Clip window 
-		emit_uint16_t(&p, 0);											// 0
-		emit_uint16_t(&p, 0);											// 0
-		emit_uint16_t(&p, scene->renderWth);							// width
-		emit_uint16_t(&p, scene->renderHt);								// height
-
-		// GL State
-		emit_uint8_t(&p, GL_CONFIG_STATE);
-		emit_uint8_t(&p, 0x03);											// enable both foward and back facing polygons
-		emit_uint8_t(&p, 0x00);											// depth testing disabled
-		emit_uint8_t(&p, 0x02);											// enable early depth write
-
-		// Viewport offset
-		emit_uint8_t(&p, GL_VIEWPORT_OFFSET);							// Viewport offset
-		emit_uint16_t(&p, 0);											// 0
-		emit_uint16_t(&p, 0);											// 0
+		v3d_cl_t cl;
+		if (scene->renderer == RENDERER_SOFT) return true;
 
-		// The triangle
-		// No Vertex Shader state (takes pre-transformed vertexes so we don't have to supply a working coordinate shader.)
-		emit_uint8_t(&p, GL_NV_SHADER_STATE);
-		emit_uint32_t(&p, scene->fragShaderRecStart);					// Shader Record
+		v3d_cl_init(&cl, (void*)(uintptr_t)GPUaddrToARMaddr(scene->binningDataVC4), scene->binningDataVC4, BINNING_MEM_SIZE);
 
-		// primitive index list
-		emit_uint8_t(&p, GL_INDEXED_PRIMITIVE_LIST);					// Indexed primitive list command
-		emit_uint8_t(&p, PRIM_TRIANGLE);								// 8bit index, triangles
-		emit_uint32_t(&p, scene->IndexVertexCt);						// Number of index vertex
-		emit_uint32_t(&p, scene->indexVertexVC4);						// Address of index vertex data
-		emit_uint32_t(&p, scene->MaxIndexVertex);						// Maximum index
+		v3d_cl_tile_binning_config(&cl, scene->tileDataBufferVC4, scene->tileMemSize, scene->tileStateDataVC4,
+			scene->binWth, scene->binHt, V3D_BIN_AUTO_INIT_STATE);
+		v3d_cl_start_tile_binning(&cl);
+		v3d_cl_primitive_list_format(&cl, V3D_PRIM_LIST_TRIANGLES_16);
+		v3d_cl_clip_window(&cl, 0, 0, scene->renderWth, scene->renderHt);
+		v3d_cl_config_state(&cl, V3D_CONFIG_FRONT_AND_BACK, 0x00, V3D_CONFIG_EARLY_Z_UPDATE);	// depth testing disabled
+		v3d_cl_viewport_offset(&cl, 0, 0);
 
+		// The triangle
+		// No Vertex Shader state (takes pre-transformed vertexes so we don't have to supply a working coordinate shader.)
+		v3d_cl_nv_shader_state(&cl, scene->fragShaderRecStart);
+		v3d_cl_indexed_primitive_list(&cl, PRIM_TRIANGLE, scene->IndexVertexCt, scene->indexVertexVC4, scene->MaxIndexVertex);
 
 		// End of bin list
-		// So Flush
-		emit_uint8_t(&p, GL_FLUSH_ALL_STATE);
-		// Nop
-		emit_uint8_t(&p, GL_NOP);
-		// Halt
-		emit_uint8_t(&p, GL_HALT);
-		scene->binningCfgEnd = scene->binningDataVC4 + (p-list);		// Hold binning data end address
+		v3d_cl_flush_all_state(&cl);
+		v3d_cl_nop(&cl);
+		v3d_cl_halt(&cl);
+		scene->binningCfgEnd = v3d_cl_end(&cl);						// Hold binning data end address
 
-		return true;
+		return v3d_cl_ok(&cl);
 	}
 	return false;
 }
 
+/*--------------------------------------------------------------------------}
+{	A scene that is set up stays resident: its vertices, shader and both	}
+{	control lists live in GPU memory until it is initialised again. A frame	}
+{	only rewrites the vertices that moved and the fields that change, then	}
+{	v3d_RenderScene runs the same lists again.								}
+{--------------------------------------------------------------------------*/
+
+static soft_vertex_t* scene_vertex (RENDER_STRUCT* scene, uint32_t index) {
+	if (!scene || !scene->vertexVC4 || index >= scene->num_verts) return 0;
+	if (scene->dirtyFirst == scene->dirtyEnd) {
+		scene->dirtyFirst = index;
+		scene->dirtyEnd = index + 1;
+	} else {
+		if (index < scene->dirtyFirst) scene->dirtyFirst = index;
+		if (index >= scene->dirtyEnd) scene->dirtyEnd = index + 1;
+	}
+	return (soft_vertex_t*)(uintptr_t)GPUaddrToARMaddr(scene->vertexVC4) + index;
+}
+
+/* X and Y in 12.4 fixed point, like v3d_AddVertexesToScene writes them */
+bool v3d_SetVertexPosition (RENDER_STRUCT* scene, uint32_t index, uint16_t x, uint16_t y) {
+	soft_vertex_t* v = scene_vertex(scene, index);
+	if (!v) return false;
+	v->x = x;
+	v->y = y;
+	return true;
+}
+
+bool v3d_SetVertexColour (RENDER_STRUCT* scene, uint32_t index, float r, float g, float b) {
+	soft_vertex_t* v = scene_vertex(scene, index);
+	if (!v) return false;
+	v->r = r;
+	v->g = g;
+	v->b = b;
+	return true;
+}
+
+/* Render the next frame somewhere else, e.g. the back page of the frame buffer */
+bool v3d_SetRenderBuffer (RENDER_STRUCT* scene, VC4_ADDR renderBufferAddr) {
+	if (!scene) return false;
+	scene->renderBufferAddr = renderBufferAddr;
+	if (scene->renderer == RENDERER_SOFT) return true;
+	if (!v3d_cl_patch_u32(&scene->renderList, scene->renderBufferField, renderBufferAddr)) return false;
+	dma_cache_clean(scene->renderList.base + scene->renderBufferField, 4);
+	return true;
+}
+
+/* The same vertices, indices and clear colour, drawn on the ARM into the render buffer */
+static void soft_RenderScene (RENDER_STRUCT* scene) {
+	blit_surface_t fb = {
+		.base = GPUaddrToARMaddr(scene->renderBufferAddr),
+		.pitch = scene->renderWth * 4,								// Linear RGBA8888, as the tile render config says
+		.width = scene->renderWth,
+		.height = scene->renderHt,
+		.bpp = 4,
+	};
+	soft_raster_clear(&fb, 0xff000000);								// Opaque Black
+	soft_raster_triangles(&fb, (const soft_vertex_t*)(uintptr_t)GPUaddrToARMaddr(scene->vertexVC4),
+		(const uint8_t*)(uintptr_t)GPUaddrToARMaddr(scene->indexVertexVC4), scene->IndexVertexCt);
+}
+
 void v3d_RenderScene (RENDER_STRUCT* scene) {
-if (scene) {
+if (scene && (scene->renderer == RENDERER_SOFT || selected_renderer == RENDERER_SOFT)) {
+		soft_RenderScene(scene);
+		scene->dirtyFirst = scene->dirtyEnd = 0;
+	} else if (scene) {
+		// Vertices rewritten by the ARM have to be in memory before the binner reads them
+		if (scene->dirtyFirst != scene->dirtyEnd) {
+			dma_cache_clean((soft_vertex_t*)(uintptr_t)GPUaddrToARMaddr(scene->vertexVC4) + scene->dirtyFirst,
+				(scene->dirtyEnd - scene->dirtyFirst) * sizeof(soft_vertex_t));
+		}
 		// clear caches
 		v3d[V3D_L2CACTL] = 4;
 		v3d[V3D_SLCACTL] = 0x0F0F0F0F;
@@ -332,27 +417,21 @@ if (scene) {
 		v3d[V3D_CT0CA] = scene->binningDataVC4;						// Start binning config address
 		v3d[V3D_CT0EA] = scene->binningCfgEnd;						// End binning config address is at render control start
 
-        printf("\n wait for binning to finish \n");
-		// wait for binning to finish
-		while (v3d[V3D_BFC] == 0) {
-			printf("V3D_CT0CA: 0x%x, V3D_PCS: 0x%x V3D_ERRSTAT: 0x%x \n", v3d[V3D_CT0CA], v3d[V3D_PCS], v3d[V3D_ERRSTAT]);
-		}
-         printf("\n wait for binning to finish completeed \n");
+		// wait for binning to finish, no printing in here: it runs every frame
+		while (v3d[V3D_BFC] == 0);
+
 		// stop the thread
 		v3d[V3D_CT1CS] = 0x20;
-           printf("\n stopped thread \n");
 		// Wait for thread to stop
 		while (v3d[V3D_CT1CS] & 0x20);
-        printf("\n wait complete for  stopped thread \n");
+
 		// Run our render
 		v3d[V3D_RFC] = 1;											// reset rendering frame count
 		v3d[V3D_CT1CA] = scene->renderControlVC4;					// Start address for render control
 		v3d[V3D_CT1EA] = scene->renderControlEndVC4;				// End address for render control
-        printf("\n wait render \n");
 
 		// wait for render to finish
 		while (v3d[V3D_RFC] == 0) {}
-        printf("\n wait render completed\n");
-
+		scene->dirtyFirst = scene->dirtyEnd = 0;
 	}
-}
\ No newline at end of file
+}
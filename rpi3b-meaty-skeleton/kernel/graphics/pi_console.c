@@ -1,9 +1,14 @@
 #include<graphics/pi_console.h>
+#include <graphics/blit.h>
+#include <graphics/shadow.h>
 #include <kernel/rpi-mailbox-interface.h>
+#include <kernel/systimer.h>
 #include <plibc/stdio.h>
+#include <plibc/string.h>
 
 #define BitFontHt 16
 #define BitFontWth 8
+#define CONSOLE_VIRTUAL_PAGES 2										// Virtual height in screens, room to scroll into
 typedef int32_t		BOOL;							// BOOL is defined to an int32_t ... yeah windows is weird -1 is often returned
 typedef char		TCHAR;							// TCHAR is a char
 typedef uint32_t	COLORREF;						// COLORREF is a uint32_t
@@ -576,6 +581,9 @@ typedef struct __attribute__((__packed__, aligned(4))) tagINTDC {
 	uint32_t wth;													// Screen width (of frame buffer)
 	uint32_t ht;													// Screen height (of frame buffer)
 	uint32_t depth;													// Colour depth (of frame buffer)
+	uint32_t pitch;													// Bytes per frame buffer line
+	uint32_t virt_ht;												// Virtual height, >= ht
+	uint32_t view_y;												// First virtual line on screen
 																	/* Position control */
 	POINT curPos;													// Current position
 	POINT cursor;													// Current cursor position
@@ -594,45 +602,234 @@ typedef struct __attribute__((__packed__, aligned(4))) tagINTDC {
 } INTDC;
 
 INTDC __attribute__((aligned(4))) console = { 0 };
+static blit_surface_t console_surface = { 0 };						// Same frame buffer, as the DMA blitter sees it
 
-static void ClearArea16(INTDC* dc, uint_fast32_t x1, uint_fast32_t y1, uint_fast32_t x2, uint_fast32_t y2) {
-	RGB565* __attribute__((__packed__, aligned(1))) video_wr_ptr = (RGB565*)(uintptr_t)(dc->fb + (y1 * dc->wth * 2) + (x1 * 2));
-	RGB565 Bc;
-	Bc.R = dc->BrushColor.rgbRed >> 3;
-	Bc.G = dc->BrushColor.rgbGreen >> 2;
-	Bc.B = dc->BrushColor.rgbBlue >> 3;
-	for (uint_fast32_t y = 0; y < (y2 - y1); y++) {					// For each y line
-		for (uint_fast32_t x = 0; x < (x2 - x1); x++) {				// For each x between x1 and x2
-			video_wr_ptr[x] = Bc;									// Write the colour
+static bool blit_pending = false;									// A DMA clear or scroll may still be moving pixels
+
+static shadow_t console_shadow;										// Cached copy of the frame buffer, see console_enable_shadow
+static bool console_shadowed = false;								// console.fb points into the shadow
+
+/*
+ * Glyph rows are expanded through a span table: entry b holds the 8 pixels
+ * of font row byte b already in frame buffer format for the current text
+ * and background colours, 8 * bytes-per-pixel bytes each. Rebuilt only
+ * when the colours change, so a glyph row is one load and 2-6 stores.
+ */
+static uint64_t __attribute__((aligned(8))) span[256][4];
+static uint32_t span_fg = 0, span_bg = 0, span_bpp = 0;
+
+static uint32_t Colour16(RGBA c) {
+	return ((c.rgbRed >> 3) << 11) | ((c.rgbGreen >> 2) << 5) | (c.rgbBlue >> 3);
+}
+
+/* Colour in the frame buffer's own format: RGB565, or B,G,R(,A) bytes */
+static uint32_t NativeColour(INTDC* dc, RGBA c) {
+	switch (dc->depth) {
+	case 16:
+		return Colour16(c);
+	case 24:
+		return c.ref & 0x00FFFFFF;
+	default:
+		return c.ref | 0xFF000000;									// Opaque, the firmware may honour alpha
+	}
+}
+
+static void BuildSpans(INTDC* dc) {
+	uint32_t fg = NativeColour(dc, dc->TxtColor);
+	uint32_t bg = NativeColour(dc, dc->BkColor);
+	uint32_t bpp = dc->depth / 8;
+	if (fg == span_fg && bg == span_bg && bpp == span_bpp) return;	// Table still valid
+	for (uint32_t b = 0; b < 256; b++) {
+		uint8_t* row = (uint8_t*)&span[b][0];
+		for (uint32_t i = 0; i < 8; i++) {
+			uint32_t col = (b & (0x80 >> i)) ? fg : bg;
+			for (uint32_t k = 0; k < bpp; k++) {
+				row[i * bpp + k] = col >> (8 * k);					// Little endian pixel bytes
+			}
 		}
-		video_wr_ptr += dc->wth;									// Offset to next line
 	}
+	span_fg = fg;
+	span_bg = bg;
+	span_bpp = bpp;
 }
 
-static void WriteChar16(INTDC* dc, uint8_t Ch) {
-	RGB565* __attribute__((aligned(1))) video_wr_ptr = (RGB565*)(uintptr_t)(dc->fb + (dc->curPos.y * dc->wth * 2) + (dc->curPos.x * 2));
-	RGB565 Fc, Bc;
-	Fc.R = dc->TxtColor.rgbRed >> 3;
-	Fc.G = dc->TxtColor.rgbGreen >> 2;
-	Fc.B = dc->TxtColor.rgbBlue >> 3;								// Colour for text
-	Bc.R = dc->BkColor.rgbRed >> 3;
-	Bc.G = dc->BkColor.rgbGreen >> 2;
-	Bc.B = dc->BkColor.rgbBlue >> 3;								// Colour for background
-	for (uint_fast32_t y = 0; y < 4; y++) {
-		uint32_t b = BitFont[(Ch * 4) + y];							// Fetch character bits
-		for (uint_fast32_t i = 0; i < 32; i++) {					// For each bit
-			RGB565 col = Bc;										// Preset background colour
-			int xoffs = i % 8;										// X offset
-			if ((b & 0x80000000) != 0) col = Fc;					// If bit set take text colour
-			video_wr_ptr[xoffs] = col;								// Write pixel
-			b <<= 1;												// Roll font bits left
-			if (xoffs == 7) video_wr_ptr += dc->wth;				// If was bit 7 next line down
+/* The blitter only works on the real frame buffer, never on the shadow */
+static bool UseBlitter(void) {
+	return !console_shadowed && blit_ready();
+}
+
+static void MarkDirty(uint32_t x, uint32_t y, uint32_t w, uint32_t h) {
+	if (console_shadowed) shadow_mark(&console_shadow, x, y, w, h);
+}
+
+/* Wait out a DMA clear or scroll before the CPU writes to the screen */
+static void SyncBlit(void) {
+	if (blit_pending) {
+		blit_wait();
+		blit_pending = false;
+	}
+}
+
+static void ClearAreaCpu(INTDC* dc, uint_fast32_t x1, uint_fast32_t y1, uint_fast32_t x2, uint_fast32_t y2) {
+	uint32_t bpp = dc->depth / 8;
+	uint32_t col = NativeColour(dc, dc->BrushColor);
+	uint8_t* line = (uint8_t*)(dc->fb + y1 * dc->pitch + x1 * bpp);
+	SyncBlit();
+	for (uint_fast32_t y = y1; y < y2; y++) {						// For each y line
+		switch (bpp) {
+		case 2: {
+			uint16_t* p = (uint16_t*)line;
+			for (uint_fast32_t x = 0; x < (x2 - x1); x++) p[x] = col;
+		}
+				break;
+		case 4: {
+			uint32_t* p = (uint32_t*)line;
+			for (uint_fast32_t x = 0; x < (x2 - x1); x++) p[x] = col;
 		}
+				break;
+		default:
+			for (uint_fast32_t x = 0; x < (x2 - x1); x++) {
+				line[x * 3 + 0] = col;
+				line[x * 3 + 1] = col >> 8;
+				line[x * 3 + 2] = col >> 16;
+			}
+			break;
+		}
+		line += dc->pitch;											// Offset to next line
+	}
+}
+
+static void ClearArea(INTDC* dc, uint_fast32_t x1, uint_fast32_t y1, uint_fast32_t x2, uint_fast32_t y2) {
+	if (UseBlitter()) {												// DMA fill, no CPU pixel loop
+		SyncBlit();
+		blit_fill(&console_surface, x1, y1, x2 - x1, y2 - y1, NativeColour(dc, dc->BrushColor));
+		blit_pending = true;
+		return;
+	}
+	ClearAreaCpu(dc, x1, y1, x2, y2);
+	MarkDirty(x1, y1, x2 - x1, y2 - y1);
+}
+
+/* Font row r of character Ch, bit 7 is the leftmost pixel */
+static inline uint32_t FontRow(const uint32_t* glyph, uint_fast32_t r) {
+	return (glyph[r >> 2] >> (24 - 8 * (r & 3))) & 0xFF;
+}
+
+static void WriteChar16(INTDC* dc, uint8_t Ch) {
+	const uint32_t* glyph = &BitFont[Ch * 4];
+	uint8_t* line = (uint8_t*)(dc->fb + dc->curPos.y * dc->pitch + dc->curPos.x * 2);
+	for (uint_fast32_t r = 0; r < BitFontHt; r++) {
+		const uint64_t* src = span[FontRow(glyph, r)];
+		uint64_t* dst = (uint64_t*)line;							// 16 bytes, two 64-bit stores
+		dst[0] = src[0];
+		dst[1] = src[1];
+		line += dc->pitch;
 	}
 	dc->curPos.x += BitFontWth;										// Increment x position
 }
 
+static void WriteChar24(INTDC* dc, uint8_t Ch) {
+	const uint32_t* glyph = &BitFont[Ch * 4];
+	uint8_t* line = (uint8_t*)(dc->fb + dc->curPos.y * dc->pitch + dc->curPos.x * 3);
+	for (uint_fast32_t r = 0; r < BitFontHt; r++) {
+		const uint32_t* src = (const uint32_t*)span[FontRow(glyph, r)];
+		uint32_t* dst = (uint32_t*)line;							// 24 bytes, the pitch may not keep 8 byte alignment
+		dst[0] = src[0];
+		dst[1] = src[1];
+		dst[2] = src[2];
+		dst[3] = src[3];
+		dst[4] = src[4];
+		dst[5] = src[5];
+		line += dc->pitch;
+	}
+	dc->curPos.x += BitFontWth;
+}
+
+static void WriteChar32(INTDC* dc, uint8_t Ch) {
+	const uint32_t* glyph = &BitFont[Ch * 4];
+	uint8_t* line = (uint8_t*)(dc->fb + dc->curPos.y * dc->pitch + dc->curPos.x * 4);
+	for (uint_fast32_t r = 0; r < BitFontHt; r++) {
+		const uint64_t* src = span[FontRow(glyph, r)];
+		uint64_t* dst = (uint64_t*)line;							// 32 bytes, four 64-bit stores
+		dst[0] = src[0];
+		dst[1] = src[1];
+		dst[2] = src[2];
+		dst[3] = src[3];
+		line += dc->pitch;
+	}
+	dc->curPos.x += BitFontWth;
+}
+
+/* Move the display window; rows it uncovers must reach the frame buffer first */
+static void SetViewOffset(uint32_t y) {
+	if (console_shadowed) shadow_flush(&console_shadow);
+	RPI_PropertyInit();
+	RPI_PropertyAddTag(TAG_SET_VIRTUAL_OFFSET, 0, y);
+	RPI_PropertyProcess();
+	console.view_y = y;
+}
+
+/* Clear virtual lines y1..y2 to the background colour */
+static void ClearLines(uint32_t y1, uint32_t y2) {
+	RGBA brush = console.BrushColor;
+	console.BrushColor = console.BkColor;
+	console.ClearArea(&console, 0, y1, console.wth, y2);
+	console.BrushColor = brush;
+}
+
+/*
+ * Move the text up one character row and blank the bottom one. With a
+ * virtual frame buffer taller than the screen this only moves the
+ * display window down; once the window reaches the end, everything but
+ * the top row is copied back to the start of the buffer (off screen)
+ * and the window jumps there. That is one copy per screenful of scrolls.
+ */
+static void console_scroll(void) {
+	uint32_t below = console.view_y + console.ht;					// First virtual line under the screen
+	uint32_t text_ht = (console.ht / BitFontHt) * BitFontHt;		// Lines covered by whole text rows
+
+	if (below + BitFontHt <= console.virt_ht) {
+		ClearLines(console.view_y + text_ht, below + BitFontHt);	// New bottom row, not yet visible
+		SyncBlit();
+		SetViewOffset(console.view_y + BitFontHt);
+		return;
+	}
+
+	if (console.virt_ht >= 2 * console.ht) {
+		// Wrap: the window is now past ht, so lines 0..keep are all off screen
+		uint32_t keep = text_ht - BitFontHt;
+		if (UseBlitter()) {
+			SyncBlit();
+			blit_copy(&console_surface, 0, 0, &console_surface, 0, console.view_y + BitFontHt, console.wth, keep);
+			blit_pending = true;
+		} else {
+			uint8_t* fb = (uint8_t*)console.fb;
+			memcpy(fb, fb + (console.view_y + BitFontHt) * console.pitch, keep * console.pitch);
+			MarkDirty(0, 0, console.wth, keep);
+		}
+		ClearLines(keep, console.ht);
+		SyncBlit();
+		SetViewOffset(0);
+		return;
+	}
+
+	// No room to scroll in, move the pixels
+	if (UseBlitter()) {
+		SyncBlit();
+		console_surface.height = console.ht;
+		blit_scroll(&console_surface, BitFontHt, NativeColour(&console, console.BkColor));
+		console_surface.height = console.virt_ht;
+		blit_pending = true;
+		return;
+	}
+	uint8_t* fb = (uint8_t*)console.fb;
+	memmove(fb, fb + BitFontHt * console.pitch, (console.ht - BitFontHt) * console.pitch);
+	MarkDirty(0, 0, console.wth, console.ht - BitFontHt);
+	ClearLines(console.ht - BitFontHt, console.ht);
+}
+
 void console_putchar(char ch) {
+	if (console.fb == 0) return;									// No frame buffer yet
 	switch (ch) {
 	case '\r': {											// Carriage return character
 		console.cursor.x = 0;								// Cursor back to line start
@@ -650,12 +847,23 @@ void console_putchar(char ch) {
 			   break;
 	default: {												// All other characters
 		console.curPos.x = console.cursor.x * BitFontWth;
-		console.curPos.y = console.cursor.y * BitFontHt;
+		console.curPos.y = console.view_y + console.cursor.y * BitFontHt;
+		SyncBlit();
+		BuildSpans(&console);
 		console.WriteChar(&console, ch);					// Write the character to graphics screen
+		MarkDirty(console.curPos.x - BitFontWth, console.curPos.y, BitFontWth, BitFontHt);
 		console.cursor.x++;									// Cursor.x forward one character
 	}
 			 break;
 	}
+	if ((console.cursor.x + 1) * BitFontWth > console.wth) {	// Wrap at the right edge
+		console.cursor.x = 0;
+		console.cursor.y++;
+	}
+	while ((console.cursor.y + 1) * BitFontHt > console.ht) {	// Scroll at the bottom
+		console_scroll();
+		console.cursor.y--;
+	}
 }
 
 void console_puts(char *str) {
@@ -665,6 +873,114 @@ void console_puts(char *str) {
     }
 }
 
+/*
+ * Write len bytes, the span table and pending DMA are checked once per batch.
+ * A run of plain characters on one line is marked dirty as one rectangle.
+ */
+uint32_t console_write(const char *buf, uint32_t len) {
+	uint32_t run_x = 0, run_y = 0, run_wth = 0;
+	if (console.fb == 0) return 0;
+	SyncBlit();
+	BuildSpans(&console);
+	for (uint32_t i = 0; i < len; i++) {
+		char ch = buf[i];
+		if (ch >= ' ' && (console.cursor.x + 2) * BitFontWth <= console.wth) {
+			console.curPos.x = console.cursor.x * BitFontWth;	// Plain character mid line, no wrap or scroll to check
+			console.curPos.y = console.view_y + console.cursor.y * BitFontHt;
+			if (run_wth == 0) {
+				run_x = console.curPos.x;
+				run_y = console.curPos.y;
+			}
+			console.WriteChar(&console, ch);
+			console.cursor.x++;
+			run_wth += BitFontWth;
+			continue;
+		}
+		if (run_wth) {
+			MarkDirty(run_x, run_y, run_wth, BitFontHt);		// Before a scroll can move the run
+			run_wth = 0;
+		}
+		console_putchar(ch);
+	}
+	if (run_wth) MarkDirty(run_x, run_y, run_wth, BitFontHt);
+	return len;
+}
+
+/**
+ * Draw into a cacheable shadow of the frame buffer from now on and copy
+ * the dirty parts across every flush_us (0: only on console_flush and
+ * before the display window moves). Log bursts then hit the cache, and
+ * the frame buffer gets whole rows once per flush. Refused while the data
+ * cache is off: the shadow would cost two screens of heap and a second
+ * copy of every pixel for nothing.
+ */
+int console_enable_shadow(uint32_t flush_us) {
+	if (console.fb == 0) return -1;
+	if (!console_shadowed) {
+		if (!shadow_cache_enabled()) {
+			printf("\n console: data cache is off, no shadow frame buffer \n");
+			return -1;
+		}
+		SyncBlit();
+		if (shadow_init(&console_shadow, &console_surface) < 0) return -1;
+		console.fb = console_shadow.buf.base;
+		console_shadowed = true;
+	}
+	shadow_auto_flush(&console_shadow, flush_us);
+	return 0;
+}
+
+/* Back to drawing straight into the frame buffer */
+static void console_drop_shadow(void) {
+	if (!console_shadowed) return;
+	shadow_flush(&console_shadow);
+	shadow_free(&console_shadow);
+	console.fb = console_surface.base;
+	console_shadowed = false;
+}
+
+/* Bring the screen up to date with everything written so far */
+void console_flush(void) {
+	if (console_shadowed) shadow_flush(&console_shadow);
+}
+
+#define SHADOW_BENCH_LINES 200
+
+/**
+ * Time a burst of console text straight into the frame buffer and through
+ * the shadow. The shadow is kept only if it won; with the data cache off it
+ * is not tried at all.
+ */
+void show_console_shadow_benchmark(void) {
+	static const char line[] = "shadow benchmark: the quick brown fox jumps over the lazy dog 0123456789\n";
+	uint64_t start, direct, shadowed;
+
+	if (console.fb == 0 && get_console_frame_buffer(640, 480, 32) == 0) {
+		printf("\n console: no frame buffer to benchmark \n");
+		return;
+	}
+	console_drop_shadow();
+
+	start = timer_getTickCount64();
+	for (uint32_t i = 0; i < SHADOW_BENCH_LINES; i++) console_write(line, sizeof(line) - 1);
+	SyncBlit();
+	direct = timer_getTickCount64() - start;
+
+	if (console_enable_shadow(0) < 0) {
+		printf("\n console: %d lines in %d us straight to the frame buffer \n", SHADOW_BENCH_LINES, (uint32_t)direct);
+		return;
+	}
+	start = timer_getTickCount64();
+	for (uint32_t i = 0; i < SHADOW_BENCH_LINES; i++) console_write(line, sizeof(line) - 1);
+	console_flush();
+	shadowed = timer_getTickCount64() - start;
+
+	printf("\n console: %d lines in %d us straight to the frame buffer, %d us through the shadow",
+		SHADOW_BENCH_LINES, (uint32_t)direct, (uint32_t)shadowed);
+	shadow_print_stats(&console_shadow);
+	if (shadowed >= direct) console_drop_shadow();
+}
+
 
 
 void get_console_width_height_depth(uint32_t *width, uint32_t *height, uint32_t *depth, uint32_t *pitch) {
@@ -692,19 +1008,28 @@ uint32_t get_console_frame_buffer(uint32_t width, uint32_t height, uint32_t dept
     if(width == 0 || height == 0 || depth == 0) {
         return 0;
     }
+    if (console_shadowed) {											// New frame buffer, new shadow if wanted
+        shadow_free(&console_shadow);
+        console_shadowed = false;
+    }
 
     RPI_PropertyInit();
     RPI_PropertyAddTag(TAG_SET_VIRTUAL_OFFSET, 0, 0);
     RPI_PropertyAddTag(TAG_SET_PHYSICAL_SIZE, width, height);
-    RPI_PropertyAddTag(TAG_SET_VIRTUAL_SIZE, width, height);
+    RPI_PropertyAddTag(TAG_SET_VIRTUAL_SIZE, width, height * CONSOLE_VIRTUAL_PAGES);
     RPI_PropertyAddTag(TAG_SET_DEPTH, depth);
 
     RPI_PropertyAddTag(TAG_ALLOCATE_BUFFER, 16);
+    RPI_PropertyAddTag(TAG_GET_PITCH);
 
     RPI_PropertyProcess();
     rpi_mailbox_property_t *mp = RPI_PropertyGet(TAG_ALLOCATE_BUFFER);
     uint32_t frame_buffer_addr = (uint32_t)(mp->data.buffer_32[0]);
     uint32_t frame_buffer_size = (uint32_t)(mp->data.buffer_32[1]);
+    mp = RPI_PropertyGet(TAG_GET_PITCH);
+    uint32_t pitch = mp ? mp->data.value_32 : 0;
+    mp = RPI_PropertyGet(TAG_SET_VIRTUAL_SIZE);
+    uint32_t virt_height = mp ? (uint32_t)(mp->data.buffer_32[1]) : height;	// Firmware may grant less
 
 	console.TxtColor.ref = 0xFFFFFFFF;
 	console.BkColor.ref = 0x00000000;
@@ -712,10 +1037,33 @@ uint32_t get_console_frame_buffer(uint32_t width, uint32_t height, uint32_t dept
 	console.wth = width;
 	console.ht = height;
 	console.depth = depth;
+	console.pitch = pitch ? pitch : width * (depth / 8);
+	console.virt_ht = virt_height < height ? height : virt_height;
+	console.view_y = 0;
+
+    console.ClearArea = ClearArea;
+    switch (depth) {
+    case 16:
+        console.WriteChar = WriteChar16;
+        break;
+    case 24:
+        console.WriteChar = WriteChar24;
+        break;
+    case 32:
+        console.WriteChar = WriteChar32;
+        break;
+    default:
+        printf("\n CONSOLE ERROR: %d bpp is not supported \n", depth);
+        return 0;
+    }
     console.fb = frame_buffer_addr & 0x3FFFFFFF; //(~0xC0000000);
 
-    console.ClearArea = ClearArea16;
-    console.WriteChar = WriteChar16;
+    console_surface.base = console.fb;
+    console_surface.width = width;
+    console_surface.height = console.virt_ht;
+    console_surface.bpp = depth / 8;
+    console_surface.pitch = console.pitch;
+    blit_init();													// Falls back to CPU loops if no channel
 
     printf("\n frame_buffer_addr: %x frame_buffer_size %d  \n", frame_buffer_addr, frame_buffer_size);
     return console.fb;
@@ -0,0 +1,8 @@
+# Fragment shader that paints every pixel opaque white.
+
+	nop; nop
+	ldi tlbc, 0xffffffff					# RGBA white
+	nop; nop; sbdone
+	nop; nop; thrend
+	nop; nop
+	nop; nop
@@ -0,0 +1,13 @@
+# Fragment shader for the NV shader state triangles: the three varyings are
+# the vertex colour interpolated across the triangle, packed into one RGBA
+# pixel and written to the tile buffer.
+
+	mov r0, vary; mov r3.8d, 1.0			# red, alpha = 1.0
+	fadd r0, r0, r5; mov r1, vary; sbwait	# add C to the varying; green
+	fadd r1, r1, r5; mov r2, vary			# blue
+	fadd r2, r2, r5; mov r3.8a, r0
+	nop; mov r3.8b, r1
+	nop; mov r3.8c, r2
+	mov tlbc, r3; nop; thrend
+	nop; nop
+	nop; nop; sbdone
@@ -0,0 +1,357 @@
+#include <graphics/shadow.h>
+#include <kernel/rpi-interrupts.h>
+#include <mem/dma_alloc.h>
+#include <mem/kernel_alloc.h>
+#include <plibc/stdio.h>
+#include <plibc/string.h>
+
+static void shadow_timer(void *data);
+
+/**
+ * The shadow only pays off when the heap is cacheable. With the MMU and data
+ * cache off, as long as kernel_main leaves initialize_virtual_memory out,
+ * every pixel is written to uncached RAM and then copied again.
+ */
+bool shadow_cache_enabled(void)
+{
+    uint32_t sctlr;
+
+    __asm__ __volatile__("mrc p15, 0, %0, c1, c0, 0"
+                         : "=r"(sctlr));
+    return (sctlr & (1 << 2)) != 0; // SCTLR.C
+}
+
+/**
+ * Set up a shadow of `fb` with the same geometry. The shadow starts out
+ * as a copy of what is on screen, so drawing can carry on where it was.
+ */
+int shadow_init(shadow_t *s, const blit_surface_t *fb)
+{
+    uint32_t size = fb->pitch * fb->height;
+    void *buf = mem_allocate(size);
+
+    if (buf == 0)
+    {
+        printf("SHADOW ERROR: no room for a %d byte shadow buffer\n", size);
+        return -1;
+    }
+    memset(s, 0, sizeof(*s));
+    s->fb = *fb;
+    s->buf = *fb;
+    s->buf.base = (uintptr_t)buf;
+    memcpy(buf, (void *)fb->base, size);
+    ktimer_setup(&s->timer, shadow_timer, s);
+    return 0;
+}
+
+void shadow_free(shadow_t *s)
+{
+    ktimer_cancel(&s->timer);
+    s->period_us = 0;
+    if (s->buf.base != 0)
+    {
+        mem_deallocate((void *)s->buf.base);
+        s->buf.base = 0;
+    }
+}
+
+/* Flush on a timer `period_us` after the first mark, or only when asked if 0 */
+void shadow_auto_flush(shadow_t *s, uint32_t period_us)
+{
+    s->period_us = period_us;
+    if (period_us == 0)
+    {
+        ktimer_cancel(&s->timer);
+    }
+    else if (s->count != 0)
+    {
+        ktimer_add(&s->timer, period_us);
+    }
+}
+
+static inline uint32_t rect_area(const shadow_rect_t *r)
+{
+    return (r->x2 - r->x1) * (r->y2 - r->y1);
+}
+
+static shadow_rect_t rect_union(const shadow_rect_t *a, const shadow_rect_t *b)
+{
+    shadow_rect_t u = {
+        .x1 = a->x1 < b->x1 ? a->x1 : b->x1,
+        .y1 = a->y1 < b->y1 ? a->y1 : b->y1,
+        .x2 = a->x2 > b->x2 ? a->x2 : b->x2,
+        .y2 = a->y2 > b->y2 ? a->y2 : b->y2};
+    return u;
+}
+
+/* Pixels the bounding box of a and b covers that neither of them does (roughly, overlap counts twice) */
+static uint32_t merge_waste(const shadow_rect_t *a, const shadow_rect_t *b)
+{
+    shadow_rect_t u = rect_union(a, b);
+    uint32_t area = rect_area(&u);
+    uint32_t used = rect_area(a) + rect_area(b);
+
+    return area > used ? area - used : 0;
+}
+
+static void remove_rect(shadow_t *s, uint32_t i)
+{
+    s->dirty[i] = s->dirty[--s->count];
+}
+
+/* Interrupts off: the timer flush takes the list from softirq context */
+static void add_rect(shadow_t *s, shadow_rect_t r)
+{
+    // Swallow every rect that merges cheaply; r grows, so start over after each
+    for (uint32_t i = 0; i < s->count;)
+    {
+        if (merge_waste(&s->dirty[i], &r) <= SHADOW_MERGE_SLACK)
+        {
+            r = rect_union(&s->dirty[i], &r);
+            remove_rect(s, i);
+            i = 0;
+            continue;
+        }
+        i++;
+    }
+
+    if (s->count == SHADOW_MAX_RECTS)
+    {
+        // Full: merge the cheapest pair, r counts as entry SHADOW_MAX_RECTS
+        uint32_t best_i = 0, best_j = SHADOW_MAX_RECTS;
+        uint32_t best = merge_waste(&s->dirty[0], &r);
+
+        for (uint32_t i = 0; i < s->count; i++)
+        {
+            for (uint32_t j = i + 1; j <= s->count; j++)
+            {
+                uint32_t waste = merge_waste(&s->dirty[i], j == s->count ? &r : &s->dirty[j]);
+                if (waste < best)
+                {
+                    best = waste;
+                    best_i = i;
+                    best_j = j;
+                }
+            }
+        }
+        if (best_j == SHADOW_MAX_RECTS)
+        {
+            r = rect_union(&s->dirty[best_i], &r);
+            remove_rect(s, best_i);
+        }
+        else
+        {
+            s->dirty[best_i] = rect_union(&s->dirty[best_i], &s->dirty[best_j]);
+            remove_rect(s, best_j);
+        }
+    }
+    s->dirty[s->count++] = r;
+}
+
+/**
+ * Note that the shadow changed in a w x h rectangle. Call after drawing:
+ * a flush that runs in between copies the old pixels but leaves the mark.
+ */
+void shadow_mark(shadow_t *s, uint32_t x, uint32_t y, uint32_t w, uint32_t h)
+{
+    shadow_rect_t r;
+    int32_t irqs_on;
+    bool arm;
+
+    if (x >= s->buf.width || y >= s->buf.height || w == 0 || h == 0)
+    {
+        return;
+    }
+    r.x1 = x;
+    r.y1 = y;
+    r.x2 = w > s->buf.width - x ? s->buf.width : x + w;
+    r.y2 = h > s->buf.height - y ? s->buf.height : y + h;
+
+    irqs_on = INTERRUPTS_ENABLED();
+    DISABLE_INTERRUPTS();
+    add_rect(s, r);
+    arm = s->period_us != 0 && !ktimer_pending(&s->timer);
+    if (irqs_on)
+    {
+        ENABLE_INTERRUPTS();
+    }
+
+    if (arm)
+    {
+        ktimer_add(&s->timer, s->period_us);
+    }
+}
+
+static inline uint8_t *shadow_pixel(const blit_surface_t *b, uint32_t x, uint32_t y)
+{
+    return (uint8_t *)(b->base + y * b->pitch + x * b->bpp);
+}
+
+/* Fill a rectangle of the shadow with `colour` in the frame buffer's format */
+void shadow_fill(shadow_t *s, uint32_t x, uint32_t y, uint32_t w, uint32_t h, uint32_t colour)
+{
+    const blit_surface_t *b = &s->buf;
+
+    if (x >= b->width || y >= b->height)
+    {
+        return;
+    }
+    w = w > b->width - x ? b->width - x : w;
+    h = h > b->height - y ? b->height - y : h;
+
+    for (uint32_t row = 0; row < h; row++)
+    {
+        uint8_t *p = shadow_pixel(b, x, y + row);
+
+        switch (b->bpp)
+        {
+        case 2:
+            for (uint32_t i = 0; i < w; i++)
+            {
+                ((uint16_t *)p)[i] = colour;
+            }
+            break;
+        case 4:
+            for (uint32_t i = 0; i < w; i++)
+            {
+                ((uint32_t *)p)[i] = colour;
+            }
+            break;
+        default:
+            for (uint32_t i = 0; i < w; i++)
+            {
+                p[i * 3 + 0] = colour;
+                p[i * 3 + 1] = colour >> 8;
+                p[i * 3 + 2] = colour >> 16;
+            }
+            break;
+        }
+    }
+    shadow_mark(s, x, y, w, h);
+}
+
+/* Copy a rectangle within the shadow, overlap allowed */
+void shadow_copy(shadow_t *s, uint32_t dx, uint32_t dy, uint32_t sx, uint32_t sy, uint32_t w, uint32_t h)
+{
+    const blit_surface_t *b = &s->buf;
+    uint32_t row_bytes = w * b->bpp;
+
+    if (w == 0 || h == 0 || dx + w > b->width || sx + w > b->width || dy + h > b->height || sy + h > b->height)
+    {
+        return;
+    }
+
+    if (dy > sy)
+    {
+        // Destination below the source: bottom row first
+        for (uint32_t row = h; row-- > 0;)
+        {
+            memmove(shadow_pixel(b, dx, dy + row), shadow_pixel(b, sx, sy + row), row_bytes);
+        }
+    }
+    else
+    {
+        for (uint32_t row = 0; row < h; row++)
+        {
+            memmove(shadow_pixel(b, dx, dy + row), shadow_pixel(b, sx, sy + row), row_bytes);
+        }
+    }
+    shadow_mark(s, dx, dy, w, h);
+}
+
+static void copy_rect(shadow_t *s, const shadow_rect_t *r, bool use_dma)
+{
+    uint32_t w = r->x2 - r->x1;
+    uint32_t h = r->y2 - r->y1;
+    uint32_t row_bytes = w * s->buf.bpp;
+    uint8_t *from = shadow_pixel(&s->buf, r->x1, r->y1);
+    uint8_t *to = shadow_pixel(&s->fb, r->x1, r->y1);
+
+    if (use_dma && blit_ready())
+    {
+        // The engine reads memory, not the cache
+        dma_cache_clean(from, (h - 1) * s->buf.pitch + row_bytes);
+        if (blit_copy(&s->fb, r->x1, r->y1, &s->buf, r->x1, r->y1, w, h) == 0)
+        {
+            return;
+        }
+    }
+    for (uint32_t row = 0; row < h; row++)
+    {
+        memcpy(to, from, row_bytes);
+        from += s->buf.pitch;
+        to += s->fb.pitch;
+    }
+}
+
+static int flush_rects(shadow_t *s, bool use_dma)
+{
+    shadow_rect_t rects[SHADOW_MAX_RECTS];
+    uint32_t count;
+    int32_t irqs_on;
+    bool busy;
+
+    irqs_on = INTERRUPTS_ENABLED();
+    DISABLE_INTERRUPTS();
+    busy = s->flushing;
+    count = busy ? 0 : s->count;
+    if (!busy)
+    {
+        memcpy(rects, s->dirty, count * sizeof(rects[0]));
+        s->count = 0;
+        s->flushing = true;
+    }
+    if (irqs_on)
+    {
+        ENABLE_INTERRUPTS();
+    }
+
+    if (busy)
+    {
+        // The timer cut into a flush from the foreground, come back for what it leaves
+        if (s->period_us != 0)
+        {
+            ktimer_add(&s->timer, s->period_us);
+        }
+        return 0;
+    }
+
+    for (uint32_t i = 0; i < count; i++)
+    {
+        copy_rect(s, &rects[i], use_dma);
+        s->bytes += (rects[i].y2 - rects[i].y1) * (rects[i].x2 - rects[i].x1) * s->buf.bpp;
+    }
+    if (use_dma)
+    {
+        blit_wait();
+    }
+    if (count != 0)
+    {
+        s->flushes++;
+        s->rects += count;
+    }
+    s->flushing = false;
+    return count;
+}
+
+static void shadow_timer(void *data)
+{
+    flush_rects(data, false);
+}
+
+/**
+ * Bring the frame buffer up to date with the shadow and return how many
+ * rectangles that took. From thread context; the frame buffer is current
+ * when it returns.
+ */
+int shadow_flush(shadow_t *s)
+{
+    ktimer_cancel(&s->timer);
+    return flush_rects(s, true);
+}
+
+void shadow_print_stats(const shadow_t *s)
+{
+    printf("\n shadow: %d flushes, %d rects, %d KB copied, %d rects dirty",
+           s->flushes, s->rects, (uint32_t)(s->bytes >> 10), s->count);
+}
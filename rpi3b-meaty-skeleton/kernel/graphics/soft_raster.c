@@ -0,0 +1,438 @@
+#include <graphics/soft_raster.h>
+#include <graphics/pi_console.h>
+#include <kernel/systimer.h>
+#include <mem/kernel_alloc.h>
+#include <plibc/stdio.h>
+
+#if defined(__arm__)
+// kernel/arch/arm/neon-span.S
+extern void soft_span_neon(uint32_t *dst, uint32_t blocks, const uint32_t *lanes, const uint32_t *step);
+#endif
+
+#define ONE_CHANNEL (255 << 16) // 1.0 as a 16.16 colour channel
+
+typedef struct
+{
+    int32_t a, b; // E(x, y) = a * x + b * y + c, x and y in 12.4
+    int64_t c;    // fill rule bias included, inside is E >= 0
+} edge_t;
+
+typedef struct
+{
+    edge_t edge[3];
+    uint32_t x0, y0, x1, y1; // pixels whose centres may be inside, x1 and y1 exclusive
+    int32_t ox, oy;          // 12.4 position colour[] is given at
+    int32_t colour[3];       // R, G, B, 16.16
+    int32_t dx[3], dy[3];    // change per pixel, 16.16
+} setup_t;
+
+static setup_t setup[SOFT_MAX_TRIANGLES];
+static bool use_neon = true;
+
+/* NEON spans, or plain C ones to compare against */
+void soft_raster_set_neon(bool on)
+{
+    use_neon = on;
+}
+
+bool soft_raster_neon(void)
+{
+#if defined(__arm__)
+    return use_neon;
+#else
+    return false;
+#endif
+}
+
+static inline int64_t edge_at(const edge_t *e, uint32_t px, uint32_t py)
+{
+    return (int64_t)e->a * (int32_t)(px * 16 + 8) + (int64_t)e->b * (int32_t)(py * 16 + 8) + e->c;
+}
+
+static inline float unit(float f)
+{
+    return f < 0.0f ? 0.0f : f > 1.0f ? 1.0f : f;
+}
+
+static inline int32_t fixed(float f)
+{
+    // Steep gradients only cover a pixel or two, keep the conversion defined
+    return f < -(float)(1 << 30) ? -(1 << 30) : f > (float)(1 << 30) ? (1 << 30) : (int32_t)f;
+}
+
+/* False for triangles that cover no pixel centre on the surface */
+static bool setup_triangle(setup_t *t, const blit_surface_t *dst,
+                           const soft_vertex_t *v0, const soft_vertex_t *v1, const soft_vertex_t *v2)
+{
+    const soft_vertex_t *v[3] = {v0, v1, v2};
+    int32_t x[3], y[3], min_x, max_x, min_y, max_y;
+    float colour[3][3];
+    int64_t area;
+
+    area = (int64_t)(v1->x - v0->x) * (v2->y - v0->y) - (int64_t)(v1->y - v0->y) * (v2->x - v0->x);
+    if (area == 0)
+    {
+        return false;
+    }
+    if (area < 0)
+    {
+        // Both windings are drawn: make every edge function positive inside
+        v[1] = v2;
+        v[2] = v1;
+        area = -area;
+    }
+
+    for (uint32_t i = 0; i < 3; i++)
+    {
+        x[i] = v[i]->x;
+        y[i] = v[i]->y;
+        colour[i][0] = unit(v[i]->r);
+        colour[i][1] = unit(v[i]->g);
+        colour[i][2] = unit(v[i]->b);
+    }
+
+    min_x = x[0] < x[1] ? (x[0] < x[2] ? x[0] : x[2]) : (x[1] < x[2] ? x[1] : x[2]);
+    max_x = x[0] > x[1] ? (x[0] > x[2] ? x[0] : x[2]) : (x[1] > x[2] ? x[1] : x[2]);
+    min_y = y[0] < y[1] ? (y[0] < y[2] ? y[0] : y[2]) : (y[1] < y[2] ? y[1] : y[2]);
+    max_y = y[0] > y[1] ? (y[0] > y[2] ? y[0] : y[2]) : (y[1] > y[2] ? y[1] : y[2]);
+
+    // Pixel p is sampled at p * 16 + 8
+    max_x = ((max_x - 8) >> 4) + 1;
+    max_y = ((max_y - 8) >> 4) + 1;
+    if (max_x <= 0 || max_y <= 0)
+    {
+        return false;
+    }
+    t->x0 = (min_x + 7) >> 4;
+    t->y0 = (min_y + 7) >> 4;
+    t->x1 = (uint32_t)max_x > dst->width ? dst->width : (uint32_t)max_x;
+    t->y1 = (uint32_t)max_y > dst->height ? dst->height : (uint32_t)max_y;
+    if (t->x0 >= t->x1 || t->y0 >= t->y1)
+    {
+        return false;
+    }
+
+    for (uint32_t i = 0; i < 3; i++)
+    {
+        uint32_t j = i == 2 ? 0 : i + 1;
+        edge_t *e = &t->edge[i];
+
+        e->a = y[i] - y[j];
+        e->b = x[j] - x[i];
+        e->c = -(int64_t)e->a * x[i] - (int64_t)e->b * y[i];
+        // Top-left rule: a centre exactly on an edge belongs to the triangle
+        // to its right or below it, so shared edges are drawn once
+        if (!(e->a > 0 || (e->a == 0 && e->b > 0)))
+        {
+            e->c -= 1;
+        }
+    }
+
+    // Colour planes through the three vertices, per 12.4 unit scaled to 16.16 per pixel
+    float dx1 = x[1] - x[0], dy1 = y[1] - y[0];
+    float dx2 = x[2] - x[0], dy2 = y[2] - y[0];
+    float scale = 16.0f * ONE_CHANNEL / (float)area;
+
+    t->ox = x[0];
+    t->oy = y[0];
+    for (uint32_t ch = 0; ch < 3; ch++)
+    {
+        float d1 = colour[1][ch] - colour[0][ch];
+        float d2 = colour[2][ch] - colour[0][ch];
+
+        t->colour[ch] = fixed(colour[0][ch] * ONE_CHANNEL);
+        t->dx[ch] = fixed((d1 * dy2 - d2 * dy1) * scale);
+        t->dy[ch] = fixed((d2 * dx1 - d1 * dx2) * scale);
+    }
+    return true;
+}
+
+static inline uint32_t channel(uint32_t c)
+{
+    int32_t s = (int32_t)c;
+    return s < 0 ? 0 : s >= ONE_CHANNEL ? 255 : (uint32_t)s >> 16;
+}
+
+/* n pixels from p, colour c[] stepping by d[] (16.16, wrapping arithmetic) */
+static void fill_span(uint32_t *p, uint32_t n, uint32_t c[3], const int32_t d[3])
+{
+#if defined(__arm__)
+    if (use_neon && n >= 8)
+    {
+        uint32_t blocks = n / 8;
+        uint32_t lanes[24];
+        uint32_t step[3];
+
+        for (uint32_t ch = 0; ch < 3; ch++)
+        {
+            for (uint32_t i = 0; i < 8; i++)
+            {
+                lanes[ch * 8 + i] = c[ch] + i * (uint32_t)d[ch];
+            }
+            step[ch] = 8 * (uint32_t)d[ch];
+            c[ch] += blocks * step[ch];
+        }
+        soft_span_neon(p, blocks, lanes, step);
+        p += blocks * 8;
+        n -= blocks * 8;
+    }
+#endif
+    for (uint32_t i = 0; i < n; i++)
+    {
+        p[i] = 0xFF000000 | channel(c[2]) << 16 | channel(c[1]) << 8 | channel(c[0]);
+        c[0] += d[0];
+        c[1] += d[1];
+        c[2] += d[2];
+    }
+}
+
+/* Draw the part of t inside [x0, x1) x [y0, y1), returns pixels written */
+static uint32_t draw_in_tile(const blit_surface_t *dst, const setup_t *t,
+                             uint32_t x0, uint32_t y0, uint32_t x1, uint32_t y1)
+{
+    const edge_t *cross[3];
+    int32_t value[3]; // crossing edges at (x0, row)
+    uint32_t crossing = 0;
+    uint32_t pixels = 0;
+
+    x0 = t->x0 > x0 ? t->x0 : x0;
+    y0 = t->y0 > y0 ? t->y0 : y0;
+    x1 = t->x1 < x1 ? t->x1 : x1;
+    y1 = t->y1 < y1 ? t->y1 : y1;
+    if (x0 >= x1 || y0 >= y1)
+    {
+        return 0;
+    }
+
+    // Linear, so the corners bound each edge over the rectangle
+    for (uint32_t i = 0; i < 3; i++)
+    {
+        const edge_t *e = &t->edge[i];
+        int64_t c[4] = {edge_at(e, x0, y0), edge_at(e, x1 - 1, y0), edge_at(e, x0, y1 - 1), edge_at(e, x1 - 1, y1 - 1)};
+        int64_t lo = c[0], hi = c[0];
+
+        for (uint32_t k = 1; k < 4; k++)
+        {
+            lo = c[k] < lo ? c[k] : lo;
+            hi = c[k] > hi ? c[k] : hi;
+        }
+        if (hi < 0)
+        {
+            return 0;
+        }
+        if (lo < 0)
+        {
+            // Within a tile a crossing edge is at most (|a| + |b|) * 16 * SOFT_TILE_SIZE
+            cross[crossing] = e;
+            value[crossing++] = (int32_t)c[0];
+        }
+    }
+
+    for (uint32_t row = y0; row < y1; row++)
+    {
+        uint32_t left = x0, right = x1;
+
+        // Solve E(x0 + k) = value + k * 16a >= 0 for k on each crossing edge
+        for (uint32_t i = 0; i < crossing; i++)
+        {
+            int32_t v = value[i];
+            int32_t step = cross[i]->a * 16;
+
+            value[i] += cross[i]->b * 16;
+            if (step > 0)
+            {
+                if (v < 0)
+                {
+                    uint32_t k = (uint32_t)(-v + step - 1) / (uint32_t)step;
+                    left = x0 + k > left ? x0 + k : left;
+                }
+            }
+            else if (v < 0)
+            {
+                right = left;
+            }
+            else if (step < 0)
+            {
+                uint32_t k = (uint32_t)v / (uint32_t)-step + 1;
+                right = x0 + k < right ? x0 + k : right;
+            }
+        }
+        if (left >= right)
+        {
+            continue;
+        }
+
+        int32_t sx = (int32_t)(left * 16 + 8) - t->ox;
+        int32_t sy = (int32_t)(row * 16 + 8) - t->oy;
+        uint32_t c[3];
+
+        for (uint32_t ch = 0; ch < 3; ch++)
+        {
+            c[ch] = t->colour[ch] + (int32_t)(((int64_t)t->dx[ch] * sx + (int64_t)t->dy[ch] * sy) >> 4);
+        }
+        fill_span((uint32_t *)(dst->base + row * dst->pitch) + left, right - left, c, t->dx);
+        pixels += right - left;
+    }
+    return pixels;
+}
+
+static uint32_t draw_tiles(const blit_surface_t *dst, uint32_t count)
+{
+    uint32_t pixels = 0;
+
+    for (uint32_t ty = 0; ty < dst->height; ty += SOFT_TILE_SIZE)
+    {
+        uint32_t ty1 = ty + SOFT_TILE_SIZE < dst->height ? ty + SOFT_TILE_SIZE : dst->height;
+
+        for (uint32_t tx = 0; tx < dst->width; tx += SOFT_TILE_SIZE)
+        {
+            uint32_t tx1 = tx + SOFT_TILE_SIZE < dst->width ? tx + SOFT_TILE_SIZE : dst->width;
+
+            // In list order, so later triangles still land on top
+            for (uint32_t i = 0; i < count; i++)
+            {
+                pixels += draw_in_tile(dst, &setup[i], tx, ty, tx1, ty1);
+            }
+        }
+    }
+    return pixels;
+}
+
+void soft_raster_clear(const blit_surface_t *dst, uint32_t colour)
+{
+    for (uint32_t y = 0; y < dst->height; y++)
+    {
+        uint32_t *p = (uint32_t *)(dst->base + y * dst->pitch);
+
+        for (uint32_t x = 0; x < dst->width; x++)
+        {
+            p[x] = colour;
+        }
+    }
+}
+
+/**
+ * Draw index_count / 3 triangles from an 8 bit index list, like the V3D's
+ * indexed primitive list. Returns the number of pixels written, or -1 if
+ * the surface is not 32 bits per pixel.
+ */
+int soft_raster_triangles(const blit_surface_t *dst, const soft_vertex_t *vertices,
+                          const uint8_t *indices, uint32_t index_count)
+{
+    uint32_t pixels = 0;
+    uint32_t next = 0;
+
+    if (dst->bpp != 4)
+    {
+        printf("SOFT RASTER ERROR: %d bytes per pixel, only 4 is supported\n", dst->bpp);
+        return -1;
+    }
+
+    while (next + 3 <= index_count)
+    {
+        uint32_t count = 0;
+
+        for (; next + 3 <= index_count && count < SOFT_MAX_TRIANGLES; next += 3)
+        {
+            if (setup_triangle(&setup[count], dst, &vertices[indices[next]],
+                               &vertices[indices[next + 1]], &vertices[indices[next + 2]]))
+            {
+                count++;
+            }
+        }
+        pixels += draw_tiles(dst, count);
+    }
+    return pixels;
+}
+
+/*----------------------------------------------------------------------
+ * Benchmark: random vertex coloured triangles of a few sizes into the
+ * console frame buffer, with NEON spans and with C spans.
+ *----------------------------------------------------------------------*/
+
+#define BENCH_TRIANGLES 85 // 255 vertices, all an 8 bit index can reach
+#define BENCH_PASSES 20
+
+static uint32_t bench_seed = 0x2545F491;
+
+static uint32_t bench_random(uint32_t range)
+{
+    bench_seed = bench_seed * 1664525 + 1013904223;
+    return (bench_seed >> 8) % range;
+}
+
+static void bench_triangles(const blit_surface_t *s, soft_vertex_t *v, uint8_t *indices, uint32_t size)
+{
+    for (uint32_t i = 0; i < BENCH_TRIANGLES * 3; i++)
+    {
+        if (i % 3 == 0)
+        {
+            // Centre of the next triangle, far enough in that it stays on screen
+            v[i].x = (size / 2 + bench_random(s->width - size)) << 4;
+            v[i].y = (size / 2 + bench_random(s->height - size)) << 4;
+        }
+        else
+        {
+            v[i].x = v[i - i % 3].x + (bench_random(size << 4)) - (size << 3);
+            v[i].y = v[i - i % 3].y + (bench_random(size << 4)) - (size << 3);
+        }
+        v[i].z = 1.0f;
+        v[i].inv_w = 1.0f;
+        v[i].r = bench_random(256) / 255.0f;
+        v[i].g = bench_random(256) / 255.0f;
+        v[i].b = bench_random(256) / 255.0f;
+        indices[i] = i;
+    }
+}
+
+static void bench_run(const blit_surface_t *s, const soft_vertex_t *v, const uint8_t *indices, bool neon,
+                      uint32_t *tris_per_sec, uint32_t *mpix_per_sec)
+{
+    uint64_t start, usecs;
+    uint32_t pixels = 0;
+
+    soft_raster_set_neon(neon);
+    start = timer_getTickCount64();
+    for (uint32_t pass = 0; pass < BENCH_PASSES; pass++)
+    {
+        pixels += soft_raster_triangles(s, v, indices, BENCH_TRIANGLES * 3);
+    }
+    usecs = timer_getTickCount64() - start;
+
+    *tris_per_sec = usecs ? (uint32_t)((uint64_t)BENCH_TRIANGLES * BENCH_PASSES * 1000000 / usecs) : 0;
+    *mpix_per_sec = usecs ? (uint32_t)(pixels / usecs) : 0;
+}
+
+void show_soft_raster_benchmark(void)
+{
+    static const uint32_t sizes[] = {8, 32, 128, 256};
+    uint32_t width = 0, height = 0, depth = 0, pitch = 0;
+    uint32_t fb = get_console_frame_buffer(640, 480, 32);
+    soft_vertex_t *v = mem_allocate(BENCH_TRIANGLES * 3 * sizeof(soft_vertex_t));
+    uint8_t *indices = mem_allocate(BENCH_TRIANGLES * 3);
+    bool was_neon = use_neon;
+
+    if (fb == 0 || v == 0 || indices == 0)
+    {
+        printf("\n soft raster benchmark: no frame buffer or out of memory");
+        return;
+    }
+    get_console_width_height_depth(&width, &height, &depth, &pitch);
+    blit_surface_t s = {.base = fb, .pitch = pitch, .width = width, .height = height, .bpp = 4};
+
+    printf("\n size  neon tri/s  neon Mpix/s  c tri/s  c Mpix/s");
+    for (uint32_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++)
+    {
+        uint32_t neon_tris, neon_mpix, c_tris, c_mpix;
+
+        bench_triangles(&s, v, indices, sizes[i]);
+        soft_raster_clear(&s, 0xFF000000);
+        bench_run(&s, v, indices, true, &neon_tris, &neon_mpix);
+        soft_raster_clear(&s, 0xFF000000);
+        bench_run(&s, v, indices, false, &c_tris, &c_mpix);
+        printf("\n %d  %d  %d  %d  %d", sizes[i], neon_tris, neon_mpix, c_tris, c_mpix);
+    }
+    soft_raster_set_neon(was_neon);
+    mem_deallocate(indices);
+    mem_deallocate(v);
+}
@@ -0,0 +1,307 @@
+#include<graphics/v3d_cl.h>
+#include <plibc/stdio.h>
+
+void v3d_cl_init (v3d_cl_t* cl, void* arm, uint32_t bus, uint32_t size) {
+	cl->base = (uint8_t*)arm;
+	cl->bus = bus;
+	cl->size = size;
+	cl->used = 0;
+	cl->overflow = false;
+	cl->relocs = 0;
+	cl->max_relocs = 0;
+	cl->reloc_count = 0;
+}
+
+/* Record where bus addresses land in offsets[0..max_relocs) from now on */
+void v3d_cl_track_relocs (v3d_cl_t* cl, uint32_t* offsets, uint32_t max_relocs) {
+	cl->relocs = offsets;
+	cl->max_relocs = max_relocs;
+	cl->reloc_count = 0;
+}
+
+/* Start over in the same memory, e.g. for the next frame */
+void v3d_cl_reset (v3d_cl_t* cl) {
+	cl->used = 0;
+	cl->overflow = false;
+	cl->reloc_count = 0;
+}
+
+bool v3d_cl_ok (const v3d_cl_t* cl) {
+	return !cl->overflow;
+}
+
+uint32_t v3d_cl_start (const v3d_cl_t* cl) {
+	return cl->bus;
+}
+
+/* Bus address one past the last byte, what the executor's end register wants */
+uint32_t v3d_cl_end (const v3d_cl_t* cl) {
+	return cl->bus + cl->used;
+}
+
+uint32_t v3d_cl_offset (const v3d_cl_t* cl) {
+	return cl->used;
+}
+
+/* Room for n more bytes, or NULL and the list is marked overflowed */
+static uint8_t* cl_reserve (v3d_cl_t* cl, uint32_t n) {
+	uint8_t* p;
+	if (cl->overflow) return 0;
+	if (n > cl->size - cl->used) {
+		printf("V3D CL ERROR: list at %x is full (%d of %d bytes)\n", cl->bus, cl->used, cl->size);
+		cl->overflow = true;
+		return 0;
+	}
+	p = cl->base + cl->used;
+	cl->used += n;
+	return p;
+}
+
+static inline void put_u16 (uint8_t* p, uint16_t d) {
+	p[0] = d;
+	p[1] = d >> 8;
+}
+
+static inline void put_u32 (uint8_t* p, uint32_t d) {
+	p[0] = d;
+	p[1] = d >> 8;
+	p[2] = d >> 16;
+	p[3] = d >> 24;
+}
+
+static inline uint32_t get_u32 (const uint8_t* p) {
+	return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+void v3d_cl_u8 (v3d_cl_t* cl, uint8_t d) {
+	uint8_t* p = cl_reserve(cl, 1);
+	if (p) p[0] = d;
+}
+
+void v3d_cl_u16 (v3d_cl_t* cl, uint16_t d) {
+	uint8_t* p = cl_reserve(cl, 2);
+	if (p) put_u16(p, d);
+}
+
+void v3d_cl_u32 (v3d_cl_t* cl, uint32_t d) {
+	uint8_t* p = cl_reserve(cl, 4);
+	if (p) put_u32(p, d);
+}
+
+void v3d_cl_f32 (v3d_cl_t* cl, float f) {
+	union { float f; uint32_t u; } bits = { .f = f };
+	v3d_cl_u32(cl, bits.u);
+}
+
+/* Write a bus address into reserved space at p and record where it went */
+static void put_addr (v3d_cl_t* cl, uint8_t* p, uint32_t bus) {
+	put_u32(p, bus);
+	if (cl->relocs == 0) return;
+	if (cl->reloc_count == cl->max_relocs) {
+		printf("V3D CL ERROR: more than %d relocations in list at %x\n", cl->max_relocs, cl->bus);
+		cl->overflow = true;
+		return;
+	}
+	cl->relocs[cl->reloc_count++] = p - cl->base;
+}
+
+/* A bus address; its position is recorded for v3d_cl_relocate */
+void v3d_cl_addr (v3d_cl_t* cl, uint32_t bus) {
+	uint8_t* p = cl_reserve(cl, 4);
+	if (p) put_addr(cl, p, bus);
+}
+
+/* Zero pad to a multiple of align (a power of two) from the list's bus address */
+void v3d_cl_align (v3d_cl_t* cl, uint32_t align) {
+	while (!cl->overflow && ((cl->bus + cl->used) & (align - 1)))
+		v3d_cl_u8(cl, 0);
+}
+
+bool v3d_cl_patch_u32 (v3d_cl_t* cl, uint32_t offset, uint32_t d) {
+	if (offset > cl->used || cl->used - offset < 4) return false;
+	put_u32(cl->base + offset, d);
+	return true;
+}
+
+/**
+ * A buffer of old_size bytes moved from old_bus to new_bus: fix every
+ * recorded address that points into it. Returns how many were changed.
+ */
+uint32_t v3d_cl_relocate (v3d_cl_t* cl, uint32_t old_bus, uint32_t old_size, uint32_t new_bus) {
+	uint32_t changed = 0;
+	for (uint32_t i = 0; i < cl->reloc_count; i++) {
+		uint8_t* p = cl->base + cl->relocs[i];
+		uint32_t addr = get_u32(p);
+		if (addr - old_bus < old_size) {
+			put_u32(p, addr - old_bus + new_bus);
+			changed++;
+		}
+	}
+	return changed;
+}
+
+/* Opcode byte plus payload, reserved together so a packet is never cut */
+static uint8_t* cl_packet (v3d_cl_t* cl, GL_CONTROL op, uint32_t payload) {
+	uint8_t* p = cl_reserve(cl, 1 + payload);
+	if (p) *p++ = op;
+	return p;
+}
+
+void v3d_cl_halt (v3d_cl_t* cl) {
+	cl_packet(cl, GL_HALT, 0);
+}
+
+void v3d_cl_nop (v3d_cl_t* cl) {
+	cl_packet(cl, GL_NOP, 0);
+}
+
+void v3d_cl_flush (v3d_cl_t* cl) {
+	cl_packet(cl, GL_FLUSH, 0);
+}
+
+void v3d_cl_flush_all_state (v3d_cl_t* cl) {
+	cl_packet(cl, GL_FLUSH_ALL_STATE, 0);
+}
+
+void v3d_cl_start_tile_binning (v3d_cl_t* cl) {
+	cl_packet(cl, GL_START_TILE_BINNING, 0);
+}
+
+void v3d_cl_branch (v3d_cl_t* cl, uint32_t bus) {
+	uint8_t* p = cl_packet(cl, GL_BRANCH, 4);
+	if (p) put_addr(cl, p, bus);
+}
+
+void v3d_cl_branch_to_sublist (v3d_cl_t* cl, uint32_t bus) {
+	uint8_t* p = cl_packet(cl, GL_BRANCH_TO_SUBLIST, 4);
+	if (p) put_addr(cl, p, bus);
+}
+
+void v3d_cl_return_from_sublist (v3d_cl_t* cl) {
+	cl_packet(cl, GL_RETURN_FROM_SUBLIST, 0);
+}
+
+/* Store the resolved colour buffer of the current tile, the last one also ends the frame */
+void v3d_cl_store_multisample (v3d_cl_t* cl, bool end_of_frame) {
+	cl_packet(cl, end_of_frame ? GL_STORE_MULTISAMPLE_END : GL_STORE_MULTISAMPLE, 0);
+}
+
+void v3d_cl_store_tile_buffer (v3d_cl_t* cl, uint16_t flags, uint32_t bus) {
+	uint8_t* p = cl_packet(cl, GL_STORE_TILE_BUFFER, 6);
+	if (p) {
+		put_u16(p, flags);
+		if (bus) put_addr(cl, &p[2], bus);
+		else put_u32(&p[2], 0);										// Nothing stored, no address to track
+	}
+}
+
+void v3d_cl_indexed_primitive_list (v3d_cl_t* cl, PRIMITIVE mode, uint32_t count, uint32_t indices, uint32_t max_index) {
+	uint8_t* p = cl_packet(cl, GL_INDEXED_PRIMITIVE_LIST, 13);
+	if (p) {
+		p[0] = mode;												// 8 bit indices
+		put_u32(&p[1], count);
+		put_addr(cl, &p[5], indices);
+		put_u32(&p[9], max_index);
+	}
+}
+
+void v3d_cl_vertex_array_primitives (v3d_cl_t* cl, PRIMITIVE mode, uint32_t count, uint32_t first) {
+	uint8_t* p = cl_packet(cl, GL_VERTEX_ARRAY_PRIMITIVES, 9);
+	if (p) {
+		p[0] = mode;
+		put_u32(&p[1], count);
+		put_u32(&p[5], first);
+	}
+}
+
+void v3d_cl_primitive_list_format (v3d_cl_t* cl, uint8_t format) {
+	uint8_t* p = cl_packet(cl, GL_PRIMITIVE_LIST_FORMAT, 1);
+	if (p) p[0] = format;
+}
+
+void v3d_cl_nv_shader_state (v3d_cl_t* cl, uint32_t record) {
+	uint8_t* p = cl_packet(cl, GL_NV_SHADER_STATE, 4);
+	if (p) put_addr(cl, p, record);
+}
+
+void v3d_cl_config_state (v3d_cl_t* cl, uint8_t flags0, uint8_t flags1, uint8_t flags2) {
+	uint8_t* p = cl_packet(cl, GL_CONFIG_STATE, 3);
+	if (p) {
+		p[0] = flags0;
+		p[1] = flags1;
+		p[2] = flags2;
+	}
+}
+
+void v3d_cl_clip_window (v3d_cl_t* cl, uint16_t left, uint16_t bottom, uint16_t wth, uint16_t ht) {
+	uint8_t* p = cl_packet(cl, GL_CLIP_WINDOW, 8);
+	if (p) {
+		put_u16(&p[0], left);
+		put_u16(&p[2], bottom);
+		put_u16(&p[4], wth);
+		put_u16(&p[6], ht);
+	}
+}
+
+void v3d_cl_viewport_offset (v3d_cl_t* cl, int16_t x, int16_t y) {
+	uint8_t* p = cl_packet(cl, GL_VIEWPORT_OFFSET, 4);
+	if (p) {
+		put_u16(&p[0], x);
+		put_u16(&p[2], y);
+	}
+}
+
+void v3d_cl_tile_binning_config (v3d_cl_t* cl, uint32_t tile_alloc, uint32_t tile_alloc_size, uint32_t tile_state, uint8_t bin_wth, uint8_t bin_ht, uint8_t flags) {
+	uint8_t* p = cl_packet(cl, GL_TILE_BINNING_CONFIG, 15);
+	if (p) {
+		put_addr(cl, &p[0], tile_alloc);
+		put_u32(&p[4], tile_alloc_size);
+		put_addr(cl, &p[8], tile_state);
+		p[12] = bin_wth;
+		p[13] = bin_ht;
+		p[14] = flags;
+	}
+}
+
+void v3d_cl_tile_render_config (v3d_cl_t* cl, uint32_t render_buffer, uint16_t wth, uint16_t ht, uint16_t flags) {
+	uint8_t* p = cl_packet(cl, GL_TILE_RENDER_CONFIG, 10);
+	if (p) {
+		put_addr(cl, &p[0], render_buffer);
+		put_u16(&p[4], wth);
+		put_u16(&p[6], ht);
+		put_u16(&p[8], flags);
+	}
+}
+
+/* 32 bit colour is given twice (the field is 64 bits), then 24 bit Z + 8 bit VG mask and stencil */
+void v3d_cl_clear_colors (v3d_cl_t* cl, uint32_t colour, uint32_t clear_zs, uint8_t stencil) {
+	uint8_t* p = cl_packet(cl, GL_CLEAR_COLORS, 13);
+	if (p) {
+		put_u32(&p[0], colour);
+		put_u32(&p[4], colour);
+		put_u32(&p[8], clear_zs);
+		p[12] = stencil;
+	}
+}
+
+void v3d_cl_tile_coordinates (v3d_cl_t* cl, uint8_t col, uint8_t row) {
+	uint8_t* p = cl_packet(cl, GL_TILE_COORDINATES, 2);
+	if (p) {
+		p[0] = col;
+		p[1] = row;
+	}
+}
+
+void v3d_cl_nv_shader_record (v3d_cl_t* cl, uint8_t flags, uint8_t stride, uint8_t num_uniforms, uint8_t num_varyings, uint32_t code, uint32_t uniforms, uint32_t vertices) {
+	uint8_t* p = cl_reserve(cl, 16);
+	if (p) {
+		p[0] = flags;
+		p[1] = stride;
+		p[2] = num_uniforms;
+		p[3] = num_varyings;
+		put_addr(cl, &p[4], code);
+		if (uniforms) put_addr(cl, &p[8], uniforms);
+		else put_u32(&p[8], 0);
+		put_addr(cl, &p[12], vertices);
+	}
+}
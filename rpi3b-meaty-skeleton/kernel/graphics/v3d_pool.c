@@ -0,0 +1,267 @@
+#include<graphics/v3d_pool.h>
+#include<graphics/v3d.h>
+#include<mem/dma_alloc.h>
+#include <plibc/stdio.h>
+#include <plibc/string.h>
+
+extern uint32_t GPUaddrToARMaddr (uint32_t BUSaddress);
+
+#define CHUNK_ALIGN		0x1000
+
+/* Handles are (generation << 16) | (descriptor + 1), so a stale one is caught */
+#define HANDLE(i)		(((uint32_t)blocks[i].gen << 16) | ((i) + 1))
+#define HANDLE_INDEX(h)	(((h) & 0xFFFF) - 1)
+#define HANDLE_GEN(h)	((h) >> 16)
+
+typedef struct pool_chunk {
+	uint32_t handle;						// Firmware handle, 0 for an unused slot
+	uint32_t bus;							// Locked bus address
+	uint32_t size;
+	int16_t first;							// First block, blocks follow in address order
+} pool_chunk_t;
+
+typedef struct pool_block {
+	uint32_t offset;						// From the chunk's bus address
+	uint32_t size;
+	uint8_t chunk;
+	bool used;
+	uint16_t gen;							// Bumped every time the block is handed out
+	int16_t next;							// Next block in the chunk, or next spare descriptor
+} pool_block_t;
+
+static pool_chunk_t chunks[V3D_POOL_MAX_CHUNKS];
+static pool_block_t blocks[V3D_POOL_MAX_BLOCKS];
+static int16_t spare = -1;					// Descriptors not describing any memory
+static bool pool_ready = false;
+static v3d_pool_stats_t stats = { 0 };
+
+static void pool_init (void) {
+	for (int16_t i = 0; i < V3D_POOL_MAX_BLOCKS; i++) {
+		blocks[i].used = false;
+		blocks[i].next = i + 1 < V3D_POOL_MAX_BLOCKS ? i + 1 : -1;
+	}
+	spare = 0;
+	pool_ready = true;
+}
+
+static int16_t take_descriptor (void) {
+	int16_t i = spare;
+	if (i >= 0) spare = blocks[i].next;
+	return i;
+}
+
+static void give_descriptor (int16_t i) {
+	blocks[i].used = false;
+	blocks[i].next = spare;
+	spare = i;
+}
+
+/* Cut block i at `at` bytes, the second part is free. False when out of descriptors */
+static bool split (int16_t i, uint32_t at) {
+	int16_t n = take_descriptor();
+	if (n < 0) return false;
+	blocks[n].offset = blocks[i].offset + at;
+	blocks[n].size = blocks[i].size - at;
+	blocks[n].chunk = blocks[i].chunk;
+	blocks[n].used = false;
+	blocks[n].next = blocks[i].next;
+	blocks[i].size = at;
+	blocks[i].next = n;
+	return true;
+}
+
+/* Block index of the first fit in chunk c, or -1 */
+static int16_t fit (uint32_t c, uint32_t size, uint32_t align) {
+	for (int16_t i = chunks[c].first; i >= 0; i = blocks[i].next) {
+		uint32_t bus, pad;
+		if (blocks[i].used) continue;
+		bus = chunks[c].bus + blocks[i].offset;
+		pad = ((bus + align - 1) & ~(align - 1)) - bus;
+		if (pad > blocks[i].size || blocks[i].size - pad < size) continue;
+		if (pad) {
+			if (!split(i, pad)) continue;							// Leading pad stays free
+			i = blocks[i].next;
+		}
+		if (blocks[i].size > size) split(i, size);					// Out of descriptors: it gets the whole block
+		blocks[i].used = true;
+		blocks[i].gen++;
+		return i;
+	}
+	return -1;
+}
+
+/* A new chunk of at least size bytes aligned to align, or -1 */
+static int new_chunk (uint32_t size, uint32_t align) {
+	int c;
+	int16_t b;
+
+	for (c = 0; c < V3D_POOL_MAX_CHUNKS && chunks[c].handle; c++);
+	if (c == V3D_POOL_MAX_CHUNKS) {
+		printf("V3D POOL ERROR: all %d chunks are in use\n", V3D_POOL_MAX_CHUNKS);
+		return -1;
+	}
+	b = take_descriptor();
+	if (b < 0) {
+		printf("V3D POOL ERROR: more than %d blocks\n", V3D_POOL_MAX_BLOCKS);
+		return -1;
+	}
+
+	size = size > V3D_POOL_CHUNK_SIZE ? (size + CHUNK_ALIGN - 1) & ~(CHUNK_ALIGN - 1) : V3D_POOL_CHUNK_SIZE;
+	chunks[c].handle = v3d_mem_alloc(size, align > CHUNK_ALIGN ? align : CHUNK_ALIGN, MEM_FLAG_COHERENT | MEM_FLAG_NO_INIT);
+	stats.mailbox_calls++;
+	if (chunks[c].handle == 0) {
+		printf("V3D POOL ERROR: the firmware has no %d bytes of GPU memory\n", size);
+		give_descriptor(b);
+		return -1;
+	}
+	chunks[c].bus = v3d_mem_lock(chunks[c].handle);
+	stats.mailbox_calls++;
+	if (chunks[c].bus == 0) {
+		printf("V3D POOL ERROR: the firmware would not lock %d bytes of GPU memory\n", size);
+		v3d_mem_free(chunks[c].handle);
+		stats.mailbox_calls++;
+		chunks[c].handle = 0;
+		give_descriptor(b);
+		return -1;
+	}
+	chunks[c].size = size;
+	chunks[c].first = b;
+
+	blocks[b].offset = 0;
+	blocks[b].size = size;
+	blocks[b].chunk = c;
+	blocks[b].used = false;
+	blocks[b].next = -1;
+
+	stats.chunks++;
+	stats.reserved += size;
+	return c;
+}
+
+/**
+ * An aligned piece of GPU memory. align is a power of two; sizes are
+ * rounded up to V3D_POOL_MIN_ALIGN. With MEM_FLAG_ZERO the piece is
+ * cleared, like a fresh firmware allocation would be.
+ */
+uint32_t v3d_pool_alloc (uint32_t size, uint32_t align, uint32_t flags) {
+	int16_t b = -1;
+	int c;
+
+	if (!pool_ready) pool_init();
+	if (size == 0 || (align & (align - 1))) {
+		printf("V3D POOL ERROR: bad request for %d bytes aligned to %d\n", size, align);
+		stats.failures++;
+		return 0;
+	}
+	align = align < V3D_POOL_MIN_ALIGN ? V3D_POOL_MIN_ALIGN : align;
+	size = (size + V3D_POOL_MIN_ALIGN - 1) & ~(V3D_POOL_MIN_ALIGN - 1);
+
+	for (c = 0; c < V3D_POOL_MAX_CHUNKS && b < 0; c++)
+		if (chunks[c].handle) b = fit(c, size, align);
+	if (b < 0) {
+		c = new_chunk(size, align);
+		if (c >= 0) b = fit(c, size, align);
+	}
+	if (b < 0) {
+		stats.failures++;
+		return 0;
+	}
+
+	if (flags & MEM_FLAG_ZERO) {
+		void* arm = v3d_pool_arm(HANDLE(b));
+		memset(arm, 0, blocks[b].size);
+		dma_cache_clean(arm, blocks[b].size);						// The V3D reads memory, not the cache
+	}
+	stats.allocs++;
+	stats.blocks++;
+	stats.used += blocks[b].size;
+	if (stats.used > stats.peak) stats.peak = stats.used;
+	return HANDLE(b);
+}
+
+static pool_block_t* block_of (uint32_t handle) {
+	uint32_t i = HANDLE_INDEX(handle);
+	if (i >= V3D_POOL_MAX_BLOCKS || !blocks[i].used || blocks[i].gen != HANDLE_GEN(handle)) return 0;
+	return &blocks[i];
+}
+
+/* Back to its chunk's free space, merged with free neighbours */
+bool v3d_pool_free (uint32_t handle) {
+	pool_block_t* b = block_of(handle);
+	int16_t i = HANDLE_INDEX(handle), prev = -1, n;
+
+	if (b == 0) {
+		printf("V3D POOL ERROR: %x is not an allocated handle\n", handle);
+		return false;
+	}
+	b->used = false;
+	stats.frees++;
+	stats.blocks--;
+	stats.used -= b->size;
+
+	n = b->next;
+	if (n >= 0 && !blocks[n].used) {
+		b->size += blocks[n].size;
+		b->next = blocks[n].next;
+		give_descriptor(n);
+	}
+	for (int16_t j = chunks[b->chunk].first; j != i; j = blocks[j].next) prev = j;
+	if (prev >= 0 && !blocks[prev].used) {
+		blocks[prev].size += b->size;
+		blocks[prev].next = b->next;
+		give_descriptor(i);
+	}
+	return true;
+}
+
+/* Give chunks with nothing allocated back to the firmware, returns how many */
+uint32_t v3d_pool_trim (void) {
+	uint32_t released = 0;
+	for (int c = 0; c < V3D_POOL_MAX_CHUNKS; c++) {
+		int16_t b = chunks[c].first;
+		if (!chunks[c].handle || blocks[b].used || blocks[b].next >= 0) continue;
+		v3d_mem_unlock(chunks[c].handle);
+		v3d_mem_free(chunks[c].handle);
+		stats.mailbox_calls += 2;
+		stats.chunks--;
+		stats.reserved -= chunks[c].size;
+		give_descriptor(b);
+		chunks[c].handle = 0;
+		released++;
+	}
+	return released;
+}
+
+uint32_t v3d_pool_bus (uint32_t handle) {
+	pool_block_t* b = block_of(handle);
+	return b ? chunks[b->chunk].bus + b->offset : 0;
+}
+
+void* v3d_pool_arm (uint32_t handle) {
+	uint32_t bus = v3d_pool_bus(handle);
+	return bus ? (void*)(uintptr_t)GPUaddrToARMaddr(bus) : 0;
+}
+
+uint32_t v3d_pool_size (uint32_t handle) {
+	pool_block_t* b = block_of(handle);
+	return b ? b->size : 0;
+}
+
+void v3d_pool_get_stats (v3d_pool_stats_t* s) {
+	*s = stats;
+	s->largest_free = 0;
+	for (int c = 0; c < V3D_POOL_MAX_CHUNKS; c++) {
+		if (!chunks[c].handle) continue;
+		for (int16_t i = chunks[c].first; i >= 0; i = blocks[i].next)
+			if (!blocks[i].used && blocks[i].size > s->largest_free) s->largest_free = blocks[i].size;
+	}
+}
+
+void v3d_pool_print_stats (void) {
+	v3d_pool_stats_t s;
+	v3d_pool_get_stats(&s);
+	printf("\n v3d pool: %d chunks, %d KB from the firmware, %d KB used in %d blocks (peak %d KB), largest free %d KB",
+		s.chunks, s.reserved >> 10, s.used >> 10, s.blocks, s.peak >> 10, s.largest_free >> 10);
+	printf("\n v3d pool: %d allocations, %d frees, %d failed, %d mailbox calls",
+		s.allocs, s.frees, s.failures, s.mailbox_calls);
+}
@@ -0,0 +1,126 @@
+#include <stddef.h>
+#include <stdint.h>
+#include <kernel/idle.h>
+#include <kernel/ktimer.h>
+#include <kernel/softirq.h>
+#include <kernel/generic-timer.h>
+#include <kernel/rpi-interrupts.h>
+
+#define NUM_CORES 4
+
+typedef struct
+{
+    volatile uint64_t idle_ticks;  // generic timer ticks spent in WFI
+    volatile uint64_t idle_since;  // 0 when the core is running
+    volatile uint64_t wakeups;
+    uint64_t window_start;
+    uint64_t window_idle;
+    uint32_t utilisation;
+} cpu_idle_stats_t;
+
+static cpu_idle_stats_t idle_stats[NUM_CORES];
+
+static inline uint64_t ticks_to_usecs(uint64_t ticks)
+{
+    return (ticks * 1000000) / generic_timer_frequency();
+}
+
+/**
+ * One pass of the idle loop. Interrupts stay masked across the check and
+ * the WFI so a wakeup can not slip in between; WFI still returns on a
+ * pending IRQ and the IRQ is taken once they are unmasked again.
+ */
+void cpu_idle_once(void)
+{
+    cpu_idle_stats_t *stats = &idle_stats[CORE_ID()];
+    uint64_t start;
+
+    DISABLE_INTERRUPTS();
+
+    // Bottom halves left over by an interrupt storm run here, never sleep on them
+    if (softirq_pending())
+    {
+        ENABLE_INTERRUPTS();
+        do_softirq();
+        return;
+    }
+
+    // Core 0 owns the ktimer queues, its compares always hold the next deadline
+    if (CORE_ID() == 0 && ktimer_next_expiry() <= ktimer_now())
+    {
+        ENABLE_INTERRUPTS();
+        return;
+    }
+
+    generic_timer_suspend_tick();
+    start = generic_timer_count();
+    stats->idle_since = start;
+
+    __asm__ __volatile__("dsb\n\twfi" ::
+                             : "memory");
+
+    stats->idle_ticks += generic_timer_count() - start;
+    stats->idle_since = 0;
+    stats->wakeups++;
+    generic_timer_resume_tick();
+
+    ENABLE_INTERRUPTS();
+}
+
+void cpu_idle(void)
+{
+    while (1)
+    {
+        cpu_idle_once();
+    }
+}
+
+uint64_t cpu_idle_time_us(uint32_t core)
+{
+    cpu_idle_stats_t *stats = &idle_stats[core & (NUM_CORES - 1)];
+    uint64_t idle = stats->idle_ticks;
+    uint64_t since = stats->idle_since;
+
+    if (since != 0)
+    {
+        idle += generic_timer_count() - since;
+    }
+    return ticks_to_usecs(idle);
+}
+
+uint64_t cpu_idle_wakeups(uint32_t core)
+{
+    return idle_stats[core & (NUM_CORES - 1)].wakeups;
+}
+
+/**
+ * Busy percentage of `core` over the last completed window of at least
+ * IDLE_UTILISATION_WINDOW_US. The window rolls over when this is read.
+ */
+uint32_t cpu_utilisation(uint32_t core)
+{
+    cpu_idle_stats_t *stats = &idle_stats[core & (NUM_CORES - 1)];
+    uint64_t now = generic_timer_count();
+    uint64_t elapsed = now - stats->window_start;
+    uint64_t idle = stats->idle_ticks;
+    uint64_t since = stats->idle_since;
+
+    if (since != 0)
+    {
+        idle += now - since;
+    }
+
+    if (elapsed >= generic_timer_usecs_to_ticks(IDLE_UTILISATION_WINDOW_US))
+    {
+        uint64_t idle_in_window = idle - stats->window_idle;
+
+        if (idle_in_window > elapsed)
+        {
+            idle_in_window = elapsed;
+        }
+        stats->utilisation = (uint32_t)(((elapsed - idle_in_window) * 100) / elapsed);
+        stats->window_start = now;
+        stats->window_idle = idle;
+    }
+    return stats->utilisation;
+}
@@ -8,6 +8,10 @@
 #include <device/dma.h>
 #include <device/usbd.h>
 #include <fs/fat.h>
+#include <kernel/fiq.h>
+#include <kernel/generic-timer.h>
+#include <kernel/idle.h>
+#include <kernel/ktimer.h>
 #include <kernel/rpi-armtimer.h>
 #include <kernel/rpi-interrupts.h>
 #include <kernel/systimer.h>
@@ -16,8 +20,11 @@
 #include <mem/kernel_alloc.h>
 #include <graphics/v3d.h>
 #include <graphics/pi_console.h>
+#include <graphics/framebuffer.h>
 #include <graphics/opengl_es.h>
 #include <graphics/opengl_es2.h>
+#include <graphics/soft_raster.h>
+#include <graphics/v3d_pool.h>
 
 extern uint32_t __kernel_end;
 
@@ -33,26 +40,9 @@ extern uint32_t __kernel_end;
 
 // #define COLOUR_DELTA    0.05
 
-// static uint32_t shader1[18] = {  // Vertex Color Shader
-// 		0x958e0dbf, 0xd1724823,   /* mov r0, vary; mov r3.8d, 1.0 */
-// 		0x818e7176, 0x40024821,   /* fadd r0, r0, r5; mov r1, vary */
-//         0x818e7376, 0x10024862,   /* fadd r1, r1, r5; mov r2, vary */
-// 		0x819e7540, 0x114248a3,   /* fadd r2, r2, r5; mov r3.8a, r0 */
-// 	    0x809e7009, 0x115049e3,   /* nop; mov r3.8b, r1 */
-// 		0x809e7012, 0x116049e3,   /* nop; mov r3.8c, r2 */
-// 		0x159e76c0, 0x30020ba7,   /* mov tlbc, r3; nop; thrend */
-// 		0x009e7000, 0x100009e7,   /* nop; nop; nop */
-// 		0x009e7000, 0x500009e7,   /* nop; nop; sbdone */
-// };
-
-// static uint32_t shader2[12] = { // Fill Color Shader
-// 		0x009E7000, 0x100009E7,   // nop; nop; nop
-// 		0xFFFFFFFF,	0xE0020BA7,	  // ldi tlbc, RGBA White
-// 		0x009E7000, 0x500009E7,   // nop; nop; sbdone
-// 		0x009E7000, 0x300009E7,   // nop; nop; thrend
-// 		0x009E7000, 0x100009E7,   // nop; nop; nop
-// 		0x009E7000, 0x100009E7,   // nop; nop; nop
-// };
+// Shaders are assembled from kernel/graphics/shaders/*.qasm, "make shaders" in kernel/
+// #include <graphics/shaders/vertex_colour.h>
+// #include <graphics/shaders/fill_colour.h>
 
 // static RENDER_STRUCT scene = { 0 };
 
@@ -68,14 +58,16 @@ void kernel_main(uint32_t r0, uint32_t r1, uint32_t atags)
 
 	printf("\n-----------------Kernel Started Dude........................\n");
 	interrupts_init();
+	generic_timer_init();
 
 	timer_init();
-	// This will flash activity led
-	timer_set(500000);
+	ktimer_init();
 	// mem_init();
 	printf("\n Kernel End: 0x%x \n", &__kernel_end);
 
 	mem_alloc_init((uint32_t)&__kernel_end, 0x100000 * 16); // 16 MB
+	dma_offload_enable(true);
+	uart_dma_init();
 	// uart_puts(" Hello From UART0 \n");
 	// mini_uart_puts(" Hello From MINI UART \n");
 
@@ -87,6 +79,11 @@ void kernel_main(uint32_t r0, uint32_t r1, uint32_t atags)
 	// uart_puts("\n Hello virtual memory world 123 \n ");
 
 	show_dma_demo();
+	// show_dma_benchmark();
+	// show_fiq_latency_demo();
+	// show_page_flip_demo();
+	// show_console_shadow_benchmark();
+	// show_soft_raster_benchmark();
 	// enable_wifi();
 	// udelay(4579 * 1000 * 10);
 	// printf("\n 64 bit: %lx", 0x1234567812340000);
@@ -113,6 +110,7 @@ void kernel_main(uint32_t r0, uint32_t r1, uint32_t atags)
 	// 	depth = 32;
 	// 	uint32_t fb_addr = get_console_frame_buffer(width, height, depth);
 	// 	// Arm Address we got here
+	// 	// v3d_SelectRenderer(RENDERER_SOFT);	// Draw on the ARM, e.g. under QEMU
 	// 	printf("Init scene \n");
 	// 	if(v3d_InitializeScene(&scene, width, height)) {
 	// 		printf("Initialized the v3d scene \n");
@@ -126,7 +124,7 @@ void kernel_main(uint32_t r0, uint32_t r1, uint32_t atags)
 	// 		printf("Failed Added vertex to scene successfully \n");
 	// 	}
 	// 	printf("Add vertex complete \n");
-	// 	if(v3d_AddShadderToScene(&scene, &shader1[0], _countof(shader1))) {
+	// 	if(v3d_AddShadderToScene(&scene, &vertex_colour_shader[0], _countof(vertex_colour_shader))) {
 	// 		printf("Add shaders successfully \n");
 	// 	} else {
 	// 		printf("Failed Add shaders successfully \n");
@@ -172,12 +170,12 @@ void kernel_main(uint32_t r0, uint32_t r1, uint32_t atags)
 	// 	// 	do_rotate(0.1f);
 	// 	// 	test_triangle(width, height, fb_addr);
 	// 	// }
+	// 	// v3d_pool_print_stats();
 	// 	// screen_me(fb_addr, width, height, depth, pitch);
 	// } else {
 	// 	printf("-------Failed to initialize QPU----------\n");
 	// }
 
-	while (1)
-	{
-	}
+	// Nothing left to do in the foreground, sleep until the next interrupt
+	cpu_idle();
 }
\ No newline at end of file
@@ -0,0 +1,613 @@
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <plibc/stdio.h>
+#include <kernel/ktimer.h>
+#include <kernel/softirq.h>
+#include <kernel/systimer.h>
+#include <kernel/rpi-interrupts.h>
+
+#define HRES_CHANNEL 1
+#define WHEEL_CHANNEL 3
+
+// A compare closer than this to the counter could be passed before it is written
+#define COMPARE_MIN_DELTA_US 5
+
+#define KTIMER_SOFTIRQ_BUDGET_US 1000
+
+/*
+ * Wheel geometry (non-cascading, same scheme as the Linux timer wheel):
+ * LVL_DEPTH levels of LVL_SIZE buckets, each level LVL_CLK_DIV times coarser
+ * than the one below. A timer is put in the level whose range covers its
+ * timeout and is never moved again, trading exactness for O(1) add/remove.
+ *
+ *   level 0:  1 ms buckets,      0 ..    62 ms
+ *   level 1:  8 ms buckets,     63 ..   503 ms
+ *   ...
+ *   level 5: 32768 ms buckets, up to ~34 min, longer timeouts are capped
+ */
+#define LVL_CLK_SHIFT 3
+#define LVL_CLK_DIV (1 << LVL_CLK_SHIFT)
+#define LVL_CLK_MASK (LVL_CLK_DIV - 1)
+#define LVL_SHIFT(n) ((n)*LVL_CLK_SHIFT)
+#define LVL_GRAN(n) (1UL << LVL_SHIFT(n))
+#define LVL_START(n) ((LVL_SIZE - 1) << (((n)-1) * LVL_CLK_SHIFT))
+
+#define LVL_BITS 6
+#define LVL_SIZE (1UL << LVL_BITS)
+#define LVL_MASK (LVL_SIZE - 1)
+#define LVL_OFFS(n) ((n)*LVL_SIZE)
+
+#define LVL_DEPTH 6
+#define WHEEL_SIZE (LVL_SIZE * LVL_DEPTH)
+
+#define WHEEL_TIMEOUT_CUTOFF (LVL_START(LVL_DEPTH))
+#define WHEEL_TIMEOUT_MAX (WHEEL_TIMEOUT_CUTOFF - LVL_GRAN(LVL_DEPTH - 1))
+#define NEXT_TIMER_MAX_DELTA ((1UL << 30) - 1)
+
+#define TIME_AFTER_EQ(a, b) ((int32_t)((a) - (b)) >= 0)
+#define TIME_BEFORE(a, b) ((int32_t)((a) - (b)) < 0)
+
+typedef struct
+{
+    uint32_t clk; // ms, next bucket time to be processed
+    uint32_t next_expiry;
+    uint32_t pending;
+    uint64_t pending_map[LVL_DEPTH];
+    ktimer_t *vectors[WHEEL_SIZE];
+} timer_wheel_t;
+
+static timer_wheel_t wheel;
+
+static ktimer_t *heap[KTIMER_HEAP_SIZE];
+static uint32_t heap_count;
+
+static inline uint32_t usecs_to_ms_round_up(uint64_t usecs)
+{
+    return (uint32_t)((usecs + 999) / 1000);
+}
+
+static inline uint32_t ktimer_now_ms(void)
+{
+    return (uint32_t)(ktimer_now() / 1000);
+}
+
+/* Save the I bit and mask, the queues are also touched from the timer IRQs */
+static inline int32_t ktimer_lock(void)
+{
+    int32_t irqs_on = INTERRUPTS_ENABLED();
+    DISABLE_INTERRUPTS();
+    return irqs_on;
+}
+
+static inline void ktimer_unlock(int32_t irqs_on)
+{
+    if (irqs_on)
+    {
+        ENABLE_INTERRUPTS();
+    }
+}
+
+static void program_compare(uint8_t channel, uint64_t expires)
+{
+    uint32_t now = timer_getTickCount32();
+    uint32_t target = (uint32_t)expires;
+
+    if ((int32_t)(target - now) < COMPARE_MIN_DELTA_US)
+    {
+        target = now + COMPARE_MIN_DELTA_US;
+    }
+    timer_set_compare(channel, target);
+}
+
+/*----------------------------------------------------------------------
+ * Timing wheel (C3)
+ *----------------------------------------------------------------------*/
+
+/*
+ * Round the expiry up to the level granularity so a timer can not fire
+ * early when it is armed right at the edge of a bucket.
+ */
+static inline uint32_t calc_index(uint32_t expires, uint32_t lvl)
+{
+    expires = (expires + LVL_GRAN(lvl)) >> LVL_SHIFT(lvl);
+    return LVL_OFFS(lvl) + (expires & LVL_MASK);
+}
+
+static uint32_t calc_wheel_index(uint32_t expires, uint32_t clk)
+{
+    int32_t delta = (int32_t)(expires - clk);
+    uint32_t lvl;
+
+    if (delta < 0)
+    {
+        return clk & LVL_MASK;
+    }
+    if ((uint32_t)delta >= WHEEL_TIMEOUT_CUTOFF)
+    {
+        expires = clk + WHEEL_TIMEOUT_MAX;
+        delta = WHEEL_TIMEOUT_MAX;
+    }
+    for (lvl = 0; lvl < LVL_DEPTH - 1; lvl++)
+    {
+        if ((uint32_t)delta < LVL_START(lvl + 1))
+        {
+            break;
+        }
+    }
+    return calc_index(expires, lvl);
+}
+
+/* Distance from bucket `clk` to the next pending bucket of a level, -1 if empty */
+static int32_t next_pending_bucket(uint32_t lvl, uint32_t clk)
+{
+    uint64_t map = wheel.pending_map[lvl];
+    uint64_t above = map & (~0ULL << clk);
+    uint64_t below = map & ((1ULL << clk) - 1);
+
+    if (above)
+    {
+        return __builtin_ctzll(above) - clk;
+    }
+    if (below)
+    {
+        return __builtin_ctzll(below) + LVL_SIZE - clk;
+    }
+    return -1;
+}
+
+static uint32_t next_wheel_expiry(void)
+{
+    uint32_t clk = wheel.clk;
+    uint32_t next = wheel.clk + NEXT_TIMER_MAX_DELTA;
+    uint32_t lvl;
+
+    for (lvl = 0; lvl < LVL_DEPTH; lvl++)
+    {
+        int32_t pos = next_pending_bucket(lvl, clk & LVL_MASK);
+
+        if (pos >= 0)
+        {
+            uint32_t tmp = (clk + pos) << LVL_SHIFT(lvl);
+            if (TIME_BEFORE(tmp, next))
+            {
+                next = tmp;
+            }
+        }
+        // The next level only advances once this one wraps
+        uint32_t adj = (clk & LVL_CLK_MASK) ? 1 : 0;
+        clk >>= LVL_CLK_SHIFT;
+        clk += adj;
+    }
+    return next;
+}
+
+static void program_wheel(void)
+{
+    if (wheel.pending == 0)
+    {
+        wheel.next_expiry = wheel.clk + NEXT_TIMER_MAX_DELTA;
+        return;
+    }
+    wheel.next_expiry = next_wheel_expiry();
+    program_compare(WHEEL_CHANNEL, (uint64_t)wheel.next_expiry * 1000);
+}
+
+static void wheel_enqueue(ktimer_t *timer)
+{
+    uint32_t now = ktimer_now_ms();
+    uint32_t expires = usecs_to_ms_round_up(timer->expires);
+    uint32_t idx;
+
+    // Nothing is due before now, so the wheel can skip the idle stretch
+    if (TIME_BEFORE(wheel.clk, now) && TIME_BEFORE(now, wheel.next_expiry))
+    {
+        wheel.clk = now;
+    }
+
+    idx = calc_wheel_index(expires, wheel.clk);
+    timer->queue = KTIMER_WHEEL;
+    timer->index = idx;
+    timer->next = wheel.vectors[idx];
+    timer->pprev = &wheel.vectors[idx];
+    if (timer->next != NULL)
+    {
+        timer->next->pprev = &timer->next;
+    }
+    wheel.vectors[idx] = timer;
+    wheel.pending_map[idx / LVL_SIZE] |= 1ULL << (idx & LVL_MASK);
+    wheel.pending++;
+
+    if (wheel.pending == 1 || TIME_BEFORE(expires, wheel.next_expiry))
+    {
+        program_wheel();
+    }
+}
+
+static void wheel_detach(ktimer_t *timer)
+{
+    *timer->pprev = timer->next;
+    if (timer->next != NULL)
+    {
+        timer->next->pprev = timer->pprev;
+    }
+    if (wheel.vectors[timer->index] == NULL)
+    {
+        wheel.pending_map[timer->index / LVL_SIZE] &= ~(1ULL << (timer->index & LVL_MASK));
+    }
+    timer->next = NULL;
+    timer->pprev = NULL;
+    timer->queue = KTIMER_IDLE;
+    wheel.pending--;
+}
+
+/* Move every bucket due at wheel.clk onto heads[], returns the number of lists */
+static uint32_t collect_expired_timers(ktimer_t **heads, uint32_t now)
+{
+    uint32_t clk, lvl, levels = 0;
+
+    // Catch up after a long quiet period in one step instead of bucket by bucket
+    if ((int32_t)(now - wheel.clk) > 2)
+    {
+        uint32_t next = next_wheel_expiry();
+        if (TIME_BEFORE(now, next))
+        {
+            wheel.clk = now;
+            return 0;
+        }
+        wheel.clk = next;
+    }
+
+    clk = wheel.clk;
+    for (lvl = 0; lvl < LVL_DEPTH; lvl++)
+    {
+        uint32_t idx = (clk & LVL_MASK) + LVL_OFFS(lvl);
+
+        if (wheel.pending_map[lvl] & (1ULL << (clk & LVL_MASK)))
+        {
+            ktimer_t **head = &heads[levels++];
+
+            wheel.pending_map[lvl] &= ~(1ULL << (clk & LVL_MASK));
+            *head = wheel.vectors[idx];
+            wheel.vectors[idx] = NULL;
+            (*head)->pprev = head;
+        }
+        // Is it time to look at the next level?
+        if (clk & LVL_CLK_MASK)
+        {
+            break;
+        }
+        clk >>= LVL_CLK_SHIFT;
+    }
+    return levels;
+}
+
+static void expire_timers(ktimer_t **head, int32_t irqs_on)
+{
+    while (*head != NULL)
+    {
+        ktimer_t *timer = *head;
+
+        // The bucket bit is already gone, so only unlink
+        *head = timer->next;
+        if (timer->next != NULL)
+        {
+            timer->next->pprev = head;
+        }
+        timer->next = NULL;
+        timer->pprev = NULL;
+        timer->queue = KTIMER_IDLE;
+        wheel.pending--;
+
+        ktimer_unlock(irqs_on);
+        timer->callback(timer->data);
+        ktimer_lock();
+    }
+}
+
+static void run_wheel_timers(void)
+{
+    ktimer_t *heads[LVL_DEPTH];
+    int32_t irqs_on = ktimer_lock();
+    uint32_t now = ktimer_now_ms();
+
+    while (TIME_AFTER_EQ(now, wheel.clk))
+    {
+        uint32_t levels = collect_expired_timers(heads, now);
+
+        wheel.clk++;
+        while (levels--)
+        {
+            expire_timers(&heads[levels], irqs_on);
+        }
+    }
+    program_wheel();
+    ktimer_unlock(irqs_on);
+}
+
+/*----------------------------------------------------------------------
+ * High resolution min-heap (C1)
+ *----------------------------------------------------------------------*/
+
+static inline void heap_set(uint32_t pos, ktimer_t *timer)
+{
+    heap[pos] = timer;
+    timer->index = pos;
+}
+
+static void heap_sift_up(uint32_t pos)
+{
+    ktimer_t *timer = heap[pos];
+
+    while (pos > 0)
+    {
+        uint32_t parent = (pos - 1) / 2;
+        if (heap[parent]->expires <= timer->expires)
+        {
+            break;
+        }
+        heap_set(pos, heap[parent]);
+        pos = parent;
+    }
+    heap_set(pos, timer);
+}
+
+static void heap_sift_down(uint32_t pos)
+{
+    ktimer_t *timer = heap[pos];
+
+    while (1)
+    {
+        uint32_t child = 2 * pos + 1;
+        if (child >= heap_count)
+        {
+            break;
+        }
+        if (child + 1 < heap_count && heap[child + 1]->expires < heap[child]->expires)
+        {
+            child++;
+        }
+        if (timer->expires <= heap[child]->expires)
+        {
+            break;
+        }
+        heap_set(pos, heap[child]);
+        pos = child;
+    }
+    heap_set(pos, timer);
+}
+
+static bool heap_enqueue(ktimer_t *timer)
+{
+    if (heap_count == KTIMER_HEAP_SIZE)
+    {
+        return false;
+    }
+    timer->queue = KTIMER_HEAP;
+    heap_set(heap_count++, timer);
+    heap_sift_up(timer->index);
+    if (heap[0] == timer)
+    {
+        program_compare(HRES_CHANNEL, timer->expires);
+    }
+    return true;
+}
+
+static void heap_remove(ktimer_t *timer)
+{
+    uint32_t pos = timer->index;
+
+    timer->queue = KTIMER_IDLE;
+    heap_count--;
+    if (pos != heap_count)
+    {
+        // Refill the hole with the last entry and let it find its place
+        ktimer_t *last = heap[heap_count];
+        heap_set(pos, last);
+        heap_sift_down(pos);
+        heap_sift_up(last->index);
+    }
+}
+
+static void run_hres_timers(void)
+{
+    int32_t irqs_on = ktimer_lock();
+
+    while (heap_count > 0 && heap[0]->expires <= ktimer_now())
+    {
+        ktimer_t *timer = heap[0];
+
+        heap_remove(timer);
+        ktimer_unlock(irqs_on);
+        timer->callback(timer->data);
+        ktimer_lock();
+    }
+    if (heap_count > 0)
+    {
+        program_compare(HRES_CHANNEL, heap[0]->expires);
+    }
+    ktimer_unlock(irqs_on);
+}
+
+/*----------------------------------------------------------------------
+ * Interrupts
+ *----------------------------------------------------------------------*/
+
+/*
+ * Top halves only acknowledge the compare, expiry and the callbacks run in
+ * the timer softirq. Both queues are cheap to check when nothing is due, so
+ * the softirq simply looks at both.
+ */
+static void ktimer_hres_clearer(void)
+{
+    timer_clear_match(HRES_CHANNEL);
+    raise_softirq(SOFTIRQ_TIMER);
+}
+
+static void ktimer_wheel_clearer(void)
+{
+    timer_clear_match(WHEEL_CHANNEL);
+    raise_softirq(SOFTIRQ_TIMER);
+}
+
+static void ktimer_softirq(void)
+{
+    run_hres_timers();
+    run_wheel_timers();
+}
+
+/*----------------------------------------------------------------------
+ * API
+ *----------------------------------------------------------------------*/
+
+void ktimer_init(void)
+{
+    uint32_t i;
+
+    for (i = 0; i < WHEEL_SIZE; i++)
+    {
+        wheel.vectors[i] = NULL;
+    }
+    for (i = 0; i < LVL_DEPTH; i++)
+    {
+        wheel.pending_map[i] = 0;
+    }
+    wheel.pending = 0;
+    wheel.clk = ktimer_now_ms();
+    wheel.next_expiry = wheel.clk + NEXT_TIMER_MAX_DELTA;
+    heap_count = 0;
+
+    timer_clear_match(HRES_CHANNEL);
+    timer_clear_match(WHEEL_CHANNEL);
+    open_softirq(SOFTIRQ_TIMER, ktimer_softirq, KTIMER_SOFTIRQ_BUDGET_US);
+    register_irq_handler(INTERRUPT_SYSTIMER1, NULL, ktimer_hres_clearer);
+    register_irq_handler(INTERRUPT_SYSTIMER3, NULL, ktimer_wheel_clearer);
+}
+
+void ktimer_setup(ktimer_t *timer, ktimer_callback_f callback, void *data)
+{
+    timer->expires = 0;
+    timer->callback = callback;
+    timer->data = data;
+    timer->queue = KTIMER_IDLE;
+    timer->next = NULL;
+    timer->pprev = NULL;
+    timer->index = 0;
+}
+
+/**
+ * Arm `timer` to fire `usecs` from now, re-arming it if it was already
+ * pending. Short timeouts go to the high resolution queue, the rest to the
+ * wheel. Returns false if the timer has no callback.
+ */
+bool ktimer_add(ktimer_t *timer, uint64_t usecs)
+{
+    if (usecs < KTIMER_HRES_THRESHOLD_US)
+    {
+        return ktimer_add_hres(timer, usecs);
+    }
+    return ktimer_add_at(timer, ktimer_now() + usecs);
+}
+
+/* Absolute expiry, always on the wheel unless it is due within the threshold */
+bool ktimer_add_at(ktimer_t *timer, uint64_t expires)
+{
+    int32_t irqs_on;
+
+    if (timer->callback == NULL)
+    {
+        return false;
+    }
+
+    irqs_on = ktimer_lock();
+    ktimer_cancel(timer);
+    timer->expires = expires;
+    if (expires >= ktimer_now() + KTIMER_HRES_THRESHOLD_US || !heap_enqueue(timer))
+    {
+        wheel_enqueue(timer);
+    }
+    ktimer_unlock(irqs_on);
+    return true;
+}
+
+/**
+ * Arm `timer` on the high resolution queue regardless of the timeout. Falls
+ * back to the (coarser) wheel when all KTIMER_HEAP_SIZE slots are in use.
+ */
+bool ktimer_add_hres(ktimer_t *timer, uint64_t usecs)
+{
+    int32_t irqs_on;
+
+    if (timer->callback == NULL)
+    {
+        return false;
+    }
+
+    irqs_on = ktimer_lock();
+    ktimer_cancel(timer);
+    timer->expires = ktimer_now() + usecs;
+    if (!heap_enqueue(timer))
+    {
+        wheel_enqueue(timer);
+    }
+    ktimer_unlock(irqs_on);
+    return true;
+}
+
+/* Returns true if the timer was pending and has been removed */
+bool ktimer_cancel(ktimer_t *timer)
+{
+    int32_t irqs_on = ktimer_lock();
+    bool was_pending = true;
+
+    switch (timer->queue)
+    {
+    case KTIMER_WHEEL:
+        // A stale C3 compare only costs one empty wheel pass
+        wheel_detach(timer);
+        break;
+    case KTIMER_HEAP:
+        heap_remove(timer);
+        break;
+    default:
+        was_pending = false;
+        break;
+    }
+    ktimer_unlock(irqs_on);
+    return was_pending;
+}
+
+bool ktimer_pending(const ktimer_t *timer)
+{
+    return timer->queue != KTIMER_IDLE;
+}
+
+uint64_t ktimer_now(void)
+{
+    return timer_getTickCount64();
+}
+
+/* Earliest pending expiry in microseconds, UINT64_MAX when nothing is queued */
+uint64_t ktimer_next_expiry(void)
+{
+    int32_t irqs_on = ktimer_lock();
+    uint64_t next = UINT64_MAX;
+
+    if (heap_count > 0)
+    {
+        next = heap[0]->expires;
+    }
+    if (wheel.pending > 0)
+    {
+        // The wheel counts in wrapping 32 bit ms, rebuild the full time from now
+        uint64_t now = ktimer_now();
+        int32_t delta_ms = (int32_t)(wheel.next_expiry - (uint32_t)(now / 1000));
+        uint64_t wheel_next = delta_ms > 0 ? now + (uint64_t)delta_ms * 1000 : now;
+        if (wheel_next < next)
+        {
+            next = wheel_next;
+        }
+    }
+    ktimer_unlock(irqs_on);
+    return next;
+}
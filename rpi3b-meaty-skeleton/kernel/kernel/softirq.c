@@ -0,0 +1,308 @@
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <plibc/stdio.h>
+#include <kernel/softirq.h>
+#include <kernel/generic-timer.h>
+#include <kernel/rpi-interrupts.h>
+
+#define NUM_CORES 4
+
+typedef struct
+{
+    softirq_action_f action;
+    uint32_t budget_us;
+    uint64_t budget_ticks;
+} softirq_vec_t;
+
+typedef struct
+{
+    tasklet_t *head;
+    tasklet_t **tail;
+} tasklet_list_t;
+
+typedef struct
+{
+    volatile uint32_t pending;
+    volatile uint32_t active;
+    tasklet_list_t tasklets[2]; // [0] hi, [1] normal
+    softirq_stats_t stats[NR_SOFTIRQS];
+} softirq_core_t;
+
+static softirq_vec_t softirq_vec[NR_SOFTIRQS];
+static softirq_core_t softirq_cores[NUM_CORES];
+static uint64_t max_pass_ticks;
+
+static inline int32_t softirq_lock(void)
+{
+    int32_t irqs_on = INTERRUPTS_ENABLED();
+    DISABLE_INTERRUPTS();
+    return irqs_on;
+}
+
+static inline void softirq_unlock(int32_t irqs_on)
+{
+    if (irqs_on)
+    {
+        ENABLE_INTERRUPTS();
+    }
+}
+
+static inline uint32_t ticks_to_usecs(uint64_t ticks)
+{
+    return (uint32_t)((ticks * 1000000) / generic_timer_frequency());
+}
+
+/*
+ * Drain one tasklet list. The list is detached up front so tasklets may
+ * reschedule themselves; whatever is left when the budget runs out goes
+ * back to the front of the queue for the next pass.
+ */
+static void run_tasklets(uint32_t list_index, softirq_number_t nr)
+{
+    softirq_core_t *core = &softirq_cores[CORE_ID()];
+    tasklet_list_t *list = &core->tasklets[list_index];
+    uint64_t deadline = generic_timer_count() + softirq_vec[nr].budget_ticks;
+    tasklet_t *tasklet;
+    int32_t irqs_on;
+
+    irqs_on = softirq_lock();
+    tasklet = list->head;
+    list->head = NULL;
+    list->tail = &list->head;
+    softirq_unlock(irqs_on);
+
+    while (tasklet != NULL)
+    {
+        tasklet_t *next = tasklet->next;
+
+        tasklet->next = NULL;
+        tasklet->scheduled = 0;
+        tasklet->func(tasklet->data);
+        tasklet = next;
+
+        if (tasklet != NULL && generic_timer_count() > deadline)
+        {
+            tasklet_t *last = tasklet;
+
+            while (last->next != NULL)
+            {
+                last = last->next;
+            }
+            irqs_on = softirq_lock();
+            last->next = list->head;
+            if (list->head == NULL)
+            {
+                list->tail = &last->next;
+            }
+            list->head = tasklet;
+            core->pending |= (1 << nr);
+            softirq_unlock(irqs_on);
+            break;
+        }
+    }
+}
+
+static void tasklet_hi_action(void)
+{
+    run_tasklets(0, SOFTIRQ_HI_TASKLET);
+}
+
+static void tasklet_action(void)
+{
+    run_tasklets(1, SOFTIRQ_TASKLET);
+}
+
+static void tasklet_enqueue(tasklet_t *tasklet, uint32_t list_index, softirq_number_t nr)
+{
+    int32_t irqs_on = softirq_lock();
+    softirq_core_t *core = &softirq_cores[CORE_ID()];
+    tasklet_list_t *list = &core->tasklets[list_index];
+
+    if (!tasklet->scheduled)
+    {
+        tasklet->scheduled = 1;
+        tasklet->next = NULL;
+        *list->tail = tasklet;
+        list->tail = &tasklet->next;
+        core->pending |= (1 << nr);
+    }
+    softirq_unlock(irqs_on);
+}
+
+void softirq_init(void)
+{
+    uint32_t i, j;
+
+    for (i = 0; i < NR_SOFTIRQS; i++)
+    {
+        softirq_vec[i].action = NULL;
+        softirq_vec[i].budget_us = 0;
+        softirq_vec[i].budget_ticks = 0;
+    }
+    for (i = 0; i < NUM_CORES; i++)
+    {
+        softirq_cores[i].pending = 0;
+        softirq_cores[i].active = 0;
+        for (j = 0; j < 2; j++)
+        {
+            softirq_cores[i].tasklets[j].head = NULL;
+            softirq_cores[i].tasklets[j].tail = &softirq_cores[i].tasklets[j].head;
+        }
+        for (j = 0; j < NR_SOFTIRQS; j++)
+        {
+            softirq_cores[i].stats[j].runs = 0;
+            softirq_cores[i].stats[j].overruns = 0;
+            softirq_cores[i].stats[j].max_us = 0;
+            softirq_cores[i].stats[j].budget_us = 0;
+        }
+    }
+    max_pass_ticks = generic_timer_usecs_to_ticks(SOFTIRQ_MAX_TIME_US);
+
+    open_softirq(SOFTIRQ_HI_TASKLET, tasklet_hi_action, 200);
+    open_softirq(SOFTIRQ_TASKLET, tasklet_action, 1000);
+}
+
+void open_softirq(softirq_number_t nr, softirq_action_f action, uint32_t budget_us)
+{
+    if (nr >= NR_SOFTIRQS)
+    {
+        printf("ERROR: CANNOT OPEN SOFTIRQ: INVALID NUMBER: %d\n", nr);
+        return;
+    }
+    softirq_vec[nr].budget_us = budget_us;
+    softirq_vec[nr].budget_ticks = generic_timer_usecs_to_ticks(budget_us);
+    softirq_vec[nr].action = action;
+}
+
+/* Safe from top halves, marks the softirq pending on the calling core */
+void raise_softirq(softirq_number_t nr)
+{
+    int32_t irqs_on = softirq_lock();
+    softirq_cores[CORE_ID()].pending |= (1 << nr);
+    softirq_unlock(irqs_on);
+}
+
+bool softirq_pending(void)
+{
+    return softirq_cores[CORE_ID()].pending != 0;
+}
+
+bool in_softirq(void)
+{
+    return softirq_cores[CORE_ID()].active != 0;
+}
+
+/**
+ * Run the pending softirqs of this core with IRQs enabled. Re-entry from an
+ * interrupt that nests inside a softirq is a no-op, the outer pass picks
+ * up whatever that interrupt raised.
+ */
+void do_softirq(void)
+{
+    softirq_core_t *core = &softirq_cores[CORE_ID()];
+    uint32_t restart = SOFTIRQ_MAX_RESTART;
+    uint64_t start;
+    int32_t irqs_on = softirq_lock();
+
+    if (core->active || core->pending == 0)
+    {
+        softirq_unlock(irqs_on);
+        return;
+    }
+    core->active = 1;
+    start = generic_timer_count();
+
+    do
+    {
+        uint32_t pending = core->pending;
+        uint32_t nr;
+
+        core->pending = 0;
+        ENABLE_INTERRUPTS();
+
+        for (nr = 0; pending != 0; nr++, pending >>= 1)
+        {
+            softirq_stats_t *stats = &core->stats[nr];
+            uint64_t t0, elapsed;
+
+            if ((pending & 1) == 0 || softirq_vec[nr].action == NULL)
+            {
+                continue;
+            }
+
+            t0 = generic_timer_count();
+            softirq_vec[nr].action();
+            elapsed = generic_timer_count() - t0;
+
+            stats->runs++;
+            if (elapsed > softirq_vec[nr].budget_ticks)
+            {
+                stats->overruns++;
+            }
+            if (ticks_to_usecs(elapsed) > stats->max_us)
+            {
+                stats->max_us = ticks_to_usecs(elapsed);
+            }
+        }
+
+        DISABLE_INTERRUPTS();
+    } while (core->pending != 0 && --restart != 0 && (generic_timer_count() - start) < max_pass_ticks);
+
+    // Anything still pending now waits for the idle loop
+    core->active = 0;
+    softirq_unlock(irqs_on);
+}
+
+/* Called at the end of irq_handler, before returning to the interrupted code */
+void irq_exit(void)
+{
+    if (!in_softirq() && softirq_pending())
+    {
+        do_softirq();
+    }
+}
+
+void tasklet_init(tasklet_t *tasklet, tasklet_func_f func, void *data)
+{
+    tasklet->next = NULL;
+    tasklet->func = func;
+    tasklet->data = data;
+    tasklet->scheduled = 0;
+}
+
+/* A tasklet runs once per schedule, on the core that scheduled it */
+void tasklet_schedule(tasklet_t *tasklet)
+{
+    tasklet_enqueue(tasklet, 1, SOFTIRQ_TASKLET);
+}
+
+void tasklet_hi_schedule(tasklet_t *tasklet)
+{
+    tasklet_enqueue(tasklet, 0, SOFTIRQ_HI_TASKLET);
+}
+
+void softirq_get_stats(uint32_t core, softirq_number_t nr, softirq_stats_t *stats)
+{
+    *stats = softirq_cores[core & (NUM_CORES - 1)].stats[nr];
+    stats->budget_us = softirq_vec[nr].budget_us;
+}
+
+void softirq_print_stats(void)
+{
+    uint32_t core, nr;
+
+    for (core = 0; core < NUM_CORES; core++)
+    {
+        for (nr = 0; nr < NR_SOFTIRQS; nr++)
+        {
+            softirq_stats_t *stats = &softirq_cores[core].stats[nr];
+            if (stats->runs == 0)
+            {
+                continue;
+            }
+            printf("\n softirq %d core %d: runs %d overruns %d max %d us budget %d us",
+                   nr, core, stats->runs, stats->overruns, stats->max_us, softirq_vec[nr].budget_us);
+        }
+    }
+}
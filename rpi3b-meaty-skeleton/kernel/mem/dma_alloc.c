@@ -0,0 +1,216 @@
+#include <mem/dma_alloc.h>
+#include <plibc/stdio.h>
+#include <plibc/string.h>
+#include <kernel/rpi-interrupts.h>
+
+// Bounds of the uncached section, see linker.ld
+extern uint8_t __dma_coherent_start;
+extern uint8_t __dma_coherent_end;
+
+#define NUM_GRANULES (DMA_COHERENT_SIZE / DMA_COHERENT_GRANULE)
+#define MAP_WORDS (NUM_GRANULES / 32)
+
+/*
+ * Two bitmaps over the granules: used_map marks allocated granules and
+ * last_map the final granule of each allocation, so free needs no size.
+ */
+static uint32_t used_map[MAP_WORDS];
+static uint32_t last_map[MAP_WORDS];
+static uint32_t free_granules;
+static uint8_t *pool_base;
+
+static inline bool granule_used(uint32_t i)
+{
+    return used_map[i >> 5] & (1 << (i & 31));
+}
+
+void dma_alloc_init(void)
+{
+    if (pool_base != 0)
+    {
+        return;
+    }
+    if ((uint32_t)(&__dma_coherent_end - &__dma_coherent_start) < DMA_COHERENT_SIZE)
+    {
+        printf("DMA ALLOC ERROR: coherent region is smaller than %x\n", DMA_COHERENT_SIZE);
+        return;
+    }
+    pool_base = &__dma_coherent_start;
+    free_granules = NUM_GRANULES;
+}
+
+/**
+ * Allocate `size` bytes of uncached memory aligned to `align` (power of two,
+ * rounded up to a cache line). Memory comes back zeroed. NULL when full.
+ */
+void *dma_alloc_coherent(uint32_t size, uint32_t align)
+{
+    uint32_t count = (size + DMA_COHERENT_GRANULE - 1) / DMA_COHERENT_GRANULE;
+    uint32_t step;
+    int32_t irqs_on;
+    int32_t found = -1;
+
+    dma_alloc_init();
+    if (pool_base == 0 || count == 0 || count > NUM_GRANULES || (align & (align - 1)))
+    {
+        return 0;
+    }
+    step = align > DMA_COHERENT_GRANULE ? align / DMA_COHERENT_GRANULE : 1;
+
+    irqs_on = INTERRUPTS_ENABLED();
+    DISABLE_INTERRUPTS();
+    for (uint32_t start = 0; start + count <= NUM_GRANULES && found < 0; start += step)
+    {
+        uint32_t i;
+
+        for (i = 0; i < count && !granule_used(start + i); i++)
+            ;
+        if (i == count)
+        {
+            found = start;
+        }
+    }
+    if (found >= 0)
+    {
+        for (uint32_t i = found; i < found + count; i++)
+        {
+            used_map[i >> 5] |= 1 << (i & 31);
+        }
+        last_map[(found + count - 1) >> 5] |= 1 << ((found + count - 1) & 31);
+        free_granules -= count;
+    }
+    if (irqs_on)
+    {
+        ENABLE_INTERRUPTS();
+    }
+
+    if (found < 0)
+    {
+        printf("DMA ALLOC ERROR: no room for %d bytes aligned to %d\n", size, align);
+        return 0;
+    }
+
+    void *ptr = pool_base + found * DMA_COHERENT_GRANULE;
+    memset(ptr, 0, count * DMA_COHERENT_GRANULE);
+    return ptr;
+}
+
+void dma_free_coherent(void *ptr)
+{
+    uint32_t i;
+    int32_t irqs_on;
+
+    if (ptr == 0)
+    {
+        return;
+    }
+    if (!dma_is_coherent(ptr) || ((uint8_t *)ptr - pool_base) % DMA_COHERENT_GRANULE)
+    {
+        printf("DMA ALLOC ERROR: %x was not allocated here\n", ptr);
+        return;
+    }
+
+    irqs_on = INTERRUPTS_ENABLED();
+    DISABLE_INTERRUPTS();
+    for (i = ((uint8_t *)ptr - pool_base) / DMA_COHERENT_GRANULE; i < NUM_GRANULES && granule_used(i); i++)
+    {
+        uint32_t bit = 1 << (i & 31);
+        bool last = last_map[i >> 5] & bit;
+
+        used_map[i >> 5] &= ~bit;
+        last_map[i >> 5] &= ~bit;
+        free_granules++;
+        if (last)
+        {
+            break;
+        }
+    }
+    if (irqs_on)
+    {
+        ENABLE_INTERRUPTS();
+    }
+}
+
+bool dma_is_coherent(const void *ptr)
+{
+    const uint8_t *p = ptr;
+
+    return pool_base != 0 && p >= pool_base && p < pool_base + DMA_COHERENT_SIZE;
+}
+
+uint32_t dma_coherent_free(void)
+{
+    return free_granules * DMA_COHERENT_GRANULE;
+}
+
+/* ARM physical (identity mapped) address to the address DMA masters use */
+uint32_t dma_bus_address(const void *ptr)
+{
+    return (uint32_t)ptr | DMA_BUS_ALIAS;
+}
+
+void *dma_bus_to_virt(uint32_t bus_addr)
+{
+    return (void *)(bus_addr & ~DMA_BUS_ALIAS);
+}
+
+/*
+ * Cache maintenance by MVA to the point of coherency, one line at a time.
+ * Clean before a device reads memory the CPU wrote, invalidate before the
+ * CPU reads memory a device wrote. Harmless while the data cache is off.
+ */
+#define CACHE_OP(ptr, size, op)                                                      \
+    do                                                                               \
+    {                                                                                \
+        uint32_t line = (uint32_t)(ptr) & ~(DMA_COHERENT_GRANULE - 1);              \
+        uint32_t end = (uint32_t)(ptr) + (size);                                     \
+        for (; line < end; line += DMA_COHERENT_GRANULE)                             \
+        {                                                                            \
+            __asm__ __volatile__("mcr p15, 0, %0, c7, " op ::"r"(line) : "memory"); \
+        }                                                                            \
+        __asm__ __volatile__("dsb" ::                                                \
+                                 : "memory");                                        \
+    } while (0)
+
+void dma_cache_clean(const void *ptr, uint32_t size)
+{
+    CACHE_OP(ptr, size, "c10, 1"); // DCCMVAC
+}
+
+/**
+ * Lines the buffer only partly covers are cleaned as well as invalidated,
+ * plain invalidation would throw away dirty data of whatever shares them.
+ * Such a line holds the CPU's copy of the buffer bytes in it if the CPU
+ * wrote the neighbour during the transfer, so device buffers should still
+ * start and end on a line (DMA_COHERENT_GRANULE) for exact results.
+ */
+void dma_cache_invalidate(void *ptr, uint32_t size)
+{
+    uint32_t start = (uint32_t)ptr;
+    uint32_t end = start + size;
+    uint32_t head = start & ~(DMA_COHERENT_GRANULE - 1);
+    uint32_t tail = end & ~(DMA_COHERENT_GRANULE - 1);
+
+    if (size == 0)
+    {
+        return;
+    }
+    if (head != start)
+    {
+        CACHE_OP(head, 1, "c14, 1"); // DCCIMVAC
+        head += DMA_COHERENT_GRANULE;
+    }
+    if (tail != end && tail >= head)
+    {
+        CACHE_OP(tail, 1, "c14, 1");
+    }
+    if (tail > head)
+    {
+        CACHE_OP(head, tail - head, "c6, 1"); // DCIMVAC
+    }
+}
+
+void dma_cache_flush(void *ptr, uint32_t size)
+{
+    CACHE_OP(ptr, size, "c14, 1"); // DCCIMVAC
+}
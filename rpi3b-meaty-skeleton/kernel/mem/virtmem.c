@@ -5,6 +5,7 @@
 
 extern uint32_t __kernel_end;
 extern uint32_t __first_lvl_tbl_base;
+extern uint32_t __dma_coherent_start;
 static uint32_t MMUTABLEBASE;
 extern void initialize_virtual_memory(void)
 {
@@ -20,6 +21,9 @@ extern void initialize_virtual_memory(void)
         }
     }
 
+    // DMA coherent pool stays uncached whatever the kernel mapping becomes
+    mmu_section((uint32_t)&__dma_coherent_start, (uint32_t)&__dma_coherent_start, 0x0000); //NOT CACHED!
+
     //peripherals
     mmu_section(0x3f000000, 0x3f000000, 0x0000); //NOT CACHED!
     mmu_section(0x3f200000, 0x3f200000, 0x0000); //NOT CACHED!
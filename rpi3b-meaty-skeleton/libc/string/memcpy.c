@@ -1,6 +1,15 @@
 #include <string.h>
 
+#if defined(__is_libk)
+/* The kernel may hand large copies to the DMA engine, returns 1 if it did */
+extern int memcpy_offload(void* dstptr, const void* srcptr, size_t size) __attribute__((weak));
+#endif
+
 void* memcpy(void* restrict dstptr, const void* restrict srcptr, size_t size) {
+#if defined(__is_libk)
+	if (memcpy_offload && memcpy_offload(dstptr, srcptr, size))
+		return dstptr;
+#endif
 	unsigned char* dst = (unsigned char*) dstptr;
 	const unsigned char* src = (const unsigned char*) srcptr;
 	for (size_t i = 0; i < size; i++)
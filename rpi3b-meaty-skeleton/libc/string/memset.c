@@ -1,6 +1,15 @@
 #include <string.h>
 
+#if defined(__is_libk)
+/* The kernel may hand large fills to the DMA engine, returns 1 if it did */
+extern int memset_offload(void* bufptr, int value, size_t size) __attribute__((weak));
+#endif
+
 void* memset(void* bufptr, int value, size_t size) {
+#if defined(__is_libk)
+	if (memset_offload && memset_offload(bufptr, value, size))
+		return bufptr;
+#endif
 	unsigned char* buf = (unsigned char*) bufptr;
 	for (size_t i = 0; i < size; i++)
 		buf[i] = (unsigned char) value;
@@ -0,0 +1,1013 @@
+/* qpuasm.c - VideoCore IV QPU assembler and disassembler for the build host
+ *
+ *   qpuasm [-o OUT.h] [-n NAME] FILE.qasm
+ *       Assemble FILE into a C header holding `static uint32_t NAME_shader[]`,
+ *       two words per instruction, low word first, as the V3D reads them.
+ *
+ *   qpuasm -d FILE
+ *       Disassemble every 0x... word in FILE (C comments are skipped, so a
+ *       generated header or a kernel source with a shader array will do).
+ *
+ * Syntax, one instruction per line, `#` or `//` comments, `label:` prefixes:
+ *
+ *   fadd r0, r0, r5; mov r1, vary; sbwait      add op; mul op; signal
+ *   mov.ifz.setf ra1.16a, rb2; nop              condition, flags, pack
+ *   fmul r1, ra3.8a, 0.5                        unpack, small immediate
+ *   ldi tlbc, 0xffffffff                        load immediate
+ *   brr.anynz loop                              branch, relative to a label
+ *   sacq 3 / srel 3                             semaphores
+ *   .word 0x009e7000, 0x100009e7                raw instruction
+ *
+ * Every instruction assembled is disassembled and assembled again, and the
+ * disassembler only prints text that assembles back to the same words, so
+ * the two always agree.
+ */
+
+#include <ctype.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MAX_LINE		256
+#define MAX_INSTS		4096
+#define MAX_LABELS		256
+
+/* Instruction fields as (shift, width) in the 64 bit word */
+#define F_SIG			60, 4
+#define F_UNPACK		57, 3
+#define F_PM			56, 1
+#define F_PACK			52, 4
+#define F_COND_ADD		49, 3
+#define F_COND_MUL		46, 3
+#define F_SF			45, 1
+#define F_WS			44, 1
+#define F_WADDR_ADD		38, 6
+#define F_WADDR_MUL		32, 6
+#define F_OP_MUL		29, 3
+#define F_OP_ADD		24, 5
+#define F_RADDR_A		18, 6
+#define F_RADDR_B		12, 6
+#define F_ADD_A			9, 3
+#define F_ADD_B			6, 3
+#define F_MUL_A			3, 3
+#define F_MUL_B			0, 3
+#define F_IMM			0, 32
+#define F_BR_COND		52, 4
+#define F_BR_REL		51, 1
+#define F_BR_REG		50, 1
+#define F_BR_RADDR		45, 5
+#define F_BR_UNUSED		56, 4
+#define F_SEM_DOWN		4, 1
+#define F_SEM			0, 4
+#define F_SEM_UNUSED	5, 27
+
+#define SIG_NONE		1
+#define SIG_THREAD_END	3
+#define SIG_SMALL_IMM	13
+#define SIG_LOAD_IMM	14
+#define SIG_BRANCH		15
+
+#define LDI_SEMAPHORE	4			// Unpack field of a load immediate that is a semaphore op
+
+#define OP_ADD_OR		21
+#define OP_MUL_V8MIN	4
+
+#define MUX_R4			4
+#define MUX_A			6
+#define MUX_B			7
+
+#define ADDR_NOP		39
+#define NONE			-1
+
+enum { FILE_A, FILE_B, FILE_ANY };
+
+static const char* const add_ops[32] = {
+	"nop", "fadd", "fsub", "fmin", "fmax", "fminabs", "fmaxabs", "ftoi",
+	"itof", 0, 0, 0, "add", "sub", "shr", "asr",
+	"ror", "shl", "min", "max", "and", "or", "xor", "not",
+	"clz", 0, 0, 0, 0, 0, "v8adds", "v8subs",
+};
+
+static const char* const mul_ops[8] = {
+	"nop", "fmul", "mul24", "v8muld", "v8min", "v8max", "v8adds", "v8subs",
+};
+
+static const char* const conds[8] = { "never", "", "ifz", "ifnz", "ifn", "ifnn", "ifc", "ifnc" };
+
+static const char* const branch_conds[16] = {
+	"allz", "allnz", "anyz", "anynz", "alln", "allnn", "anyn", "anynn",
+	"allc", "allnc", "anyc", "anync", 0, 0, 0, "",
+};
+
+static const char* const signals[16] = {
+	"bkpt", "", "thrsw", "thrend", "sbwait", "sbdone", "lthrsw", "loadcv",
+	"loadc", "ldcend", "ldtmu0", "ldtmu1", "loadam", 0, 0, 0,
+};
+
+static const char* const packs[16] = {
+	"", "16a", "16b", "8888", "8a", "8b", "8c", "8d",
+	"32s", "16as", "16bs", "8888s", "8as", "8bs", "8cs", "8ds",
+};
+
+static const char* const unpacks[8] = { "", "16a", "16b", "8dr", "8a", "8b", "8c", "8d" };
+
+/* Small immediates 32..47 are powers of two */
+static const char* const small_floats[16] = {
+	"1.0", "2.0", "4.0", "8.0", "16.0", "32.0", "64.0", "128.0",
+	"0.00390625", "0.0078125", "0.015625", "0.03125", "0.0625", "0.125", "0.25", "0.5",
+};
+
+/* Register names above 31, by file; the same name in both files reads or writes either */
+static const char* const read_names[2][64] = {
+	{ [32] = "unif", [35] = "vary", [38] = "elem_num", [41] = "x_coord", [42] = "ms_flags",
+	  [48] = "vpm", [49] = "vr_busy", [50] = "vr_wait", [51] = "mutex" },
+	{ [32] = "unif", [35] = "vary", [38] = "qpu_num", [41] = "y_coord", [42] = "rev_flag",
+	  [48] = "vpm", [49] = "vw_busy", [50] = "vw_wait", [51] = "mutex" },
+};
+
+static const char* const write_names[2][64] = {
+	{ [32] = "r0", "r1", "r2", "r3", "tmu_noswap", "r5quad", "host_int", "-",
+	  "unif_addr", "quad_x", "ms_flags", "tlbs", "tlbz", "tlbm", "tlbc", "tlbam",
+	  "vpm", "vr_setup", "vr_addr", "mutex", "sfu_recip", "sfu_recipsqrt", "sfu_exp", "sfu_log",
+	  "tmu0_s", "tmu0_t", "tmu0_r", "tmu0_b", "tmu1_s", "tmu1_t", "tmu1_r", "tmu1_b" },
+	{ [32] = "r0", "r1", "r2", "r3", "tmu_noswap", "r5rep", "host_int", "-",
+	  "unif_addr", "quad_y", "rev_flag", "tlbs", "tlbz", "tlbm", "tlbc", "tlbam",
+	  "vpm", "vw_setup", "vw_addr", "mutex", "sfu_recip", "sfu_recipsqrt", "sfu_exp", "sfu_log",
+	  "tmu0_s", "tmu0_t", "tmu0_r", "tmu0_b", "tmu1_s", "tmu1_t", "tmu1_r", "tmu1_b" },
+};
+
+typedef struct {
+	char name[32];
+	uint32_t pc;					// Byte offset in the program
+} label_t;
+
+static const char* src_file = "-";
+static int src_line;
+static label_t labels[MAX_LABELS];
+static int label_count;
+static uint32_t cur_pc;
+static char err_msg[MAX_LINE];		// Set when assembling a line failed
+
+static void fatal (const char* fmt, ...) {
+	va_list ap;
+	fprintf(stderr, "qpuasm: ");
+	va_start(ap, fmt);
+	vfprintf(stderr, fmt, ap);
+	va_end(ap);
+	fprintf(stderr, "\n");
+	exit(1);
+}
+
+static bool fail (const char* fmt, ...) {
+	va_list ap;
+	va_start(ap, fmt);
+	vsnprintf(err_msg, sizeof(err_msg), fmt, ap);
+	va_end(ap);
+	return false;
+}
+
+static inline uint32_t get (uint64_t w, int shift, int width) {
+	return (w >> shift) & ((1ull << width) - 1);
+}
+
+static inline uint64_t set (uint64_t w, int shift, int width, uint64_t v) {
+	uint64_t mask = ((1ull << width) - 1) << shift;
+	return (w & ~mask) | ((v << shift) & mask);
+}
+
+static int find_name (const char* const* table, int count, const char* name) {
+	for (int i = 0; i < count; i++)
+		if (table[i] && strcmp(table[i], name) == 0) return i;
+	return NONE;
+}
+
+static char* trim (char* s) {
+	char* e;
+	while (isspace((unsigned char)*s)) s++;
+	e = s + strlen(s);
+	while (e > s && isspace((unsigned char)e[-1])) *--e = 0;
+	return s;
+}
+
+/* Split s at each sep into at most max trimmed pieces */
+static int split (char* s, char sep, char** out, int max) {
+	int n = 0;
+	if (*trim(s) == 0) return 0;
+	while (n < max) {
+		char* next = strchr(s, sep);
+		if (next) *next = 0;
+		out[n++] = trim(s);
+		if (!next) return n;
+		s = next + 1;
+	}
+	return n + 1;													// Too many, caller reports it
+}
+
+static bool parse_int (const char* s, int64_t* v) {
+	char* end;
+	if (*s == 0) return false;
+	*v = strtoll(s, &end, 0);
+	return *end == 0;
+}
+
+/*--------------------------------------------------------------------------}
+{								  OPERANDS									}
+{--------------------------------------------------------------------------*/
+
+typedef struct {
+	uint32_t addr;
+	int file;
+	int pack;						// Index into packs, 0 for none
+} dst_t;
+
+enum { SRC_ACC, SRC_REG, SRC_IMM };
+
+typedef struct {
+	int kind;
+	uint32_t value;					// Mux for SRC_ACC, raddr for SRC_REG, small immediate for SRC_IMM
+	int file;
+	int unpack;						// Index into unpacks, 0 for none
+	int mux;						// Filled in by the register allocation
+} src_t;
+
+/* Strip a .suffix from a register operand, the index of it in table or NONE if it is not there */
+static bool take_suffix (char* reg, const char* const* table, int count, int* index) {
+	char* dot = strchr(reg, '.');
+	*index = 0;
+	if (!dot) return true;
+	*dot = 0;
+	*index = find_name(table, count, dot + 1);
+	if (*index <= 0) return fail("unknown suffix .%s", dot + 1);
+	return true;
+}
+
+/* raN and rbN name any address, including the ones above 31 */
+static bool parse_raw_reg (const char* s, uint32_t* addr, int* file) {
+	int64_t v;
+	if (s[0] != 'r' || (s[1] != 'a' && s[1] != 'b') || !isdigit((unsigned char)s[2])) return false;
+	if (!parse_int(&s[2], &v) || v < 0 || v > 63) return false;
+	*addr = v;
+	*file = s[1] == 'a' ? FILE_A : FILE_B;
+	return true;
+}
+
+static bool lookup_name (const char* const names[2][64], const char* s, uint32_t* addr, int* file) {
+	for (int f = FILE_A; f <= FILE_B; f++) {
+		int i = find_name(names[f], 64, s);
+		if (i == NONE) continue;
+		*addr = i;
+		*file = (f == FILE_A && names[FILE_B][i] && strcmp(names[FILE_B][i], s) == 0) ? FILE_ANY : f;
+		return true;
+	}
+	return false;
+}
+
+static bool parse_dst (char* s, dst_t* d) {
+	if (!take_suffix(s, packs, 16, &d->pack)) return false;
+	if (parse_raw_reg(s, &d->addr, &d->file)) return true;
+	if (strcmp(s, "nop") == 0) s = "-";
+	if (lookup_name(write_names, s, &d->addr, &d->file)) return true;
+	return fail("%s is not a register that can be written", s);
+}
+
+static bool parse_small_imm (const char* s, uint32_t* imm) {
+	int64_t v;
+	int i = find_name(small_floats, 16, s);
+	if (i != NONE) {
+		*imm = 32 + i;
+		return true;
+	}
+	if (!parse_int(s, &v)) return false;
+	if (v < -16 || v > 15) return fail("%s does not fit a small immediate (-16..15, or a power of two float)", s);
+	*imm = v & 31;
+	return true;
+}
+
+static bool parse_src (char* s, src_t* src) {
+	memset(src, 0, sizeof(*src));
+	if (isdigit((unsigned char)s[0]) || s[0] == '-' || s[0] == '.') {
+		src->kind = SRC_IMM;
+		return parse_small_imm(s, &src->value) || (err_msg[0] ? false : fail("bad operand %s", s));
+	}
+	if (!take_suffix(s, unpacks, 8, &src->unpack)) return false;
+	if (s[0] == 'r' && s[1] >= '0' && s[1] <= '5' && s[2] == 0) {
+		src->kind = SRC_ACC;
+		src->value = s[1] - '0';
+		if (src->unpack && src->value != MUX_R4) return fail("only r4 and regfile A reads unpack");
+		return true;
+	}
+	src->kind = SRC_REG;
+	if (parse_raw_reg(s, &src->value, &src->file)) return true;
+	if (lookup_name(read_names, s, &src->value, &src->file)) return true;
+	return fail("%s is not a register that can be read", s);
+}
+
+/*--------------------------------------------------------------------------}
+{							   ALU INSTRUCTIONS								}
+{--------------------------------------------------------------------------*/
+
+typedef struct {
+	int op;
+	int cond;
+	bool setf;
+	dst_t dst;
+	src_t src[2];
+	int nsrc;
+} alu_part_t;
+
+/* "fadd.ifz.setf" -> op, cond, setf */
+static bool parse_opcode (char* s, const char* const* table, int count, int* op, int* cond, bool* setf) {
+	char* dot = strchr(s, '.');
+	char* suffix;
+
+	*cond = NONE;
+	*setf = false;
+	if (dot) *dot = 0;
+	*op = find_name(table, count, s);
+	while (dot) {
+		suffix = dot + 1;
+		dot = strchr(suffix, '.');
+		if (dot) *dot = 0;
+		if (strcmp(suffix, "setf") == 0) *setf = true;
+		else if (*cond == NONE && (*cond = find_name(conds, 8, suffix)) > 0) continue;
+		else return fail("unknown suffix .%s", suffix);
+	}
+	return true;
+}
+
+static bool parse_alu_part (char* text, bool is_mul, alu_part_t* part) {
+	char* ops[4];
+	char* sp;
+	char opcode[32];
+	int n;
+	bool unary;
+
+	memset(part, 0, sizeof(*part));
+	part->dst.addr = ADDR_NOP;
+	part->dst.file = FILE_ANY;
+	sp = text + strcspn(text, " \t");
+	if (*sp) *sp++ = 0;
+
+	// "mov" is or in the add unit and v8min in the mul unit, with both operands the same
+	unary = strncmp(text, "mov", 3) == 0 && (text[3] == 0 || text[3] == '.');
+	if (strlen(text) >= sizeof(opcode) - 2) return fail("unknown op %s", text);
+	sprintf(opcode, "%s%s", unary ? (is_mul ? "v8min" : "or") : "", unary ? text + 3 : text);
+	if (!parse_opcode(opcode, is_mul ? mul_ops : add_ops, is_mul ? 8 : 32, &part->op, &part->cond, &part->setf)) return false;
+	if (part->op == NONE) return fail("%s is not a%s op", text, is_mul ? " mul" : "n add");
+
+	n = split(sp, ',', ops, 4);
+	if (part->op == 0) {
+		if (n != 0 || part->cond != NONE) return fail("nop takes nothing");
+		part->cond = 0;
+		return true;
+	}
+	if (part->cond == NONE) part->cond = 1;
+	if (!is_mul && (part->op == 7 || part->op == 8 || part->op == 23 || part->op == 24)) unary = true;
+	if (n != 3 && !(unary && n == 2)) return fail("%s takes %d operands", text, unary ? 2 : 3);
+	if (!parse_dst(ops[0], &part->dst)) return false;
+	for (int i = 1; i < n; i++)
+		if (!parse_src(ops[i], &part->src[i - 1])) return false;
+	if (n == 2) part->src[1] = part->src[0];
+	part->nsrc = 2;
+	return true;
+}
+
+/* Pick write swap so both results land in a file they can be written from */
+static bool pick_ws (int add_file, int mul_file, uint32_t* ws) {
+	if (add_file != FILE_B && mul_file != FILE_A) *ws = 0;
+	else if (add_file != FILE_A && mul_file != FILE_B) *ws = 1;
+	else return fail("both results go to regfile %c", add_file == FILE_A ? 'A' : 'B');
+	return true;
+}
+
+/* pm and pack from destination suffixes; ws must be known */
+static bool pick_pack (const dst_t* add, const dst_t* mul, uint32_t ws, int* pm, uint32_t* pack) {
+	*pm = NONE;
+	*pack = 0;
+	if (add->pack && mul->pack) return fail("only one result can be packed");
+	if (add->pack) {
+		if (ws) return fail("the add result packs only into regfile A");
+		*pm = 0;
+		*pack = add->pack;
+	}
+	else if (mul->pack) {
+		*pm = ws ? 0 : 1;
+		*pack = mul->pack;
+		if (*pm && (*pack < 3 || *pack > 7)) return fail("the mul result packs only to 8888, 8a, 8b, 8c or 8d");
+	}
+	return true;
+}
+
+/* Give every register source a read port and a mux */
+static bool allocate_reads (src_t** srcs, int count, int* raddr_a, int* raddr_b, int* imm) {
+	*raddr_a = *raddr_b = *imm = NONE;
+	for (int pass = 0; pass < 2; pass++) {
+		for (int i = 0; i < count; i++) {
+			src_t* s = srcs[i];
+			if (s->kind == SRC_ACC) {
+				s->mux = s->value;
+				continue;
+			}
+			if (s->kind == SRC_IMM) {
+				if (pass) continue;
+				if (*imm != NONE && *imm != (int)s->value) return fail("two different small immediates");
+				*imm = s->value;
+				s->mux = MUX_B;
+				continue;
+			}
+			if ((s->file == FILE_ANY) != (pass == 1)) continue;		// Fixed files first
+			int file = s->file;
+			if (file == FILE_ANY) {
+				if (*raddr_a == (int)s->value || *raddr_a == NONE) file = FILE_A;
+				else if (*raddr_b == (int)s->value || (*raddr_b == NONE && *imm == NONE)) file = FILE_B;
+				else return fail("no read port left for %s", read_names[0][s->value] ? read_names[0][s->value] : "register");
+			}
+			int* port = file == FILE_A ? raddr_a : raddr_b;
+			if (*port != NONE && *port != (int)s->value) return fail("two different regfile %c reads", file == FILE_A ? 'A' : 'B');
+			*port = s->value;
+			s->file = file;
+			s->mux = file == FILE_A ? MUX_A : MUX_B;
+		}
+		if (pass == 0 && *imm != NONE) {
+			if (*raddr_b != NONE) return fail("a small immediate and a regfile B read");
+			*raddr_b = *imm;
+		}
+	}
+	return true;
+}
+
+/* pm and unpack from source suffixes */
+static bool pick_unpack (src_t** srcs, int count, int* pm, uint32_t* unpack) {
+	int a_unpack = NONE, r4_unpack = NONE;
+	*unpack = 0;
+	for (int i = 0; i < count; i++) {
+		src_t* s = srcs[i];
+		int* seen;
+		if (s->mux == MUX_A) seen = &a_unpack;
+		else if (s->mux == MUX_R4) seen = &r4_unpack;
+		else {
+			if (s->unpack) return fail("only r4 and regfile A reads unpack");
+			continue;
+		}
+		if (*seen != NONE && *seen != s->unpack) return fail("every read of %s unpacks the same way", s->mux == MUX_A ? "regfile A" : "r4");
+		*seen = s->unpack;
+	}
+	if (a_unpack > 0 && r4_unpack > 0) return fail("regfile A and r4 cannot both unpack");
+	if (a_unpack > 0 || r4_unpack > 0) {
+		int want = a_unpack > 0 ? 0 : 1;
+		if (*pm != NONE && *pm != want) return fail("the pack and the unpack need different pm");
+		*pm = want;
+		*unpack = a_unpack > 0 ? a_unpack : r4_unpack;
+	}
+	return true;
+}
+
+static bool assemble_alu (char** parts, int nparts, uint64_t* out) {
+	alu_part_t add, mul;
+	src_t* srcs[4];
+	int nsrcs = 0, raddr_a, raddr_b, imm, pm;
+	uint32_t ws = 0, pack, unpack, sig = SIG_NONE;
+	char nop_text[] = "nop";
+	uint64_t w = 0;
+
+	if (nparts == 1) {
+		// A lone mul op is fine, the add unit does nothing
+		char op[16];
+		snprintf(op, sizeof(op), "%.*s", (int)strcspn(parts[0], " \t."), parts[0]);
+		if (find_name(add_ops, 32, op) == NONE && find_name(mul_ops, 8, op) != NONE) {
+			parts[1] = parts[0];
+			parts[0] = nop_text;
+			nparts = 2;
+		}
+	}
+	if (!parse_alu_part(parts[0], false, &add)) return false;
+	if (nparts > 1) {
+		if (!parse_alu_part(parts[1], true, &mul)) return false;
+	}
+	else parse_alu_part(nop_text, true, &mul);
+	if (nparts > 2 && strcmp(parts[2], "nop") != 0) {
+		int s = find_name(signals, 16, parts[2]);
+		if (s <= 0 && strcmp(parts[2], "bkpt") != 0) return fail("unknown signal %s", parts[2]);
+		sig = s;
+	}
+	if (mul.setf && add.op) return fail("the flags come from the add op when there is one");
+	if (add.setf && !add.op) return fail("nop sets no flags");
+
+	for (int i = 0; i < add.nsrc; i++) srcs[nsrcs++] = &add.src[i];
+	for (int i = 0; i < mul.nsrc; i++) srcs[nsrcs++] = &mul.src[i];
+	if (!allocate_reads(srcs, nsrcs, &raddr_a, &raddr_b, &imm)) return false;
+	if (imm != NONE) {
+		if (sig != SIG_NONE) return fail("signal %s and a small immediate in one instruction", parts[2]);
+		sig = SIG_SMALL_IMM;
+	}
+	if (!pick_ws(add.dst.file, mul.dst.file, &ws)) return false;
+	if (!pick_pack(&add.dst, &mul.dst, ws, &pm, &pack)) return false;
+	if (!pick_unpack(srcs, nsrcs, &pm, &unpack)) return false;
+
+	w = set(w, F_SIG, sig);
+	w = set(w, F_UNPACK, unpack);
+	w = set(w, F_PM, pm == 1);
+	w = set(w, F_PACK, pack);
+	w = set(w, F_COND_ADD, add.cond);
+	w = set(w, F_COND_MUL, mul.cond);
+	w = set(w, F_SF, add.setf || mul.setf);
+	w = set(w, F_WS, ws);
+	w = set(w, F_WADDR_ADD, add.dst.addr);
+	w = set(w, F_WADDR_MUL, mul.dst.addr);
+	w = set(w, F_OP_MUL, mul.op);
+	w = set(w, F_OP_ADD, add.op);
+	w = set(w, F_RADDR_A, raddr_a == NONE ? ADDR_NOP : raddr_a);
+	w = set(w, F_RADDR_B, raddr_b == NONE ? ADDR_NOP : raddr_b);
+	w = set(w, F_ADD_A, add.src[0].mux);
+	w = set(w, F_ADD_B, add.src[1].mux);
+	w = set(w, F_MUL_A, mul.src[0].mux);
+	w = set(w, F_MUL_B, mul.src[1].mux);
+	*out = w;
+	return true;
+}
+
+/*--------------------------------------------------------------------------}
+{				LOAD IMMEDIATE, SEMAPHORES, BRANCHES, RAW WORDS				}
+{--------------------------------------------------------------------------*/
+
+/* ldi[.cond][.setf] dst[, dst2], value: dst gets the add write, dst2 the mul write */
+static bool assemble_ldi (char* opcode, char* operands, uint64_t* out) {
+	char* ops[4];
+	dst_t add = { ADDR_NOP, FILE_ANY, 0 }, mul = { ADDR_NOP, FILE_ANY, 0 };
+	int op, cond, pm, n = split(operands, ',', ops, 4);
+	uint32_t ws = 0, pack;
+	bool setf;
+	int64_t v;
+	char* end;
+	uint64_t w = 0;
+
+	if (!parse_opcode(opcode, (const char* const[]){ "ldi" }, 1, &op, &cond, &setf)) return false;
+	if (n < 2 || n > 3) return fail("ldi takes a destination or two and a value");
+	if (!parse_dst(ops[0], &add)) return false;
+	if (n == 3 && !parse_dst(ops[1], &mul)) return false;
+
+	v = strtoll(ops[n - 1], &end, 0);
+	if (*end == '.' || *end == 'e' || *end == 'f') {				// A float, stored as its bits
+		union { float f; uint32_t u; } bits = { .f = strtof(ops[n - 1], &end) };
+		if (*end == 'f') end++;
+		v = bits.u;
+	}
+	if (*end != 0 || v < INT32_MIN || v > UINT32_MAX) return fail("bad immediate %s", ops[n - 1]);
+
+	if (cond == NONE) cond = 1;
+	if (!pick_ws(add.file, mul.file, &ws)) return false;
+	if (!pick_pack(&add, &mul, ws, &pm, &pack)) return false;
+
+	w = set(w, F_SIG, SIG_LOAD_IMM);
+	w = set(w, F_PM, pm == 1);
+	w = set(w, F_PACK, pack);
+	w = set(w, F_COND_ADD, strcmp(ops[0], "-") ? cond : 0);
+	w = set(w, F_COND_MUL, n == 3 && strcmp(ops[1], "-") ? cond : 0);
+	w = set(w, F_SF, setf);
+	w = set(w, F_WS, ws);
+	w = set(w, F_WADDR_ADD, add.addr);
+	w = set(w, F_WADDR_MUL, mul.addr);
+	w = set(w, F_IMM, (uint32_t)v);
+	*out = w;
+	return true;
+}
+
+static bool assemble_semaphore (bool down, char* operands, uint64_t* out) {
+	int64_t v;
+	if (!parse_int(operands, &v) || v < 0 || v > 15) return fail("semaphore number 0..15 expected");
+	*out = set(set(set(set(set(set(set(0, F_SIG, SIG_LOAD_IMM), F_UNPACK, LDI_SEMAPHORE),
+		F_WADDR_ADD, ADDR_NOP), F_WADDR_MUL, ADDR_NOP), F_SEM_DOWN, down), F_SEM, v), F_COND_ADD, 0);
+	return true;
+}
+
+static bool find_label (const char* name, uint32_t* pc) {
+	for (int i = 0; i < label_count; i++) {
+		if (strcmp(labels[i].name, name) == 0) {
+			*pc = labels[i].pc;
+			return true;
+		}
+	}
+	return false;
+}
+
+/* bra|brr[.cond] [link,] target[, raN]; brr targets are relative to the instruction after the 3 delay slots */
+static bool assemble_branch (char* opcode, char* operands, uint64_t* out) {
+	char* ops[4];
+	char* dot = strchr(opcode, '.');
+	int n = split(operands, ',', ops, 4);
+	bool rel = strncmp(opcode, "brr", 3) == 0;
+	int cond = 15;
+	dst_t link = { ADDR_NOP, FILE_ANY, 0 };
+	uint32_t reg_addr = 0, ws;
+	int reg_file, reg = 0;
+	int64_t target;
+	uint32_t pc;
+	uint64_t w = 0;
+
+	if (dot && (cond = find_name(branch_conds, 16, dot + 1)) < 0) return fail("unknown branch condition .%s", dot + 1);
+	if (n >= 2 && parse_raw_reg(ops[n - 1], &reg_addr, &reg_file)) {
+		if (reg_file != FILE_A || reg_addr > 31) return fail("branches add ra0..ra31 only");
+		reg = 1;
+		n--;
+	}
+	if (n < 1 || n > 2) return fail("branch takes [link,] target[, raN]");
+	if (n == 2) {
+		if (!parse_dst(ops[0], &link)) return false;
+		if (link.pack) return fail("a link address is not packed");
+	}
+	if (!parse_int(ops[n - 1], &target)) {
+		if (!find_label(ops[n - 1], &pc)) return fail("unknown label %s", ops[n - 1]);
+		if (!rel) return fail("bra takes an address, use brr to branch to a label");
+		target = (int64_t)pc - (cur_pc + 4 * 8);
+	}
+	if (target < INT32_MIN || target > UINT32_MAX) return fail("branch target out of range");
+	if (!pick_ws(link.file, FILE_ANY, &ws)) return false;
+
+	w = set(w, F_SIG, SIG_BRANCH);
+	w = set(w, F_BR_COND, cond);
+	w = set(w, F_BR_REL, rel);
+	w = set(w, F_BR_REG, reg);
+	w = set(w, F_BR_RADDR, reg_addr);
+	w = set(w, F_WS, ws);
+	w = set(w, F_WADDR_ADD, link.addr);
+	w = set(w, F_WADDR_MUL, ADDR_NOP);
+	w = set(w, F_IMM, (uint32_t)target);
+	*out = w;
+	return true;
+}
+
+/* .word low, high */
+static bool assemble_word (char* operands, uint64_t* out) {
+	char* ops[3];
+	int64_t lo, hi;
+	if (split(operands, ',', ops, 3) != 2 || !parse_int(ops[0], &lo) || !parse_int(ops[1], &hi) ||
+		lo < 0 || lo > UINT32_MAX || hi < 0 || hi > UINT32_MAX)
+		return fail(".word takes the low and the high word");
+	*out = (uint64_t)hi << 32 | (uint32_t)lo;
+	return true;
+}
+
+/* One instruction, no label or comment */
+static bool assemble_line (const char* line, uint64_t* out) {
+	char buf[MAX_LINE];
+	char* parts[4];
+	char* operands;
+	int n;
+
+	err_msg[0] = 0;
+	if (strlen(line) >= sizeof(buf)) return fail("line too long");
+	strcpy(buf, line);
+	operands = buf + strcspn(buf, " \t");
+	if (*operands) *operands++ = 0;
+
+	if (strcmp(buf, ".word") == 0) return assemble_word(operands, out);
+	if (strcmp(buf, "ldi") == 0 || strncmp(buf, "ldi.", 4) == 0) return assemble_ldi(buf, operands, out);
+	if (strcmp(buf, "sacq") == 0 || strcmp(buf, "srel") == 0) return assemble_semaphore(buf[1] == 'a', operands, out);
+	if (strncmp(buf, "bra", 3) == 0 || strncmp(buf, "brr", 3) == 0) {
+		if (buf[3] == 0 || buf[3] == '.') return assemble_branch(buf, operands, out);
+	}
+
+	strcpy(buf, line);
+	n = split(buf, ';', parts, 3);
+	if (n > 3) return fail("more than add op; mul op; signal");
+	return assemble_alu(parts, n, out);
+}
+
+/*--------------------------------------------------------------------------}
+{								DISASSEMBLER								}
+{--------------------------------------------------------------------------*/
+
+static void read_name (char* out, int file, uint32_t addr, bool raw) {
+	if (!raw && addr >= 32 && read_names[file][addr]) strcpy(out, read_names[file][addr]);
+	else sprintf(out, "r%c%d", file == FILE_A ? 'a' : 'b', addr);
+}
+
+static void write_name (char* out, int file, uint32_t addr, bool raw) {
+	if (!raw && addr >= 32) strcpy(out, write_names[file][addr]);
+	else sprintf(out, "r%c%d", file == FILE_A ? 'a' : 'b', addr);
+}
+
+static bool src_text (char* out, uint64_t w, uint32_t mux, bool raw) {
+	uint32_t pm = get(w, F_PM), unpack = get(w, F_UNPACK);
+
+	if (mux < MUX_A) {
+		sprintf(out, "r%d", mux);
+		if (mux == MUX_R4 && pm && unpack) sprintf(out + strlen(out), ".%s", unpacks[unpack]);
+	}
+	else if (mux == MUX_A) {
+		read_name(out, FILE_A, get(w, F_RADDR_A), raw);
+		if (!pm && unpack) sprintf(out + strlen(out), ".%s", unpacks[unpack]);
+	}
+	else if (get(w, F_SIG) == SIG_SMALL_IMM) {
+		uint32_t imm = get(w, F_RADDR_B);
+		if (imm < 16) sprintf(out, "%d", imm);
+		else if (imm < 32) sprintf(out, "%d", (int)imm - 32);
+		else if (imm < 48) strcpy(out, small_floats[imm - 32]);
+		else return false;											// Vector rotates have no syntax
+	}
+	else read_name(out, FILE_B, get(w, F_RADDR_B), raw);
+	return true;
+}
+
+static bool alu_part_text (char* out, uint64_t w, bool is_mul, bool raw) {
+	uint32_t op = is_mul ? get(w, F_OP_MUL) : get(w, F_OP_ADD);
+	uint32_t cond = is_mul ? get(w, F_COND_MUL) : get(w, F_COND_ADD);
+	uint32_t waddr = is_mul ? get(w, F_WADDR_MUL) : get(w, F_WADDR_ADD);
+	uint32_t a = is_mul ? get(w, F_MUL_A) : get(w, F_ADD_A);
+	uint32_t b = is_mul ? get(w, F_MUL_B) : get(w, F_ADD_B);
+	uint32_t ws = get(w, F_WS), pm = get(w, F_PM), pack = get(w, F_PACK);
+	bool setf = get(w, F_SF) && (is_mul ? get(w, F_OP_ADD) == 0 : true);
+	const char* name = is_mul ? mul_ops[op] : add_ops[op];
+	bool unary = !is_mul && (op == 7 || op == 8 || op == 23 || op == 24);
+	int file = (ws != is_mul) ? FILE_B : FILE_A;					// Add writes A unless swapped, mul the other
+	char dst[24], sa[24], sb[24];
+
+	if (name == 0) return false;
+	if (op == 0) {
+		strcpy(out, "nop");
+		return true;
+	}
+	if (a == b && op == (is_mul ? OP_MUL_V8MIN : OP_ADD_OR)) {
+		name = "mov";
+		unary = true;
+	}
+	write_name(dst, file, waddr, raw);
+	if (pack && ((pm && is_mul) || (!pm && file == FILE_A))) sprintf(dst + strlen(dst), ".%s", packs[pack]);
+	if (!src_text(sa, w, a, raw) || !src_text(sb, w, b, raw)) return false;
+
+	out += sprintf(out, "%s%s%s%s", name, cond == 1 ? "" : ".", cond == 1 ? "" : conds[cond], setf ? ".setf" : "");
+	if (unary && a == b) sprintf(out, " %s, %s", dst, sa);
+	else sprintf(out, " %s, %s, %s", dst, sa, sb);
+	return true;
+}
+
+static bool disasm_alu (char* out, uint64_t w, bool raw) {
+	char add[64], mul[64];
+	uint32_t sig = get(w, F_SIG);
+
+	if (!alu_part_text(add, w, false, raw) || !alu_part_text(mul, w, true, raw)) return false;
+	out += sprintf(out, "%s; %s", add, mul);
+	if (sig != SIG_NONE && sig != SIG_SMALL_IMM) sprintf(out, "; %s", signals[sig]);
+	return true;
+}
+
+static bool disasm_ldi (char* out, uint64_t w, bool raw) {
+	uint32_t cond_add = get(w, F_COND_ADD), cond_mul = get(w, F_COND_MUL);
+	uint32_t waddr_add = get(w, F_WADDR_ADD), waddr_mul = get(w, F_WADDR_MUL);
+	uint32_t ws = get(w, F_WS), pm = get(w, F_PM), pack = get(w, F_PACK);
+	bool use_mul = cond_mul != 0 || waddr_mul != ADDR_NOP;
+	uint32_t cond = cond_add ? cond_add : cond_mul;
+	char add[24], mul[24];
+
+	if (get(w, F_UNPACK) == LDI_SEMAPHORE) {
+		sprintf(out, "%s %d", get(w, F_SEM_DOWN) ? "sacq" : "srel", get(w, F_SEM));
+		return true;
+	}
+	if (get(w, F_UNPACK) != 0) return false;						// Per element immediates have no syntax
+	if (use_mul && cond_add && cond_mul != cond_add) return false;
+	if (cond == 0) cond = 1;
+
+	write_name(add, ws ? FILE_B : FILE_A, waddr_add, raw);
+	write_name(mul, ws ? FILE_A : FILE_B, waddr_mul, raw);
+	if (pack && !pm && !ws) sprintf(add + strlen(add), ".%s", packs[pack]);
+	if (pack && (pm || ws)) sprintf(mul + strlen(mul), ".%s", packs[pack]);
+
+	out += sprintf(out, "ldi%s%s%s %s", cond == 1 ? "" : ".", cond == 1 ? "" : conds[cond], get(w, F_SF) ? ".setf" : "", add);
+	if (use_mul) out += sprintf(out, ", %s", mul);
+	sprintf(out, ", 0x%08x", get(w, F_IMM));
+	return true;
+}
+
+static bool disasm_branch (char* out, uint64_t w, bool raw) {
+	uint32_t cond = get(w, F_BR_COND);
+	uint32_t waddr = get(w, F_WADDR_ADD);
+	char link[24];
+
+	if (branch_conds[cond] == 0) return false;
+	out += sprintf(out, "%s%s%s", get(w, F_BR_REL) ? "brr" : "bra", cond == 15 ? "" : ".", branch_conds[cond]);
+	if (waddr != ADDR_NOP || get(w, F_WS)) {
+		write_name(link, get(w, F_WS) ? FILE_B : FILE_A, waddr, raw);
+		out += sprintf(out, " %s,", link);
+	}
+	out += sprintf(out, " %d", (int32_t)get(w, F_IMM));
+	if (get(w, F_BR_REG)) sprintf(out, ", ra%d", get(w, F_BR_RADDR));
+	return true;
+}
+
+/**
+ * Text for one instruction that assembles back to exactly w: the readable
+ * form if that round trips, else with raw register numbers, else .word.
+ */
+static void disassemble (char* out, uint64_t w) {
+	for (int raw = 0; raw < 2; raw++) {
+		uint64_t again;
+		bool ok;
+		uint32_t sig = get(w, F_SIG);
+
+		if (sig == SIG_BRANCH) ok = disasm_branch(out, w, raw);
+		else if (sig == SIG_LOAD_IMM) ok = disasm_ldi(out, w, raw);
+		else ok = disasm_alu(out, w, raw);
+		if (ok && assemble_line(out, &again) && again == w) return;
+	}
+	sprintf(out, ".word 0x%08x, 0x%08x", (uint32_t)w, (uint32_t)(w >> 32));
+}
+
+/*--------------------------------------------------------------------------}
+{									 DRIVER									}
+{--------------------------------------------------------------------------*/
+
+typedef struct {
+	uint64_t word;
+	char text[MAX_LINE];			// Source with comments and labels removed
+	int line;
+} inst_t;
+
+static inst_t insts[MAX_INSTS];
+static int inst_count;
+
+/* Cut the comment off and take any "label:" prefixes, what is left is the instruction */
+static char* strip_line (char* line, bool define_labels) {
+	char* s = line;
+	char* c;
+
+	if ((c = strchr(s, '#')) != 0) *c = 0;
+	if ((c = strstr(s, "//")) != 0) *c = 0;
+	s = trim(s);
+	for (;;) {
+		size_t n = strspn(s, "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789_");
+		if (n == 0 || s[n] != ':') return s;
+		s[n] = 0;
+		if (define_labels) {
+			uint32_t pc;
+			if (n >= sizeof(labels[0].name)) fatal("%s:%d: label %s is too long", src_file, src_line, s);
+			if (find_label(s, &pc)) fatal("%s:%d: label %s defined twice", src_file, src_line, s);
+			if (label_count == MAX_LABELS) fatal("%s:%d: too many labels", src_file, src_line);
+			strcpy(labels[label_count].name, s);
+			labels[label_count++].pc = inst_count * 8;
+		}
+		s = trim(s + n + 1);
+	}
+}
+
+static void assemble_file (FILE* f) {
+	char line[MAX_LINE];
+
+	// First pass finds the labels, the second assembles with all of them known
+	for (src_line = 1; fgets(line, sizeof(line), f); src_line++) {
+		char* s = strip_line(line, true);
+		if (*s == 0) continue;
+		if (inst_count == MAX_INSTS) fatal("%s:%d: more than %d instructions", src_file, src_line, MAX_INSTS);
+		strcpy(insts[inst_count].text, s);
+		insts[inst_count++].line = src_line;
+	}
+
+	for (int i = 0; i < inst_count; i++) {
+		char text[MAX_LINE];
+		uint64_t again;
+
+		src_line = insts[i].line;
+		cur_pc = i * 8;
+		if (!assemble_line(insts[i].text, &insts[i].word)) fatal("%s:%d: %s", src_file, src_line, err_msg);
+
+		// The disassembler has to read back what was written
+		disassemble(text, insts[i].word);
+		if (!assemble_line(text, &again) || again != insts[i].word)
+			fatal("%s:%d: internal error, \"%s\" does not round trip", src_file, src_line, insts[i].text);
+
+		if (get(insts[i].word, F_SIG) == SIG_THREAD_END && i + 2 >= inst_count)
+			fatal("%s:%d: thrend needs two more instructions after it", src_file, src_line);
+	}
+}
+
+static void write_header (FILE* out, const char* source, const char* name) {
+	char guard[64];
+	int n = 0;
+
+	for (const char* p = name; *p && n < (int)sizeof(guard) - 8; p++) guard[n++] = toupper((unsigned char)*p);
+	guard[n] = 0;
+
+	fprintf(out, "/* Generated from %s by tools/qpuasm, do not edit */\n", source);
+	fprintf(out, "#ifndef _SHADER_%s_H\n#define _SHADER_%s_H\n\n#include <stdint.h>\n\n", guard, guard);
+	fprintf(out, "static uint32_t %s_shader[%d] = {\n", name, inst_count * 2);
+	for (int i = 0; i < inst_count; i++) {
+		fprintf(out, "\t0x%08x, 0x%08x,\t/* %s */\n", (uint32_t)insts[i].word, (uint32_t)(insts[i].word >> 32), insts[i].text);
+	}
+	fprintf(out, "};\n\n#endif\n");
+}
+
+/* Every 0x word outside C comments, in order */
+static void disassemble_file (FILE* f) {
+	uint32_t words[MAX_INSTS * 2];
+	int count = 0, c, prev = 0;
+	bool in_comment = false, in_line_comment = false;
+	char token[16];
+	int len = 0;
+
+	do {
+		c = fgetc(f);
+		if (in_comment) {
+			if (prev == '*' && c == '/') in_comment = false;
+			prev = c;
+			continue;
+		}
+		if (in_line_comment) {
+			if (c == '\n') in_line_comment = false;
+			continue;
+		}
+		if (prev == '/' && c == '*') {
+			in_comment = true;
+			prev = 0;
+			len = 0;
+			continue;
+		}
+		if (prev == '/' && c == '/') {
+			in_line_comment = true;
+			prev = 0;
+			continue;
+		}
+		prev = c;
+		if (isalnum(c) && len < (int)sizeof(token) - 1) {
+			token[len++] = c;
+			continue;
+		}
+		token[len] = 0;
+		if (len > 2 && token[0] == '0' && (token[1] == 'x' || token[1] == 'X')) {
+			if (count == MAX_INSTS * 2) fatal("%s: too many words", src_file);
+			words[count++] = strtoul(token, 0, 16);
+		}
+		len = 0;
+	} while (c != EOF);
+	if (count & 1) fatal("%s: %d words is not a whole number of instructions", src_file, count);
+
+	for (int i = 0; i < count; i += 2) {
+		char text[MAX_LINE];
+		uint64_t w = (uint64_t)words[i + 1] << 32 | words[i];
+		cur_pc = i * 4;
+		disassemble(text, w);
+		printf("\t%-48s # %04x: %08x %08x", text, cur_pc, words[i], words[i + 1]);
+		if (get(w, F_SIG) == SIG_BRANCH && get(w, F_BR_REL))
+			printf(" -> %04x", cur_pc + 32 + (int32_t)get(w, F_IMM));
+		printf("\n");
+	}
+}
+
+static void usage (void) {
+	fprintf(stderr,
+		"usage: qpuasm [-o OUT.h] [-n NAME] FILE.qasm\n"
+		"       qpuasm -d FILE\n");
+	exit(2);
+}
+
+int main (int argc, char* argv[]) {
+	const char* out_path = 0;
+	const char* name = 0;
+	bool dis = false;
+	char base[64];
+	FILE* in;
+	int i;
+
+	for (i = 1; i < argc && argv[i][0] == '-' && argv[i][1]; i++) {
+		if (strcmp(argv[i], "-d") == 0) dis = true;
+		else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) out_path = argv[++i];
+		else if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) name = argv[++i];
+		else usage();
+	}
+	if (i != argc - 1) usage();
+	src_file = argv[i];
+	in = strcmp(src_file, "-") ? fopen(src_file, "r") : stdin;
+	if (in == 0) {
+		perror(src_file);
+		return 1;
+	}
+
+	if (dis) {
+		disassemble_file(in);
+		return 0;
+	}
+
+	assemble_file(in);
+	if (name == 0) {
+		// File name without directory and extension
+		const char* slash = strrchr(src_file, '/');
+		snprintf(base, sizeof(base), "%s", slash ? slash + 1 : src_file);
+		base[strcspn(base, ".")] = 0;
+		name = base;
+	}
+	if (out_path) {
+		FILE* out = fopen(out_path, "w");
+		if (out == 0) {
+			perror(out_path);
+			return 1;
+		}
+		write_header(out, src_file, name);
+		if (fclose(out) != 0) {
+			perror(out_path);
+			return 1;
+		}
+	}
+	else write_header(stdout, src_file, name);
+	return 0;
+}
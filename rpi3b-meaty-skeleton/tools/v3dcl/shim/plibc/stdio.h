@@ -0,0 +1,2 @@
+/* Host build: kernel sources that print get the C library's printf */
+#include <stdio.h>
@@ -0,0 +1,1086 @@
+/* v3dcl.c - decode and check VC4 control lists on the build host
+ *
+ *   v3dcl scene [width height]
+ *       Build the kernel's test scene with graphics/opengl_es2.c against
+ *       fake GPU memory, then check the binning and render lists it made.
+ *
+ *   v3dcl soft OUT.ppm [width height]
+ *       Build the same scene and draw it with graphics/soft_raster.c, the
+ *       kernel's fallback when there is no V3D, into OUT.ppm.
+ *
+ *   v3dcl bench
+ *       The kernel's software rasteriser benchmark, on the host's C spans.
+ *
+ *   v3dcl cltest
+ *       Emit lists for several frame sizes straight from graphics/v3d_cl.c,
+ *       check them, relocate them and check again, and check the builder's
+ *       own limits. Exits 1 if anything is off.
+ *
+ *   v3dcl bin|render LIST ADDR [ADDR:SIZE | ADDR:FILE ...]
+ *       Check a list dumped from the Pi, loaded at bus address ADDR. The
+ *       other arguments describe the rest of GPU memory: a size is enough
+ *       for address checks, with a dump shader records and indices are
+ *       read too.
+ *
+ * Every packet is printed with its fields; problems are reported under
+ * the packet. The exit status is 1 when there was an error.
+ */
+
+#define _GNU_SOURCE
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+
+#include <graphics/opengl_es.h>
+#include <graphics/opengl_es2.h>
+#include <graphics/pi_console.h>
+#include <graphics/shaders/vertex_colour.h>
+#include <graphics/v3d.h>
+#include <graphics/v3d_cl.h>
+#include <graphics/v3d_pool.h>
+#include <graphics/soft_raster.h>
+#include <kernel/systimer.h>
+#include <mem/dma_alloc.h>
+#include <mem/kernel_alloc.h>
+
+#define BUS_ALIAS_MASK	0x3FFFFFFF	// 0x4, 0x8 and 0xC aliases are the same memory
+#define MAX_REGIONS		32
+
+#define LIST_BIN		0x01
+#define LIST_RENDER		0x02
+#define LIST_ANY		(LIST_BIN | LIST_RENDER)
+
+#define TILE_STATE_SIZE	48			// Binner state per tile
+#define MAX_TILES		(256 * 256)	// Tile coordinates are bytes
+
+/* STORE_TILE_BUFFER and STORE_FULL_TILE_BUFFER address word */
+#define STORE_EOF		0x08		// Last tile of the frame
+
+typedef struct {
+	const char* name;
+	uint32_t bus;					// Alias bits stripped
+	uint32_t size;
+	uint8_t* data;					// Contents, NULL when only the size is known
+} region_t;
+
+typedef struct {
+	const char* name;
+	uint8_t size;					// Including the opcode, 0 for an unknown opcode
+	uint8_t lists;					// LIST_BIN and/or LIST_RENDER
+} packet_t;
+
+static const packet_t packets[256] = {
+	[GL_HALT] = { "HALT", 1, LIST_ANY },
+	[GL_NOP] = { "NOP", 1, LIST_ANY },
+	[GL_FLUSH] = { "FLUSH", 1, LIST_BIN },
+	[GL_FLUSH_ALL_STATE] = { "FLUSH_ALL_STATE", 1, LIST_BIN },
+	[GL_START_TILE_BINNING] = { "START_TILE_BINNING", 1, LIST_BIN },
+	[GL_INCREMENT_SEMAPHORE] = { "INCREMENT_SEMAPHORE", 1, LIST_ANY },
+	[GL_WAIT_ON_SEMAPHORE] = { "WAIT_ON_SEMAPHORE", 1, LIST_ANY },
+	[GL_BRANCH] = { "BRANCH", 5, LIST_ANY },
+	[GL_BRANCH_TO_SUBLIST] = { "BRANCH_TO_SUBLIST", 5, LIST_ANY },
+	[GL_RETURN_FROM_SUBLIST] = { "RETURN_FROM_SUBLIST", 1, LIST_ANY },
+	[GL_STORE_MULTISAMPLE] = { "STORE_MULTISAMPLE", 1, LIST_RENDER },
+	[GL_STORE_MULTISAMPLE_END] = { "STORE_MULTISAMPLE_END", 1, LIST_RENDER },
+	[GL_STORE_FULL_TILE_BUFFER] = { "STORE_FULL_TILE_BUFFER", 5, LIST_RENDER },
+	[GL_RELOAD_FULL_TILE_BUFFER] = { "RELOAD_FULL_TILE_BUFFER", 5, LIST_RENDER },
+	[GL_STORE_TILE_BUFFER] = { "STORE_TILE_BUFFER", 7, LIST_RENDER },
+	[GL_LOAD_TILE_BUFFER] = { "LOAD_TILE_BUFFER", 7, LIST_RENDER },
+	[GL_INDEXED_PRIMITIVE_LIST] = { "INDEXED_PRIMITIVE_LIST", 14, LIST_ANY },
+	[GL_VERTEX_ARRAY_PRIMITIVES] = { "VERTEX_ARRAY_PRIMITIVES", 10, LIST_ANY },
+	[GL_PRIMITIVE_LIST_FORMAT] = { "PRIMITIVE_LIST_FORMAT", 2, LIST_ANY },
+	[GL_SHADER_STATE] = { "SHADER_STATE", 5, LIST_ANY },
+	[GL_NV_SHADER_STATE] = { "NV_SHADER_STATE", 5, LIST_ANY },
+	[GL_VG_SHADER_STATE] = { "VG_SHADER_STATE", 5, LIST_ANY },
+	[GL_CONFIG_STATE] = { "CONFIG_STATE", 4, LIST_ANY },
+	[GL_FLAT_SHADE_FLAGS] = { "FLAT_SHADE_FLAGS", 5, LIST_ANY },
+	[GL_POINTS_SIZE] = { "POINTS_SIZE", 5, LIST_ANY },
+	[GL_LINE_WIDTH] = { "LINE_WIDTH", 5, LIST_ANY },
+	[GL_RHT_X_BOUNDARY] = { "RHT_X_BOUNDARY", 3, LIST_ANY },
+	[GL_DEPTH_OFFSET] = { "DEPTH_OFFSET", 5, LIST_ANY },
+	[GL_CLIP_WINDOW] = { "CLIP_WINDOW", 9, LIST_ANY },
+	[GL_VIEWPORT_OFFSET] = { "VIEWPORT_OFFSET", 5, LIST_ANY },
+	[GL_Z_CLIPPING_PLANES] = { "Z_CLIPPING_PLANES", 9, LIST_ANY },
+	[GL_CLIPPER_XY_SCALING] = { "CLIPPER_XY_SCALING", 9, LIST_ANY },
+	[GL_CLIPPER_Z_ZSCALE_OFFSET] = { "CLIPPER_Z_ZSCALE_OFFSET", 9, LIST_ANY },
+	[GL_TILE_BINNING_CONFIG] = { "TILE_BINNING_CONFIG", 16, LIST_BIN },
+	[GL_TILE_RENDER_CONFIG] = { "TILE_RENDER_CONFIG", 11, LIST_RENDER },
+	[GL_CLEAR_COLORS] = { "CLEAR_COLORS", 14, LIST_RENDER },
+	[GL_TILE_COORDINATES] = { "TILE_COORDINATES", 3, LIST_RENDER },
+};
+
+/* What the checks have seen so far in the list being decoded */
+typedef struct {
+	uint32_t kind;
+
+	bool bin_config;				// TILE_BINNING_CONFIG seen
+	bool binning;					// START_TILE_BINNING seen
+	bool flushed;					// FLUSH since the last primitives
+	bool clip_window;
+	bool prim_format;
+	bool shader_state;
+	bool record_known;				// The record below could be read
+	uint32_t stride;				// From the current NV shader record
+	uint32_t vertices;
+	uint32_t primitives;
+
+	bool render_config;
+	uint32_t tiles_x, tiles_y;
+	bool tile_open;					// TILE_COORDINATES with no store yet
+	uint32_t tile_x, tile_y;
+	uint32_t frames_ended;
+	uint32_t stores;
+	uint8_t stored[MAX_TILES];
+} cl_state_t;
+
+/* The binning configuration, kept so the render list can be checked against it */
+static struct {
+	bool known;
+	uint32_t tile_alloc;
+	uint32_t tile_alloc_size;
+	uint32_t block_size;
+	uint32_t wth, ht;
+} bin_cfg;
+
+static region_t regions[MAX_REGIONS];
+static uint32_t region_count;
+
+static uint32_t errors;
+static uint32_t warnings;
+static uint32_t packet_addr;		// Bus address of the packet being checked
+
+static uint32_t op_count[256];
+static uint32_t op_bytes[256];
+
+static void cl_report (const char* kind, const char* fmt, va_list ap) {
+	printf("%08x    %s: ", packet_addr, kind);
+	vprintf(fmt, ap);
+	printf("\n");
+}
+
+static void cl_error (const char* fmt, ...) {
+	va_list ap;
+	va_start(ap, fmt);
+	cl_report("ERROR", fmt, ap);
+	va_end(ap);
+	errors++;
+}
+
+static void cl_warn (const char* fmt, ...) {
+	va_list ap;
+	va_start(ap, fmt);
+	cl_report("warning", fmt, ap);
+	va_end(ap);
+	warnings++;
+}
+
+static inline uint16_t get_u16 (const uint8_t* p) {
+	return p[0] | (p[1] << 8);
+}
+
+static inline uint32_t get_u32 (const uint8_t* p) {
+	return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static float get_f32 (const uint8_t* p) {
+	union { uint32_t u; float f; } bits = { .u = get_u32(p) };
+	return bits.f;
+}
+
+static region_t* add_region (const char* name, uint32_t bus, uint32_t size, uint8_t* data) {
+	region_t* r;
+	if (region_count == MAX_REGIONS) {
+		fprintf(stderr, "v3dcl: more than %d memory regions\n", MAX_REGIONS);
+		exit(2);
+	}
+	r = &regions[region_count++];
+	r->name = name;
+	r->bus = bus & BUS_ALIAS_MASK;
+	r->size = size;
+	r->data = data;
+	return r;
+}
+
+/* The region holding all of [bus, bus + len), or NULL */
+static region_t* find_region (uint32_t bus, uint32_t len) {
+	bus &= BUS_ALIAS_MASK;
+	for (uint32_t i = 0; i < region_count; i++) {
+		region_t* r = &regions[i];
+		if (bus - r->bus < r->size && len <= r->size - (bus - r->bus))
+			return r;
+	}
+	return 0;
+}
+
+/* Host copy of [bus, bus + len), or NULL if nobody gave us that memory */
+static uint8_t* host_ptr (uint32_t bus, uint32_t len) {
+	region_t* r = find_region(bus, len);
+	if (r == 0 || r->data == 0) return 0;
+	return r->data + ((bus & BUS_ALIAS_MASK) - r->bus);
+}
+
+/* An address field: aligned and, when any memory is described, inside it */
+static bool check_addr (const char* what, uint32_t bus, uint32_t len, uint32_t align) {
+	bool ok = true;
+	if (align > 1 && (bus & (align - 1))) {
+		cl_error("%s %08x is not %d byte aligned", what, bus, align);
+		ok = false;
+	}
+	if (region_count != 0 && find_region(bus, len ? len : 1) == 0) {
+		cl_error("%s %08x..%08x is outside GPU memory", what, bus, bus + len);
+		ok = false;
+	}
+	return ok;
+}
+
+/*--------------------------------------------------------------------------}
+{						   SHADER RECORDS AND INDICES						}
+{--------------------------------------------------------------------------*/
+
+static void check_nv_record (cl_state_t* st, uint32_t addr) {
+	const uint8_t* rec;
+	uint32_t flags, stride, varyings, code, uniforms, vertices, need;
+
+	st->shader_state = true;
+	st->record_known = false;
+	if (!check_addr("shader record", addr, 16, 16)) return;
+	rec = host_ptr(addr, 16);
+	if (rec == 0) return;
+
+	flags = rec[0];
+	stride = rec[1];
+	varyings = rec[3];
+	code = get_u32(&rec[4]);
+	uniforms = get_u32(&rec[8]);
+	vertices = get_u32(&rec[12]);
+	printf("%08x    record: flags %02x stride %d uniforms %d varyings %d code %08x uniforms %08x vertices %08x\n",
+		addr, flags, stride, rec[2], varyings, code, uniforms, vertices);
+
+	check_addr("fragment shader", code, 8, 8);
+	if (uniforms) check_addr("uniforms", uniforms, 4, 4);
+	check_addr("vertex data", vertices, stride, 1);
+
+	// Xs, Ys, Zs, 1/Wc then the varyings; point size and clip header when flagged
+	need = 12 + 4 * varyings;
+	if (flags & 0x02) need += 4;
+	if (flags & 0x08) need += 16;
+	if (stride < need) cl_error("vertex stride %d is less than the %d bytes each vertex needs", stride, need);
+
+	st->record_known = true;
+	st->stride = stride;
+	st->vertices = vertices;
+}
+
+/* The vertices indices 0..max_index reach must be inside the vertex buffer */
+static void check_vertices (cl_state_t* st, uint32_t max_index) {
+	if (!st->record_known) return;
+	check_addr("vertex data", st->vertices, (max_index + 1) * st->stride, 1);
+}
+
+static void start_primitives (cl_state_t* st, const char* name) {
+	if (st->kind == LIST_BIN && !st->binning) cl_error("%s before START_TILE_BINNING", name);
+	if (!st->shader_state) cl_error("%s with no shader state", name);
+	if (st->kind == LIST_BIN && !st->clip_window) cl_warn("%s with no clip window", name);
+	if (st->kind == LIST_BIN && !st->prim_format) cl_warn("%s with no primitive list format", name);
+	st->primitives++;
+	st->flushed = false;
+}
+
+static void check_count (uint32_t prim, uint32_t count) {
+	if (prim > PRIM_TRIANGLE_FAN) cl_error("primitive mode %d does not exist", prim);
+	else if (count == 0) cl_warn("draws nothing");
+	else if (prim == PRIM_TRIANGLE && count % 3) cl_warn("%d vertices is not a whole number of triangles", count);
+	else if (prim == PRIM_LINE && count % 2) cl_warn("%d vertices is not a whole number of lines", count);
+}
+
+static void check_indexed (cl_state_t* st, const uint8_t* p) {
+	uint32_t prim = p[0] & 0x0F;
+	uint32_t index_size = (p[0] >> 4) == 1 ? 2 : 1;
+	uint32_t count = get_u32(&p[1]);
+	uint32_t indices = get_u32(&p[5]);
+	uint32_t max_index = get_u32(&p[9]);
+	const uint8_t* data;
+
+	printf(" mode %d, %d %d bit indices at %08x, max %d\n", prim, count, index_size * 8, indices, max_index);
+	start_primitives(st, "primitives");
+	if ((p[0] >> 4) > 1) cl_error("index type %d does not exist", p[0] >> 4);
+	check_count(prim, count);
+	if (!check_addr("indices", indices, count * index_size, index_size)) return;
+
+	data = host_ptr(indices, count * index_size);
+	if (data) {
+		uint32_t top = 0;
+		for (uint32_t i = 0; i < count; i++) {
+			uint32_t index = index_size == 2 ? get_u16(&data[i * 2]) : data[i];
+			if (index > top) top = index;
+		}
+		if (top > max_index) cl_error("index %d is above the max index %d", top, max_index);
+	}
+	check_vertices(st, max_index);
+}
+
+/*--------------------------------------------------------------------------}
+{							 BINNING PACKETS								}
+{--------------------------------------------------------------------------*/
+
+static void check_bin_config (cl_state_t* st, const uint8_t* p) {
+	uint32_t tile_alloc = get_u32(&p[0]);
+	uint32_t size = get_u32(&p[4]);
+	uint32_t tile_state = get_u32(&p[8]);
+	uint32_t wth = p[12], ht = p[13], flags = p[14];
+	uint32_t block = 32 << ((flags >> 3) & 3);
+	uint32_t state_size = wth * ht * TILE_STATE_SIZE;
+
+	printf(" %dx%d tiles, alloc %08x size %d, state %08x, flags %02x\n", wth, ht, tile_alloc, size, tile_state, flags);
+	if (st->binning) cl_error("binning config after START_TILE_BINNING");
+	if (wth == 0 || ht == 0) cl_error("no tiles");
+	check_addr("tile allocation", tile_alloc, size, 32);
+	check_addr("tile state", tile_state, state_size, 16);
+	if (size < wth * ht * block)
+		cl_error("tile allocation of %d bytes is short of the %d byte first blocks", size, wth * ht * block);
+	if (tile_state < tile_alloc + size && tile_alloc < tile_state + state_size)
+		cl_error("tile state and tile allocation memory overlap");
+	if (!(flags & V3D_BIN_AUTO_INIT_STATE)) cl_warn("tile state is not auto initialised, the CPU must clear it");
+
+	st->bin_config = true;
+	bin_cfg.known = true;
+	bin_cfg.tile_alloc = tile_alloc & BUS_ALIAS_MASK;
+	bin_cfg.tile_alloc_size = size;
+	bin_cfg.block_size = block;
+	bin_cfg.wth = wth;
+	bin_cfg.ht = ht;
+}
+
+/*--------------------------------------------------------------------------}
+{							 RENDER PACKETS									}
+{--------------------------------------------------------------------------*/
+
+static void check_render_config (cl_state_t* st, const uint8_t* p) {
+	uint32_t fb = get_u32(&p[0]);
+	uint32_t wth = get_u16(&p[4]), ht = get_u16(&p[6]), flags = get_u16(&p[8]);
+	uint32_t format = (flags >> 2) & 3;
+	uint32_t tile = (flags & 1) ? 32 : 64;							// Multisampled tiles are 32x32
+
+	printf(" %dx%d to %08x, flags %04x\n", wth, ht, fb, flags);
+	if (st->tile_open || st->stores) cl_warn("render config changed in the middle of the frame");
+	if (wth == 0 || ht == 0) cl_error("empty frame");
+	if (format == 3) cl_error("frame buffer format 3 does not exist");
+	else check_addr("frame buffer", fb, wth * ht * (format == 1 ? 4 : 2), 16);
+
+	st->render_config = true;
+	st->tiles_x = (wth + tile - 1) / tile;
+	st->tiles_y = (ht + tile - 1) / tile;
+	if (bin_cfg.known && (bin_cfg.wth != st->tiles_x || bin_cfg.ht != st->tiles_y))
+		cl_error("frame is %dx%d tiles but binning made %dx%d", st->tiles_x, st->tiles_y, bin_cfg.wth, bin_cfg.ht);
+}
+
+static void check_tile_coordinates (cl_state_t* st, const uint8_t* p) {
+	printf(" (%d, %d)\n", p[0], p[1]);
+	if (!st->render_config) cl_error("tile selected before TILE_RENDER_CONFIG");
+	else if (p[0] >= st->tiles_x || p[1] >= st->tiles_y)
+		cl_error("tile (%d, %d) is outside the %dx%d tile frame", p[0], p[1], st->tiles_x, st->tiles_y);
+	if (st->tile_open) cl_error("tile (%d, %d) is never stored", st->tile_x, st->tile_y);
+	st->tile_open = true;
+	st->tile_x = p[0];
+	st->tile_y = p[1];
+}
+
+/* Any store writes out the selected tile; end_of_frame also finishes the frame */
+static void check_store (cl_state_t* st, bool end_of_frame) {
+	if (!st->tile_open) cl_error("store with no tile selected");
+	else if (st->tile_x < st->tiles_x && st->tile_y < st->tiles_y)
+		st->stored[st->tile_y * st->tiles_x + st->tile_x] = 1;
+	if (st->frames_ended) cl_error("store after the end of the frame");
+	if (end_of_frame) st->frames_ended++;
+	st->tile_open = false;
+	st->stores++;
+}
+
+static void check_store_general (cl_state_t* st, const uint8_t* p) {
+	uint32_t flags = get_u16(&p[0]);
+	uint32_t word = get_u32(&p[2]);
+	uint32_t buffer = flags & 7;
+
+	printf(" buffer %d, flags %04x, address %08x%s\n", buffer, flags, word & ~0xF, (word & STORE_EOF) ? ", end of frame" : "");
+	if (buffer > 4) cl_error("tile buffer %d does not exist", buffer);
+	if (buffer != 0) check_addr("store", word & ~0xF, 16, 16);
+	check_store(st, word & STORE_EOF);
+}
+
+static void check_sublist (cl_state_t* st, uint32_t addr) {
+	uint32_t offset, expect;
+
+	printf(" %08x\n", addr);
+	if (st->kind != LIST_RENDER || !bin_cfg.known) {
+		check_addr("sublist", addr, 1, 1);
+		return;
+	}
+	if (!st->tile_open) cl_error("sublist outside a tile");
+	offset = (addr & BUS_ALIAS_MASK) - bin_cfg.tile_alloc;
+	if (offset >= bin_cfg.tile_alloc_size) {
+		cl_error("sublist %08x is not in tile allocation memory", addr);
+		return;
+	}
+	expect = (st->tile_y * bin_cfg.wth + st->tile_x) * bin_cfg.block_size;
+	if (offset % bin_cfg.block_size) cl_error("sublist %08x is not at the start of a tile list", addr);
+	else if (st->tile_open && offset != expect && bin_cfg.wth)
+		cl_error("tile (%d, %d) branches to the list of tile (%d, %d)", st->tile_x, st->tile_y,
+			(offset / bin_cfg.block_size) % bin_cfg.wth, (offset / bin_cfg.block_size) / bin_cfg.wth);
+}
+
+/*--------------------------------------------------------------------------}
+{								THE DECODER									}
+{--------------------------------------------------------------------------*/
+
+static void decode_packet (cl_state_t* st, uint8_t op, const uint8_t* p) {
+	switch (op) {
+		case GL_FLUSH:
+		case GL_FLUSH_ALL_STATE:
+			printf("\n");
+			if (!st->binning) cl_warn("flush before START_TILE_BINNING");
+			st->flushed = true;
+			break;
+		case GL_START_TILE_BINNING:
+			printf("\n");
+			if (!st->bin_config) cl_error("START_TILE_BINNING before TILE_BINNING_CONFIG");
+			st->binning = true;
+			st->flushed = false;
+			break;
+		case GL_BRANCH:
+			printf(" %08x, not followed\n", get_u32(p));
+			check_addr("branch", get_u32(p), 1, 1);
+			break;
+		case GL_BRANCH_TO_SUBLIST:
+			check_sublist(st, get_u32(p));
+			break;
+		case GL_STORE_MULTISAMPLE:
+		case GL_STORE_MULTISAMPLE_END:
+			printf("\n");
+			check_store(st, op == GL_STORE_MULTISAMPLE_END);
+			break;
+		case GL_STORE_FULL_TILE_BUFFER:
+			printf(" %08x%s\n", get_u32(p) & ~0xF, (get_u32(p) & STORE_EOF) ? ", end of frame" : "");
+			check_addr("store", get_u32(p) & ~0xF, 16, 16);
+			check_store(st, get_u32(p) & STORE_EOF);
+			break;
+		case GL_STORE_TILE_BUFFER:
+			check_store_general(st, p);
+			break;
+		case GL_RELOAD_FULL_TILE_BUFFER:
+			printf(" %08x\n", get_u32(p) & ~0xF);
+			check_addr("reload", get_u32(p) & ~0xF, 16, 16);
+			if (!st->tile_open) cl_error("load with no tile selected");
+			break;
+		case GL_LOAD_TILE_BUFFER:
+			printf(" buffer %d, flags %04x, address %08x\n", p[0] & 7, get_u16(p), get_u32(&p[2]) & ~0xF);
+			check_addr("load", get_u32(&p[2]) & ~0xF, 16, 16);
+			if (!st->tile_open) cl_error("load with no tile selected");
+			break;
+		case GL_INDEXED_PRIMITIVE_LIST:
+			check_indexed(st, p);
+			break;
+		case GL_VERTEX_ARRAY_PRIMITIVES: {
+			uint32_t count = get_u32(&p[1]);
+			uint32_t first = get_u32(&p[5]);
+			printf(" mode %d, %d vertices from %d\n", p[0], count, first);
+			start_primitives(st, "primitives");
+			check_count(p[0], count);
+			if (count) check_vertices(st, first + count - 1);
+			break;
+		}
+		case GL_PRIMITIVE_LIST_FORMAT:
+			printf(" %02x\n", p[0]);
+			st->prim_format = true;
+			break;
+		case GL_NV_SHADER_STATE:
+			printf(" %08x\n", get_u32(p));
+			check_nv_record(st, get_u32(p));
+			break;
+		case GL_SHADER_STATE:
+		case GL_VG_SHADER_STATE:
+			// Low bits of GL shader state are the attribute count, records are not decoded
+			printf(" %08x\n", get_u32(p) & ~0xF);
+			check_addr("shader record", get_u32(p) & ~0xF, 16, 16);
+			st->shader_state = true;
+			st->record_known = false;
+			break;
+		case GL_CONFIG_STATE:
+			printf(" %02x %02x %02x\n", p[0], p[1], p[2]);
+			break;
+		case GL_CLIP_WINDOW:
+			printf(" left %d bottom %d, %dx%d\n", get_u16(&p[0]), get_u16(&p[2]), get_u16(&p[4]), get_u16(&p[6]));
+			if (get_u16(&p[4]) == 0 || get_u16(&p[6]) == 0) cl_warn("empty clip window, nothing is drawn");
+			st->clip_window = true;
+			break;
+		case GL_VIEWPORT_OFFSET:
+			printf(" (%d, %d)\n", (int16_t)get_u16(&p[0]), (int16_t)get_u16(&p[2]));
+			break;
+		case GL_POINTS_SIZE:
+		case GL_LINE_WIDTH:
+			printf(" %g\n", get_f32(p));
+			break;
+		case GL_TILE_BINNING_CONFIG:
+			check_bin_config(st, p);
+			break;
+		case GL_TILE_RENDER_CONFIG:
+			check_render_config(st, p);
+			break;
+		case GL_CLEAR_COLORS:
+			printf(" colour %08x %08x, z/mask %08x, stencil %02x\n", get_u32(&p[0]), get_u32(&p[4]), get_u32(&p[8]), p[12]);
+			break;
+		case GL_TILE_COORDINATES:
+			check_tile_coordinates(st, p);
+			break;
+		default:
+			for (uint32_t i = 0; i + 1 < packets[op].size; i++) printf(" %02x", p[i]);
+			printf("\n");
+			break;
+	}
+}
+
+static void print_stats (void) {
+	uint32_t count = 0, bytes = 0;
+	printf("\n    %-26s %7s %7s\n", "packet", "count", "bytes");
+	for (uint32_t op = 0; op < 256; op++) {
+		if (op_count[op] == 0) continue;
+		printf("    %-26s %7d %7d\n", packets[op].name, op_count[op], op_bytes[op]);
+		count += op_count[op];
+		bytes += op_bytes[op];
+	}
+	printf("    %-26s %7d %7d\n", "total", count, bytes);
+}
+
+static void check_list_end (cl_state_t* st) {
+	if (st->kind == LIST_BIN) {
+		if (!st->bin_config) cl_error("no TILE_BINNING_CONFIG");
+		if (!st->binning) cl_error("no START_TILE_BINNING");
+		else if (!st->flushed) cl_error("no FLUSH after the last primitives, binning never finishes");
+		if (st->binning && st->primitives == 0) cl_warn("nothing drawn");
+		return;
+	}
+
+	uint32_t missing = 0, first = 0;
+	if (!st->render_config) cl_error("no TILE_RENDER_CONFIG");
+	if (st->tile_open) cl_error("tile (%d, %d) is never stored", st->tile_x, st->tile_y);
+	if (st->frames_ended == 0) cl_error("no end of frame store, rendering never finishes");
+	else if (st->frames_ended > 1) cl_error("%d end of frame stores", st->frames_ended);
+	for (uint32_t i = 0; i < st->tiles_x * st->tiles_y; i++) {
+		if (st->stored[i]) continue;
+		if (missing++ == 0) first = i;
+	}
+	if (missing)
+		cl_warn("%d tiles are never stored, the first is (%d, %d)", missing, first % st->tiles_x, first / st->tiles_x);
+}
+
+/**
+ * Decode and check the list from bus address start to end, the way the
+ * control list executor would run it. Returns the errors found.
+ */
+static uint32_t check_list (uint32_t kind, uint32_t start, uint32_t end) {
+	static cl_state_t st;
+	uint32_t before = errors;
+	uint32_t len = end - start;
+	const uint8_t* list = host_ptr(start, len);
+	uint32_t pos = 0;
+
+	memset(&st, 0, sizeof(st));
+	memset(op_count, 0, sizeof(op_count));
+	memset(op_bytes, 0, sizeof(op_bytes));
+	st.kind = kind;
+
+	printf("\n%s list %08x..%08x, %d bytes\n\n", kind == LIST_BIN ? "Binning" : "Render", start, end, len);
+	packet_addr = start;
+	if (list == 0) {
+		cl_error("list is not inside the memory given");
+		return errors - before;
+	}
+
+	while (pos < len) {
+		uint8_t op = list[pos];
+		const packet_t* pk = &packets[op];
+
+		packet_addr = start + pos;
+		if (pk->size == 0) {
+			cl_error("unknown opcode %d, the rest of the list is not decoded", op);
+			break;
+		}
+		if (pk->size > len - pos) {
+			printf("%08x  %s\n", packet_addr, pk->name);
+			cl_error("%s cut short, %d of %d bytes", pk->name, len - pos, pk->size);
+			break;
+		}
+
+		printf("%08x  %-24s", packet_addr, pk->name);
+		decode_packet(&st, op, &list[pos + 1]);
+		if (!(pk->lists & kind)) cl_error("%s does not belong in a %s list", pk->name, kind == LIST_BIN ? "binning" : "render");
+		op_count[op]++;
+		op_bytes[op] += pk->size;
+		pos += pk->size;
+
+		if (op == GL_HALT || op == GL_BRANCH) break;
+	}
+	if (pos < len && (list[pos - 1] == GL_HALT || list[pos - 1] == GL_BRANCH))
+		cl_warn("%d bytes after it are never run", len - pos);
+
+	packet_addr = end;
+	check_list_end(&st);
+	print_stats();
+	return errors - before;
+}
+
+/*--------------------------------------------------------------------------}
+{		FAKE GPU MEMORY, ENOUGH FOR opengl_es2.c TO BUILD ITS SCENE			}
+{--------------------------------------------------------------------------*/
+
+#define ARENA_SIZE		0x200000	// Room for a second pool chunk
+#define ARENA_BUS		0x1E000000	// Somewhere in GPU memory on a 1 GB Pi
+#define SCENE_FB_BUS	0x3C100000	// Typical frame buffer address from the firmware
+
+static uint8_t* arena;
+static uint32_t arena_used;
+
+/* The kernel keeps ARM addresses in uint32_t, so fake memory has to live below 4 GB */
+static uint8_t* low_alloc (uint32_t size) {
+	void* p;
+#ifdef MAP_32BIT
+	p = mmap(0, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_32BIT, -1, 0);
+#else
+	static uintptr_t hint = 0x20000000;
+	p = mmap((void*)hint, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	hint += (size + 0xFFFFF) & ~0xFFFFF;
+#endif
+	if (p == MAP_FAILED || (uint64_t)(uintptr_t)p + size > 0xFFFFFFFFull) {
+		fprintf(stderr, "v3dcl: cannot map fake memory below 4 GB\n");
+		exit(2);
+	}
+	return p;
+}
+
+static void arena_init (void) {
+	arena = low_alloc(ARENA_SIZE);
+}
+
+uint32_t v3d_mem_alloc (uint32_t size, uint32_t align, uint32_t flags) {
+	uint32_t start = (arena_used + align - 1) & ~(align - 1);
+
+	if (start > ARENA_SIZE || size > ARENA_SIZE - start) return 0;
+	memset(arena + start, (flags & MEM_FLAG_ZERO) ? 0x00 : 0xFF, size);
+	arena_used = start + size;
+	add_region("gpu pool", ARENA_BUS + start, size, arena + start);
+	return region_count;											// Handle is the region number + 1
+}
+
+uint32_t v3d_mem_lock (uint32_t handle) {
+	if (handle == 0 || handle > region_count) return 0;
+	return regions[handle - 1].bus | 0xC0000000;					// L2 coherent alias, like the firmware gives
+}
+
+/* The arena is never reused, a scene set up once keeps its memory anyway */
+bool v3d_mem_unlock (uint32_t handle) {
+	return handle != 0 && handle <= region_count;
+}
+
+bool v3d_mem_free (uint32_t handle) {
+	return handle != 0 && handle <= region_count;
+}
+
+/* Host memory is coherent with itself */
+void dma_cache_clean (const void* ptr, uint32_t size) {
+	(void)ptr;
+	(void)size;
+}
+
+uint32_t GPUaddrToARMaddr (uint32_t bus) {
+	return (uint32_t)(uintptr_t)host_ptr(bus, 1);
+}
+
+/* The kernel_main triangle test, rendering into fb (host memory, or none) */
+static bool build_scene (RENDER_STRUCT* scene, uint32_t wth, uint32_t ht, uint8_t* fb) {
+	arena_init();
+	if (!v3d_InitializeScene(scene, wth, ht) ||
+		!v3d_AddVertexesToScene(scene) ||
+		!v3d_AddShadderToScene(scene, vertex_colour_shader, sizeof(vertex_colour_shader) / sizeof(vertex_colour_shader[0]))) {
+		fprintf(stderr, "v3dcl: the scene did not fit in its GPU memory\n");
+		return false;
+	}
+	add_region("frame buffer", SCENE_FB_BUS, wth * ht * 4, fb);
+	if (!v3d_SetupRenderControl(scene, SCENE_FB_BUS) || !v3d_SetupBinningConfig(scene)) {
+		fprintf(stderr, "v3dcl: the control lists did not fit in their GPU memory\n");
+		return false;
+	}
+	return true;
+}
+
+static int check_scene (uint32_t wth, uint32_t ht) {
+	static RENDER_STRUCT scene;
+
+	if (!build_scene(&scene, wth, ht, 0)) return 1;
+
+	printf("Scene %dx%d\n", wth, ht);
+	for (uint32_t i = 0; i < region_count; i++)
+		printf("    %-14s %08x..%08x\n", regions[i].name, regions[i].bus, regions[i].bus + regions[i].size);
+	printf("    renderer %08x, tile state %08x, binning %08x", scene.rendererDataVC4, scene.tileStateDataVC4, scene.binningDataVC4);
+	v3d_pool_print_stats();
+	printf("\n");
+
+	check_list(LIST_BIN, scene.binningDataVC4, scene.binningCfgEnd);
+	check_list(LIST_RENDER, scene.renderControlVC4, scene.renderControlEndVC4);
+	return 0;
+}
+
+/*--------------------------------------------------------------------------}
+{		SELF TEST: LISTS STRAIGHT FROM THE v3d_cl.c BUILDER					}
+{--------------------------------------------------------------------------*/
+
+#define TEST_BUS		0x1F000000
+#define TEST_SIZE		0x60000
+#define T_BIN			0x00000
+#define T_RENDER		0x01000
+#define T_RENDER_SIZE	0x08000
+#define T_RECORD		0x09000
+#define T_CODE			0x09100
+#define T_VERTS			0x09800
+#define T_INDICES		0x09A00
+#define T_STATE			0x10000
+#define T_ALLOC			0x20000
+#define T_ALLOC_MOVED	0x40000		// Where the relocation test moves tile allocation memory to
+#define T_ALLOC_SIZE	0x20000
+#define T_MAX_RELOCS	1024
+
+static uint32_t test_failures;
+
+static void expect (bool ok, const char* what) {
+	if (ok) return;
+	printf("FAILED: %s\n", what);
+	test_failures++;
+}
+
+/* Shader code, its NV record and one triangle of vertices and indices */
+static void test_scene_data (uint8_t* mem, uint32_t wth, uint32_t ht) {
+	v3d_cl_t cl;
+
+	memcpy(mem + T_CODE, vertex_colour_shader, sizeof(vertex_colour_shader));
+
+	v3d_cl_init(&cl, mem + T_RECORD, TEST_BUS + T_RECORD, 16);
+	v3d_cl_nv_shader_record(&cl, 0x01, 6 * 4, 0xcc, 3, TEST_BUS + T_CODE, 0, TEST_BUS + T_VERTS);
+	expect(v3d_cl_ok(&cl) && v3d_cl_offset(&cl) == 16, "NV shader record is 16 bytes");
+
+	v3d_cl_init(&cl, mem + T_VERTS, TEST_BUS + T_VERTS, 3 * 24);
+	for (uint32_t i = 0; i < 3; i++) {
+		v3d_cl_u16(&cl, (i == 1 ? 0 : wth - 1) << 4);
+		v3d_cl_u16(&cl, (i == 0 ? 0 : ht - 1) << 4);
+		v3d_cl_f32(&cl, 1.0f);
+		v3d_cl_f32(&cl, 1.0f);
+		v3d_cl_f32(&cl, i == 0 ? 1.0f : 0.0f);
+		v3d_cl_f32(&cl, i == 1 ? 1.0f : 0.0f);
+		v3d_cl_f32(&cl, i == 2 ? 1.0f : 0.0f);
+	}
+	expect(v3d_cl_ok(&cl) && v3d_cl_offset(&cl) == 3 * 24, "three vertices fill their 72 bytes exactly");
+
+	v3d_cl_init(&cl, mem + T_INDICES, TEST_BUS + T_INDICES, 3);
+	for (uint32_t i = 0; i < 3; i++) v3d_cl_u8(&cl, i);
+}
+
+/* The binning list v3d_SetupBinningConfig makes, for the test memory; relocs may be NULL */
+static void test_bin_list (v3d_cl_t* cl, uint8_t* mem, uint32_t wth, uint32_t ht, uint32_t* relocs) {
+	v3d_cl_init(cl, mem + T_BIN, TEST_BUS + T_BIN, T_RENDER - T_BIN);
+	if (relocs) v3d_cl_track_relocs(cl, relocs, T_MAX_RELOCS);
+	v3d_cl_tile_binning_config(cl, TEST_BUS + T_ALLOC, T_ALLOC_SIZE, TEST_BUS + T_STATE,
+		(wth + 63) / 64, (ht + 63) / 64, V3D_BIN_AUTO_INIT_STATE);
+	v3d_cl_start_tile_binning(cl);
+	v3d_cl_primitive_list_format(cl, V3D_PRIM_LIST_TRIANGLES_16);
+	v3d_cl_clip_window(cl, 0, 0, wth, ht);
+	v3d_cl_config_state(cl, V3D_CONFIG_FRONT_AND_BACK, 0x00, V3D_CONFIG_EARLY_Z_UPDATE);
+	v3d_cl_viewport_offset(cl, 0, 0);
+	v3d_cl_nv_shader_state(cl, TEST_BUS + T_RECORD);
+	v3d_cl_indexed_primitive_list(cl, PRIM_TRIANGLE, 3, TEST_BUS + T_INDICES, 2);
+	v3d_cl_flush_all_state(cl);
+	v3d_cl_nop(cl);
+	v3d_cl_halt(cl);
+}
+
+/* The render list v3d_SetupRenderControl makes; without end_of_frame the last store does not end the frame */
+static void test_render_list (v3d_cl_t* cl, uint8_t* mem, uint32_t wth, uint32_t ht, uint32_t* relocs, bool end_of_frame) {
+	uint32_t bin_wth = (wth + 63) / 64, bin_ht = (ht + 63) / 64;
+
+	v3d_cl_init(cl, mem + T_RENDER, TEST_BUS + T_RENDER, T_RENDER_SIZE);
+	if (relocs) v3d_cl_track_relocs(cl, relocs, T_MAX_RELOCS);
+	v3d_cl_clear_colors(cl, 0xff000000, 0, 0);
+	v3d_cl_tile_render_config(cl, SCENE_FB_BUS, wth, ht, V3D_RENDER_RGBA8888);
+	v3d_cl_tile_coordinates(cl, 0, 0);
+	v3d_cl_store_tile_buffer(cl, V3D_STORE_NONE, 0);
+	for (uint32_t x = 0; x < bin_wth; x++) {
+		for (uint32_t y = 0; y < bin_ht; y++) {
+			v3d_cl_tile_coordinates(cl, x, y);
+			v3d_cl_branch_to_sublist(cl, TEST_BUS + T_ALLOC + (y * bin_wth + x) * 32);
+			v3d_cl_store_multisample(cl, end_of_frame && x == bin_wth - 1 && y == bin_ht - 1);
+		}
+	}
+}
+
+/* Check both lists, true when that added no errors and no warnings */
+static bool test_lists_clean (const v3d_cl_t* bin, const v3d_cl_t* render) {
+	uint32_t before = errors, warned = warnings;
+	check_list(LIST_BIN, v3d_cl_start(bin), v3d_cl_end(bin));
+	check_list(LIST_RENDER, v3d_cl_start(render), v3d_cl_end(render));
+	return errors == before && warnings == warned;
+}
+
+static void test_frame (uint8_t* mem, uint32_t wth, uint32_t ht) {
+	static uint32_t bin_relocs[T_MAX_RELOCS], render_relocs[T_MAX_RELOCS];
+	uint32_t tiles = ((wth + 63) / 64) * ((ht + 63) / 64);
+	uint32_t before, warned;
+	char what[96];
+	v3d_cl_t bin, render;
+
+	printf("\n==== %dx%d ====\n", wth, ht);
+	test_scene_data(mem, wth, ht);
+	test_bin_list(&bin, mem, wth, ht, bin_relocs);
+	test_render_list(&render, mem, wth, ht, render_relocs, true);
+	snprintf(what, sizeof(what), "%dx%d lists fit", wth, ht);
+	expect(v3d_cl_ok(&bin) && v3d_cl_ok(&render), what);
+	snprintf(what, sizeof(what), "%dx%d lists check clean", wth, ht);
+	expect(test_lists_clean(&bin, &render), what);
+
+	// Every address field was recorded: moving tile allocation memory fixes both lists
+	snprintf(what, sizeof(what), "%dx%d relocation moves 1 binning and %d render addresses", wth, ht, tiles);
+	expect(v3d_cl_relocate(&bin, TEST_BUS + T_ALLOC, T_ALLOC_SIZE, TEST_BUS + T_ALLOC_MOVED) == 1 &&
+		v3d_cl_relocate(&render, TEST_BUS + T_ALLOC, T_ALLOC_SIZE, TEST_BUS + T_ALLOC_MOVED) == tiles, what);
+	snprintf(what, sizeof(what), "%dx%d relocated lists check clean", wth, ht);
+	expect(test_lists_clean(&bin, &render), what);
+
+	// And the checker must notice a frame that never ends; those errors are expected
+	test_bin_list(&bin, mem, wth, ht, 0);
+	test_render_list(&render, mem, wth, ht, 0, false);
+	before = errors;
+	warned = warnings;
+	test_lists_clean(&bin, &render);
+	snprintf(what, sizeof(what), "%dx%d render list without an end of frame store is an error", wth, ht);
+	expect(errors > before, what);
+	errors = before;
+	warnings = warned;
+}
+
+/* What the builder itself promises: bounded writes, sticky overflow, rewinding */
+static void test_builder (uint8_t* mem) {
+	uint32_t relocs[1];
+	v3d_cl_t cl;
+
+	memset(mem, 0xEE, 16);
+	v3d_cl_init(&cl, mem, TEST_BUS, 8);
+	v3d_cl_tile_coordinates(&cl, 1, 2);
+	v3d_cl_tile_coordinates(&cl, 3, 4);
+	expect(v3d_cl_ok(&cl) && v3d_cl_offset(&cl) == 6, "two 3 byte packets fit in 8 bytes");
+	v3d_cl_tile_coordinates(&cl, 5, 6);
+	expect(!v3d_cl_ok(&cl) && v3d_cl_offset(&cl) == 6, "a packet that does not fit overflows the list");
+	v3d_cl_nop(&cl);
+	expect(!v3d_cl_ok(&cl) && v3d_cl_offset(&cl) == 6, "nothing is emitted after an overflow");
+	expect(mem[6] == 0xEE && mem[7] == 0xEE && mem[8] == 0xEE, "an overflowed list writes nothing past its end");
+	expect(v3d_cl_end(&cl) == TEST_BUS + 6, "the end address is the last byte emitted plus one");
+	v3d_cl_reset(&cl);
+	expect(v3d_cl_ok(&cl) && v3d_cl_offset(&cl) == 0, "reset rewinds and clears the overflow");
+
+	v3d_cl_init(&cl, mem, TEST_BUS + 1, 16);
+	v3d_cl_u8(&cl, 0x55);
+	v3d_cl_align(&cl, 4);
+	expect(v3d_cl_end(&cl) == TEST_BUS + 4 && mem[1] == 0 && mem[2] == 0, "align pads from the bus address with zeros");
+	v3d_cl_u32(&cl, 0);
+	expect(!v3d_cl_patch_u32(&cl, 4, 0) && v3d_cl_patch_u32(&cl, 3, 0x12345678) && mem[3] == 0x78,
+		"patches stay inside what was emitted");
+
+	v3d_cl_init(&cl, mem, TEST_BUS, 16);
+	v3d_cl_track_relocs(&cl, relocs, 1);
+	v3d_cl_branch(&cl, TEST_BUS + 0x100);
+	v3d_cl_branch_to_sublist(&cl, TEST_BUS + 0x200);
+	expect(!v3d_cl_ok(&cl), "running out of relocation slots overflows the list");
+}
+
+static int run_cl_tests (void) {
+	uint8_t* mem = low_alloc(TEST_SIZE);
+
+	add_region("cltest", TEST_BUS, TEST_SIZE, mem);
+	add_region("frame buffer", SCENE_FB_BUS, 2048 * 2048 * 4, 0);
+
+	test_builder(mem);
+	test_frame(mem, 64, 64);
+	test_frame(mem, 200, 130);
+	test_frame(mem, 640, 480);
+	test_frame(mem, 1920, 1080);
+
+	printf("\nv3d_cl self test: %d failed, %d errors, %d warnings\n", test_failures, errors, warnings);
+	return test_failures || errors || warnings ? 1 : 0;
+}
+
+/*--------------------------------------------------------------------------}
+{		SOFTWARE RENDERER, AND THE KERNEL CALLS soft_raster.c MAKES			}
+{--------------------------------------------------------------------------*/
+
+static uint8_t* console_fb;
+static uint32_t console_wth, console_ht;
+
+void* mem_allocate (uint32_t size) {
+	return malloc(size);
+}
+
+void mem_deallocate (void* p) {
+	free(p);
+}
+
+uint64_t timer_getTickCount64 (void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000ull + ts.tv_nsec / 1000;
+}
+
+uint32_t get_console_frame_buffer (uint32_t width, uint32_t height, uint32_t depth) {
+	if (depth != 32) return 0;
+	console_fb = low_alloc(width * height * 4);
+	console_wth = width;
+	console_ht = height;
+	return (uint32_t)(uintptr_t)console_fb;
+}
+
+void get_console_width_height_depth (uint32_t* width, uint32_t* height, uint32_t* depth, uint32_t* pitch) {
+	*width = console_wth;
+	*height = console_ht;
+	*depth = 32;
+	*pitch = console_wth * 4;
+}
+
+/* RGBA8888 with R in the low byte, as the V3D stores it */
+static int write_ppm (const char* path, const uint8_t* fb, uint32_t wth, uint32_t ht) {
+	FILE* f = fopen(path, "wb");
+	if (f == 0) {
+		perror(path);
+		return 2;
+	}
+	fprintf(f, "P6\n%d %d\n255\n", wth, ht);
+	for (uint32_t i = 0; i < wth * ht; i++)
+		fwrite(&fb[i * 4], 1, 3, f);
+	fclose(f);
+	return 0;
+}
+
+static int soft_scene (const char* path, uint32_t wth, uint32_t ht) {
+	static RENDER_STRUCT scene;
+	uint8_t* fb = low_alloc(wth * ht * 4);
+
+	if (!build_scene(&scene, wth, ht, fb)) return 1;
+	v3d_SelectRenderer(RENDERER_SOFT);
+	v3d_RenderScene(&scene);
+	printf("Scene %dx%d drawn in software to %s\n", wth, ht, path);
+	return write_ppm(path, fb, wth, ht);
+}
+
+/*--------------------------------------------------------------------------}
+{							   LISTS FROM FILES								}
+{--------------------------------------------------------------------------*/
+
+static uint8_t* load_file (const char* path, uint32_t* size) {
+	FILE* f = fopen(path, "rb");
+	uint8_t* data;
+	long len;
+
+	if (f == 0 || fseek(f, 0, SEEK_END) != 0 || (len = ftell(f)) < 0) {
+		perror(path);
+		exit(2);
+	}
+	rewind(f);
+	data = malloc(len ? len : 1);
+	if (data == 0 || fread(data, 1, len, f) != (size_t)len) {
+		perror(path);
+		exit(2);
+	}
+	fclose(f);
+	*size = len;
+	return data;
+}
+
+static uint32_t parse_number (const char* s, bool* ok) {
+	char* end;
+	unsigned long v = strtoul(s, &end, 0);
+	*ok = *s != 0 && *end == 0 && v <= 0xFFFFFFFFul;
+	return v;
+}
+
+/* ADDR:SIZE or ADDR:FILE */
+static void parse_region (const char* arg) {
+	char addr[32];
+	const char* colon = strchr(arg, ':');
+	uint32_t bus, size;
+	bool ok;
+
+	if (colon == 0 || colon - arg >= (long)sizeof(addr)) {
+		fprintf(stderr, "v3dcl: %s is not ADDR:SIZE or ADDR:FILE\n", arg);
+		exit(2);
+	}
+	memcpy(addr, arg, colon - arg);
+	addr[colon - arg] = 0;
+	bus = parse_number(addr, &ok);
+	if (!ok) {
+		fprintf(stderr, "v3dcl: bad address %s\n", addr);
+		exit(2);
+	}
+	size = parse_number(colon + 1, &ok);
+	if (ok) add_region(arg, bus, size, 0);
+	else {
+		uint8_t* data = load_file(colon + 1, &size);
+		add_region(colon + 1, bus, size, data);
+	}
+}
+
+static void usage (void) {
+	fprintf(stderr,
+		"usage: v3dcl scene [width height]\n"
+		"       v3dcl soft OUT.ppm [width height]\n"
+		"       v3dcl bench\n"
+		"       v3dcl cltest\n"
+		"       v3dcl bin|render LIST ADDR [ADDR:SIZE | ADDR:FILE ...]\n");
+	exit(2);
+}
+
+int main (int argc, char* argv[]) {
+	if (argc < 2) usage();
+
+	if (strcmp(argv[1], "scene") == 0) {
+		uint32_t wth = 640, ht = 480;
+		bool ok = true, ok2 = true;
+		if (argc == 4) {
+			wth = parse_number(argv[2], &ok);
+			ht = parse_number(argv[3], &ok2);
+		} else if (argc != 2) usage();
+		if (!ok || !ok2 || wth == 0 || ht == 0 || wth > 2048 || ht > 2048) usage();
+		if (check_scene(wth, ht)) return 1;
+	} else if (strcmp(argv[1], "soft") == 0 && (argc == 3 || argc == 5)) {
+		uint32_t wth = 640, ht = 480;
+		bool ok = true, ok2 = true;
+		if (argc == 5) {
+			wth = parse_number(argv[3], &ok);
+			ht = parse_number(argv[4], &ok2);
+		}
+		if (!ok || !ok2 || wth == 0 || ht == 0 || wth > 2048 || ht > 2048) usage();
+		return soft_scene(argv[2], wth, ht);
+	} else if (strcmp(argv[1], "cltest") == 0 && argc == 2) {
+		return run_cl_tests();
+	} else if (strcmp(argv[1], "bench") == 0 && argc == 2) {
+		show_soft_raster_benchmark();
+		printf("\n");
+		return 0;
+	} else if ((strcmp(argv[1], "bin") == 0 || strcmp(argv[1], "render") == 0) && argc >= 4) {
+		uint32_t size, bus;
+		bool ok;
+		uint8_t* list = load_file(argv[2], &size);
+
+		bus = parse_number(argv[3], &ok);
+		if (!ok) usage();
+		add_region(argv[2], bus, size, list);
+		for (int i = 4; i < argc; i++) parse_region(argv[i]);
+		check_list(argv[1][0] == 'b' ? LIST_BIN : LIST_RENDER, bus, bus + size);
+	} else usage();
+
+	printf("\n%d errors, %d warnings\n", errors, warnings);
+	return errors ? 1 : 0;
+}
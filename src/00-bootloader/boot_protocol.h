@@ -0,0 +1,56 @@
+/* boot_protocol.h - serial upload protocol shared by kernel.c and raspbootcom */
+#ifndef _BOOT_PROTOCOL_H
+#define _BOOT_PROTOCOL_H
+
+/*
+ * The Pi announces itself with three ^C (BOOT_BREAK). The host answers with
+ * a start frame, then streams the image in numbered blocks without waiting
+ * for each one to be acknowledged (go-back-N, up to BOOT_WINDOW blocks in
+ * flight). All integers are little endian.
+ *
+ * host -> pi
+ *   start:  STX size:u32 image_crc:u32 flags:u32 crc:u32   crc over the three fields
+ *   block:  SOH seq:u16 len:u16 data[len] crc:u32          crc over seq, len, data
+ *
+ * pi -> host
+ *   ACK next:u16   every block up to `next` arrived intact
+ *   NAK next:u16   resend everything from `next`
+ *   EOT            image complete and image_crc matches, jumping
+ *   CAN            upload refused (too big), stalled or image_crc mismatch, start over
+ *
+ * A start frame whose ACK was lost is sent again; the Pi answers ACK 0
+ * until block 0 arrives, and the host also takes a NAK 0 as that answer.
+ *
+ * size and image_crc describe the bytes sent. With BOOT_FLAG_LZ4 those are
+ * an LZ4 frame, decoded to BOOT_LOAD_ADDR while the next block arrives.
+ *
+ * Every block but the last carries BOOT_BLOCK_SIZE bytes. The CRC is the
+ * plain CRC-32 (IEEE 802.3, reflected, init and final xor 0xffffffff),
+ * which is what the ARMv8 crc32b/crc32w instructions compute.
+ */
+
+#define BOOT_BREAK 0x03
+#define BOOT_SOH 0x01
+#define BOOT_STX 0x02
+#define BOOT_EOT 0x04
+#define BOOT_ACK 0x06
+#define BOOT_NAK 0x15
+#define BOOT_CAN 0x18
+
+#define BOOT_FLAG_LZ4 (1 << 0)
+
+#define BOOT_BLOCK_SIZE 1024
+#define BOOT_WINDOW 8
+
+// Kernel is loaded here and must stay below the bootloader itself
+#define BOOT_LOAD_ADDR 0x8000
+#define BOOT_MAX_SIZE (0x2000000 - BOOT_LOAD_ADDR)
+
+// Pi side: a frame that stalls this long mid-way is dropped and NAKed
+#define BOOT_BYTE_TIMEOUT_US 200000
+
+// Either side gives up after this many NAKs or timeouts in a row; the Pi
+// then sends CAN and asks for the kernel again with BOOT_BREAK
+#define BOOT_MAX_RETRIES 16
+
+#endif
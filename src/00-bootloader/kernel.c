@@ -1,5 +1,12 @@
 #include <stddef.h>
 #include <stdint.h>
+#include <arm_acle.h>
+#include "boot_protocol.h"
+#include "lz4.h"
+#include "sdboot.h"
+
+// Any key within this long after reset skips the SD card and waits for an upload
+#define BOOT_KEY_WAIT_US 100000
 
 extern void BRANCHTO(unsigned int);
 
@@ -59,6 +66,9 @@ enum
 	UART0_ITIP = (UART0_BASE + 0x84),
 	UART0_ITOP = (UART0_BASE + 0x88),
 	UART0_TDR = (UART0_BASE + 0x8C),
+
+	// Free running 1 MHz counter, low word
+	SYSTIMER_CLO = 0x3F003004,
 };
 
 void uart_init()
@@ -148,6 +158,224 @@ void hexstrings(unsigned int d)
 	uart_putc(0x20);
 }
 
+/*
+ * Compressed uploads land in these two buffers in turn: one receives the
+ * next block while the previous one is decoded to BOOT_LOAD_ADDR.
+ */
+static uint8_t block_buf[2][BOOT_BLOCK_SIZE] __attribute__((aligned(4)));
+static lz4_stream_t lz4;
+static int compressed;
+
+// Returns the next byte, or -1 if none arrives within `usec`
+static int uart_getc_timeout(uint32_t usec)
+{
+	uint32_t start = mmio_read(SYSTIMER_CLO);
+
+	while (mmio_read(UART0_FR) & (1 << 4))
+	{
+		// Decode while the line is idle, a step is well under a byte time
+		if (compressed)
+			lz4_step(&lz4);
+		if (mmio_read(SYSTIMER_CLO) - start > usec)
+			return -1;
+	}
+	return mmio_read(UART0_DR) & 0xFF;
+}
+
+static void uart_put16(uint8_t type, uint32_t value)
+{
+	uart_putc(type);
+	uart_putc(value & 0xFF);
+	uart_putc((value >> 8) & 0xFF);
+}
+
+/*
+ * CRC-32 on the ARMv8 CRC unit (-march=armv8-a+crc), a word at a time
+ * where the buffer allows. Pass and get back the un-inverted value so
+ * a frame can be checksummed in pieces.
+ */
+static uint32_t crc32_update(uint32_t crc, const uint8_t *data, uint32_t len)
+{
+	while (len > 0 && ((uint32_t)data & 3))
+	{
+		crc = __crc32b(crc, *data++);
+		len--;
+	}
+	for (; len >= 4; len -= 4, data += 4)
+	{
+		crc = __crc32w(crc, *(const uint32_t *)data);
+	}
+	while (len-- > 0)
+	{
+		crc = __crc32b(crc, *data++);
+	}
+	return crc;
+}
+
+/*
+ * Read `len` bytes into `dest` (or drop them if dest is NULL), folding
+ * them into `*crc` as they arrive. Returns -1 if the line goes quiet.
+ */
+static int receive_bytes(uint8_t *dest, uint32_t len, uint32_t *crc)
+{
+	for (uint32_t i = 0; i < len; i++)
+	{
+		int c = uart_getc_timeout(BOOT_BYTE_TIMEOUT_US);
+		if (c < 0)
+			return -1;
+		*crc = __crc32b(*crc, c);
+		if (dest)
+			dest[i] = c;
+	}
+	return 0;
+}
+
+static int receive_u32(uint32_t *value, uint32_t *crc)
+{
+	uint8_t b[4];
+
+	if (receive_bytes(b, 4, crc) < 0)
+		return -1;
+	*value = b[0] | (b[1] << 8) | (b[2] << 16) | ((uint32_t)b[3] << 24);
+	return 0;
+}
+
+/* The rest of a start frame after its STX. Returns -1 if it is cut short or corrupt */
+static int receive_start_frame(uint32_t *size, uint32_t *image_crc, uint32_t *flags)
+{
+	uint32_t crc = 0xFFFFFFFF, frame_crc, unused = 0;
+
+	if (receive_u32(size, &crc) < 0 || receive_u32(image_crc, &crc) < 0 ||
+		receive_u32(flags, &crc) < 0 || receive_u32(&frame_crc, &unused) < 0)
+		return -1;
+	return (crc ^ 0xFFFFFFFF) == frame_crc ? 0 : -1;
+}
+
+/*
+ * Wait for a start frame and return the image size and checksum.
+ * Answers ACK 0 once accepted, CAN if the image would not fit.
+ */
+static int receive_start(uint32_t *size, uint32_t *image_crc, uint32_t *flags)
+{
+	while (1)
+	{
+		if (uart_getc() != BOOT_STX)
+			continue;
+		if (receive_start_frame(size, image_crc, flags) < 0)
+			continue;
+		if (*size > BOOT_MAX_SIZE)
+		{
+			uart_putc(BOOT_CAN);
+			uart_puts("SE\r\n");
+			return -1;
+		}
+		uart_put16(BOOT_ACK, 0);
+		return 0;
+	}
+}
+
+/*
+ * Receive blocks until `size` bytes are in, straight into place or, for a
+ * compressed image, into the block buffers for the decoder. Only the
+ * expected block is kept; anything after a bad or missing block is read
+ * and dropped, and one NAK makes the host go back to it. A start frame
+ * seen before block 0 means the host missed our ACK, so it is answered
+ * again. Gives up (-1) after BOOT_MAX_RETRIES NAKs in a row without a
+ * good block, the host has most likely given up too. Otherwise returns 0
+ * with the CRC of the accepted stream in *received_crc.
+ */
+static int receive_image(uint8_t *kernel, uint32_t size, uint32_t image_crc, uint32_t flags, uint32_t *received_crc)
+{
+	uint32_t blocks = (size + BOOT_BLOCK_SIZE - 1) / BOOT_BLOCK_SIZE;
+	uint32_t expected = 0;
+	uint32_t stream_crc = 0xFFFFFFFF;
+	uint32_t cur = 0;
+	uint32_t naks = 0;
+	int nak_sent = 0;
+
+	while (expected < blocks)
+	{
+		uint8_t header[4];
+		uint32_t crc = 0xFFFFFFFF, frame_crc, unused = 0;
+		uint32_t seq, len, want;
+		uint8_t *dest;
+		int c = uart_getc_timeout(BOOT_BYTE_TIMEOUT_US * 5);
+
+		if (c < 0)
+		{
+			// Lost the tail of the window, ask again
+			if (++naks > BOOT_MAX_RETRIES)
+				return -1;
+			uart_put16(BOOT_NAK, expected);
+			nak_sent = 1;
+			continue;
+		}
+		if (c == BOOT_STX && expected == 0)
+		{
+			uint32_t again_size, again_crc, again_flags;
+
+			if (receive_start_frame(&again_size, &again_crc, &again_flags) == 0 &&
+				again_size == size && again_crc == image_crc && again_flags == flags)
+				uart_put16(BOOT_ACK, 0);
+			continue;
+		}
+		if (c != BOOT_SOH)
+			continue;
+
+		if (receive_bytes(header, 4, &crc) < 0)
+			goto bad_frame;
+		seq = header[0] | (header[1] << 8);
+		len = header[2] | (header[3] << 8);
+		want = expected == blocks - 1 ? size - expected * BOOT_BLOCK_SIZE : BOOT_BLOCK_SIZE;
+		if (len > BOOT_BLOCK_SIZE || (seq == expected && len != want))
+			goto bad_frame;
+
+		dest = NULL;
+		if (seq == expected)
+			dest = compressed ? block_buf[cur] : kernel + seq * BOOT_BLOCK_SIZE;
+		if (receive_bytes(dest, len, &crc) < 0 || receive_u32(&frame_crc, &unused) < 0)
+			goto bad_frame;
+		if (seq != expected || (crc ^ 0xFFFFFFFF) != frame_crc)
+			goto bad_frame;
+
+		expected++;
+		nak_sent = 0;
+		naks = 0;
+		uart_put16(BOOT_ACK, expected);
+
+		stream_crc = crc32_update(stream_crc, dest, len);
+		if (compressed)
+		{
+			// The other buffer is about to be reused, finish decoding it first
+			lz4_finish(&lz4);
+			lz4_feed(&lz4, dest, len);
+			cur ^= 1;
+		}
+		continue;
+
+	bad_frame:
+		if (!nak_sent)
+		{
+			if (++naks > BOOT_MAX_RETRIES)
+				return -1;
+			uart_put16(BOOT_NAK, expected);
+			nak_sent = 1;
+		}
+	}
+	*received_crc = stream_crc ^ 0xFFFFFFFF;
+	return 0;
+}
+
+// True if a key is pressed (or held, autorepeat) right after reset
+static int serial_requested(void)
+{
+	int pressed = uart_getc_timeout(BOOT_KEY_WAIT_US) >= 0;
+
+	while (uart_getc_timeout(1000) >= 0)
+		;
+	return pressed;
+}
+
 #if defined(__cplusplus)
 extern "C" /* Use C linkage for kernel_main. */
 #endif
@@ -161,6 +389,17 @@ extern "C" /* Use C linkage for kernel_main. */
 
 	uart_init();
 
+	if (!serial_requested())
+	{
+		uart_puts("Loading kernel from SD card\r\n");
+		if (sd_load_kernel() == 0)
+		{
+			uart_puts("JUMP\r\n");
+			BRANCHTO(BOOT_LOAD_ADDR);
+		}
+		uart_puts("SD boot failed, falling back to serial\r\n");
+	}
+
 again:
 	uart_puts("####################\r\n");
 	uart_puts("Inside Bootloader\r\n");
@@ -170,43 +409,57 @@ again:
 	uart_puts("####################\r\n");
 
 	uart_puts("Requesting kernel\r\n");
+	uart_putc(BOOT_BREAK);
+	uart_putc(BOOT_BREAK);
+	uart_putc(BOOT_BREAK);
 
-	hexstrings(0x1018);
-	uart_putc(3);
-	uart_putc(3);
-	uart_putc(3);
-
-	uint32_t size = uart_getc();
-	size |= uart_getc() << 8;
-	size |= uart_getc() << 16;
-	size |= uart_getc() << 24;
+	uint32_t size, image_crc, flags, received_crc;
+	uint8_t *kernel = (uint8_t *)BOOT_LOAD_ADDR;
 
-	hexstrings(0x12345678);
-	hexstrings(size);
+	compressed = 0;
+	if (receive_start(&size, &image_crc, &flags) < 0)
+		goto again;
+	if (flags & BOOT_FLAG_LZ4)
+	{
+		lz4_init(&lz4, kernel, BOOT_MAX_SIZE);
+		compressed = 1;
+	}
 
-	if (0x8000 + size > 0x2000000)
+	if (receive_image(kernel, size, image_crc, flags, &received_crc) < 0)
 	{
-		uart_puts("SE");
+		uart_putc(BOOT_CAN);
+		uart_puts("upload stalled\r\n");
 		goto again;
 	}
-	else
+	if (received_crc != image_crc)
 	{
-		uart_puts("OK");
+		uart_putc(BOOT_CAN);
+		uart_puts("image CRC mismatch\r\n");
+		goto again;
 	}
-
-	uint8_t *kernel = (uint8_t *)0x8000;
-	while (size-- > 0)
+	if (compressed)
 	{
-		*kernel++ = uart_getc();
+		compressed = 0;
+		if (lz4_finish(&lz4) != LZ4_DONE)
+		{
+			uart_putc(BOOT_CAN);
+			uart_puts("bad LZ4 image\r\n");
+			goto again;
+		}
+	}
+	uart_putc(BOOT_EOT);
+	if (flags & BOOT_FLAG_LZ4)
+	{
+		uart_puts("LZ4 image unpacked to ");
+		hexstrings(lz4_output_size(&lz4));
+		uart_puts("bytes\r\n");
 	}
 
-	unsigned int addr = 0x8000;
-
-	uart_puts("JUMP");
-	BRANCHTO(addr);
+	uart_puts("JUMP\r\n");
+	BRANCHTO(BOOT_LOAD_ADDR);
 
 	uart_puts("KERNEL FAILED");
 
 	while (1)
 		uart_putc(uart_getc());
-}
\ No newline at end of file
+}
@@ -0,0 +1,268 @@
+/* lz4.c - incremental LZ4 frame decoder for the bootloader */
+#include "lz4.h"
+
+// Upper bound on output bytes per lz4_step(), keeps the UART FIFO from overflowing
+#define LZ4_STEP_BYTES 16
+
+enum
+{
+	S_MAGIC,
+	S_FLG,
+	S_BD,
+	S_SKIP,
+	S_BLOCK_SIZE,
+	S_RAW,
+	S_TOKEN,
+	S_LITERAL_LEN,
+	S_LITERALS,
+	S_OFFSET,
+	S_MATCH_LEN,
+	S_MATCH,
+	S_END,
+};
+
+static void fail(lz4_stream_t *s)
+{
+	s->status = LZ4_ERROR;
+	s->in_len = 0;
+}
+
+// Start reading a `count` byte little endian field
+static void field(lz4_stream_t *s, uint32_t count, int next)
+{
+	s->field = 0;
+	s->shift = 0;
+	s->count = count;
+	s->state = next;
+}
+
+static void enter(lz4_stream_t *s, int next)
+{
+	if (next == S_BLOCK_SIZE)
+	{
+		field(s, 4, S_BLOCK_SIZE);
+		return;
+	}
+	s->state = next;
+	if (next == S_END)
+		s->status = LZ4_DONE;
+}
+
+static void skip(lz4_stream_t *s, uint32_t count, int next)
+{
+	s->count = count;
+	s->after_skip = next;
+	if (count == 0)
+		enter(s, next);
+	else
+		s->state = S_SKIP;
+}
+
+// After literals or a match: next sequence, or the end of the block
+static void sequence_done(lz4_stream_t *s)
+{
+	if (s->block_left != 0)
+		s->state = S_TOKEN;
+	else
+		skip(s, (s->flags & 0x10) ? 4 : 0, S_BLOCK_SIZE); // block checksum (FLG bit 4)
+}
+
+static void literals_done(lz4_stream_t *s)
+{
+	if (s->block_left == 0)
+		sequence_done(s);
+	else
+		field(s, 2, S_OFFSET);
+}
+
+static int emit(lz4_stream_t *s, uint8_t c)
+{
+	if (s->out == s->out_end)
+	{
+		fail(s);
+		return -1;
+	}
+	*s->out++ = c;
+	return 0;
+}
+
+void lz4_init(lz4_stream_t *s, uint8_t *out, uint32_t out_size)
+{
+	s->state = S_MAGIC;
+	s->status = LZ4_RUNNING;
+	s->out = out;
+	s->out_start = out;
+	s->out_end = out + out_size;
+	s->in = 0;
+	s->in_len = 0;
+	s->block_left = 0;
+	field(s, 4, S_MAGIC);
+}
+
+void lz4_feed(lz4_stream_t *s, const uint8_t *in, uint32_t len)
+{
+	s->in = in;
+	s->in_len = len;
+}
+
+uint32_t lz4_pending(const lz4_stream_t *s)
+{
+	return s->in_len;
+}
+
+uint32_t lz4_output_size(const lz4_stream_t *s)
+{
+	return s->out - s->out_start;
+}
+
+/* Consume one input byte */
+static void decode_byte(lz4_stream_t *s, uint8_t c)
+{
+	if (s->state >= S_TOKEN && s->state <= S_MATCH_LEN)
+	{
+		if (s->block_left == 0)
+		{
+			fail(s);
+			return;
+		}
+		s->block_left--;
+	}
+
+	switch (s->state)
+	{
+	case S_MAGIC:
+	case S_BLOCK_SIZE:
+	case S_OFFSET:
+		s->field |= (uint32_t)c << s->shift;
+		s->shift += 8;
+		if (--s->count != 0)
+			return;
+		if (s->state == S_MAGIC)
+		{
+			if (s->field != LZ4_FRAME_MAGIC)
+				fail(s);
+			else
+				s->state = S_FLG;
+		}
+		else if (s->state == S_BLOCK_SIZE)
+		{
+			if (s->field == 0)
+			{
+				// End mark, then the optional content checksum (FLG bit 2)
+				skip(s, (s->flags & 0x04) ? 4 : 0, S_END);
+			}
+			else if (s->field & 0x80000000)
+			{
+				s->count = s->field & 0x7FFFFFFF;
+				s->state = S_RAW;
+			}
+			else
+			{
+				s->block_left = s->field;
+				s->state = S_TOKEN;
+			}
+		}
+		else
+		{
+			s->offset = s->field;
+			if (s->offset == 0 || s->offset > (uint32_t)(s->out - s->out_start))
+				fail(s);
+			else if ((s->token & 0xF) == 0xF)
+				s->state = S_MATCH_LEN;
+			else
+				s->state = S_MATCH;
+		}
+		break;
+	case S_FLG:
+		// Version 01 only
+		if ((c & 0xC0) != 0x40)
+		{
+			fail(s);
+			return;
+		}
+		s->flags = c;
+		s->state = S_BD;
+		break;
+	case S_BD:
+		// Content size (bit 3), dictionary id (bit 0), header checksum
+		skip(s, ((s->flags & 0x08) ? 8 : 0) + ((s->flags & 0x01) ? 4 : 0) + 1, S_BLOCK_SIZE);
+		break;
+	case S_SKIP:
+		if (--s->count == 0)
+			enter(s, s->after_skip);
+		break;
+	case S_RAW:
+		if (emit(s, c) < 0)
+			return;
+		if (--s->count == 0)
+			sequence_done(s);
+		break;
+	case S_TOKEN:
+		s->token = c;
+		s->count = c >> 4;
+		s->match_len = (c & 0xF) + 4;
+		if (s->count == 0xF)
+			s->state = S_LITERAL_LEN;
+		else if (s->count != 0)
+			s->state = S_LITERALS;
+		else
+			literals_done(s);
+		break;
+	case S_LITERAL_LEN:
+		s->count += c;
+		if (c != 0xFF)
+			s->state = S_LITERALS;
+		break;
+	case S_LITERALS:
+		if (emit(s, c) < 0)
+			return;
+		if (--s->count == 0)
+			literals_done(s);
+		break;
+	case S_MATCH_LEN:
+		s->match_len += c;
+		if (c != 0xFF)
+			s->state = S_MATCH;
+		break;
+	default:
+		// Trailing bytes after the end mark
+		fail(s);
+		break;
+	}
+}
+
+/**
+ * Do a bounded amount of work: copy up to LZ4_STEP_BYTES of a match or
+ * consume up to that many input bytes. Returns the stream status.
+ */
+int lz4_step(lz4_stream_t *s)
+{
+	for (uint32_t n = 0; n < LZ4_STEP_BYTES && s->status == LZ4_RUNNING; n++)
+	{
+		if (s->state == S_MATCH)
+		{
+			if (emit(s, s->out[-(int32_t)s->offset]) < 0)
+				break;
+			if (--s->match_len == 0)
+				sequence_done(s);
+		}
+		else if (s->in_len != 0)
+		{
+			s->in_len--;
+			decode_byte(s, *s->in++);
+		}
+		else
+		{
+			break;
+		}
+	}
+	return s->status;
+}
+
+/* Decode everything queued, including a match still being copied */
+int lz4_finish(lz4_stream_t *s)
+{
+	while (s->status == LZ4_RUNNING && (s->in_len != 0 || s->state == S_MATCH))
+		lz4_step(s);
+	return s->status;
+}
@@ -0,0 +1,51 @@
+/* lz4.h - incremental LZ4 frame decoder for the bootloader */
+#ifndef _LZ4_H
+#define _LZ4_H
+
+#include <stdint.h>
+
+#define LZ4_FRAME_MAGIC 0x184D2204
+
+/*
+ * Input is queued a buffer at a time with lz4_feed() and decoded in small
+ * steps by lz4_step(), so decoding can run while the UART is waiting for
+ * the next byte. A queued buffer must stay untouched until lz4_pending()
+ * drops to zero. Block and content checksums are skipped: the transport
+ * already checks every byte with CRC32.
+ */
+
+enum
+{
+	LZ4_RUNNING = 0,
+	LZ4_DONE = 1,
+	LZ4_ERROR = -1,
+};
+
+typedef struct
+{
+	int state;
+	int status;
+	uint8_t *out;
+	uint8_t *out_start;
+	uint8_t *out_end;
+	const uint8_t *in;
+	uint32_t in_len;
+	uint32_t field;		 // little endian value being assembled
+	uint32_t shift;
+	uint32_t count;		 // bytes left in the current field, literal run, raw block or skip
+	uint32_t block_left; // input bytes left in the current compressed block
+	uint32_t match_len;
+	uint32_t offset;
+	uint8_t token;
+	uint8_t flags;
+	int after_skip;
+} lz4_stream_t;
+
+void lz4_init(lz4_stream_t *s, uint8_t *out, uint32_t out_size);
+void lz4_feed(lz4_stream_t *s, const uint8_t *in, uint32_t len);
+int lz4_step(lz4_stream_t *s);
+int lz4_finish(lz4_stream_t *s);
+uint32_t lz4_pending(const lz4_stream_t *s);
+uint32_t lz4_output_size(const lz4_stream_t *s);
+
+#endif
@@ -29,21 +29,19 @@
 // #include <machine/endian.h>
 #include <stdint.h>
 #include <termios.h>
+#include <sys/select.h>
+#include <sys/time.h>
 
-#include <libkern/OSByteOrder.h>
-
-// #define htobe16(x) OSSwapHostToBigInt16(x)
-// #define htole16(x) OSSwapHostToLittleInt16(x)
-// #define be16toh(x) OSSwapBigToHostInt16(x)
-// #define le16toh(x) OSSwapLittleToHostInt16(x)
-
-#define htobe32(x) OSSwapHostToBigInt32(x)
+#include "../boot_protocol.h"
 
 #define BUF_SIZE 65536
 
+// No answer for this long means the window was lost, go back to the base
+#define ACK_TIMEOUT_MS 2000
+
 struct termios old_tio, new_tio;
 
-void do_exit(int fd, int res) {
+__attribute__((noreturn)) void do_exit(int fd, int res) {
     // close FD
     if (fd != -1) close(fd);
     // restore settings for STDIN_FILENO
@@ -103,15 +101,124 @@ int open_serial(const char *dev) {
     return fd;
 }
 
+// CRC-32 as computed by the bootloader's crc32 instructions
+static uint32_t crc_table[256];
+
+static void crc32_init(void) {
+    for (uint32_t i = 0; i < 256; i++) {
+	uint32_t c = i;
+	for (int k = 0; k < 8; k++) {
+	    c = (c >> 1) ^ (0xEDB88320 & -(c & 1));
+	}
+	crc_table[i] = c;
+    }
+}
+
+static uint32_t crc32_update(uint32_t crc, const uint8_t *data, size_t len) {
+    while (len-- > 0) {
+	crc = crc_table[(crc ^ *data++) & 0xFF] ^ (crc >> 8);
+    }
+    return crc;
+}
+
+static uint8_t *put_u16(uint8_t *p, uint32_t v) {
+    p[0] = v;
+    p[1] = v >> 8;
+    return p + 2;
+}
+
+static uint8_t *put_u32(uint8_t *p, uint32_t v) {
+    p = put_u16(p, v);
+    return put_u16(p, v >> 16);
+}
+
+static void write_all(int fd, const uint8_t *buf, size_t len) {
+    while (len > 0) {
+	ssize_t n = write(fd, buf, len);
+	if (n == -1) {
+	    if (errno == EAGAIN || errno == EINTR) continue;
+	    perror("write()");
+	    do_exit(fd, EXIT_FAILURE);
+	}
+	buf += n;
+	len -= n;
+    }
+}
+
+// Read one byte, -1 on timeout
+static int read_byte(int fd, int timeout_ms) {
+    fd_set rfds;
+    struct timeval tv;
+    uint8_t c;
+
+    FD_ZERO(&rfds);
+    FD_SET(fd, &rfds);
+    tv.tv_sec = timeout_ms / 1000;
+    tv.tv_usec = (timeout_ms % 1000) * 1000;
+    switch (select(fd + 1, &rfds, NULL, NULL, &tv)) {
+    case -1:
+	perror("select()");
+	do_exit(fd, EXIT_FAILURE);
+    case 0:
+	return -1;
+    }
+    if (read(fd, &c, 1) != 1) return -1;
+    return c;
+}
+
+/*
+ * Wait for the next control byte from the Pi. ACK/NAK come back with
+ * their block number in *seq. Anything else the bootloader prints is
+ * passed through to stdout. Returns -1 on timeout.
+ */
+static int read_reply(int fd, uint32_t *seq) {
+    while (true) {
+	int c = read_byte(fd, ACK_TIMEOUT_MS);
+	if (c == -1) return -1;
+	if (c == BOOT_ACK || c == BOOT_NAK) {
+	    int lo = read_byte(fd, ACK_TIMEOUT_MS);
+	    int hi = read_byte(fd, ACK_TIMEOUT_MS);
+	    if (lo == -1 || hi == -1) return -1;
+	    *seq = lo | (hi << 8);
+	    return c;
+	}
+	if (c == BOOT_EOT || c == BOOT_CAN) return c;
+	putchar(c);
+	fflush(stdout);
+    }
+}
+
+static void send_block(int fd, const uint8_t *image, uint32_t size, uint32_t seq) {
+    uint8_t frame[1 + 4 + BOOT_BLOCK_SIZE + 4];
+    uint32_t offset = seq * BOOT_BLOCK_SIZE;
+    uint32_t len = size - offset < BOOT_BLOCK_SIZE ? size - offset : BOOT_BLOCK_SIZE;
+    uint8_t *p = frame;
+
+    *p++ = BOOT_SOH;
+    p = put_u16(p, seq);
+    p = put_u16(p, len);
+    memcpy(p, &image[offset], len);
+    p += len;
+    put_u32(p, crc32_update(0xFFFFFFFF, &frame[1], 4 + len) ^ 0xFFFFFFFF);
+    write_all(fd, frame, 1 + 4 + len + 4);
+}
+
+static uint64_t now_ms(void) {
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return (uint64_t)tv.tv_sec * 1000 + tv.tv_usec / 1000;
+}
+
 // send kernel to rpi
 void send_kernel(int fd, const char *file) {
     int file_fd;
     off_t off;
-    uint32_t size;
-    ssize_t pos;
-    char *p;
-    bool done = false;
-    
+    uint32_t size, blocks, image_crc, flags = 0;
+    uint32_t base = 0, next = 0, retries = 0, resent = 0, seq;
+    uint8_t start[1 + 16];
+    uint8_t *image, *p;
+    uint64_t started;
+
     // Set fd blocking
     if (fcntl(fd, F_SETFL, 0) == -1) {
 	perror("fcntl()");
@@ -126,136 +233,120 @@ void send_kernel(int fd, const char *file) {
 
     // Get kernel size
     off = lseek(file_fd, 0L, SEEK_END);
-    if (off > 0x200000) {
+    if (off <= 0 || off > BOOT_MAX_SIZE || off > 0xFFFF * BOOT_BLOCK_SIZE) {
 	fprintf(stderr, "kernel too big\n");
 	do_exit(fd, EXIT_FAILURE);
     }
-    size = OSSwapBigToHostConstInt32(off);
-	printf("sending size in hex: %x %d \n", off, (size_t)off);
+    size = off;
+    blocks = (size + BOOT_BLOCK_SIZE - 1) / BOOT_BLOCK_SIZE;
     lseek(file_fd, 0L, SEEK_SET);
 
-    fprintf(stderr, "### sending kernel %s [%zu byte]\n", file, (size_t)off);
-
-	size= (size_t)off;
-    // send kernel size to RPi
-    p = (char*)&size;
-    pos = 0;
-
-	printf("sending size: %x %x %x %x \n", p[0], p[1], p[2], p[3]);
-    while(pos < 4) {
-	ssize_t len = write(fd, &p[pos], 4 - pos);
-	if (len == -1) {
-	    perror("write()");
+    image = (uint8_t *)malloc(size);
+    for (uint32_t pos = 0; image != NULL && pos < size;) {
+	ssize_t len = read(file_fd, &image[pos], size - pos);
+	if (len <= 0) {
+	    perror("read()");
 	    do_exit(fd, EXIT_FAILURE);
 	}
 	pos += len;
     }
-
-
-    // wait for OK
-    char ok_buf1[8];
-    p = ok_buf1;
-    pos = 0;
-    while(pos < 8) {
-		ssize_t len = read(fd, &p[pos], 8 - pos);
-		
-		if (len == -1) {
-			perror("read()");
-			do_exit(fd, EXIT_FAILURE);
-		}
-		pos += len;
+    close(file_fd);
+    if (image == NULL) {
+	fprintf(stderr, "out of memory\n");
+	do_exit(fd, EXIT_FAILURE);
     }
+    crc32_init();
+    image_crc = crc32_update(0xFFFFFFFF, image, size) ^ 0xFFFFFFFF;
 
-	printf("receiving size: %c %c %c %c %c %c %c %c\n", p[0], p[1], p[2], p[3],p[4], p[5], p[6], p[7]);
-	read(fd, &p[0], 1);
-
-	char ok_buf2[8];
-	p = ok_buf2;
-    pos = 0;
-    while(pos < 8) {
-		ssize_t len = read(fd, &p[pos], 8 - pos);
-		
-		if (len == -1) {
-			perror("read()");
-			do_exit(fd, EXIT_FAILURE);
-		}
-		pos += len;
+    // An LZ4 frame (make kernel8-32.img.lz4) is unpacked by the bootloader
+    if (size >= 4 && (image[0] | image[1] << 8 | image[2] << 16 | (uint32_t)image[3] << 24) == 0x184D2204) {
+	flags |= BOOT_FLAG_LZ4;
     }
-	
 
-	printf("receiving size: %c %c %c %c %c %c %c %c\n", p[0], p[1], p[2], p[3],p[4], p[5], p[6], p[7]);
-	char c;
-	read(fd, &c, 1);
-
-   char ok_buf[2];
-    p = ok_buf;
-    pos = 0;
-    while(pos < 2) {
-		ssize_t len = read(fd, &p[pos], 2 - pos);
-		
-		if (len == -1) {
-			perror("read()");
-			do_exit(fd, EXIT_FAILURE);
-		}
-		pos += len;
+    fprintf(stderr, "### sending %s kernel %s [%u byte, %u blocks, crc %08x]\n",
+	    (flags & BOOT_FLAG_LZ4) ? "LZ4" : "raw", file, size, blocks, image_crc);
+
+    // Start frame, repeated until the Pi acknowledges it
+    p = start;
+    *p++ = BOOT_STX;
+    p = put_u32(p, size);
+    p = put_u32(p, image_crc);
+    p = put_u32(p, flags);
+    put_u32(p, crc32_update(0xFFFFFFFF, &start[1], 12) ^ 0xFFFFFFFF);
+    while (true) {
+	int reply;
+	write_all(fd, start, sizeof(start));
+	reply = read_reply(fd, &seq);
+	// NAK 0 comes from a Pi already waiting for block 0: our ACK got lost
+	if ((reply == BOOT_ACK || reply == BOOT_NAK) && seq == 0) break;
+	if (reply == BOOT_CAN) {
+	    fprintf(stderr, "\n### upload refused\n");
+	    free(image);
+	    return;
+	}
+	if (++retries > BOOT_MAX_RETRIES) {
+	    fprintf(stderr, "\n### no answer to start frame\n");
+	    free(image);
+	    return;
+	}
     }
-    if (ok_buf[0] != 'O' || ok_buf[1] != 'K') {
-		printf("chars :%c\n", ok_buf[0]);
-		printf("chars :%c\n", ok_buf[1]);
-	fprintf(stderr, "error after sending size\n");
-	
 
-	do_exit(fd, EXIT_FAILURE);
-    }
+    // Go-back-N: keep BOOT_WINDOW blocks in flight, rewind on NAK or silence
+    started = now_ms();
+    retries = 0;
+    while (base < blocks) {
+	int reply;
 
-    while(!done) {
-	char buf[BUF_SIZE];
-	ssize_t pos = 0;
-	ssize_t len = read(file_fd, buf, BUF_SIZE);
-	switch(len) {
-	case -1:
-	    perror("read()");
-	    do_exit(fd, EXIT_FAILURE);
-	case 0:
-	    done = true;
+	while (next < blocks && next < base + BOOT_WINDOW) {
+	    send_block(fd, image, size, next++);
 	}
-
-	while(len > 0) {
-	    ssize_t len2 = write(fd, &buf[pos], len);
-	    if (len2 == -1) {
-		perror("write()");
-		do_exit(fd, EXIT_FAILURE);
+	reply = read_reply(fd, &seq);
+	if (reply == BOOT_ACK && seq > base && seq <= blocks) {
+	    base = seq;
+	    retries = 0;
+	    if ((base & 63) == 0 || base == blocks) {
+		fprintf(stderr, "\r### %u / %u blocks", base, blocks);
 	    }
-	    len -= len2;
-	    pos += len2;
+	    continue;
+	}
+	if (reply == BOOT_ACK) continue; // stale
+	if (reply == BOOT_CAN || reply == BOOT_EOT) {
+	    fprintf(stderr, "\n### unexpected %s mid upload\n", reply == BOOT_CAN ? "CAN" : "EOT");
+	    free(image);
+	    return;
 	}
+	if (reply == BOOT_NAK && seq < base) continue;
+	if (++retries > BOOT_MAX_RETRIES) {
+	    fprintf(stderr, "\n### giving up at block %u\n", base);
+	    free(image);
+	    return;
+	}
+	if (reply == BOOT_NAK) base = seq;
+	resent += next - base;
+	next = base;
     }
-    
+    free(image);
+
+    // The Pi checks the whole image before jumping
+    switch (read_reply(fd, &seq)) {
+    case BOOT_EOT: {
+	uint64_t ms = now_ms() - started;
+	fprintf(stderr, "\n### finished sending in %u ms (%u B/s, %u blocks resent)\n",
+		(unsigned)ms, ms ? (unsigned)(size * 1000ULL / ms) : 0, resent);
+	break;
+    }
+    case BOOT_CAN:
+	fprintf(stderr, "\n### image CRC mismatch on the Pi\n");
+	break;
+    default:
+	fprintf(stderr, "\n### no final answer from the Pi\n");
+    }
+
     // Set fd non-blocking
     if (fcntl(fd, F_SETFL, O_NONBLOCK) == -1) {
 	perror("fcntl()");
 	do_exit(fd, EXIT_FAILURE);
     }
-
-    fprintf(stderr, "### finished sending\n");
-
-	char ok_buf3[4];
-	p = ok_buf3;
-    pos = 0;
-    while(pos < 4) {
-		ssize_t len = read(fd, &p[pos], 4 - pos);
-		
-		if (len == -1) {
-			perror("read()");
-			do_exit(fd, EXIT_FAILURE);
-		}
-		pos += len;
-    }
-	
-
-	printf("Jumping token: %s\n", p);
-
-    return;
 }
 
 int main(int argc, char *argv[]) {
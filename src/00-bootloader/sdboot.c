@@ -0,0 +1,85 @@
+/* sdboot.c - load the kernel from the SD card instead of the serial line */
+#include <stddef.h>
+#include <stdbool.h>
+#include <kernel/systimer.h>
+#include <device/emmc.h>
+#include <fs/fat.h>
+#include <plibc/stdio.h>
+#include "boot_protocol.h"
+#include "lz4.h"
+#include "sdboot.h"
+
+/*
+ * emmc.c and fat.c come from the kernel tree unchanged. They only need
+ * the system timer and printf (libk's, over our uart_putc); the timer
+ * calls are answered straight from the free running counter here.
+ */
+static volatile uint32_t *const timer_clo = (uint32_t *)(SYSTEM_TIMER_BASE + 0x04);
+static volatile uint32_t *const timer_chi = (uint32_t *)(SYSTEM_TIMER_BASE + 0x08);
+
+uint64_t timer_getTickCount64(void)
+{
+	uint32_t hi, lo;
+
+	do
+	{
+		hi = *timer_chi;
+		lo = *timer_clo;
+	} while (hi != *timer_chi);
+	return ((uint64_t)hi << 32) | lo;
+}
+
+uint64_t tick_difference(uint64_t us1, uint64_t us2)
+{
+	return us2 > us1 ? us2 - us1 : us1 - us2;
+}
+
+void MicroDelay(uint64_t delayInUs)
+{
+	uint64_t start = timer_getTickCount64();
+
+	while (timer_getTickCount64() - start < delayInUs)
+	{
+	}
+}
+
+/**
+ * Read BOOT_SD_KERNEL_LZ4 and unpack it to BOOT_LOAD_ADDR, or else
+ * BOOT_SD_KERNEL straight into place. Returns -1 if there is no card,
+ * no FAT partition or neither file.
+ */
+int sd_load_kernel(void)
+{
+	uint8_t *kernel = (uint8_t *)BOOT_LOAD_ADDR;
+	uint8_t *staging = (uint8_t *)BOOT_SD_STAGING;
+	uint32_t size;
+
+	if (!initialize_fat())
+	{
+		return -1;
+	}
+
+	size = fat_read_file((uint8_t *)BOOT_SD_KERNEL_LZ4, staging, BOOT_LOAD_ADDR + BOOT_MAX_SIZE - BOOT_SD_STAGING);
+	if (size != 0)
+	{
+		lz4_stream_t lz4;
+
+		lz4_init(&lz4, kernel, BOOT_SD_STAGING - BOOT_LOAD_ADDR);
+		lz4_feed(&lz4, staging, size);
+		if (lz4_finish(&lz4) != LZ4_DONE)
+		{
+			printf("SD: %s is not a valid LZ4 frame\n", BOOT_SD_KERNEL_LZ4);
+			return -1;
+		}
+		printf("SD: unpacked %s, %d -> %d bytes\n", BOOT_SD_KERNEL_LZ4, size, lz4_output_size(&lz4));
+		return 0;
+	}
+
+	size = fat_read_file((uint8_t *)BOOT_SD_KERNEL, kernel, BOOT_MAX_SIZE);
+	if (size != 0)
+	{
+		printf("SD: loaded %s, %d bytes\n", BOOT_SD_KERNEL, size);
+		return 0;
+	}
+	return -1;
+}
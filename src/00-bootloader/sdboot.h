@@ -0,0 +1,16 @@
+/* sdboot.h - load the kernel from the SD card instead of the serial line */
+#ifndef _SDBOOT_H
+#define _SDBOOT_H
+
+#include <stdint.h>
+
+// Tried in this order on the first FAT partition
+#define BOOT_SD_KERNEL_LZ4 "/kernel-app.img.lz4"
+#define BOOT_SD_KERNEL "/kernel-app.img"
+
+// A compressed image is read here, above any kernel it unpacks to
+#define BOOT_SD_STAGING 0x1000000
+
+int sd_load_kernel(void);
+
+#endif